@@ -31,8 +31,61 @@
 #include <string.h> // For memcpy for uncompressed frames
 #include "snappy-c.h"
 
+// Non-temporal stores for HapDecodeOption_NonTemporalStores need SSE2, and are otherwise ordinary copies
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAP_SSE2 1
+#include <emmintrin.h>
+#endif
+
 #define kHapUInt24Max 0x00FFFFFF
 
+/*
+ Chunks written with a Chunk Offset Table are placed by whichever thread compressed them, which claims its place
+ in the frame with an atomic add
+ */
+#if defined(_MSC_VER)
+#include <intrin.h>
+#if defined(_WIN64)
+#define hap_atomic_fetch_add(value, amount) ((size_t)_InterlockedExchangeAdd64((volatile __int64 *)(value), (__int64)(amount)))
+#else
+#define hap_atomic_fetch_add(value, amount) ((size_t)_InterlockedExchangeAdd((volatile long *)(value), (long)(amount)))
+#endif
+#else
+#define hap_atomic_fetch_add(value, amount) __atomic_fetch_add((value), (amount), __ATOMIC_RELAXED)
+#endif
+
+/*
+ Scratch space for chunks passed to a HapDecodeChunkFunction or from a HapEncodeChunkFunction is claimed by setting a
+ flag, and released by clearing it
+ */
+#if defined(_MSC_VER)
+#define hap_atomic_claim(flag) (_InterlockedExchange((volatile long *)(flag), 1) == 0)
+#define hap_atomic_release(flag) _InterlockedExchange((volatile long *)(flag), 0)
+#else
+#define hap_atomic_claim(flag) (__atomic_exchange_n((flag), 1, __ATOMIC_ACQUIRE) == 0)
+#define hap_atomic_release(flag) __atomic_store_n((flag), 0, __ATOMIC_RELEASE)
+#endif
+
+/*
+ An asynchronous decode counts down the chunks still to be decoded, and the thread which decodes the last one sees the
+ work of the others and marks the decode done
+ */
+#if defined(_MSC_VER)
+#define hap_atomic_decrement(value) _InterlockedDecrement((volatile long *)(value))
+#define hap_atomic_subtract(value, amount) (_InterlockedExchangeAdd((volatile long *)(value), -(long)(amount)) - (long)(amount))
+#define hap_atomic_set(flag) _InterlockedExchange((volatile long *)(flag), 1)
+#define hap_atomic_clear(flag) _InterlockedExchange((volatile long *)(flag), 0)
+#define hap_atomic_is_set(flag) (_InterlockedOr((volatile long *)(flag), 0) != 0)
+#define hap_atomic_load(value) _InterlockedOr((volatile long *)(value), 0)
+#else
+#define hap_atomic_decrement(value) __atomic_sub_fetch((value), 1, __ATOMIC_ACQ_REL)
+#define hap_atomic_subtract(value, amount) __atomic_sub_fetch((value), (amount), __ATOMIC_ACQ_REL)
+#define hap_atomic_set(flag) __atomic_store_n((flag), 1, __ATOMIC_RELEASE)
+#define hap_atomic_clear(flag) __atomic_store_n((flag), 0, __ATOMIC_RELEASE)
+#define hap_atomic_is_set(flag) (__atomic_load_n((flag), __ATOMIC_ACQUIRE) != 0)
+#define hap_atomic_load(value) __atomic_load_n((value), __ATOMIC_ACQUIRE)
+#endif
+
 /*
  Hap Constants
  First four bits represent the compressor
@@ -87,6 +140,53 @@
 #define kHapSectionChunkSizeTable 0x03
 #define kHapSectionChunkOffsetTable 0x04
 
+/*
+ Scratch space for one chunk, which a thread claims while it decompresses a chunk for a HapDecodeChunkFunction, or while
+ it compresses a chunk from a HapEncodeChunkFunction
+ */
+typedef struct HapChunkScratch {
+    char *data;
+    size_t capacity;
+    long claimed;
+} HapChunkScratch;
+
+/*
+ Details shared by every chunk of a texture being passed to a HapDecodeChunkFunction
+ */
+typedef struct HapChunkFunctionInfo {
+    HapDecodeChunkFunction function;
+    void *p;
+    HapChunkScratch *scratch;
+    unsigned int scratch_count;
+} HapChunkFunctionInfo;
+
+/*
+ What a chunk decoded to a buffer by HapDecodeChangedChunks() was, to tell if the next chunk decoded there is the same
+ */
+typedef struct HapChunkFingerprint {
+    uint64_t hash; // of the compressed chunk
+    unsigned int compressor;
+    size_t compressed_chunk_size;
+    size_t uncompressed_chunk_offset;
+    size_t uncompressed_chunk_size;
+} HapChunkFingerprint;
+
+/*
+ The chunks last decoded to an output buffer by HapDecodeChangedChunks()
+ */
+typedef struct HapBufferHistory {
+    const void *buffer;
+    unsigned int texture_format;
+    size_t decoded_bytes;
+    unsigned int chunk_count; // 0 if the buffer's contents are unknown
+    HapChunkFingerprint *chunks;
+    unsigned int chunks_capacity;
+    unsigned int last_used;
+} HapBufferHistory;
+
+// The number of output buffers a decoder context remembers, enough for triple-buffered playback of Hap Q Alpha
+#define kHapBufferHistoryCount 6
+
 /*
  To decode we use a struct to store details of each chunk
  */
@@ -97,8 +197,139 @@ typedef struct HapChunkDecodeInfo {
     size_t compressed_chunk_size;
     char *uncompressed_chunk_data;
     size_t uncompressed_chunk_size;
+    /*
+     If clip_destination is non-NULL only part of the chunk is wanted: the chunk is decompressed to uncompressed_chunk_data,
+     which is scratch space, and clip_length bytes from clip_offset in the decompressed chunk are copied to clip_destination
+     */
+    char *clip_destination;
+    size_t clip_offset;
+    size_t clip_length;
+    /*
+     If function_info is non-NULL the chunk is passed to its function rather than kept: a compressed chunk is decompressed
+     to scratch space claimed from function_info, and uncompressed_chunk_offset is its position in the decoded texture
+     */
+    const HapChunkFunctionInfo *function_info;
+    size_t uncompressed_chunk_offset;
+    /*
+     If fingerprint is non-NULL it is replaced with the chunk's, and if compare is non-zero and they match the chunk is
+     already in the output buffer and is skipped. dirty is set to whether the chunk was decoded.
+     */
+    HapChunkFingerprint *fingerprint;
+    unsigned int compare;
+    unsigned char *dirty;
 } HapChunkDecodeInfo;
 
+/*
+ A decoder context keeps the storage for chunk details between frames
+ */
+struct HapDecoderContext {
+    HapChunkDecodeInfo *chunk_info;
+    unsigned int chunk_info_capacity;
+    char *scratch;
+    size_t scratch_capacity;
+    HapChunkScratch *chunk_scratch;
+    unsigned int chunk_scratch_count;
+    char *texture;
+    size_t texture_capacity;
+    HapBufferHistory buffers[kHapBufferHistoryCount];
+    unsigned int buffer_clock;
+    unsigned long minimum_work_bytes;
+    unsigned int *groups;
+    unsigned int groups_capacity;
+    unsigned int last_chunk_count;
+    unsigned int last_work_item_count;
+};
+
+/*
+ A texture to encode is either in a buffer, or produced a chunk at a time by a function
+ */
+typedef struct HapEncodeSource {
+    const void *buffer;
+    HapEncodeChunkFunction function;
+    void *p;
+    unsigned int index;
+} HapEncodeSource;
+
+/*
+ To encode we use a similar struct to store details of each chunk
+ */
+typedef struct HapChunkEncodeInfo {
+    unsigned int result;
+    unsigned int compressor;
+    const char *uncompressed_chunk_data;
+    size_t uncompressed_chunk_size;
+    char *compressed_chunk_data;
+    size_t compressed_chunk_size;
+    /*
+     If frame_data is non-NULL, compressed_chunk_data is scratch space and the chunk is moved to frame_data at an offset
+     claimed from frame_data_length, after which compressed_chunk_data points to its new location
+     */
+    char *frame_data;
+    size_t *frame_data_length;
+    /*
+     If uncompressed_chunk_data is NULL the chunk is produced by source's function into scratch space claimed from scratch,
+     and uncompressed_chunk_offset is its position in the texture
+     */
+    const HapEncodeSource *source;
+    HapChunkScratch *scratch;
+    unsigned int scratch_count;
+    size_t uncompressed_chunk_offset;
+    // If skip_incompressible is non-zero, chunks which look incompressible are stored without trying snappy
+    unsigned int skip_incompressible;
+    unsigned int decision; // A HapChunkDecision
+    /*
+     If hash_chunk is non-zero the chunk's hash is calculated, and if previous is non-NULL and has the same hash, the
+     chunk is stored as it was in the previous frame, with snappy chunks copied from previous_data
+     */
+    unsigned int hash_chunk;
+    uint64_t hash;
+    const struct HapChunkHistory *previous;
+    const char *previous_data;
+} HapChunkEncodeInfo;
+
+/*
+ How a chunk was stored in the previous frame. Snappy chunks are kept at offset in their texture's history data, and
+ chunks stored uncompressed are taken from the current texture, which is the same if the hash is.
+ */
+typedef struct HapChunkHistory {
+    uint64_t hash;
+    unsigned int compressor;
+    size_t offset;
+    size_t size;
+} HapChunkHistory;
+
+/*
+ The chunks of a texture in the previous frame. data alternates between two buffers so that a frame's chunks can be kept
+ while chunks it reused from the one before are still in the other.
+ */
+typedef struct HapTextureHistory {
+    unsigned int texture_format;
+    size_t input_bytes;
+    unsigned int chunk_count; // 0 if there is no history
+    HapChunkHistory *chunks;
+    unsigned int chunks_capacity;
+    char *data[2];
+    size_t data_capacity[2];
+    unsigned int current;
+} HapTextureHistory;
+
+/*
+ An encoder context keeps the storage for chunk details and compressed chunks between frames. The textures of a frame are
+ encoded one after another, so they share it. It also keeps the chunks of each texture of the previous frame for
+ HapEncodeOption_ReuseUnchangedChunks.
+ */
+struct HapEncoderContext {
+    HapChunkEncodeInfo *chunk_info;
+    unsigned int chunk_info_capacity;
+    char *scratch;
+    size_t scratch_capacity;
+    HapChunkScratch *chunk_scratch;
+    unsigned int chunk_scratch_count;
+    HapTextureHistory history[2];
+    unsigned int reused_chunks;
+    unsigned int total_chunks;
+};
+
 // TODO: rename the defines we use for codes used in stored frames
 // to better differentiate them from the enums used for the API
 
@@ -260,9 +491,21 @@ static unsigned int hap_texture_format_identifier_for_format_constant(unsigned i
     }
 }
 
+// Returns the length in bytes of a 4x4 block of an API texture format
+static unsigned int hap_texture_format_block_bytes(unsigned int texture_format)
+{
+    switch (texture_format) {
+        case HapTextureFormat_RGB_DXT1:
+        case HapTextureFormat_A_RGTC1:
+            return 8;
+        default:
+            return 16;
+    }
+}
+
 // Returns the length of a decode instructions container of chunk_count chunks
 // not including the section header
-static size_t hap_decode_instructions_length(unsigned int chunk_count)
+static size_t hap_decode_instructions_length(unsigned int chunk_count, int chunk_offsets)
 {
     /*
      Calculate the size of our Decode Instructions Section
@@ -271,45 +514,78 @@ static size_t hap_decode_instructions_length(unsigned int chunk_count)
      */
     size_t length = (5 * chunk_count) + 8;
 
+    /*
+     + Chunk Offset Table + its header
+     = (4 * chunk_count) + 4
+     */
+    if (chunk_offsets)
+    {
+        length += (4 * chunk_count) + 4;
+    }
+
     return length;
 }
 
-static unsigned int hap_limited_chunk_count_for_frame(size_t input_bytes, unsigned int texture_format, unsigned int chunk_count)
+static unsigned int hap_limited_chunk_count_for_frame(size_t input_bytes, unsigned int texture_format, unsigned int chunk_count, int chunk_offsets)
 {
     // This is a hard limit due to the 4-byte headers we use for the decode instruction container
-    // (0xFFFFFF == count + (4 x count) + 20)
-    if (chunk_count > 3355431)
+    // (0xFFFFFF == count + (4 x count) + 20, or with a Chunk Offset Table, count + (4 x count) + (4 x count) + 16)
+    unsigned int max_chunk_count = chunk_offsets ? 1864133 : 3355431;
+    if (chunk_count > max_chunk_count)
     {
-        chunk_count = 3355431;
+        chunk_count = max_chunk_count;
     }
-    // Divide frame equally on DXT block boundries (8 or 16 bytes)
-    unsigned long dxt_block_count;
-    switch (texture_format) {
-        case HapTextureFormat_RGB_DXT1:
-        case HapTextureFormat_A_RGTC1:
-            dxt_block_count = input_bytes / 8;
-            break;
-        default:
-            dxt_block_count = input_bytes / 16;
+    // Chunks begin on DXT block boundaries (8 or 16 bytes), so there can't be more chunks than blocks
+    size_t dxt_block_count = input_bytes / hap_texture_format_block_bytes(texture_format);
+    if (chunk_count > dxt_block_count)
+    {
+        chunk_count = (unsigned int)dxt_block_count;
     }
-    while (dxt_block_count % chunk_count != 0) {
-        chunk_count--;
+    if (chunk_count == 0)
+    {
+        chunk_count = 1;
     }
 
     return chunk_count;
 }
 
+/*
+ Returns the offset into the texture of the chunk at index, or the length of the texture for index chunk_count.
+ The texture's blocks are shared between the chunks as evenly as possible, so chunk sizes differ by at most one block,
+ and the last chunk takes any bytes left over after the last whole block.
+ */
+static size_t hap_chunk_offset(size_t input_bytes, unsigned int texture_format, unsigned int chunk_count, unsigned int index)
+{
+    size_t block_bytes = hap_texture_format_block_bytes(texture_format);
+    uint64_t dxt_block_count = input_bytes / block_bytes;
+
+    if (index >= chunk_count)
+    {
+        return input_bytes;
+    }
+    return (size_t)((dxt_block_count * index) / chunk_count) * block_bytes;
+}
+
+// Returns the size of the largest chunk of a texture
+static size_t hap_max_chunk_size(size_t input_bytes, unsigned int texture_format, unsigned int chunk_count)
+{
+    size_t block_bytes = hap_texture_format_block_bytes(texture_format);
+    size_t dxt_block_count = input_bytes / block_bytes;
+
+    return ((dxt_block_count + chunk_count - 1) / chunk_count) * block_bytes + (input_bytes % block_bytes);
+}
+
 static size_t hap_max_encoded_length(size_t input_bytes, unsigned int texture_format, unsigned int compressor, unsigned int chunk_count)
 {
     size_t decode_instructions_length, max_compressed_length;
 
-    chunk_count = hap_limited_chunk_count_for_frame(input_bytes, texture_format, chunk_count);
+    chunk_count = hap_limited_chunk_count_for_frame(input_bytes, texture_format, chunk_count, 0);
 
-    decode_instructions_length = hap_decode_instructions_length(chunk_count);
+    decode_instructions_length = hap_decode_instructions_length(chunk_count, 0);
 
     if (compressor == HapCompressorSnappy)
     {
-        size_t chunk_size = input_bytes / chunk_count;
+        size_t chunk_size = hap_max_chunk_size(input_bytes, texture_format, chunk_count);
         max_compressed_length = snappy_max_compressed_length(chunk_size) * chunk_count;
     }
     else
@@ -318,6 +594,7 @@ static size_t hap_max_encoded_length(size_t input_bytes, unsigned int texture_fo
     }
 
     // top section header + decode instructions section header + decode instructions + compressed data
+    // This also allows for a Chunk Offset Table, as no chunk is stored larger than its uncompressed size
     return max_compressed_length + 8U + decode_instructions_length + 4U;
 }
 
@@ -352,688 +629,4029 @@ unsigned long HapMaxEncodedLength(unsigned int count,
     return total_length;
 }
 
-static unsigned int hap_encode_texture(const void *inputBuffer, unsigned long inputBufferBytes, unsigned int textureFormat,
-                                       unsigned int compressor, unsigned int chunkCount, void *outputBuffer,
-                                       unsigned long outputBufferBytes, unsigned long *outputBufferBytesUsed)
+/*
+ Claims one of count scratch slots and gives it space for at least length bytes, leaving its data NULL if that can't be
+ allocated. There must be a slot for everything which could use one at once, so that one is always free. Slots are tried
+ from the first, so the same few are used over and over and their space is likely to be in cache.
+ */
+static HapChunkScratch *hap_claim_chunk_scratch(HapChunkScratch *slots, unsigned int count, size_t length)
 {
-    size_t top_section_header_length;
-    size_t top_section_length;
-    unsigned int storedCompressor;
-    unsigned int storedFormat;
+    HapChunkScratch *scratch = NULL;
+    unsigned int i = 0;
 
-    /*
-     Check arguments
-     */
-    if (inputBuffer == NULL
-        || inputBufferBytes == 0
-        || (textureFormat != HapTextureFormat_RGB_DXT1
-            && textureFormat != HapTextureFormat_RGBA_DXT5
-            && textureFormat != HapTextureFormat_YCoCg_DXT5
-            && textureFormat != HapTextureFormat_A_RGTC1
-            && textureFormat != HapTextureFormat_RGBA_BPTC_UNORM
-            && textureFormat != HapTextureFormat_RGB_BPTC_UNSIGNED_FLOAT
-            && textureFormat != HapTextureFormat_RGB_BPTC_SIGNED_FLOAT
-            )
-        || (compressor != HapCompressorNone
-            && compressor != HapCompressorSnappy
-            )
-        || outputBuffer == NULL
-        || outputBufferBytesUsed == NULL
-        )
+    while (scratch == NULL)
     {
-        return HapResult_Bad_Arguments;
+        if (hap_atomic_claim(&slots[i].claimed))
+        {
+            scratch = &slots[i];
+        }
+        i = (i + 1) % count;
     }
-    else if (outputBufferBytes < hap_max_encoded_length(inputBufferBytes, textureFormat, compressor, chunkCount))
+
+    if (scratch->capacity < length)
     {
-        return HapResult_Buffer_Too_Small;
+        free(scratch->data);
+        scratch->data = (char *)malloc(length);
+        scratch->capacity = scratch->data ? length : 0;
     }
-    
-    /*
-     To store frames of length greater than can be expressed in three bytes, we use an eight byte header (the last four bytes are the
-     frame size). We don't know the compressed size until we have performed compression, but we know the worst-case size
-     (the uncompressed size), so choose header-length based on that.
-     
-     A simpler encoder could always use the eight-byte header variation.
-     */
-    if (inputBufferBytes > kHapUInt24Max)
+
+    return scratch;
+}
+
+// Grows storage in a context to at least length bytes, returning it, or NULL on error
+static char *hap_context_storage(char **storage, size_t *capacity, size_t length)
+{
+    if (length > *capacity)
     {
-        top_section_header_length = 8U;
+        // The previous contents needn't be kept, so don't realloc
+        free(*storage);
+        *storage = (char *)malloc(length);
+        *capacity = *storage ? length : 0;
     }
-    else
+    return *storage;
+}
+
+HapEncoderContext *HapCreateEncoderContext(void)
+{
+    HapEncoderContext *context = (HapEncoderContext *)malloc(sizeof(HapEncoderContext));
+    if (context)
     {
-        top_section_header_length = 4U;
+        context->chunk_info = NULL;
+        context->chunk_info_capacity = 0;
+        context->scratch = NULL;
+        context->scratch_capacity = 0;
+        context->chunk_scratch = NULL;
+        context->chunk_scratch_count = 0;
+        memset(context->history, 0, sizeof(context->history));
+        context->reused_chunks = 0;
+        context->total_chunks = 0;
     }
+    return context;
+}
 
-    if (compressor == HapCompressorSnappy)
+void HapDestroyEncoderContext(HapEncoderContext *context)
+{
+    if (context)
     {
-        /*
-         We attempt to chunk as requested, and if resulting frame is larger than it is uncompressed then
-         store frame uncompressed
-         */
-
-        size_t decode_instructions_length;
-        size_t chunk_size, compress_buffer_remaining;
-        uint8_t *second_stage_compressor_table;
-        void *chunk_size_table;
-        char *compressed_data;
         unsigned int i;
+        for (i = 0; i < context->chunk_scratch_count; i++)
+        {
+            free(context->chunk_scratch[i].data);
+        }
+        free(context->chunk_scratch);
+        free(context->chunk_info);
+        free(context->scratch);
+        for (i = 0; i < 2; i++)
+        {
+            free(context->history[i].chunks);
+            free(context->history[i].data[0]);
+            free(context->history[i].data[1]);
+        }
+        free(context);
+    }
+}
 
-        chunkCount = hap_limited_chunk_count_for_frame(inputBufferBytes, textureFormat, chunkCount);
-        decode_instructions_length = hap_decode_instructions_length(chunkCount);
+void HapGetEncoderContextReuse(const HapEncoderContext *context, unsigned int *reusedChunks, unsigned int *totalChunks)
+{
+    if (reusedChunks)
+    {
+        *reusedChunks = context ? context->reused_chunks : 0;
+    }
+    if (totalChunks)
+    {
+        *totalChunks = context ? context->total_chunks : 0;
+    }
+}
 
-        // Check we have space for the Decode Instructions Container
-        if ((inputBufferBytes + decode_instructions_length + 4) > kHapUInt24Max)
+// Returns storage for details of chunk_count chunks, or NULL on error
+static HapChunkEncodeInfo *hap_encoder_context_chunk_info(HapEncoderContext *context, unsigned int chunk_count)
+{
+    if (context == NULL)
+    {
+        return (HapChunkEncodeInfo *)malloc(sizeof(HapChunkEncodeInfo) * chunk_count);
+    }
+    if (chunk_count > context->chunk_info_capacity)
+    {
+        HapChunkEncodeInfo *chunk_info = (HapChunkEncodeInfo *)realloc(context->chunk_info, sizeof(HapChunkEncodeInfo) * chunk_count);
+        if (chunk_info == NULL)
         {
-            top_section_header_length = 8U;
+            return NULL;
         }
+        context->chunk_info = chunk_info;
+        context->chunk_info_capacity = chunk_count;
+    }
+    return context->chunk_info;
+}
 
-        second_stage_compressor_table = ((uint8_t *)outputBuffer) + top_section_header_length + 4 + 4;
-        chunk_size_table = ((uint8_t *)outputBuffer) + top_section_header_length + 4 + 4 + chunkCount + 4;
+// Releases storage returned by hap_encoder_context_chunk_info()
+static void hap_encoder_context_release_chunk_info(HapEncoderContext *context, HapChunkEncodeInfo *chunk_info)
+{
+    if (context == NULL)
+    {
+        free(chunk_info);
+    }
+}
 
-        chunk_size = inputBufferBytes / chunkCount;
+// Returns scratch space of at least length bytes for compressed chunks, or NULL on error
+static char *hap_encoder_context_scratch(HapEncoderContext *context, size_t length)
+{
+    if (context == NULL)
+    {
+        return (char *)malloc(length);
+    }
+    return hap_context_storage(&context->scratch, &context->scratch_capacity, length);
+}
 
-        // write the Decode Instructions section header
-        hap_write_section_header(((uint8_t *)outputBuffer) + top_section_header_length, 4U, decode_instructions_length, kHapSectionDecodeInstructionsContainer);
-        // write the Second Stage Compressor Table section header
-        hap_write_section_header(((uint8_t *)outputBuffer) + top_section_header_length + 4U, 4U, chunkCount, kHapSectionChunkSecondStageCompressorTable);
-        // write the Chunk Size Table section header
-        hap_write_section_header(((uint8_t *)outputBuffer) + top_section_header_length + 4U + 4U + chunkCount, 4U, chunkCount * 4U, kHapSectionChunkSizeTable);
+// Releases scratch space returned by hap_encoder_context_scratch()
+static void hap_encoder_context_release_scratch(HapEncoderContext *context, char *scratch)
+{
+    if (context == NULL)
+    {
+        free(scratch);
+    }
+}
 
-        compressed_data = (char *)(((uint8_t *)outputBuffer) + top_section_header_length + 4 + decode_instructions_length);
+/*
+ Returns count scratch slots for chunks produced by a function, or NULL on error. As for decoding, slots keep their space
+ between frames and are only given space when a thread first claims them.
+ */
+static HapChunkScratch *hap_encoder_context_chunk_scratch(HapEncoderContext *context, unsigned int count)
+{
+    if (context == NULL)
+    {
+        return (HapChunkScratch *)calloc(count, sizeof(HapChunkScratch));
+    }
+    if (count > context->chunk_scratch_count)
+    {
+        HapChunkScratch *chunk_scratch = (HapChunkScratch *)realloc(context->chunk_scratch, sizeof(HapChunkScratch) * count);
+        if (chunk_scratch == NULL)
+        {
+            return NULL;
+        }
+        memset(chunk_scratch + context->chunk_scratch_count, 0, sizeof(HapChunkScratch) * (count - context->chunk_scratch_count));
+        context->chunk_scratch = chunk_scratch;
+        context->chunk_scratch_count = count;
+    }
+    return context->chunk_scratch;
+}
 
-        compress_buffer_remaining = outputBufferBytes - top_section_header_length - 4 - decode_instructions_length;
+// Releases slots returned by hap_encoder_context_chunk_scratch()
+static void hap_encoder_context_release_chunk_scratch(HapEncoderContext *context, HapChunkScratch *chunk_scratch, unsigned int count)
+{
+    if (context == NULL)
+    {
+        unsigned int i;
+        for (i = 0; i < count; i++)
+        {
+            free(chunk_scratch[i].data);
+        }
+        free(chunk_scratch);
+    }
+}
 
-        top_section_length = 4 + decode_instructions_length;
+/*
+ Returns the history of the texture at index if it was encoded in the previous frame in the same format and chunks, or
+ NULL. Textures may only be at index 0 or 1.
+ */
+static const HapTextureHistory *hap_encoder_context_history(HapEncoderContext *context, unsigned int index,
+                                                            unsigned int texture_format, size_t input_bytes, unsigned int chunk_count)
+{
+    const HapTextureHistory *history = &context->history[index];
+    if (history->chunk_count == chunk_count
+        && history->texture_format == texture_format
+        && history->input_bytes == input_bytes)
+    {
+        return history;
+    }
+    return NULL;
+}
 
-        for (i = 0; i < chunkCount; i++) {
-            size_t chunk_packed_length = compress_buffer_remaining;
-            const char *chunk_input_start = (const char *)(((uint8_t *)inputBuffer) + (chunk_size * i));
-            if (compressor == HapCompressorSnappy)
-            {
-                snappy_status result = snappy_compress(chunk_input_start, chunk_size, (char *)compressed_data, &chunk_packed_length);
-                if (result != SNAPPY_OK)
-                {
-                    return HapResult_Internal_Error;
-                }
-            }
+/*
+ Keeps the chunks of the texture at index as they were stored in this frame, for the next. On error the history is
+ dropped, so the next frame compresses every chunk.
+ */
+static void hap_encoder_context_keep_history(HapEncoderContext *context, unsigned int index,
+                                             unsigned int texture_format, size_t input_bytes,
+                                             const HapChunkEncodeInfo *chunk_info, unsigned int chunk_count)
+{
+    HapTextureHistory *history = &context->history[index];
+    unsigned int next = history->current ^ 1U;
+    size_t length = 0;
+    char *data;
+    unsigned int i;
 
-            if (compressor == HapCompressorNone || chunk_packed_length >= chunk_size)
-            {
-                // store the chunk uncompressed
-                memcpy(compressed_data, chunk_input_start, chunk_size);
-                chunk_packed_length = chunk_size;
-                second_stage_compressor_table[i] = kHapCompressorNone;
-            }
-            else
-            {
-                // ie we used snappy and saved some space
-                second_stage_compressor_table[i] = kHapCompressorSnappy;
-            }
-            hap_write_4_byte_uint(((uint8_t *)chunk_size_table) + (i * 4), chunk_packed_length);
-            compressed_data += chunk_packed_length;
-            top_section_length += chunk_packed_length;
-            compress_buffer_remaining -= chunk_packed_length;
-        }
+    history->chunk_count = 0;
 
-        if (top_section_length < inputBufferBytes + top_section_header_length)
+    if (chunk_count > history->chunks_capacity)
+    {
+        HapChunkHistory *chunks = (HapChunkHistory *)realloc(history->chunks, sizeof(HapChunkHistory) * chunk_count);
+        if (chunks == NULL)
         {
-            // use the complex storage because snappy compression saved space
-            storedCompressor = kHapCompressorComplex;
+            return;
         }
-        else
+        history->chunks = chunks;
+        history->chunks_capacity = chunk_count;
+    }
+
+    for (i = 0; i < chunk_count; i++)
+    {
+        if (chunk_info[i].compressor == kHapCompressorSnappy)
         {
-            // Signal to store the frame uncompressed
-            compressor = HapCompressorNone;
+            length += chunk_info[i].compressed_chunk_size;
         }
     }
 
-    if (compressor == HapCompressorNone)
+    data = hap_context_storage(&history->data[next], &history->data_capacity[next], length);
+    if (data == NULL && length != 0)
     {
-        memcpy(((uint8_t *)outputBuffer) + top_section_header_length, inputBuffer, inputBufferBytes);
-        top_section_length = inputBufferBytes;
-        storedCompressor = kHapCompressorNone;
+        return;
     }
-    
-    storedFormat = hap_texture_format_identifier_for_format_constant(textureFormat);
-    
-    hap_write_section_header(outputBuffer, top_section_header_length, top_section_length, hap_4_bit_packed_byte(storedCompressor, storedFormat));
 
-    *outputBufferBytesUsed = top_section_length + top_section_header_length;
+    length = 0;
+    for (i = 0; i < chunk_count; i++)
+    {
+        history->chunks[i].hash = chunk_info[i].hash;
+        history->chunks[i].compressor = chunk_info[i].compressor;
+        history->chunks[i].offset = length;
+        history->chunks[i].size = chunk_info[i].compressed_chunk_size;
+        if (chunk_info[i].compressor == kHapCompressorSnappy)
+        {
+            memcpy(data + length, chunk_info[i].compressed_chunk_data, chunk_info[i].compressed_chunk_size);
+            length += chunk_info[i].compressed_chunk_size;
+        }
+    }
 
-    return HapResult_No_Error;
+    history->texture_format = texture_format;
+    history->input_bytes = input_bytes;
+    history->chunk_count = chunk_count;
+    history->current = next;
 }
 
-unsigned int HapEncode(unsigned int count,
-                       const void **inputBuffers, unsigned long *inputBuffersBytes,
-                       unsigned int *textureFormats,
-                       unsigned int *compressors,
-                       unsigned int *chunkCounts,
-                       void *outputBuffer, unsigned long outputBufferBytes,
-                       unsigned long *outputBufferBytesUsed)
+/*
+ A 64-bit hash of a chunk, computed as xxHash64 computes it with a seed of zero, reading values in the host's byte order
+ as they are only compared on one machine
+ */
+#define kHapHashPrime1 0x9E3779B185EBCA87ULL
+#define kHapHashPrime2 0xC2B2AE3D27D4EB4FULL
+#define kHapHashPrime3 0x165667B19E3779F9ULL
+#define kHapHashPrime4 0x85EBCA77C2B2AE63ULL
+#define kHapHashPrime5 0x27D4EB2F165667C5ULL
+
+static uint64_t hap_hash_rotate(uint64_t value, unsigned int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t hap_hash_read_8(const char *data)
+{
+    uint64_t value;
+    memcpy(&value, data, 8);
+    return value;
+}
+
+static uint64_t hap_hash_round(uint64_t accumulator, uint64_t value)
+{
+    accumulator += value * kHapHashPrime2;
+    accumulator = hap_hash_rotate(accumulator, 31);
+    return accumulator * kHapHashPrime1;
+}
+
+static uint64_t hap_hash_merge(uint64_t hash, uint64_t accumulator)
+{
+    hash ^= hap_hash_round(0, accumulator);
+    return hash * kHapHashPrime1 + kHapHashPrime4;
+}
+
+static uint64_t hap_hash_chunk(const char *data, size_t length)
+{
+    const char *end = data + length;
+    uint64_t hash;
+
+    if (length >= 32)
+    {
+        uint64_t v1 = kHapHashPrime1 + kHapHashPrime2;
+        uint64_t v2 = kHapHashPrime2;
+        uint64_t v3 = 0;
+        uint64_t v4 = 0 - kHapHashPrime1;
+        do
+        {
+            v1 = hap_hash_round(v1, hap_hash_read_8(data));
+            v2 = hap_hash_round(v2, hap_hash_read_8(data + 8));
+            v3 = hap_hash_round(v3, hap_hash_read_8(data + 16));
+            v4 = hap_hash_round(v4, hap_hash_read_8(data + 24));
+            data += 32;
+        } while (end - data >= 32);
+        hash = hap_hash_rotate(v1, 1) + hap_hash_rotate(v2, 7) + hap_hash_rotate(v3, 12) + hap_hash_rotate(v4, 18);
+        hash = hap_hash_merge(hash, v1);
+        hash = hap_hash_merge(hash, v2);
+        hash = hap_hash_merge(hash, v3);
+        hash = hap_hash_merge(hash, v4);
+    }
+    else
+    {
+        hash = kHapHashPrime5;
+    }
+
+    hash += length;
+
+    while (end - data >= 8)
+    {
+        hash ^= hap_hash_round(0, hap_hash_read_8(data));
+        hash = hap_hash_rotate(hash, 27) * kHapHashPrime1 + kHapHashPrime4;
+        data += 8;
+    }
+    if (end - data >= 4)
+    {
+        uint32_t value;
+        memcpy(&value, data, 4);
+        hash ^= value * kHapHashPrime1;
+        hash = hap_hash_rotate(hash, 23) * kHapHashPrime2 + kHapHashPrime3;
+        data += 4;
+    }
+    while (data < end)
+    {
+        hash ^= ((uint8_t)*data) * kHapHashPrime5;
+        hash = hap_hash_rotate(hash, 11) * kHapHashPrime1;
+        data++;
+    }
+
+    hash ^= hash >> 33;
+    hash *= kHapHashPrime2;
+    hash ^= hash >> 29;
+    hash *= kHapHashPrime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/*
+ Snappy only saves space by replacing sequences of four or more bytes which occurred shortly before with copies of them.
+ Windows spread through a chunk are hashed four bytes at a time as snappy hashes its input, and the chunk is judged
+ incompressible if few positions repeat a sequence seen earlier in their window. Small chunks aren't sampled.
+ */
+#define kHapSampleWindowBytes 2048
+#define kHapSampleWindowCount 8
+#define kHapSampleHashBits 10
+
+static int hap_chunk_looks_incompressible(const char *data, size_t length)
+{
+    uint16_t table[1 << kHapSampleHashBits];
+    size_t window_count = length / kHapSampleWindowBytes;
+    size_t repeats_needed;
+    size_t repeats = 0;
+    size_t window;
+
+    if (window_count < 2)
+    {
+        return 0;
+    }
+    if (window_count > kHapSampleWindowCount)
+    {
+        window_count = kHapSampleWindowCount;
+    }
+    /*
+     Snappy can only save a little of what repeats, so a chunk with fewer than one repeat in 32 bytes won't shrink much.
+     Sampling stops as soon as there are enough, so chunks which compress well are judged quickly.
+     */
+    repeats_needed = window_count * (kHapSampleWindowBytes - 3) / 32;
+    for (window = 0; window < window_count; window++)
+    {
+        const char *start = data + (length / window_count) * window;
+        size_t i;
+        memset(table, 0, sizeof(table));
+        for (i = 0; i + 4 <= kHapSampleWindowBytes; i++)
+        {
+            uint32_t sequence;
+            uint32_t hash;
+            memcpy(&sequence, start + i, 4);
+            hash = (sequence * 0x1E35A7BDU) >> (32 - kHapSampleHashBits);
+            // Positions are stored plus one, so zero means none
+            if (table[hash] != 0 && memcmp(start + table[hash] - 1, start + i, 4) == 0 && ++repeats >= repeats_needed)
+            {
+                return 0;
+            }
+            table[hash] = (uint16_t)(i + 1);
+        }
+    }
+    return 1;
+}
+
+static void hap_encode_chunk(HapChunkEncodeInfo chunks[], unsigned int index)
+{
+    if (chunks)
+    {
+        size_t chunk_packed_length = 0;
+        unsigned int chunk_compressor = kHapCompressorNone;
+
+        if (chunks[index].hash_chunk)
+        {
+            chunks[index].hash = hap_hash_chunk(chunks[index].uncompressed_chunk_data, chunks[index].uncompressed_chunk_size);
+        }
+
+        if (chunks[index].previous && chunks[index].previous->hash == chunks[index].hash)
+        {
+            // The chunk is unchanged, so is stored as it was, with the previous frame's copy taking the place of the slot
+            chunks[index].decision = HapChunkDecision_Reused;
+            chunk_compressor = chunks[index].previous->compressor;
+            if (chunk_compressor == kHapCompressorSnappy)
+            {
+                chunk_packed_length = chunks[index].previous->size;
+                chunks[index].compressed_chunk_data = (char *)chunks[index].previous_data + chunks[index].previous->offset;
+            }
+        }
+        else if (chunks[index].skip_incompressible
+                 && hap_chunk_looks_incompressible(chunks[index].uncompressed_chunk_data, chunks[index].uncompressed_chunk_size))
+        {
+            chunks[index].decision = HapChunkDecision_Skipped;
+        }
+        else
+        {
+            snappy_status snappy_result;
+            chunk_packed_length = snappy_max_compressed_length(chunks[index].uncompressed_chunk_size);
+            snappy_result = snappy_compress(chunks[index].uncompressed_chunk_data,
+                                            chunks[index].uncompressed_chunk_size,
+                                            chunks[index].compressed_chunk_data,
+                                            &chunk_packed_length);
+            if (snappy_result != SNAPPY_OK)
+            {
+                chunks[index].result = HapResult_Internal_Error;
+                return;
+            }
+            if (chunk_packed_length < chunks[index].uncompressed_chunk_size)
+            {
+                chunks[index].decision = HapChunkDecision_Compressed;
+                chunk_compressor = kHapCompressorSnappy;
+            }
+            else
+            {
+                chunks[index].decision = HapChunkDecision_Uncompressed;
+            }
+        }
+
+        if (chunk_compressor != kHapCompressorSnappy)
+        {
+            // store the chunk uncompressed
+            chunks[index].compressed_chunk_size = chunks[index].uncompressed_chunk_size;
+            chunks[index].compressor = kHapCompressorNone;
+        }
+        else
+        {
+            // ie we used snappy and saved some space
+            chunks[index].compressed_chunk_size = chunk_packed_length;
+            chunks[index].compressor = kHapCompressorSnappy;
+        }
+
+        if (chunks[index].frame_data)
+        {
+            // claim space in the frame and move the chunk there
+            char *destination = chunks[index].frame_data + hap_atomic_fetch_add(chunks[index].frame_data_length, chunks[index].compressed_chunk_size);
+            if (chunks[index].compressor == kHapCompressorSnappy)
+            {
+                memcpy(destination, chunks[index].compressed_chunk_data, chunks[index].compressed_chunk_size);
+            }
+            else
+            {
+                memcpy(destination, chunks[index].uncompressed_chunk_data, chunks[index].compressed_chunk_size);
+            }
+            chunks[index].compressed_chunk_data = destination;
+        }
+        else if (chunks[index].compressor == kHapCompressorNone && chunks[index].source->buffer)
+        {
+            /*
+             The chunk is left in the texture and copied from there when the frame is packed, which isn't done at all if
+             the texture ends up being stored uncompressed
+             */
+            chunks[index].compressed_chunk_data = (char *)chunks[index].uncompressed_chunk_data;
+        }
+        else if (chunks[index].compressor == kHapCompressorNone)
+        {
+            memcpy(chunks[index].compressed_chunk_data,
+                   chunks[index].uncompressed_chunk_data,
+                   chunks[index].uncompressed_chunk_size);
+        }
+        chunks[index].result = HapResult_No_Error;
+    }
+}
+
+/*
+ Has a texture's function produce a chunk in scratch space, and compresses it from there
+ */
+static void hap_encode_chunk_from_function(HapChunkEncodeInfo chunks[], unsigned int index)
+{
+    const HapEncodeSource *source = chunks[index].source;
+    HapChunkScratch *scratch = hap_claim_chunk_scratch(chunks[index].scratch, chunks[index].scratch_count, chunks[index].uncompressed_chunk_size);
+
+    if (scratch->data == NULL)
+    {
+        chunks[index].result = HapResult_Internal_Error;
+    }
+    else
+    {
+        source->function(source->p, source->index, scratch->data, chunks[index].uncompressed_chunk_offset, chunks[index].uncompressed_chunk_size);
+        chunks[index].uncompressed_chunk_data = scratch->data;
+        hap_encode_chunk(chunks, index);
+        chunks[index].uncompressed_chunk_data = NULL;
+    }
+
+    hap_atomic_release(&scratch->claimed);
+}
+
+/*
+ Has a texture's function produce a chunk directly in an uncompressed frame
+ */
+static void hap_encode_chunk_uncompressed(HapChunkEncodeInfo chunks[], unsigned int index)
+{
+    const HapEncodeSource *source = chunks[index].source;
+    source->function(source->p, source->index, chunks[index].compressed_chunk_data, chunks[index].uncompressed_chunk_offset, chunks[index].uncompressed_chunk_size);
+    chunks[index].result = HapResult_No_Error;
+}
+
+/*
+ context may be NULL. If decisions is non-NULL it receives the HapChunkDecision of each chunk as stored
+ */
+static unsigned int hap_encode_texture(HapEncoderContext *context, const HapEncodeSource *source, unsigned long inputBufferBytes, unsigned int textureFormat,
+                                       unsigned int compressor, unsigned int chunkCount, unsigned int options,
+                                       HapDecodeCallback callback, void *info,
+                                       void *outputBuffer, unsigned long outputBufferBytes, unsigned long *outputBufferBytesUsed,
+                                       unsigned int *decisions)
 {
     size_t top_section_header_length;
-    size_t top_section_length;
-    unsigned long section_length;
+    size_t top_section_length = 0;
+    unsigned int storedCompressor;
+    unsigned int storedFormat;
+    unsigned int uncompressed_decision = HapChunkDecision_Uncompressed; // Reported if the texture is stored uncompressed
 
-    if (count == 0 || count > 2 // A frame must contain one or two textures
-        || inputBuffers == NULL
-        || inputBuffersBytes == NULL
-        || textureFormats == NULL
-        || compressors == NULL
-        || chunkCounts == NULL
+    /*
+     Check arguments
+     */
+    if ((source->buffer == NULL && source->function == NULL)
+        || inputBufferBytes == 0
+        || (textureFormat != HapTextureFormat_RGB_DXT1
+            && textureFormat != HapTextureFormat_RGBA_DXT5
+            && textureFormat != HapTextureFormat_YCoCg_DXT5
+            && textureFormat != HapTextureFormat_A_RGTC1
+            && textureFormat != HapTextureFormat_RGBA_BPTC_UNORM
+            && textureFormat != HapTextureFormat_RGB_BPTC_UNSIGNED_FLOAT
+            && textureFormat != HapTextureFormat_RGB_BPTC_SIGNED_FLOAT
+            )
+        || (compressor != HapCompressorNone
+            && compressor != HapCompressorSnappy
+            )
         || outputBuffer == NULL
-        || outputBufferBytes == 0
-        || outputBufferBytesUsed == NULL)
+        || outputBufferBytesUsed == NULL
+        )
+    {
+        return HapResult_Bad_Arguments;
+    }
+    else if (outputBufferBytes < hap_max_encoded_length(inputBufferBytes, textureFormat, compressor, chunkCount))
+    {
+        return HapResult_Buffer_Too_Small;
+    }
+    
+    /*
+     To store frames of length greater than can be expressed in three bytes, we use an eight byte header (the last four bytes are the
+     frame size). We don't know the compressed size until we have performed compression, but we know the worst-case size
+     (the uncompressed size), so choose header-length based on that.
+     
+     A simpler encoder could always use the eight-byte header variation.
+     */
+    if (inputBufferBytes > kHapUInt24Max)
+    {
+        top_section_header_length = 8U;
+    }
+    else
+    {
+        top_section_header_length = 4U;
+    }
+
+    if (compressor == HapCompressorSnappy)
+    {
+        /*
+         We attempt to chunk as requested, and if resulting frame is larger than it is uncompressed then
+         store frame uncompressed
+         */
+
+        size_t decode_instructions_length;
+        size_t chunk_size;
+        uint8_t *second_stage_compressor_table;
+        void *chunk_size_table;
+        void *chunk_offset_table = NULL;
+        char *compressed_data;
+        char *frame_data;
+        size_t frame_data_length = 0;
+        HapChunkEncodeInfo *chunk_info;
+        HapChunkScratch *chunk_scratch = NULL;
+        HapDecodeWorkFunction encode_chunk = (HapDecodeWorkFunction)hap_encode_chunk;
+        char *scratch = NULL;
+        const HapTextureHistory *history = NULL;
+        unsigned int reuse = context && (options & HapEncodeOption_ReuseUnchangedChunks) && source->index < 2;
+        unsigned int result = HapResult_No_Error;
+        int skipped_all = 1;
+        unsigned int i;
+
+        chunkCount = hap_limited_chunk_count_for_frame(inputBufferBytes, textureFormat, chunkCount, options & HapEncodeOption_ChunkOffsetTable);
+        decode_instructions_length = hap_decode_instructions_length(chunkCount, options & HapEncodeOption_ChunkOffsetTable);
+
+        // Check we have space for the Decode Instructions Container
+        if ((inputBufferBytes + decode_instructions_length + 4) > kHapUInt24Max)
+        {
+            top_section_header_length = 8U;
+        }
+
+        second_stage_compressor_table = ((uint8_t *)outputBuffer) + top_section_header_length + 4 + 4;
+        chunk_size_table = ((uint8_t *)outputBuffer) + top_section_header_length + 4 + 4 + chunkCount + 4;
+
+        // Chunks may differ in size by a block, so worst-case slots are sized for the largest
+        chunk_size = hap_max_chunk_size(inputBufferBytes, textureFormat, chunkCount);
+
+        // write the Decode Instructions section header
+        hap_write_section_header(((uint8_t *)outputBuffer) + top_section_header_length, 4U, decode_instructions_length, kHapSectionDecodeInstructionsContainer);
+        // write the Second Stage Compressor Table section header
+        hap_write_section_header(((uint8_t *)outputBuffer) + top_section_header_length + 4U, 4U, chunkCount, kHapSectionChunkSecondStageCompressorTable);
+        // write the Chunk Size Table section header
+        hap_write_section_header(((uint8_t *)outputBuffer) + top_section_header_length + 4U + 4U + chunkCount, 4U, chunkCount * 4U, kHapSectionChunkSizeTable);
+
+        if (options & HapEncodeOption_ChunkOffsetTable)
+        {
+            chunk_offset_table = ((uint8_t *)chunk_size_table) + (chunkCount * 4) + 4;
+            // write the Chunk Offset Table section header
+            hap_write_section_header(((uint8_t *)chunk_offset_table) - 4U, 4U, chunkCount * 4U, kHapSectionChunkOffsetTable);
+        }
+
+        compressed_data = (char *)(((uint8_t *)outputBuffer) + top_section_header_length + 4 + decode_instructions_length);
+        frame_data = compressed_data;
+
+        top_section_length = 4 + decode_instructions_length;
+
+        chunk_info = hap_encoder_context_chunk_info(context, chunkCount);
+        if (chunk_info == NULL)
+        {
+            return HapResult_Internal_Error;
+        }
+
+        if (source->buffer == NULL)
+        {
+            /*
+             Chunks are produced by the texture's function in scratch space as they are compressed
+             */
+            chunk_scratch = hap_encoder_context_chunk_scratch(context, chunkCount);
+            if (chunk_scratch == NULL)
+            {
+                hap_encoder_context_release_chunk_info(context, chunk_info);
+                return HapResult_Internal_Error;
+            }
+            encode_chunk = (HapDecodeWorkFunction)hap_encode_chunk_from_function;
+        }
+
+        if (reuse)
+        {
+            history = hap_encoder_context_history(context, source->index, textureFormat, inputBufferBytes, chunkCount);
+        }
+
+        for (i = 0; i < chunkCount; i++)
+        {
+            size_t chunk_offset = hap_chunk_offset(inputBufferBytes, textureFormat, chunkCount, i);
+            chunk_info[i].uncompressed_chunk_data = source->buffer ? (const char *)(((uint8_t *)source->buffer) + chunk_offset) : NULL;
+            chunk_info[i].uncompressed_chunk_size = hap_chunk_offset(inputBufferBytes, textureFormat, chunkCount, i + 1) - chunk_offset;
+            chunk_info[i].frame_data = NULL;
+            chunk_info[i].frame_data_length = NULL;
+            chunk_info[i].source = source;
+            chunk_info[i].scratch = chunk_scratch;
+            chunk_info[i].scratch_count = chunkCount;
+            chunk_info[i].uncompressed_chunk_offset = chunk_offset;
+            chunk_info[i].skip_incompressible = (options & HapEncodeOption_SkipIncompressible) != 0;
+            chunk_info[i].hash_chunk = reuse;
+            chunk_info[i].previous = history ? &history->chunks[i] : NULL;
+            chunk_info[i].previous_data = history ? history->data[history->current] : NULL;
+        }
+
+        if (chunkCount == 1 || callback == NULL)
+        {
+            /*
+             Compress the chunks in order on this thread, placing each immediately after the previous one
+             */
+            char *chunk_data = compressed_data;
+            for (i = 0; i < chunkCount; i++)
+            {
+                chunk_info[i].compressed_chunk_data = chunk_data;
+                encode_chunk(chunk_info, i);
+                if (chunk_info[i].result != HapResult_No_Error)
+                {
+                    break;
+                }
+                // Chunks left in the texture must be in place for their offset to be recorded
+                if (chunk_offset_table && chunk_info[i].compressed_chunk_data != chunk_data)
+                {
+                    memcpy(chunk_data, chunk_info[i].compressed_chunk_data, chunk_info[i].compressed_chunk_size);
+                    chunk_info[i].compressed_chunk_data = chunk_data;
+                }
+                chunk_data += chunk_info[i].compressed_chunk_size;
+            }
+        }
+        else if (chunk_offset_table)
+        {
+            /*
+             With a Chunk Offset Table the chunks may be stored in any order, so each chunk is compressed into its own
+             worst-case slot in scratch space and then moved into the frame by the thread which compressed it, as soon
+             as it is done.
+             */
+            size_t slot_length = snappy_max_compressed_length(chunk_size);
+            scratch = hap_encoder_context_scratch(context, slot_length * chunkCount);
+            if (scratch == NULL)
+            {
+                hap_encoder_context_release_chunk_info(context, chunk_info);
+                if (chunk_scratch)
+                {
+                    hap_encoder_context_release_chunk_scratch(context, chunk_scratch, chunkCount);
+                }
+                return HapResult_Internal_Error;
+            }
+            for (i = 0; i < chunkCount; i++)
+            {
+                chunk_info[i].compressed_chunk_data = scratch + (slot_length * i);
+                chunk_info[i].frame_data = frame_data;
+                chunk_info[i].frame_data_length = &frame_data_length;
+            }
+
+            callback(encode_chunk, chunk_info, chunkCount, info);
+        }
+        else
+        {
+            /*
+             We don't know the compressed size of each chunk until it has been compressed, so to compress chunks
+             concurrently each is given a worst-case slot in the output buffer. hap_max_encoded_length() allows
+             for this. The chunks are moved into place once they have all been compressed.
+             */
+            size_t slot_length = snappy_max_compressed_length(chunk_size);
+            for (i = 0; i < chunkCount; i++)
+            {
+                chunk_info[i].compressed_chunk_data = compressed_data + (slot_length * i);
+            }
+
+            callback(encode_chunk, chunk_info, chunkCount, info);
+        }
+
+        for (i = 0; i < chunkCount; i++)
+        {
+            if (chunk_info[i].result != HapResult_No_Error)
+            {
+                result = chunk_info[i].result;
+                break;
+            }
+            second_stage_compressor_table[i] = chunk_info[i].compressor;
+            if (decisions)
+            {
+                decisions[i] = chunk_info[i].decision;
+            }
+            if (chunk_info[i].decision != HapChunkDecision_Skipped)
+            {
+                skipped_all = 0;
+            }
+            if (context && chunk_info[i].decision == HapChunkDecision_Reused)
+            {
+                context->reused_chunks++;
+            }
+            hap_write_4_byte_uint(((uint8_t *)chunk_size_table) + (i * 4), chunk_info[i].compressed_chunk_size);
+
+            if (chunk_offset_table)
+            {
+                hap_write_4_byte_uint(((uint8_t *)chunk_offset_table) + (i * 4), chunk_info[i].compressed_chunk_data - frame_data);
+            }
+            top_section_length += chunk_info[i].compressed_chunk_size;
+        }
+
+        if (result == HapResult_No_Error)
+        {
+            if (top_section_length < inputBufferBytes + top_section_header_length)
+            {
+                // use the complex storage because snappy compression saved space
+                storedCompressor = kHapCompressorComplex;
+            }
+            else if (source->buffer == NULL)
+            {
+                /*
+                 A texture from a function isn't kept, so can't be stored uncompressed without being produced again. The
+                 chunks which didn't compress are already stored uncompressed, so this is only a little larger.
+                 */
+                storedCompressor = kHapCompressorComplex;
+            }
+            else
+            {
+                // Signal to store the frame uncompressed
+                compressor = HapCompressorNone;
+                if (skipped_all)
+                {
+                    uncompressed_decision = HapChunkDecision_Skipped;
+                }
+            }
+        }
+
+        if (compressor == HapCompressorSnappy && !chunk_offset_table)
+        {
+            // Slots are always at or beyond the packed position, so moving chunks in order never overwrites one yet to be moved
+            for (i = 0; i < chunkCount && result == HapResult_No_Error; i++)
+            {
+                if (chunk_info[i].compressed_chunk_data != compressed_data)
+                {
+                    memmove(compressed_data, chunk_info[i].compressed_chunk_data, chunk_info[i].compressed_chunk_size);
+                    chunk_info[i].compressed_chunk_data = compressed_data;
+                }
+                compressed_data += chunk_info[i].compressed_chunk_size;
+            }
+        }
+
+        if (result == HapResult_No_Error && context)
+        {
+            context->total_chunks += chunkCount;
+            if (reuse)
+            {
+                // Chunks are kept as compressed even if the texture is stored uncompressed, which doesn't change them
+                hap_encoder_context_keep_history(context, source->index, textureFormat, inputBufferBytes, chunk_info, chunkCount);
+            }
+        }
+
+        if (chunk_scratch)
+        {
+            hap_encoder_context_release_chunk_scratch(context, chunk_scratch, chunkCount);
+        }
+        hap_encoder_context_release_chunk_info(context, chunk_info);
+        if (scratch)
+        {
+            hap_encoder_context_release_scratch(context, scratch);
+        }
+
+        if (result != HapResult_No_Error)
+        {
+            return result;
+        }
+    }
+
+    if (compressor == HapCompressorNone && source->buffer)
+    {
+        memcpy(((uint8_t *)outputBuffer) + top_section_header_length, source->buffer, inputBufferBytes);
+        top_section_length = inputBufferBytes;
+        storedCompressor = kHapCompressorNone;
+        if (decisions)
+        {
+            decisions[0] = uncompressed_decision;
+        }
+    }
+    else if (compressor == HapCompressorNone)
+    {
+        /*
+         The texture's function produces it directly in the frame, split as it would be into chunks so that they can
+         be produced concurrently
+         */
+        HapChunkEncodeInfo *chunk_info;
+        unsigned int i;
+
+        chunkCount = hap_limited_chunk_count_for_frame(inputBufferBytes, textureFormat, chunkCount, 0);
+
+        chunk_info = hap_encoder_context_chunk_info(context, chunkCount);
+        if (chunk_info == NULL)
+        {
+            return HapResult_Internal_Error;
+        }
+
+        for (i = 0; i < chunkCount; i++)
+        {
+            size_t chunk_offset = hap_chunk_offset(inputBufferBytes, textureFormat, chunkCount, i);
+            chunk_info[i].source = source;
+            chunk_info[i].compressed_chunk_data = ((char *)outputBuffer) + top_section_header_length + chunk_offset;
+            chunk_info[i].uncompressed_chunk_offset = chunk_offset;
+            chunk_info[i].uncompressed_chunk_size = hap_chunk_offset(inputBufferBytes, textureFormat, chunkCount, i + 1) - chunk_offset;
+        }
+
+        if (chunkCount == 1 || callback == NULL)
+        {
+            for (i = 0; i < chunkCount; i++)
+            {
+                hap_encode_chunk_uncompressed(chunk_info, i);
+            }
+        }
+        else
+        {
+            callback((HapDecodeWorkFunction)hap_encode_chunk_uncompressed, chunk_info, chunkCount, info);
+        }
+
+        hap_encoder_context_release_chunk_info(context, chunk_info);
+
+        top_section_length = inputBufferBytes;
+        storedCompressor = kHapCompressorNone;
+        if (decisions)
+        {
+            decisions[0] = uncompressed_decision;
+        }
+    }
+    
+    storedFormat = hap_texture_format_identifier_for_format_constant(textureFormat);
+    
+    hap_write_section_header(outputBuffer, top_section_header_length, top_section_length, hap_4_bit_packed_byte(storedCompressor, storedFormat));
+
+    *outputBufferBytesUsed = top_section_length + top_section_header_length;
+
+    return HapResult_No_Error;
+}
+
+static unsigned int hap_encode_frame(HapEncoderContext *context,
+                                     unsigned int count,
+                                     const HapEncodeSource *sources, unsigned long *inputBuffersBytes,
+                                     unsigned int *textureFormats,
+                                     unsigned int *compressors,
+                                     unsigned int *chunkCounts,
+                                     unsigned int options,
+                                     HapDecodeCallback callback, void *info,
+                                     void *outputBuffer, unsigned long outputBufferBytes,
+                                     unsigned long *outputBufferBytesUsed,
+                                     unsigned int **chunkDecisions)
+{
+    size_t top_section_header_length;
+    size_t top_section_length;
+    unsigned long section_length;
+
+    if (count == 0 || count > 2 // A frame must contain one or two textures
+        || inputBuffersBytes == NULL
+        || textureFormats == NULL
+        || compressors == NULL
+        || chunkCounts == NULL
+        || outputBuffer == NULL
+        || outputBufferBytes == 0
+        || outputBufferBytesUsed == NULL)
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (chunkCounts[i] == 0)
+        {
+            return HapResult_Bad_Arguments;
+        }
+    }
+
+    if (context)
+    {
+        context->reused_chunks = 0;
+        context->total_chunks = 0;
+    }
+
+    if (count == 1)
+    {
+        // Encode without the multi-image layout
+        return hap_encode_texture(context, &sources[0],
+                                  inputBuffersBytes[0],
+                                  textureFormats[0],
+                                  compressors[0],
+                                  chunkCounts[0],
+                                  options,
+                                  callback, info,
+                                  outputBuffer,
+                                  outputBufferBytes,
+                                  outputBufferBytesUsed,
+                                  chunkDecisions ? chunkDecisions[0] : NULL);
+    }
+    else if ((textureFormats[0] != HapTextureFormat_YCoCg_DXT5 && textureFormats[1] != HapTextureFormat_YCoCg_DXT5)
+             && (textureFormats[0] != HapTextureFormat_A_RGTC1 && textureFormats[1] != HapTextureFormat_A_RGTC1))
+    {
+        /*
+         Permitted combinations:
+         HapTextureFormat_YCoCg_DXT5 + HapTextureFormat_A_RGTC1
+         */
+        return HapResult_Bad_Arguments;
+    }
+    else
+    {
+        // Calculate the worst-case size for the top section and choose a header-length based on that
+        top_section_length = 0;
+        for (int i = 0; i < count; i++)
+        {
+            top_section_length += inputBuffersBytes[i] + hap_decode_instructions_length(chunkCounts[i], options & HapEncodeOption_ChunkOffsetTable) + 4;
+        }
+
+        if (top_section_length > kHapUInt24Max)
+        {
+            top_section_header_length = 8U;
+        }
+        else
+        {
+            top_section_header_length = 4U;
+        }
+
+        // Encode each texture
+        top_section_length = 0;
+        for (int i = 0; i < count; i++)
+        {
+            void *section = ((uint8_t *)outputBuffer) + top_section_header_length + top_section_length;
+            unsigned int result = hap_encode_texture(context, &sources[i],
+                                                     inputBuffersBytes[i],
+                                                     textureFormats[i],
+                                                     compressors[i],
+                                                     chunkCounts[i],
+                                                     options,
+                                                     callback, info,
+                                                     section,
+                                                     outputBufferBytes - (top_section_header_length + top_section_length),
+                                                     &section_length,
+                                                     chunkDecisions ? chunkDecisions[i] : NULL);
+            if (result != HapResult_No_Error)
+            {
+                return result;
+            }
+            top_section_length += section_length;
+        }
+
+        hap_write_section_header(outputBuffer, top_section_header_length, top_section_length, kHapSectionMultipleImages);
+
+        *outputBufferBytesUsed = top_section_length + top_section_header_length;
+
+        return HapResult_No_Error;
+    }
+}
+
+unsigned int HapEncodeWithContext(HapEncoderContext *context,
+                                  unsigned int count,
+                                  const void **inputBuffers, unsigned long *inputBuffersBytes,
+                                  unsigned int *textureFormats,
+                                  unsigned int *compressors,
+                                  unsigned int *chunkCounts,
+                                  unsigned int options,
+                                  HapDecodeCallback callback, void *info,
+                                  void *outputBuffer, unsigned long outputBufferBytes,
+                                  unsigned long *outputBufferBytesUsed,
+                                  unsigned int **chunkDecisions)
+{
+    HapEncodeSource sources[2];
+    unsigned int i;
+
+    if (count == 0 || count > 2 || inputBuffers == NULL)
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        sources[i].buffer = inputBuffers[i];
+        sources[i].function = NULL;
+        sources[i].p = NULL;
+        sources[i].index = i;
+    }
+
+    return hap_encode_frame(context,
+                            count,
+                            sources, inputBuffersBytes,
+                            textureFormats,
+                            compressors,
+                            chunkCounts,
+                            options,
+                            callback, info,
+                            outputBuffer, outputBufferBytes,
+                            outputBufferBytesUsed,
+                            chunkDecisions);
+}
+
+unsigned int HapEncodeWithReport(unsigned int count,
+                                 const void **inputBuffers, unsigned long *inputBuffersBytes,
+                                 unsigned int *textureFormats,
+                                 unsigned int *compressors,
+                                 unsigned int *chunkCounts,
+                                 unsigned int options,
+                                 HapDecodeCallback callback, void *info,
+                                 void *outputBuffer, unsigned long outputBufferBytes,
+                                 unsigned long *outputBufferBytesUsed,
+                                 unsigned int **chunkDecisions)
+{
+    return HapEncodeWithContext(NULL,
+                                count,
+                                inputBuffers, inputBuffersBytes,
+                                textureFormats,
+                                compressors,
+                                chunkCounts,
+                                options,
+                                callback, info,
+                                outputBuffer, outputBufferBytes,
+                                outputBufferBytesUsed,
+                                chunkDecisions);
+}
+
+unsigned int HapEncodeWithCallback(unsigned int count,
+                                   const void **inputBuffers, unsigned long *inputBuffersBytes,
+                                   unsigned int *textureFormats,
+                                   unsigned int *compressors,
+                                   unsigned int *chunkCounts,
+                                   unsigned int options,
+                                   HapDecodeCallback callback, void *info,
+                                   void *outputBuffer, unsigned long outputBufferBytes,
+                                   unsigned long *outputBufferBytesUsed)
+{
+    return HapEncodeWithContext(NULL,
+                                count,
+                                inputBuffers, inputBuffersBytes,
+                                textureFormats,
+                                compressors,
+                                chunkCounts,
+                                options,
+                                callback, info,
+                                outputBuffer, outputBufferBytes,
+                                outputBufferBytesUsed,
+                                NULL);
+}
+
+unsigned int HapEncodeChunks(HapEncoderContext *context,
+                             unsigned int count,
+                             HapEncodeChunkFunction function, void *p,
+                             unsigned long *inputBuffersBytes,
+                             unsigned int *textureFormats,
+                             unsigned int *compressors,
+                             unsigned int *chunkCounts,
+                             unsigned int options,
+                             HapDecodeCallback callback, void *info,
+                             void *outputBuffer, unsigned long outputBufferBytes,
+                             unsigned long *outputBufferBytesUsed,
+                             unsigned int **chunkDecisions)
+{
+    HapEncodeSource sources[2];
+    unsigned int i;
+
+    if (count == 0 || count > 2 || function == NULL)
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        sources[i].buffer = NULL;
+        sources[i].function = function;
+        sources[i].p = p;
+        sources[i].index = i;
+    }
+
+    return hap_encode_frame(context,
+                            count,
+                            sources, inputBuffersBytes,
+                            textureFormats,
+                            compressors,
+                            chunkCounts,
+                            options,
+                            callback, info,
+                            outputBuffer, outputBufferBytes,
+                            outputBufferBytesUsed,
+                            chunkDecisions);
+}
+
+unsigned int HapEncodeWithFunction(unsigned int count,
+                                   HapEncodeChunkFunction function, void *p,
+                                   unsigned long *inputBuffersBytes,
+                                   unsigned int *textureFormats,
+                                   unsigned int *compressors,
+                                   unsigned int *chunkCounts,
+                                   unsigned int options,
+                                   HapDecodeCallback callback, void *info,
+                                   void *outputBuffer, unsigned long outputBufferBytes,
+                                   unsigned long *outputBufferBytesUsed)
+{
+    return HapEncodeChunks(NULL,
+                           count,
+                           function, p,
+                           inputBuffersBytes,
+                           textureFormats,
+                           compressors,
+                           chunkCounts,
+                           options,
+                           callback, info,
+                           outputBuffer, outputBufferBytes,
+                           outputBufferBytesUsed,
+                           NULL);
+}
+
+unsigned int HapEncode(unsigned int count,
+                       const void **inputBuffers, unsigned long *inputBuffersBytes,
+                       unsigned int *textureFormats,
+                       unsigned int *compressors,
+                       unsigned int *chunkCounts,
+                       void *outputBuffer, unsigned long outputBufferBytes,
+                       unsigned long *outputBufferBytesUsed)
+{
+    return HapEncodeWithCallback(count,
+                                 inputBuffers, inputBuffersBytes,
+                                 textureFormats,
+                                 compressors,
+                                 chunkCounts,
+                                 HapEncodeOption_None,
+                                 NULL, NULL,
+                                 outputBuffer, outputBufferBytes,
+                                 outputBufferBytesUsed);
+}
+
+HapDecoderContext *HapCreateDecoderContext(void)
+{
+    HapDecoderContext *context = (HapDecoderContext *)malloc(sizeof(HapDecoderContext));
+    if (context)
+    {
+        context->chunk_info = NULL;
+        context->chunk_info_capacity = 0;
+        context->scratch = NULL;
+        context->scratch_capacity = 0;
+        context->chunk_scratch = NULL;
+        context->chunk_scratch_count = 0;
+        context->texture = NULL;
+        context->texture_capacity = 0;
+        memset(context->buffers, 0, sizeof(context->buffers));
+        context->buffer_clock = 0;
+        context->minimum_work_bytes = 0;
+        context->groups = NULL;
+        context->groups_capacity = 0;
+        context->last_chunk_count = 0;
+        context->last_work_item_count = 0;
+    }
+    return context;
+}
+
+void HapDestroyDecoderContext(HapDecoderContext *context)
+{
+    if (context)
+    {
+        unsigned int i;
+        for (i = 0; i < context->chunk_scratch_count; i++)
+        {
+            free(context->chunk_scratch[i].data);
+        }
+        free(context->chunk_scratch);
+        free(context->chunk_info);
+        free(context->scratch);
+        free(context->texture);
+        for (i = 0; i < kHapBufferHistoryCount; i++)
+        {
+            free(context->buffers[i].chunks);
+        }
+        free(context->groups);
+        free(context);
+    }
+}
+
+void HapSetDecoderContextMinimumWorkBytes(HapDecoderContext *context, unsigned long minimumWorkBytes)
+{
+    if (context)
+    {
+        context->minimum_work_bytes = minimumWorkBytes;
+    }
+}
+
+void HapGetDecoderContextWorkItems(const HapDecoderContext *context, unsigned int *chunkCount, unsigned int *workItemCount)
+{
+    if (chunkCount)
+    {
+        *chunkCount = context ? context->last_chunk_count : 0;
+    }
+    if (workItemCount)
+    {
+        *workItemCount = context ? context->last_work_item_count : 0;
+    }
+}
+
+// Returns storage for details of chunk_count chunks, or NULL on error
+static HapChunkDecodeInfo *hap_decoder_context_chunk_info(HapDecoderContext *context, unsigned int chunk_count)
+{
+    if (context == NULL)
+    {
+        return (HapChunkDecodeInfo *)malloc(sizeof(HapChunkDecodeInfo) * chunk_count);
+    }
+    if (chunk_count > context->chunk_info_capacity)
+    {
+        HapChunkDecodeInfo *chunk_info = (HapChunkDecodeInfo *)realloc(context->chunk_info, sizeof(HapChunkDecodeInfo) * chunk_count);
+        if (chunk_info == NULL)
+        {
+            return NULL;
+        }
+        context->chunk_info = chunk_info;
+        context->chunk_info_capacity = chunk_count;
+    }
+    return context->chunk_info;
+}
+
+// Releases storage returned by hap_decoder_context_chunk_info()
+static void hap_decoder_context_release_chunk_info(HapDecoderContext *context, HapChunkDecodeInfo *chunk_info)
+{
+    if (context == NULL)
+    {
+        free(chunk_info);
+    }
+}
+
+// Returns scratch space of at least length bytes, or NULL on error
+static char *hap_decoder_context_scratch(HapDecoderContext *context, size_t length)
+{
+    if (context == NULL)
+    {
+        return (char *)malloc(length);
+    }
+    return hap_context_storage(&context->scratch, &context->scratch_capacity, length);
+}
+
+/*
+ Returns space of at least length bytes for a whole texture, which may be used at the same time as scratch space, or NULL
+ on error. Release it with hap_decoder_context_release_scratch().
+ */
+static char *hap_decoder_context_texture(HapDecoderContext *context, size_t length)
+{
+    if (context == NULL)
+    {
+        return (char *)malloc(length);
+    }
+    return hap_context_storage(&context->texture, &context->texture_capacity, length);
+}
+
+// Releases scratch space returned by hap_decoder_context_scratch()
+static void hap_decoder_context_release_scratch(HapDecoderContext *context, char *scratch)
+{
+    if (context == NULL)
+    {
+        free(scratch);
+    }
+}
+
+/*
+ Returns count scratch slots for chunks, or NULL on error. Slots keep their space between frames, and are only given space
+ when a thread first claims them, so only as many slots as there are threads decoding at once ever have any.
+ */
+static HapChunkScratch *hap_decoder_context_chunk_scratch(HapDecoderContext *context, unsigned int count)
+{
+    if (context == NULL)
+    {
+        return (HapChunkScratch *)calloc(count, sizeof(HapChunkScratch));
+    }
+    if (count > context->chunk_scratch_count)
+    {
+        HapChunkScratch *chunk_scratch = (HapChunkScratch *)realloc(context->chunk_scratch, sizeof(HapChunkScratch) * count);
+        if (chunk_scratch == NULL)
+        {
+            return NULL;
+        }
+        memset(chunk_scratch + context->chunk_scratch_count, 0, sizeof(HapChunkScratch) * (count - context->chunk_scratch_count));
+        context->chunk_scratch = chunk_scratch;
+        context->chunk_scratch_count = count;
+    }
+    return context->chunk_scratch;
+}
+
+// Releases slots returned by hap_decoder_context_chunk_scratch()
+static void hap_decoder_context_release_chunk_scratch(HapDecoderContext *context, HapChunkScratch *chunk_scratch, unsigned int count)
+{
+    if (context == NULL)
+    {
+        unsigned int i;
+        for (i = 0; i < count; i++)
+        {
+            free(chunk_scratch[i].data);
+        }
+        free(chunk_scratch);
+    }
+}
+
+/*
+ Returns the history of buffer with space for the fingerprints of chunk_count chunks, or NULL on error. A buffer which
+ isn't remembered takes the place of the one least recently used, with its contents unknown.
+ */
+static HapBufferHistory *hap_decoder_context_buffer_history(HapDecoderContext *context, const void *buffer, unsigned int chunk_count)
+{
+    HapBufferHistory *history = &context->buffers[0];
+    unsigned int i;
+
+    for (i = 0; i < kHapBufferHistoryCount; i++)
+    {
+        if (context->buffers[i].buffer == buffer)
+        {
+            history = &context->buffers[i];
+            break;
+        }
+        if (context->buffers[i].last_used < history->last_used)
+        {
+            history = &context->buffers[i];
+        }
+    }
+
+    if (history->buffer != buffer)
+    {
+        history->buffer = buffer;
+        history->chunk_count = 0;
+    }
+    history->last_used = ++context->buffer_clock;
+
+    if (chunk_count > history->chunks_capacity)
+    {
+        HapChunkFingerprint *chunks = (HapChunkFingerprint *)realloc(history->chunks, sizeof(HapChunkFingerprint) * chunk_count);
+        if (chunks == NULL)
+        {
+            return NULL;
+        }
+        history->chunks = chunks;
+        history->chunks_capacity = chunk_count;
+    }
+    return history;
+}
+
+/*
+ Replaces a chunk's fingerprint with its own, and returns non-zero if it was compared and matched, so that the chunk is
+ already in the output buffer
+ */
+static int hap_chunk_unchanged(HapChunkDecodeInfo *chunk)
+{
+    HapChunkFingerprint fingerprint;
+    int unchanged;
+
+    fingerprint.hash = hap_hash_chunk(chunk->compressed_chunk_data, chunk->compressed_chunk_size);
+    fingerprint.compressor = chunk->compressor;
+    fingerprint.compressed_chunk_size = chunk->compressed_chunk_size;
+    fingerprint.uncompressed_chunk_offset = chunk->uncompressed_chunk_offset;
+    fingerprint.uncompressed_chunk_size = chunk->uncompressed_chunk_size;
+
+    unchanged = chunk->compare
+                && chunk->fingerprint->hash == fingerprint.hash
+                && chunk->fingerprint->compressor == fingerprint.compressor
+                && chunk->fingerprint->compressed_chunk_size == fingerprint.compressed_chunk_size
+                && chunk->fingerprint->uncompressed_chunk_offset == fingerprint.uncompressed_chunk_offset
+                && chunk->fingerprint->uncompressed_chunk_size == fingerprint.uncompressed_chunk_size;
+
+    *chunk->fingerprint = fingerprint;
+    *chunk->dirty = unchanged ? 0 : 1;
+    return unchanged;
+}
+
+/*
+ Passes a chunk to a HapDecodeChunkFunction, decompressing it first if necessary
+ */
+static void hap_decode_chunk_to_function(HapChunkDecodeInfo *chunk)
+{
+    const HapChunkFunctionInfo *function_info = chunk->function_info;
+
+    if (chunk->compressor == kHapCompressorSnappy)
+    {
+        // There is a slot for every chunk, so one is always free
+        size_t length = chunk->uncompressed_chunk_size;
+        HapChunkScratch *scratch = hap_claim_chunk_scratch(function_info->scratch, function_info->scratch_count, length);
+        snappy_status snappy_result;
+
+        if (scratch->data == NULL)
+        {
+            chunk->result = HapResult_Internal_Error;
+        }
+        else
+        {
+            snappy_result = snappy_uncompress(chunk->compressed_chunk_data, chunk->compressed_chunk_size, scratch->data, &length);
+            if (snappy_result == SNAPPY_OK)
+            {
+                function_info->function(function_info->p, scratch->data, chunk->uncompressed_chunk_offset, length);
+                chunk->result = HapResult_No_Error;
+            }
+            else
+            {
+                chunk->result = snappy_result == SNAPPY_INVALID_INPUT ? HapResult_Bad_Frame : HapResult_Internal_Error;
+            }
+        }
+
+        hap_atomic_release(&scratch->claimed);
+    }
+    else if (chunk->compressor == kHapCompressorNone)
+    {
+        if (chunk->compressed_chunk_size > 0)
+        {
+            function_info->function(function_info->p, chunk->compressed_chunk_data, chunk->uncompressed_chunk_offset, chunk->compressed_chunk_size);
+        }
+        chunk->result = HapResult_No_Error;
+    }
+    else
+    {
+        chunk->result = HapResult_Bad_Frame;
+    }
+}
+
+static void hap_decode_chunk(HapChunkDecodeInfo chunks[], unsigned int index)
+{
+    if (chunks && chunks[index].function_info)
+    {
+        hap_decode_chunk_to_function(&chunks[index]);
+    }
+    else if (chunks)
+    {
+        if (chunks[index].fingerprint && hap_chunk_unchanged(&chunks[index]))
+        {
+            chunks[index].result = HapResult_No_Error;
+        }
+        else if (chunks[index].compressor == kHapCompressorSnappy)
+        {
+            snappy_status snappy_result = snappy_uncompress(chunks[index].compressed_chunk_data,
+                                                            chunks[index].compressed_chunk_size,
+                                                            chunks[index].uncompressed_chunk_data,
+                                                            &chunks[index].uncompressed_chunk_size);
+
+            switch (snappy_result)
+            {
+                case SNAPPY_INVALID_INPUT:
+                    chunks[index].result = HapResult_Bad_Frame;
+                    break;
+                case SNAPPY_OK:
+                    chunks[index].result = HapResult_No_Error;
+                    if (chunks[index].clip_destination)
+                    {
+                        memcpy(chunks[index].clip_destination,
+                               chunks[index].uncompressed_chunk_data + chunks[index].clip_offset,
+                               chunks[index].clip_length);
+                    }
+                    break;
+                default:
+                    chunks[index].result = HapResult_Internal_Error;
+                    break;
+            }
+        }
+        else if (chunks[index].compressor == kHapCompressorNone)
+        {
+            if (chunks[index].clip_destination)
+            {
+                memcpy(chunks[index].clip_destination,
+                       chunks[index].compressed_chunk_data + chunks[index].clip_offset,
+                       chunks[index].clip_length);
+            }
+            else
+            {
+                memcpy(chunks[index].uncompressed_chunk_data,
+                       chunks[index].compressed_chunk_data,
+                       chunks[index].compressed_chunk_size);
+            }
+            chunks[index].result = HapResult_No_Error;
+        }
+        else
+        {
+            chunks[index].result = HapResult_Bad_Frame;
+        }
+    }
+}
+
+static unsigned int hap_decode_header_complex_instructions(const void *texture_section, uint32_t texture_section_length, int * chunk_count,
+                                                   const void **compressors, const void **chunk_sizes, const void **chunk_offsets, const char **frame_data){
+    int result = HapResult_No_Error;
+    const void *section_start;
+    uint32_t section_header_length;
+    uint32_t section_length;
+    unsigned int section_type;
+    size_t bytes_remaining = 0;
+
+    *compressors = NULL;
+    *chunk_sizes = NULL;
+    *chunk_offsets = NULL;
+
+    result = hap_read_section_header(texture_section, texture_section_length, &section_header_length, &section_length, &section_type);
+
+    if (result == HapResult_No_Error && section_type != kHapSectionDecodeInstructionsContainer)
+    {
+        result = HapResult_Bad_Frame;
+    }
+
+    if (result != HapResult_No_Error)
+    {
+        return result;
+    }
+
+    /*
+     Frame data follows immediately after the Decode Instructions Container
+     */
+    *frame_data = ((const char *)texture_section) + section_header_length + section_length;
+
+    /*
+     Step through the sections inside the Decode Instructions Container
+     */
+    section_start = ((uint8_t *)texture_section) + section_header_length;
+    bytes_remaining = section_length;
+
+    while (bytes_remaining > 0) {
+        unsigned int section_chunk_count = 0;
+        result = hap_read_section_header(section_start, bytes_remaining, &section_header_length, &section_length, &section_type);
+        if (result != HapResult_No_Error)
+        {
+            return result;
+        }
+        section_start = ((uint8_t *)section_start) + section_header_length;
+        switch (section_type) {
+            case kHapSectionChunkSecondStageCompressorTable:
+                *compressors = section_start;
+                section_chunk_count = section_length;
+                break;
+            case kHapSectionChunkSizeTable:
+                *chunk_sizes = section_start;
+                section_chunk_count = section_length / 4;
+                break;
+            case kHapSectionChunkOffsetTable:
+                *chunk_offsets = section_start;
+                section_chunk_count = section_length / 4;
+                break;
+            default:
+                // Ignore unrecognized sections
+                break;
+        }
+
+        /*
+         If we calculated a chunk count and already have one, make sure they match
+         */
+        if (section_chunk_count != 0)
+        {
+            if ((*chunk_count) != 0 && section_chunk_count != (*chunk_count))
+            {
+                return HapResult_Bad_Frame;
+            }
+            *chunk_count = section_chunk_count;
+        }
+
+        section_start = ((uint8_t *)section_start) + section_length;
+        bytes_remaining -= section_header_length + section_length;
+    }
+
+    /*
+     The Chunk Second-Stage Compressor Table and Chunk Size Table are required
+     */
+    if (*compressors == NULL || *chunk_sizes == NULL)
+    {
+        return HapResult_Bad_Frame;
+    }
+    return result;
+}
+
+/*
+ Fills out texture with the details of a texture section, checking that they describe a texture which can be decoded
+ */
+static unsigned int hap_get_texture_info(const void *texture_section, uint32_t texture_section_length,
+                                         unsigned int texture_section_type,
+                                         HapTextureInfo *texture)
+{
+    unsigned int result = HapResult_No_Error;
+    unsigned int compressor;
+
+    /*
+     One top-level section type describes texture-format and second-stage compression
+     Hap compressor/format constants can be unpacked by reading the top and bottom four bits.
+     */
+    compressor = hap_top_4_bits(texture_section_type);
+    texture->textureFormat = hap_texture_format_constant_for_format_identifier(hap_bottom_4_bits(texture_section_type));
+    if (texture->textureFormat == 0)
+    {
+        return HapResult_Bad_Frame;
+    }
+
+    texture->chunkCompressors = NULL;
+    texture->chunkSizes = NULL;
+    texture->chunkOffsets = NULL;
+
+    if (compressor == kHapCompressorComplex)
+    {
+        /*
+         The top-level section should contain a Decode Instructions Container followed by frame data
+         */
+        int chunk_count = 0;
+        const char *frame_data = NULL;
+        size_t frame_data_length;
+        size_t running_compressed_chunk_size = 0;
+        int i;
+
+        result = hap_decode_header_complex_instructions(texture_section, texture_section_length, &chunk_count, &texture->chunkCompressors, &texture->chunkSizes, &texture->chunkOffsets, &frame_data);
+
+        if (result != HapResult_No_Error)
+        {
+            return result;
+        }
+
+        frame_data_length = texture_section_length - (frame_data - (const char *)texture_section);
+
+        texture->compressor = HapCompressorComplex;
+        texture->chunkCount = chunk_count;
+        texture->data = frame_data;
+        texture->dataBytes = frame_data_length;
+        texture->decodedBytes = 0;
+
+        /*
+         Check each chunk lies within the frame data, and total their decoded lengths
+         */
+        for (i = 0; i < chunk_count; i++)
+        {
+            size_t chunk_offset;
+            size_t chunk_size = hap_read_4_byte_uint(((uint8_t *)texture->chunkSizes) + (i * 4));
+            size_t uncompressed_chunk_size;
+
+            if (texture->chunkOffsets)
+            {
+                chunk_offset = hap_read_4_byte_uint(((uint8_t *)texture->chunkOffsets) + (i * 4));
+            }
+            else
+            {
+                chunk_offset = running_compressed_chunk_size;
+            }
+
+            running_compressed_chunk_size += chunk_size;
+
+            if (chunk_offset > frame_data_length || chunk_size > frame_data_length - chunk_offset)
+            {
+                return HapResult_Bad_Frame;
+            }
+
+            switch (*(((uint8_t *)texture->chunkCompressors) + i))
+            {
+                case kHapCompressorSnappy:
+                    switch (snappy_uncompressed_length(frame_data + chunk_offset, chunk_size, &uncompressed_chunk_size))
+                    {
+                        case SNAPPY_OK:
+                            break;
+                        case SNAPPY_INVALID_INPUT:
+                            return HapResult_Bad_Frame;
+                        default:
+                            return HapResult_Internal_Error;
+                    }
+                    break;
+                case kHapCompressorNone:
+                    uncompressed_chunk_size = chunk_size;
+                    break;
+                default:
+                    return HapResult_Bad_Frame;
+            }
+
+            texture->decodedBytes += uncompressed_chunk_size;
+        }
+    }
+    else if (compressor == kHapCompressorSnappy)
+    {
+        /*
+         Only one section is present containing a single block of snappy-compressed texture data
+         */
+        size_t uncompressed_length;
+        snappy_status snappy_result = snappy_uncompressed_length((const char *)texture_section, texture_section_length, &uncompressed_length);
+        if (snappy_result != SNAPPY_OK)
+        {
+            return HapResult_Internal_Error;
+        }
+        texture->compressor = HapCompressorSnappy;
+        texture->chunkCount = 1;
+        texture->data = texture_section;
+        texture->dataBytes = texture_section_length;
+        texture->decodedBytes = uncompressed_length;
+    }
+    else if (compressor == kHapCompressorNone)
+    {
+        /*
+         Only one section is present containing a single block of uncompressed texture data
+         */
+        texture->compressor = HapCompressorNone;
+        texture->chunkCount = 1;
+        texture->data = texture_section;
+        texture->dataBytes = texture_section_length;
+        texture->decodedBytes = texture_section_length;
+    }
+    else
+    {
+        return HapResult_Bad_Frame;
+    }
+
+    return result;
+}
+
+// Returns the number of chunks hap_texture_chunk_info() will describe for a texture
+static unsigned int hap_texture_chunk_count(const HapTextureInfo *texture)
+{
+    return texture->compressor == HapCompressorComplex ? texture->chunkCount : 1U;
+}
+
+/*
+ Fills chunk_info with details for the decompression of each chunk of a texture to outputBuffer, which may be NULL if the
+ chunks are not to be kept. A texture which is not chunked is described as a single chunk.
+ */
+static void hap_texture_chunk_info(const HapTextureInfo *texture, void *outputBuffer, HapChunkDecodeInfo *chunk_info)
+{
+    if (texture->compressor == HapCompressorComplex)
+    {
+        size_t running_compressed_chunk_size = 0;
+        size_t running_uncompressed_chunk_size = 0;
+        unsigned int i;
+
+        for (i = 0; i < texture->chunkCount; i++) {
+
+            chunk_info[i].compressor = *(((uint8_t *)texture->chunkCompressors) + i);
+
+            chunk_info[i].compressed_chunk_size = hap_read_4_byte_uint(((uint8_t *)texture->chunkSizes) + (i * 4));
+
+            if (texture->chunkOffsets)
+            {
+                chunk_info[i].compressed_chunk_data = ((const char *)texture->data) + hap_read_4_byte_uint(((uint8_t *)texture->chunkOffsets) + (i * 4));
+            }
+            else
+            {
+                chunk_info[i].compressed_chunk_data = ((const char *)texture->data) + running_compressed_chunk_size;
+            }
+
+            running_compressed_chunk_size += chunk_info[i].compressed_chunk_size;
+
+            if (chunk_info[i].compressor == kHapCompressorSnappy)
+            {
+                // This can't fail as the frame has already been checked
+                snappy_uncompressed_length(chunk_info[i].compressed_chunk_data,
+                                           chunk_info[i].compressed_chunk_size,
+                                           &(chunk_info[i].uncompressed_chunk_size));
+            }
+            else
+            {
+                chunk_info[i].uncompressed_chunk_size = chunk_info[i].compressed_chunk_size;
+            }
+
+            chunk_info[i].uncompressed_chunk_data = outputBuffer ? (char *)(((uint8_t *)outputBuffer) + running_uncompressed_chunk_size) : NULL;
+            chunk_info[i].uncompressed_chunk_offset = running_uncompressed_chunk_size;
+            running_uncompressed_chunk_size += chunk_info[i].uncompressed_chunk_size;
+            chunk_info[i].clip_destination = NULL;
+            chunk_info[i].function_info = NULL;
+            chunk_info[i].fingerprint = NULL;
+        }
+    }
+    else
+    {
+        chunk_info[0].compressor = texture->compressor == HapCompressorSnappy ? kHapCompressorSnappy : kHapCompressorNone;
+        chunk_info[0].compressed_chunk_data = (const char *)texture->data;
+        chunk_info[0].compressed_chunk_size = texture->dataBytes;
+        chunk_info[0].uncompressed_chunk_data = (char *)outputBuffer;
+        chunk_info[0].uncompressed_chunk_size = texture->decodedBytes;
+        chunk_info[0].uncompressed_chunk_offset = 0;
+        chunk_info[0].clip_destination = NULL;
+        chunk_info[0].function_info = NULL;
+        chunk_info[0].fingerprint = NULL;
+    }
+}
+
+/*
+ Adjacent chunks grouped into one work item, from chunk groups[index] up to groups[index + 1]
+ */
+typedef struct HapChunkGroups {
+    HapChunkDecodeInfo *chunk_info;
+    const unsigned int *groups;
+} HapChunkGroups;
+
+static void hap_decode_chunk_group(const HapChunkGroups *groups, unsigned int index)
+{
+    unsigned int i;
+    for (i = groups->groups[index]; i < groups->groups[index + 1]; i++)
+    {
+        hap_decode_chunk(groups->chunk_info, i);
+    }
+}
+
+/*
+ Groups adjacent chunks into work items of at least minimum_work_bytes decoded bytes, with any remainder joining the last,
+ filling groups with the first chunk of each item followed by chunk_count. Returns the number of work items.
+ */
+static unsigned int hap_group_chunks(const HapChunkDecodeInfo *chunk_info, unsigned int chunk_count,
+                                     size_t minimum_work_bytes, unsigned int *groups)
+{
+    unsigned int group_count = 0;
+    size_t group_bytes = 0;
+    unsigned int i;
+
+    groups[0] = 0;
+    for (i = 0; i < chunk_count; i++)
+    {
+        group_bytes += chunk_info[i].uncompressed_chunk_size;
+        if (group_bytes >= minimum_work_bytes)
+        {
+            group_count++;
+            groups[group_count] = i + 1;
+            group_bytes = 0;
+        }
+    }
+    if (group_count == 0)
+    {
+        group_count = 1;
+    }
+    groups[group_count] = chunk_count;
+    return group_count;
+}
+
+/*
+ Decompresses chunks, using the callback if there is more than one work item, and returns the first error encountered.
+ context may be NULL, in which case each chunk is a work item.
+ */
+static unsigned int hap_decode_chunks(HapDecoderContext *context, HapChunkDecodeInfo *chunk_info, unsigned int chunk_count, HapDecodeCallback callback, void *info)
+{
+    unsigned int work_item_count = chunk_count;
+    unsigned int i;
+
+    if (context && context->minimum_work_bytes > 0 && chunk_count > 1)
+    {
+        if (chunk_count + 1 > context->groups_capacity)
+        {
+            unsigned int *groups = (unsigned int *)realloc(context->groups, sizeof(unsigned int) * (chunk_count + 1));
+            // Without space to group them, each chunk is a work item
+            if (groups)
+            {
+                context->groups = groups;
+                context->groups_capacity = chunk_count + 1;
+            }
+        }
+        if (chunk_count + 1 <= context->groups_capacity)
+        {
+            work_item_count = hap_group_chunks(chunk_info, chunk_count, context->minimum_work_bytes, context->groups);
+        }
+    }
+
+    if (context)
+    {
+        context->last_chunk_count = chunk_count;
+        context->last_work_item_count = work_item_count;
+    }
+
+    if (work_item_count < chunk_count)
+    {
+        HapChunkGroups groups;
+        groups.chunk_info = chunk_info;
+        groups.groups = context->groups;
+        if (work_item_count == 1)
+        {
+            // The frame is too small to be worth handing to other threads
+            hap_decode_chunk_group(&groups, 0);
+        }
+        else
+        {
+            callback((HapDecodeWorkFunction)hap_decode_chunk_group, &groups, work_item_count, info);
+        }
+    }
+    else if (chunk_count == 1)
+    {
+        /*
+         We don't invoke the callback for one chunk, just decode it directly
+         */
+        hap_decode_chunk(chunk_info, 0);
+    }
+    else if (chunk_count > 1)
+    {
+        callback((HapDecodeWorkFunction)hap_decode_chunk, chunk_info, chunk_count, info);
+    }
+
+    /*
+     Check to see if we encountered any errors and report one of them
+     */
+    for (i = 0; i < chunk_count; i++)
+    {
+        if (chunk_info[i].result != HapResult_No_Error)
+        {
+            return chunk_info[i].result;
+        }
+    }
+    return HapResult_No_Error;
+}
+
+/*
+ Decodes a texture described by hap_get_texture_info()
+ */
+static unsigned int hap_decode_texture(const HapTextureInfo *texture,
+                                       HapDecoderContext *context,
+                                       HapDecodeCallback callback, void *info,
+                                       void *outputBuffer, unsigned long outputBufferBytes,
+                                       unsigned long *outputBufferBytesUsed)
+{
+    unsigned int result = HapResult_No_Error;
+
+    if (texture->decodedBytes > outputBufferBytes)
+    {
+        return HapResult_Buffer_Too_Small;
+    }
+
+    if (texture->compressor == HapCompressorComplex)
+    {
+        if (texture->chunkCount > 0)
+        {
+            HapChunkDecodeInfo *chunk_info = hap_decoder_context_chunk_info(context, texture->chunkCount);
+
+            if (chunk_info == NULL)
+            {
+                return HapResult_Internal_Error;
+            }
+
+            hap_texture_chunk_info(texture, outputBuffer, chunk_info);
+
+            result = hap_decode_chunks(context, chunk_info, texture->chunkCount, callback, info);
+
+            hap_decoder_context_release_chunk_info(context, chunk_info);
+
+            if (result != HapResult_No_Error)
+            {
+                return result;
+            }
+        }
+    }
+    else if (texture->compressor == HapCompressorSnappy)
+    {
+        size_t bytesUsed = texture->decodedBytes;
+        snappy_status snappy_result = snappy_uncompress((const char *)texture->data, texture->dataBytes, (char *)outputBuffer, &bytesUsed);
+        if (snappy_result != SNAPPY_OK)
+        {
+            return HapResult_Internal_Error;
+        }
+    }
+    else
+    {
+        memcpy(outputBuffer, texture->data, texture->dataBytes);
+    }
+    /*
+     Fill out the remaining return value
+     */
+    if (outputBufferBytesUsed != NULL)
+    {
+        *outputBufferBytesUsed = texture->decodedBytes;
+    }
+    
+    return HapResult_No_Error;
+}
+
+int hap_get_section_at_index(const void *input_buffer, uint32_t input_buffer_bytes,
+                             unsigned int index,
+                             const void **section, uint32_t *section_length, unsigned int *section_type)
+{
+    int result;
+    uint32_t section_header_length;
+
+    result = hap_read_section_header(input_buffer, input_buffer_bytes, &section_header_length, section_length, section_type);
+
+    if (result != HapResult_No_Error)
+    {
+        return result;
+    }
+
+    if (*section_type == kHapSectionMultipleImages)
+    {
+        /*
+         Step through until we find the section at index
+         */
+        size_t offset = 0;
+        size_t top_section_length = *section_length;
+        input_buffer = ((uint8_t *)input_buffer) + section_header_length;
+        section_header_length = 0;
+        *section_length = 0;
+        for (int i = 0; i <= index; i++) {
+            offset += section_header_length + *section_length;
+            if (offset >= top_section_length)
+            {
+                return HapResult_Bad_Arguments;
+            }
+            result = hap_read_section_header(((uint8_t *)input_buffer) + offset,
+                                             top_section_length - offset,
+                                             &section_header_length,
+                                             section_length,
+                                             section_type);
+            if (result != HapResult_No_Error)
+            {
+                return result;
+            }
+        }
+        offset += section_header_length;
+        *section = ((uint8_t *)input_buffer) + offset;
+        return HapResult_No_Error;
+    }
+    else if (index == 0)
+    {
+        /*
+         A single-texture frame with the texture as the top section.
+         */
+        *section = ((uint8_t *)input_buffer) + section_header_length;
+        return HapResult_No_Error;
+    }
+    else
+    {
+        *section = NULL;
+        *section_length = 0;
+        *section_type = 0;
+        return HapResult_Bad_Arguments;
+    }
+}
+
+unsigned int HapDecodeWithContext(HapDecoderContext *context,
+                                  const void *inputBuffer, unsigned long inputBufferBytes,
+                                  unsigned int index,
+                                  HapDecodeCallback callback, void *info,
+                                  void *outputBuffer, unsigned long outputBufferBytes,
+                                  unsigned long *outputBufferBytesUsed,
+                                  unsigned int *outputBufferTextureFormat)
+{
+    int result = HapResult_No_Error;
+    const void *section;
+    uint32_t section_length;
+    unsigned int section_type;
+
+    /*
+     Check arguments
+     */
+    if (inputBuffer == NULL
+        || index > 1
+        || callback == NULL
+        || outputBuffer == NULL
+        || outputBufferTextureFormat == NULL
+        )
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    /*
+     Locate the section at the given index, which will either be the top-level section in a single texture image, or one of the
+     sections inside a multi-image top-level section.
+     */
+    result = hap_get_section_at_index(inputBuffer, inputBufferBytes, index, &section, &section_length, &section_type);
+
+    if (result == HapResult_No_Error)
+    {
+        HapTextureInfo texture;
+
+        result = hap_get_texture_info(section, section_length, section_type, &texture);
+
+        if (result == HapResult_No_Error)
+        {
+            /*
+             Pass the texture format out
+             */
+            *outputBufferTextureFormat = texture.textureFormat;
+
+            /*
+             Decode the located texture
+             */
+            result = hap_decode_texture(&texture,
+                                        context,
+                                        callback, info,
+                                        outputBuffer,
+                                        outputBufferBytes,
+                                        outputBufferBytesUsed);
+        }
+    }
+
+    return result;
+}
+
+unsigned int HapDecode(const void *inputBuffer, unsigned long inputBufferBytes,
+                       unsigned int index,
+                       HapDecodeCallback callback, void *info,
+                       void *outputBuffer, unsigned long outputBufferBytes,
+                       unsigned long *outputBufferBytesUsed,
+                       unsigned int *outputBufferTextureFormat)
+{
+    return HapDecodeWithContext(NULL,
+                                inputBuffer, inputBufferBytes,
+                                index,
+                                callback, info,
+                                outputBuffer, outputBufferBytes,
+                                outputBufferBytesUsed,
+                                outputBufferTextureFormat);
+}
+
+unsigned int HapGetFrameInfo(const void *inputBuffer, unsigned long inputBufferBytes, HapFrameInfo *outputFrameInfo)
+{
+    unsigned int result;
+    uint32_t section_header_length;
+    uint32_t section_length;
+    unsigned int section_type;
+
+    /*
+     Check arguments
+     */
+    if (inputBuffer == NULL
+        || outputFrameInfo == NULL
+        )
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    outputFrameInfo->textureCount = 0;
+
+    result = hap_read_section_header(inputBuffer, inputBufferBytes, &section_header_length, &section_length, &section_type);
+
+    if (result != HapResult_No_Error)
+    {
+        return result;
+    }
+
+    if (section_type == kHapSectionMultipleImages)
+    {
+        /*
+         Step through the contained sections, reading each texture
+         */
+        const uint8_t *top_section = ((const uint8_t *)inputBuffer) + section_header_length;
+        uint32_t top_section_length = section_length;
+        uint32_t offset = 0;
+        while (offset < top_section_length)
+        {
+            if (outputFrameInfo->textureCount == sizeof(outputFrameInfo->textures) / sizeof(outputFrameInfo->textures[0]))
+            {
+                return HapResult_Bad_Frame;
+            }
+            result = hap_read_section_header(top_section + offset,
+                                             top_section_length - offset,
+                                             &section_header_length,
+                                             &section_length,
+                                             &section_type);
+            if (result == HapResult_No_Error)
+            {
+                result = hap_get_texture_info(top_section + offset + section_header_length,
+                                              section_length,
+                                              section_type,
+                                              &outputFrameInfo->textures[outputFrameInfo->textureCount]);
+            }
+            if (result != HapResult_No_Error)
+            {
+                outputFrameInfo->textureCount = 0;
+                return result;
+            }
+            offset += section_header_length + section_length;
+            outputFrameInfo->textureCount++;
+        }
+        if (outputFrameInfo->textureCount == 0)
+        {
+            return HapResult_Bad_Frame;
+        }
+    }
+    else
+    {
+        /*
+         A single-texture frame with the texture as the top section.
+         */
+        result = hap_get_texture_info(((const uint8_t *)inputBuffer) + section_header_length,
+                                      section_length,
+                                      section_type,
+                                      &outputFrameInfo->textures[0]);
+        if (result != HapResult_No_Error)
+        {
+            return result;
+        }
+        outputFrameInfo->textureCount = 1;
+    }
+
+    return HapResult_No_Error;
+}
+
+unsigned int HapDecodeWithFrameInfo(HapDecoderContext *context,
+                                    const HapFrameInfo *frameInfo,
+                                    unsigned int index,
+                                    HapDecodeCallback callback, void *info,
+                                    void *outputBuffer, unsigned long outputBufferBytes,
+                                    unsigned long *outputBufferBytesUsed)
+{
+    /*
+     Check arguments
+     */
+    if (frameInfo == NULL
+        || index >= frameInfo->textureCount
+        || callback == NULL
+        || outputBuffer == NULL
+        )
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    return hap_decode_texture(&frameInfo->textures[index],
+                              context,
+                              callback, info,
+                              outputBuffer,
+                              outputBufferBytes,
+                              outputBufferBytesUsed);
+}
+
+unsigned int HapDecodeAll(HapDecoderContext *context,
+                          const HapFrameInfo *frameInfo,
+                          HapDecodeCallback callback, void *info,
+                          void **outputBuffers, unsigned long *outputBuffersBytes)
+{
+    unsigned int result;
+    HapChunkDecodeInfo *chunk_info;
+    unsigned int chunk_count = 0;
+    unsigned int i;
+
+    /*
+     Check arguments
+     */
+    if (frameInfo == NULL
+        || callback == NULL
+        || outputBuffers == NULL
+        || outputBuffersBytes == NULL
+        )
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    for (i = 0; i < frameInfo->textureCount; i++)
+    {
+        if (outputBuffers[i] == NULL)
+        {
+            return HapResult_Bad_Arguments;
+        }
+        if (frameInfo->textures[i].decodedBytes > outputBuffersBytes[i])
+        {
+            return HapResult_Buffer_Too_Small;
+        }
+        chunk_count += hap_texture_chunk_count(&frameInfo->textures[i]);
+    }
+
+    if (chunk_count == 0)
+    {
+        return HapResult_No_Error;
+    }
+
+    /*
+     Gather the chunks of every texture so they can all be decompressed with one callback
+     */
+    chunk_info = hap_decoder_context_chunk_info(context, chunk_count);
+
+    if (chunk_info == NULL)
+    {
+        return HapResult_Internal_Error;
+    }
+
+    chunk_count = 0;
+    for (i = 0; i < frameInfo->textureCount; i++)
+    {
+        hap_texture_chunk_info(&frameInfo->textures[i], outputBuffers[i], chunk_info + chunk_count);
+        chunk_count += hap_texture_chunk_count(&frameInfo->textures[i]);
+    }
+
+    result = hap_decode_chunks(context, chunk_info, chunk_count, callback, info);
+
+    hap_decoder_context_release_chunk_info(context, chunk_info);
+
+    return result;
+}
+
+/*
+ Finds the second-stage compressor, the data and the decoded length of the chunk at index of a texture, which need not
+ be chunked. compressed_offset is the total size of the chunks before it, and is advanced past it.
+ */
+static void hap_texture_chunk(const HapTextureInfo *texture, unsigned int index, size_t *compressed_offset,
+                              unsigned int *compressor, const char **data, size_t *length)
+{
+    if (texture->compressor == HapCompressorComplex)
+    {
+        size_t compressed_length = hap_read_4_byte_uint(((uint8_t *)texture->chunkSizes) + (index * 4));
+        *compressor = *(((uint8_t *)texture->chunkCompressors) + index);
+        *data = (const char *)texture->data;
+        if (texture->chunkOffsets)
+        {
+            *data += hap_read_4_byte_uint(((uint8_t *)texture->chunkOffsets) + (index * 4));
+        }
+        else
+        {
+            *data += *compressed_offset;
+        }
+        if (*compressor == kHapCompressorSnappy)
+        {
+            // This can't fail as the frame has already been checked
+            snappy_uncompressed_length(*data, compressed_length, length);
+        }
+        else
+        {
+            *length = compressed_length;
+        }
+        *compressed_offset += compressed_length;
+    }
+    else
+    {
+        *compressor = texture->compressor == HapCompressorSnappy ? kHapCompressorSnappy : kHapCompressorNone;
+        *data = (const char *)texture->data;
+        *length = texture->decodedBytes;
+    }
+}
+
+/*
+ The chunks of a batch, in the order they are handed out, which is largest first
+ */
+typedef struct HapBatchChunk {
+    size_t size;
+    unsigned int chunk;
+} HapBatchChunk;
+
+typedef struct HapBatchInfo {
+    HapChunkDecodeInfo *chunk_info;
+    const HapBatchChunk *order;
+} HapBatchInfo;
+
+static int hap_batch_chunk_compare(const void *a, const void *b)
+{
+    const HapBatchChunk *first = (const HapBatchChunk *)a;
+    const HapBatchChunk *second = (const HapBatchChunk *)b;
+    if (first->size != second->size)
+    {
+        return first->size > second->size ? -1 : 1;
+    }
+    // Equal chunks keep their order, as qsort() isn't stable
+    return first->chunk < second->chunk ? -1 : (first->chunk > second->chunk ? 1 : 0);
+}
+
+static void hap_decode_batch_chunk(const HapBatchInfo *batch, unsigned int index)
+{
+    hap_decode_chunk(batch->chunk_info, batch->order[index].chunk);
+}
+
+unsigned int HapDecodeBatch(HapDecoderContext *context,
+                            HapDecodeBatchItem *items, unsigned int count,
+                            HapDecodeCallback callback, void *info)
+{
+    HapChunkDecodeInfo *chunk_info;
+    HapBatchChunk *order;
+    HapBatchInfo batch;
+    unsigned int chunk_count = 0;
+    unsigned int result = HapResult_No_Error;
+    unsigned int i;
+
+    /*
+     Check arguments
+     */
+    if (items == NULL
+        || callback == NULL
+        )
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    // Items which can't be decoded are given their result now and left out
+    for (i = 0; i < count; i++)
+    {
+        const HapFrameInfo *frame_info = items[i].frameInfo;
+        if (frame_info == NULL
+            || items[i].index >= frame_info->textureCount
+            || items[i].outputBuffer == NULL)
+        {
+            items[i].result = HapResult_Bad_Arguments;
+        }
+        else if (frame_info->textures[items[i].index].decodedBytes > items[i].outputBufferBytes)
+        {
+            items[i].result = HapResult_Buffer_Too_Small;
+        }
+        else
+        {
+            items[i].result = HapResult_No_Error;
+            chunk_count += hap_texture_chunk_count(&frame_info->textures[items[i].index]);
+        }
+    }
+
+    if (chunk_count > 0)
+    {
+        chunk_info = hap_decoder_context_chunk_info(context, chunk_count);
+        order = (HapBatchChunk *)hap_decoder_context_scratch(context, sizeof(HapBatchChunk) * chunk_count);
+
+        if (chunk_info == NULL || order == NULL)
+        {
+            if (chunk_info)
+            {
+                hap_decoder_context_release_chunk_info(context, chunk_info);
+            }
+            if (order)
+            {
+                hap_decoder_context_release_scratch(context, (char *)order);
+            }
+            return HapResult_Internal_Error;
+        }
+
+        /*
+         Gather the chunks of every item so they can all be decompressed with one callback, handing out the largest first so
+         that the last to finish are small
+         */
+        chunk_count = 0;
+        for (i = 0; i < count; i++)
+        {
+            if (items[i].result == HapResult_No_Error)
+            {
+                const HapTextureInfo *texture = &items[i].frameInfo->textures[items[i].index];
+                hap_texture_chunk_info(texture, items[i].outputBuffer, chunk_info + chunk_count);
+                chunk_count += hap_texture_chunk_count(texture);
+            }
+        }
+
+        for (i = 0; i < chunk_count; i++)
+        {
+            order[i].size = chunk_info[i].uncompressed_chunk_size;
+            order[i].chunk = i;
+        }
+        qsort(order, chunk_count, sizeof(HapBatchChunk), hap_batch_chunk_compare);
+
+        batch.chunk_info = chunk_info;
+        batch.order = order;
+
+        if (chunk_count == 1)
+        {
+            hap_decode_batch_chunk(&batch, 0);
+        }
+        else
+        {
+            callback((HapDecodeWorkFunction)hap_decode_batch_chunk, &batch, chunk_count, info);
+        }
+
+        // Each item's result is the first error among its chunks
+        chunk_count = 0;
+        for (i = 0; i < count; i++)
+        {
+            if (items[i].result == HapResult_No_Error)
+            {
+                unsigned int item_chunk_count = hap_texture_chunk_count(&items[i].frameInfo->textures[items[i].index]);
+                unsigned int j;
+                for (j = 0; j < item_chunk_count; j++)
+                {
+                    if (chunk_info[chunk_count + j].result != HapResult_No_Error)
+                    {
+                        items[i].result = chunk_info[chunk_count + j].result;
+                        break;
+                    }
+                }
+                chunk_count += item_chunk_count;
+            }
+        }
+
+        hap_decoder_context_release_scratch(context, (char *)order);
+        hap_decoder_context_release_chunk_info(context, chunk_info);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (items[i].result != HapResult_No_Error)
+        {
+            result = items[i].result;
+            break;
+        }
+    }
+
+    return result;
+}
+
+/*
+ A decode request keeps the details of the chunks of a texture being decoded asynchronously, and their storage between
+ frames
+ */
+struct HapDecodeRequest {
+    HapChunkDecodeInfo *chunk_info;
+    unsigned int chunk_info_capacity;
+    unsigned int chunk_count;
+    long remaining;
+    long done;
+    unsigned int result;
+    HapDecodeCompletion completion;
+    void *p;
+};
+
+HapDecodeRequest *HapCreateDecodeRequest(void)
+{
+    HapDecodeRequest *request = (HapDecodeRequest *)malloc(sizeof(HapDecodeRequest));
+    if (request)
+    {
+        request->chunk_info = NULL;
+        request->chunk_info_capacity = 0;
+        request->chunk_count = 0;
+        request->remaining = 0;
+        request->done = 1;
+        request->result = HapResult_No_Error;
+        request->completion = NULL;
+        request->p = NULL;
+    }
+    return request;
+}
+
+void HapDestroyDecodeRequest(HapDecodeRequest *request)
+{
+    if (request)
+    {
+        free(request->chunk_info);
+        free(request);
+    }
+}
+
+/*
+ Decodes one chunk of an asynchronous request, and finishes the request if it was the last
+ */
+static void hap_decode_request_chunk(HapDecodeRequest *request, unsigned int index)
+{
+    hap_decode_chunk(request->chunk_info, index);
+
+    if (hap_atomic_decrement(&request->remaining) == 0)
+    {
+        HapDecodeCompletion completion = request->completion;
+        void *p = request->p;
+        unsigned int result = HapResult_No_Error;
+        unsigned int i;
+
+        for (i = 0; i < request->chunk_count; i++)
+        {
+            if (request->chunk_info[i].result != HapResult_No_Error)
+            {
+                result = request->chunk_info[i].result;
+                break;
+            }
+        }
+        request->result = result;
+
+        // The request may be reused or destroyed as soon as it is done, so isn't touched after
+        hap_atomic_set(&request->done);
+
+        if (completion)
+        {
+            completion(p, result);
+        }
+    }
+}
+
+unsigned int HapDecodeAsync(HapDecodeRequest *request,
+                            const HapFrameInfo *frameInfo,
+                            unsigned int index,
+                            HapDecodeCallback callback, void *info,
+                            void *outputBuffer, unsigned long outputBufferBytes,
+                            HapDecodeCompletion completion, void *p)
+{
+    const HapTextureInfo *texture;
+    unsigned int chunk_count;
+
+    /*
+     Check arguments
+     */
+    if (request == NULL
+        || !hap_atomic_is_set(&request->done)
+        || frameInfo == NULL
+        || index >= frameInfo->textureCount
+        || callback == NULL
+        || outputBuffer == NULL
+        )
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    texture = &frameInfo->textures[index];
+
+    if (texture->decodedBytes > outputBufferBytes)
+    {
+        return HapResult_Buffer_Too_Small;
+    }
+
+    chunk_count = hap_texture_chunk_count(texture);
+
+    if (chunk_count > request->chunk_info_capacity)
+    {
+        HapChunkDecodeInfo *chunk_info = (HapChunkDecodeInfo *)realloc(request->chunk_info, sizeof(HapChunkDecodeInfo) * chunk_count);
+        if (chunk_info == NULL)
+        {
+            return HapResult_Internal_Error;
+        }
+        request->chunk_info = chunk_info;
+        request->chunk_info_capacity = chunk_count;
+    }
+
+    request->chunk_count = chunk_count;
+    request->result = HapResult_No_Error;
+    request->completion = completion;
+    request->p = p;
+
+    if (chunk_count == 0)
+    {
+        if (completion)
+        {
+            completion(p, HapResult_No_Error);
+        }
+        return HapResult_No_Error;
+    }
+
+    hap_texture_chunk_info(texture, outputBuffer, request->chunk_info);
+
+    request->remaining = chunk_count;
+    hap_atomic_clear(&request->done);
+
+    callback((HapDecodeWorkFunction)hap_decode_request_chunk, request, chunk_count, info);
+
+    return HapResult_No_Error;
+}
+
+int HapDecodeRequestDone(const HapDecodeRequest *request)
+{
+    return request == NULL || hap_atomic_is_set(&request->done);
+}
+
+unsigned int HapGetDecodeRequestResult(const HapDecodeRequest *request, unsigned int *chunkResults)
+{
+    if (request == NULL || !hap_atomic_is_set(&request->done))
+    {
+        return HapResult_Bad_Arguments;
+    }
+    if (chunkResults)
+    {
+        unsigned int i;
+        for (i = 0; i < request->chunk_count; i++)
+        {
+            chunkResults[i] = request->chunk_info[i].result;
+        }
+    }
+    return request->result;
+}
+
+// Chunks which arrived together and were handed to the callback as one
+typedef struct HapStreamBatch {
+    HapStreamDecoder *decoder;
+    // The batch's first entry in the decoder's order
+    unsigned int first;
+} HapStreamBatch;
+
+struct HapStreamDecoder {
+    const void *input;
+    size_t input_bytes;
+    size_t received;
+    unsigned int index;
+    HapDecodeCallback callback;
+    void *info;
+    void *output;
+    size_t output_bytes;
+    HapDecodeCompletion completion;
+    void *p;
+    unsigned int result;
+    long done;
+    int have_texture;
+    unsigned int texture_format;
+    HapChunkDecodeInfo *chunk_info;
+    // The index of each chunk handed to the callback, in the order they were, and a batch for each time it was called
+    unsigned int *order;
+    HapStreamBatch *batches;
+    unsigned char *dispatched;
+    unsigned int capacity;
+    unsigned int chunk_count;
+    unsigned int dispatched_count;
+    unsigned int batch_count;
+    // The results of the chunks before this in order have been checked
+    unsigned int checked_count;
+    // Chunks not yet decoded, and one more until the decode is ended, so whichever thread takes it to zero finishes
+    long remaining;
+    // Chunks have their decoded length and position once the start of each before them has arrived
+    unsigned int sized_count;
+    size_t decoded_bytes;
+    // Every chunk before this has been decoded
+    unsigned int first_pending;
+};
+
+HapStreamDecoder *HapCreateStreamDecoder(void)
+{
+    HapStreamDecoder *decoder = (HapStreamDecoder *)calloc(1, sizeof(HapStreamDecoder));
+    if (decoder)
+    {
+        decoder->done = 1;
+    }
+    return decoder;
+}
+
+void HapDestroyStreamDecoder(HapStreamDecoder *decoder)
+{
+    if (decoder)
+    {
+        free(decoder->chunk_info);
+        free(decoder->order);
+        free(decoder->batches);
+        free(decoder->dispatched);
+        free(decoder);
+    }
+}
+
+// Makes room in decoder for a texture of chunk_count chunks, returning 0 on error
+static int hap_stream_reserve(HapStreamDecoder *decoder, unsigned int chunk_count)
+{
+    if (chunk_count > decoder->capacity)
+    {
+        HapChunkDecodeInfo *chunk_info = (HapChunkDecodeInfo *)realloc(decoder->chunk_info, sizeof(HapChunkDecodeInfo) * chunk_count);
+        unsigned int *order = chunk_info ? (unsigned int *)realloc(decoder->order, sizeof(unsigned int) * chunk_count) : NULL;
+        HapStreamBatch *batches = order ? (HapStreamBatch *)realloc(decoder->batches, sizeof(HapStreamBatch) * chunk_count) : NULL;
+        unsigned char *dispatched = batches ? (unsigned char *)realloc(decoder->dispatched, chunk_count) : NULL;
+        if (chunk_info)
+        {
+            decoder->chunk_info = chunk_info;
+        }
+        if (order)
+        {
+            decoder->order = order;
+        }
+        if (batches)
+        {
+            decoder->batches = batches;
+        }
+        if (dispatched == NULL)
+        {
+            return 0;
+        }
+        decoder->dispatched = dispatched;
+        decoder->capacity = chunk_count;
+    }
+    return 1;
+}
+
+// Returns non-zero if the header of the section offset bytes into the frame has arrived
+static int hap_stream_header_arrived(const HapStreamDecoder *decoder, size_t offset)
+{
+    if (decoder->received < offset + 4U)
+    {
+        return 0;
+    }
+    if (hap_read_3_byte_uint(((const uint8_t *)decoder->input) + offset) == 0U && decoder->received < offset + 8U)
+    {
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ Reads the headers of the texture being decoded, once they have arrived, checking that they describe a texture which can
+ be decoded and filling decoder's chunk_info with the compressed part of each chunk
+ */
+static unsigned int hap_stream_read_texture(HapStreamDecoder *decoder)
+{
+    const uint8_t *input = (const uint8_t *)decoder->input;
+    uint32_t input_bytes = (uint32_t)decoder->input_bytes;
+    unsigned int result;
+    uint32_t section_header_length;
+    uint32_t section_length;
+    unsigned int section_type;
+    size_t section_offset;
+    unsigned int compressor;
+    unsigned int texture_format;
+    unsigned int chunk_count;
+    unsigned int i;
+
+    /*
+     Locate the texture section as hap_get_section_at_index() does, stopping at any header which hasn't arrived
+     */
+    if (!hap_stream_header_arrived(decoder, 0))
+    {
+        return HapResult_No_Error;
+    }
+    result = hap_read_section_header(input, input_bytes, &section_header_length, &section_length, &section_type);
+    if (result != HapResult_No_Error)
+    {
+        return result;
+    }
+
+    if (section_type == kHapSectionMultipleImages)
+    {
+        size_t top_section_offset = section_header_length;
+        size_t top_section_length = section_length;
+        size_t offset = 0;
+        for (i = 0; ; i++)
+        {
+            if (offset >= top_section_length)
+            {
+                return HapResult_Bad_Arguments;
+            }
+            if (!hap_stream_header_arrived(decoder, top_section_offset + offset))
+            {
+                return HapResult_No_Error;
+            }
+            result = hap_read_section_header(input + top_section_offset + offset,
+                                             (uint32_t)(top_section_length - offset),
+                                             &section_header_length,
+                                             &section_length,
+                                             &section_type);
+            if (result != HapResult_No_Error)
+            {
+                return result;
+            }
+            if (i == decoder->index)
+            {
+                break;
+            }
+            offset += section_header_length + section_length;
+        }
+        section_offset = top_section_offset + offset + section_header_length;
+    }
+    else if (decoder->index == 0)
+    {
+        section_offset = section_header_length;
+    }
+    else
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    compressor = hap_top_4_bits(section_type);
+    texture_format = hap_texture_format_constant_for_format_identifier(hap_bottom_4_bits(section_type));
+    if (texture_format == 0)
+    {
+        return HapResult_Bad_Frame;
+    }
+
+    if (compressor == kHapCompressorComplex)
+    {
+        /*
+         Wait for the whole Decode Instructions Container
+         */
+        uint32_t instructions_header_length;
+        uint32_t instructions_length;
+        unsigned int instructions_type;
+        int count = 0;
+        const void *chunk_compressors;
+        const void *chunk_sizes;
+        const void *chunk_offsets;
+        const char *frame_data;
+        size_t frame_data_length;
+        size_t running_compressed_chunk_size = 0;
+
+        if (!hap_stream_header_arrived(decoder, section_offset))
+        {
+            return HapResult_No_Error;
+        }
+        result = hap_read_section_header(input + section_offset, section_length, &instructions_header_length, &instructions_length, &instructions_type);
+        if (result != HapResult_No_Error)
+        {
+            return result;
+        }
+        if (decoder->received < section_offset + instructions_header_length + instructions_length)
+        {
+            return HapResult_No_Error;
+        }
+
+        result = hap_decode_header_complex_instructions(input + section_offset, section_length, &count, &chunk_compressors, &chunk_sizes, &chunk_offsets, &frame_data);
+        if (result != HapResult_No_Error)
+        {
+            return result;
+        }
+        chunk_count = (unsigned int)count;
+        frame_data_length = section_length - (frame_data - (const char *)(input + section_offset));
+
+        if (!hap_stream_reserve(decoder, chunk_count))
+        {
+            return HapResult_Internal_Error;
+        }
+
+        /*
+         Check each chunk lies within the frame data
+         */
+        for (i = 0; i < chunk_count; i++)
+        {
+            HapChunkDecodeInfo *chunk = &decoder->chunk_info[i];
+            size_t chunk_offset;
+
+            chunk->compressor = *(((const uint8_t *)chunk_compressors) + i);
+            chunk->compressed_chunk_size = hap_read_4_byte_uint(((const uint8_t *)chunk_sizes) + (i * 4));
+            if (chunk_offsets)
+            {
+                chunk_offset = hap_read_4_byte_uint(((const uint8_t *)chunk_offsets) + (i * 4));
+            }
+            else
+            {
+                chunk_offset = running_compressed_chunk_size;
+            }
+            running_compressed_chunk_size += chunk->compressed_chunk_size;
+
+            if (chunk_offset > frame_data_length || chunk->compressed_chunk_size > frame_data_length - chunk_offset)
+            {
+                return HapResult_Bad_Frame;
+            }
+            if (chunk->compressor != kHapCompressorSnappy && chunk->compressor != kHapCompressorNone)
+            {
+                return HapResult_Bad_Frame;
+            }
+            chunk->compressed_chunk_data = frame_data + chunk_offset;
+        }
+    }
+    else if (compressor == kHapCompressorSnappy || compressor == kHapCompressorNone)
+    {
+        /*
+         A texture which is not chunked is one chunk of the whole section
+         */
+        chunk_count = 1;
+        if (!hap_stream_reserve(decoder, chunk_count))
+        {
+            return HapResult_Internal_Error;
+        }
+        decoder->chunk_info[0].compressor = compressor;
+        decoder->chunk_info[0].compressed_chunk_data = (const char *)(input + section_offset);
+        decoder->chunk_info[0].compressed_chunk_size = section_length;
+    }
+    else
+    {
+        return HapResult_Bad_Frame;
+    }
+
+    for (i = 0; i < chunk_count; i++)
+    {
+        decoder->chunk_info[i].clip_destination = NULL;
+        decoder->chunk_info[i].function_info = NULL;
+        decoder->chunk_info[i].fingerprint = NULL;
+        decoder->dispatched[i] = 0;
+    }
+
+    decoder->texture_format = texture_format;
+    decoder->chunk_count = chunk_count;
+    decoder->remaining = chunk_count + 1;
+    decoder->have_texture = 1;
+    return HapResult_No_Error;
+}
+
+// Returns the first error in the chunks handed to the callback since they were last checked, which must all be decoded
+static unsigned int hap_stream_check_decoded(HapStreamDecoder *decoder)
+{
+    unsigned int result = HapResult_No_Error;
+
+    while (decoder->checked_count < decoder->dispatched_count)
+    {
+        unsigned int chunk_result = decoder->chunk_info[decoder->order[decoder->checked_count++]].result;
+        if (result == HapResult_No_Error)
+        {
+            result = chunk_result;
+        }
+    }
+    return result;
+}
+
+/*
+ Finishes a stream decode once it has been ended and every chunk handed to the callback has been decoded, returning its
+ result
+ */
+static unsigned int hap_stream_finish(HapStreamDecoder *decoder)
+{
+    HapDecodeCompletion completion = decoder->completion;
+    void *p = decoder->p;
+    unsigned int result = decoder->result;
+
+    if (result == HapResult_No_Error)
+    {
+        result = hap_stream_check_decoded(decoder);
+    }
+    decoder->result = result;
+
+    // The decoder may be reused or destroyed as soon as it is done, so isn't touched after
+    hap_atomic_set(&decoder->done);
+
+    if (completion)
+    {
+        completion(p, result);
+    }
+    return result;
+}
+
+/*
+ Decodes one chunk of a batch handed to the callback by a stream decoder, and finishes the decode if it has been ended
+ and this was the last chunk
+ */
+static void hap_stream_decode_chunk(HapStreamBatch *batch, unsigned int index)
+{
+    HapStreamDecoder *decoder = batch->decoder;
+
+    hap_decode_chunk(decoder->chunk_info, decoder->order[batch->first + index]);
+
+    if (hap_atomic_decrement(&decoder->remaining) == 0)
+    {
+        hap_stream_finish(decoder);
+    }
+}
+
+// Returns non-zero if no chunk handed to the callback is still being decoded
+static int hap_stream_idle(const HapStreamDecoder *decoder)
+{
+    return hap_atomic_load(&decoder->remaining) == (long)(decoder->chunk_count - decoder->dispatched_count) + 1;
+}
+
+/*
+ Works out the decoded length and position of each chunk whose start has arrived, in order, then hands every chunk which
+ has arrived whole and whose position is known to the callback
+ */
+static unsigned int hap_stream_decode_arrived(HapStreamDecoder *decoder)
+{
+    const char *input = (const char *)decoder->input;
+    unsigned int first = decoder->dispatched_count;
+    unsigned int i;
+
+    while (decoder->sized_count < decoder->chunk_count)
+    {
+        HapChunkDecodeInfo *chunk = &decoder->chunk_info[decoder->sized_count];
+        size_t chunk_offset = chunk->compressed_chunk_data - input;
+
+        if (chunk->compressor == kHapCompressorSnappy)
+        {
+            // The decoded length is a varint of at most five bytes at the start of the chunk
+            size_t header_length = chunk->compressed_chunk_size < 5U ? chunk->compressed_chunk_size : 5U;
+            if (decoder->received < chunk_offset + header_length)
+            {
+                break;
+            }
+            switch (snappy_uncompressed_length(chunk->compressed_chunk_data, chunk->compressed_chunk_size, &chunk->uncompressed_chunk_size))
+            {
+                case SNAPPY_OK:
+                    break;
+                case SNAPPY_INVALID_INPUT:
+                    return HapResult_Bad_Frame;
+                default:
+                    return HapResult_Internal_Error;
+            }
+        }
+        else
+        {
+            chunk->uncompressed_chunk_size = chunk->compressed_chunk_size;
+        }
+
+        if (chunk->uncompressed_chunk_size > decoder->output_bytes - decoder->decoded_bytes)
+        {
+            return HapResult_Buffer_Too_Small;
+        }
+        chunk->uncompressed_chunk_data = ((char *)decoder->output) + decoder->decoded_bytes;
+        chunk->uncompressed_chunk_offset = decoder->decoded_bytes;
+        decoder->decoded_bytes += chunk->uncompressed_chunk_size;
+        decoder->sized_count++;
+    }
+
+    for (i = decoder->first_pending; i < decoder->sized_count; i++)
+    {
+        const HapChunkDecodeInfo *chunk = &decoder->chunk_info[i];
+        if (!decoder->dispatched[i]
+            && decoder->received >= (size_t)(chunk->compressed_chunk_data - input) + chunk->compressed_chunk_size)
+        {
+            decoder->order[decoder->dispatched_count++] = i;
+            decoder->dispatched[i] = 1;
+        }
+    }
+    while (decoder->first_pending < decoder->chunk_count && decoder->dispatched[decoder->first_pending])
+    {
+        decoder->first_pending++;
+    }
+
+    if (decoder->dispatched_count > first)
+    {
+        HapStreamBatch *batch = &decoder->batches[decoder->batch_count++];
+        unsigned int count = decoder->dispatched_count - first;
+
+        batch->decoder = decoder;
+        batch->first = first;
+
+        // Even one chunk is handed to the callback, which may decode it on another thread and return without waiting
+        decoder->callback((HapDecodeWorkFunction)hap_stream_decode_chunk, batch, count, decoder->info);
+    }
+    // An error decoding a chunk is only seen once none are being decoded
+    if (!hap_stream_idle(decoder))
+    {
+        return HapResult_No_Error;
+    }
+    return hap_stream_check_decoded(decoder);
+}
+
+unsigned int HapBeginStreamDecode(HapStreamDecoder *decoder,
+                                  const void *inputBuffer, unsigned long inputBufferBytes,
+                                  unsigned int index,
+                                  HapDecodeCallback callback, void *info,
+                                  void *outputBuffer, unsigned long outputBufferBytes,
+                                  HapDecodeCompletion completion, void *p)
+{
+    /*
+     Check arguments
+     */
+    if (decoder == NULL
+        || !hap_atomic_is_set(&decoder->done)
+        || inputBuffer == NULL
+        || index > 1
+        || callback == NULL
+        || outputBuffer == NULL
+        )
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    decoder->input = inputBuffer;
+    decoder->input_bytes = inputBufferBytes;
+    decoder->received = 0;
+    decoder->index = index;
+    decoder->callback = callback;
+    decoder->info = info;
+    decoder->output = outputBuffer;
+    decoder->output_bytes = outputBufferBytes;
+    decoder->completion = completion;
+    decoder->p = p;
+    decoder->result = HapResult_No_Error;
+    decoder->have_texture = 0;
+    decoder->chunk_count = 0;
+    decoder->dispatched_count = 0;
+    decoder->batch_count = 0;
+    decoder->checked_count = 0;
+    decoder->remaining = 1;
+    decoder->sized_count = 0;
+    decoder->decoded_bytes = 0;
+    decoder->first_pending = 0;
+    hap_atomic_clear(&decoder->done);
+
+    return HapResult_No_Error;
+}
+
+unsigned int HapStreamBytesReceived(HapStreamDecoder *decoder, unsigned long receivedBytes)
+{
+    /*
+     Check arguments
+     */
+    if (decoder == NULL
+        || decoder->input == NULL
+        || receivedBytes < decoder->received
+        || receivedBytes > decoder->input_bytes
+        )
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    if (decoder->result != HapResult_No_Error)
+    {
+        return decoder->result;
+    }
+
+    decoder->received = receivedBytes;
+
+    if (!decoder->have_texture)
+    {
+        decoder->result = hap_stream_read_texture(decoder);
+    }
+    if (decoder->result == HapResult_No_Error && decoder->have_texture)
+    {
+        decoder->result = hap_stream_decode_arrived(decoder);
+    }
+    return decoder->result;
+}
+
+unsigned int HapEndStreamDecode(HapStreamDecoder *decoder,
+                                unsigned long *outputBufferBytesUsed,
+                                unsigned int *outputBufferTextureFormat)
+{
+    unsigned int result;
+    long undispatched;
+
+    /*
+     Check arguments
+     */
+    if (decoder == NULL
+        || decoder->input == NULL
+        || outputBufferTextureFormat == NULL
+        )
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    if (decoder->received < decoder->input_bytes)
+    {
+        decoder->result = HapResult_Bad_Arguments;
+    }
+    else if (decoder->result == HapResult_No_Error && !decoder->have_texture)
+    {
+        // The whole frame arrived without the headers it claimed to have
+        decoder->result = HapResult_Bad_Frame;
+    }
+    result = decoder->result;
+
+    if (result == HapResult_No_Error)
+    {
+        *outputBufferTextureFormat = decoder->texture_format;
+        if (outputBufferBytesUsed != NULL)
+        {
+            *outputBufferBytesUsed = decoder->decoded_bytes;
+        }
+    }
+
+    // No more of the frame will arrive
+    decoder->input = NULL;
+
+    /*
+     Give up the chunks which will never be handed to the callback, and the one held until now, then finish here if every
+     chunk has been decoded, or otherwise leave the thread which decodes the last one to finish, after which the decoder
+     isn't touched
+     */
+    undispatched = (long)(decoder->chunk_count - decoder->dispatched_count);
+    if (hap_atomic_subtract(&decoder->remaining, undispatched + 1) == 0)
+    {
+        result = hap_stream_finish(decoder);
+    }
+    return result;
+}
+
+int HapStreamDecodeDone(const HapStreamDecoder *decoder)
+{
+    return decoder == NULL || hap_atomic_is_set(&decoder->done);
+}
+
+unsigned int HapGetStreamDecodeResult(const HapStreamDecoder *decoder)
+{
+    if (decoder == NULL || !hap_atomic_is_set(&decoder->done))
     {
         return HapResult_Bad_Arguments;
     }
+    return decoder->result;
+}
 
-    for (int i = 0; i < count; i++)
+unsigned int HapGetTextureChunkExtents(const HapTextureInfo *texture, unsigned long *chunkOffsets, unsigned long *chunkLengths)
+{
+    size_t offset = 0;
+    size_t compressed_offset = 0;
+    unsigned int i;
+
+    if (texture == NULL
+        || chunkOffsets == NULL
+        || chunkLengths == NULL)
     {
-        if (chunkCounts[i] == 0)
-        {
-            return HapResult_Bad_Arguments;
-        }
+        return HapResult_Bad_Arguments;
     }
 
-    if (count == 1)
+    for (i = 0; i < hap_texture_chunk_count(texture); i++)
     {
-        // Encode without the multi-image layout
-        return hap_encode_texture(inputBuffers[0],
-                                  inputBuffersBytes[0],
-                                  textureFormats[0],
-                                  compressors[0],
-                                  chunkCounts[0],
-                                  outputBuffer,
-                                  outputBufferBytes,
-                                  outputBufferBytesUsed);
+        unsigned int compressor;
+        const char *data;
+        size_t length;
+        hap_texture_chunk(texture, i, &compressed_offset, &compressor, &data, &length);
+        chunkOffsets[i] = offset;
+        chunkLengths[i] = length;
+        offset += length;
     }
-    else if ((textureFormats[0] != HapTextureFormat_YCoCg_DXT5 && textureFormats[1] != HapTextureFormat_YCoCg_DXT5)
-             && (textureFormats[0] != HapTextureFormat_A_RGTC1 && textureFormats[1] != HapTextureFormat_A_RGTC1))
+    return HapResult_No_Error;
+}
+
+unsigned int HapGetTextureSpans(const HapFrameInfo *frameInfo, unsigned int index,
+                                HapTextureSpan *spans, unsigned int *spanCount)
+{
+    const HapTextureInfo *texture;
+    size_t offset = 0;
+    size_t compressed_offset = 0;
+    unsigned int count = 0;
+    unsigned int i;
+
+    if (frameInfo == NULL
+        || index >= frameInfo->textureCount
+        || spans == NULL
+        || spanCount == NULL)
     {
-        /*
-         Permitted combinations:
-         HapTextureFormat_YCoCg_DXT5 + HapTextureFormat_A_RGTC1
-         */
         return HapResult_Bad_Arguments;
     }
-    else
+
+    texture = &frameInfo->textures[index];
+
+    for (i = 0; i < hap_texture_chunk_count(texture); i++)
     {
-        // Calculate the worst-case size for the top section and choose a header-length based on that
-        top_section_length = 0;
-        for (int i = 0; i < count; i++)
+        unsigned int compressor;
+        const char *data;
+        size_t length;
+        hap_texture_chunk(texture, i, &compressed_offset, &compressor, &data, &length);
+        if (compressor != kHapCompressorNone)
         {
-            top_section_length += inputBuffersBytes[i] + hap_decode_instructions_length(chunkCounts[i]) + 4;
+            data = NULL;
         }
-
-        if (top_section_length > kHapUInt24Max)
+        if (length == 0)
         {
-            top_section_header_length = 8U;
+            continue;
         }
-        else
+        // Extend the last span if this chunk follows on from it, in the frame too if it is uncompressed
+        if (count > 0
+            && (spans[count - 1].data == NULL) == (data == NULL)
+            && (data == NULL || (const char *)spans[count - 1].data + spans[count - 1].length == data))
         {
-            top_section_header_length = 4U;
+            spans[count - 1].length += length;
         }
-
-        // Encode each texture
-        top_section_length = 0;
-        for (int i = 0; i < count; i++)
+        else
         {
-            void *section = ((uint8_t *)outputBuffer) + top_section_header_length + top_section_length;
-            unsigned int result = hap_encode_texture(inputBuffers[i],
-                                                     inputBuffersBytes[i],
-                                                     textureFormats[i],
-                                                     compressors[i],
-                                                     chunkCounts[i],
-                                                     section,
-                                                     outputBufferBytes - (top_section_header_length + top_section_length),
-                                                     &section_length);
-            if (result != HapResult_No_Error)
-            {
-                return result;
-            }
-            top_section_length += section_length;
+            spans[count].data = data;
+            spans[count].offset = offset;
+            spans[count].length = length;
+            count++;
         }
+        offset += length;
+    }
+    *spanCount = count;
+    return HapResult_No_Error;
+}
 
-        hap_write_section_header(outputBuffer, top_section_header_length, top_section_length, kHapSectionMultipleImages);
+unsigned int HapDecodeCompressedChunks(HapDecoderContext *context,
+                                       const HapFrameInfo *frameInfo,
+                                       unsigned int index,
+                                       HapDecodeCallback callback, void *info,
+                                       void *outputBuffer, unsigned long outputBufferBytes)
+{
+    const HapTextureInfo *texture;
+    HapChunkDecodeInfo *chunk_info;
+    unsigned int chunk_count;
+    unsigned int compressed_count = 0;
+    unsigned int result;
+    unsigned int i;
 
-        *outputBufferBytesUsed = top_section_length + top_section_header_length;
+    /*
+     Check arguments
+     */
+    if (frameInfo == NULL
+        || index >= frameInfo->textureCount
+        || callback == NULL
+        || outputBuffer == NULL
+        )
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    texture = &frameInfo->textures[index];
+
+    if (texture->decodedBytes > outputBufferBytes)
+    {
+        return HapResult_Buffer_Too_Small;
+    }
 
+    chunk_count = hap_texture_chunk_count(texture);
+    if (chunk_count == 0)
+    {
         return HapResult_No_Error;
     }
-}
 
-static void hap_decode_chunk(HapChunkDecodeInfo chunks[], unsigned int index)
-{
-    if (chunks)
+    chunk_info = hap_decoder_context_chunk_info(context, chunk_count);
+    if (chunk_info == NULL)
     {
-        if (chunks[index].compressor == kHapCompressorSnappy)
-        {
-            snappy_status snappy_result = snappy_uncompress(chunks[index].compressed_chunk_data,
-                                                            chunks[index].compressed_chunk_size,
-                                                            chunks[index].uncompressed_chunk_data,
-                                                            &chunks[index].uncompressed_chunk_size);
+        return HapResult_Internal_Error;
+    }
 
-            switch (snappy_result)
-            {
-                case SNAPPY_INVALID_INPUT:
-                    chunks[index].result = HapResult_Bad_Frame;
-                    break;
-                case SNAPPY_OK:
-                    chunks[index].result = HapResult_No_Error;
-                    break;
-                default:
-                    chunks[index].result = HapResult_Internal_Error;
-                    break;
-            }
-        }
-        else if (chunks[index].compressor == kHapCompressorNone)
-        {
-            memcpy(chunks[index].uncompressed_chunk_data,
-                   chunks[index].compressed_chunk_data,
-                   chunks[index].compressed_chunk_size);
-            chunks[index].result = HapResult_No_Error;
-        }
-        else
+    // Gather the compressed chunks at the start of chunk_info, leaving out the rest
+    hap_texture_chunk_info(texture, outputBuffer, chunk_info);
+    for (i = 0; i < chunk_count; i++)
+    {
+        if (chunk_info[i].compressor != kHapCompressorNone)
         {
-            chunks[index].result = HapResult_Bad_Frame;
+            chunk_info[compressed_count] = chunk_info[i];
+            compressed_count++;
         }
     }
+
+    result = hap_decode_chunks(context, chunk_info, compressed_count, callback, info);
+
+    hap_decoder_context_release_chunk_info(context, chunk_info);
+
+    return result;
 }
 
-static unsigned int hap_decode_header_complex_instructions(const void *texture_section, uint32_t texture_section_length, int * chunk_count,
-                                                   const void **compressors, const void **chunk_sizes, const void **chunk_offsets, const char **frame_data){
-    int result = HapResult_No_Error;
-    const void *section_start;
-    uint32_t section_header_length;
-    uint32_t section_length;
-    unsigned int section_type;
-    size_t bytes_remaining = 0;
+unsigned int HapDecodeChangedChunks(HapDecoderContext *context,
+                                    const HapFrameInfo *frameInfo,
+                                    unsigned int index,
+                                    HapDecodeCallback callback, void *info,
+                                    void *outputBuffer, unsigned long outputBufferBytes,
+                                    unsigned char *dirtyChunks)
+{
+    const HapTextureInfo *texture;
+    HapBufferHistory *history;
+    HapChunkDecodeInfo *chunk_info;
+    unsigned int chunk_count;
+    unsigned int compare;
+    unsigned int result;
+    unsigned int i;
 
-    *compressors = NULL;
-    *chunk_sizes = NULL;
-    *chunk_offsets = NULL;
+    /*
+     Check arguments
+     */
+    if (context == NULL
+        || frameInfo == NULL
+        || index >= frameInfo->textureCount
+        || callback == NULL
+        || outputBuffer == NULL
+        || dirtyChunks == NULL
+        )
+    {
+        return HapResult_Bad_Arguments;
+    }
 
-    result = hap_read_section_header(texture_section, texture_section_length, &section_header_length, &section_length, &section_type);
+    texture = &frameInfo->textures[index];
 
-    if (result == HapResult_No_Error && section_type != kHapSectionDecodeInstructionsContainer)
+    if (texture->decodedBytes > outputBufferBytes)
     {
-        result = HapResult_Bad_Frame;
+        return HapResult_Buffer_Too_Small;
     }
 
-    if (result != HapResult_No_Error)
+    chunk_count = hap_texture_chunk_count(texture);
+    if (chunk_count == 0)
     {
-        return result;
+        return HapResult_No_Error;
+    }
+
+    history = hap_decoder_context_buffer_history(context, outputBuffer, chunk_count);
+    chunk_info = hap_decoder_context_chunk_info(context, chunk_count);
+    if (history == NULL || chunk_info == NULL)
+    {
+        return HapResult_Internal_Error;
+    }
+
+    compare = history->chunk_count == chunk_count
+              && history->texture_format == texture->textureFormat
+              && history->decoded_bytes == texture->decodedBytes;
+
+    // Until every chunk has been decoded the buffer's contents are unknown
+    history->chunk_count = 0;
+
+    hap_texture_chunk_info(texture, outputBuffer, chunk_info);
+    for (i = 0; i < chunk_count; i++)
+    {
+        chunk_info[i].fingerprint = &history->chunks[i];
+        chunk_info[i].compare = compare;
+        chunk_info[i].dirty = &dirtyChunks[i];
     }
 
+    result = hap_decode_chunks(context, chunk_info, chunk_count, callback, info);
+
+    hap_decoder_context_release_chunk_info(context, chunk_info);
+
+    if (result == HapResult_No_Error)
+    {
+        history->texture_format = texture->textureFormat;
+        history->decoded_bytes = texture->decodedBytes;
+        history->chunk_count = chunk_count;
+    }
+
+    return result;
+}
+
+unsigned int HapDecodeRows(HapDecoderContext *context,
+                           const HapFrameInfo *frameInfo,
+                           unsigned int index,
+                           unsigned int width,
+                           unsigned int firstBlockRow, unsigned int blockRowCount,
+                           HapDecodeCallback callback, void *info,
+                           void *outputBuffer, unsigned long outputBufferBytes)
+{
+    const HapTextureInfo *texture;
+    size_t row_length;
+    size_t region_start;
+    size_t region_end;
+    size_t chunk_start = 0;
+    size_t scratch_length = 0;
+    char *scratch = NULL;
+    HapChunkDecodeInfo *chunk_info;
+    unsigned int chunk_count;
+    unsigned int region_chunk_count = 0;
+    unsigned int result;
+    unsigned int i;
+
     /*
-     Frame data follows immediately after the Decode Instructions Container
+     Check arguments
      */
-    *frame_data = ((const char *)texture_section) + section_header_length + section_length;
+    if (frameInfo == NULL
+        || index >= frameInfo->textureCount
+        || width == 0
+        || callback == NULL
+        || outputBuffer == NULL
+        )
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    texture = &frameInfo->textures[index];
 
     /*
-     Step through the sections inside the Decode Instructions Container
+     Chunks are runs of blocks in row order, so a range of block rows is a range of bytes in the decoded texture
      */
-    section_start = ((uint8_t *)texture_section) + section_header_length;
-    bytes_remaining = section_length;
+    row_length = (size_t)((width + 3) / 4) * hap_texture_format_block_bytes(texture->textureFormat);
+    region_start = (size_t)firstBlockRow * row_length;
+    region_end = region_start + ((size_t)blockRowCount * row_length);
 
-    while (bytes_remaining > 0) {
-        unsigned int section_chunk_count = 0;
-        result = hap_read_section_header(section_start, bytes_remaining, &section_header_length, &section_length, &section_type);
-        if (result != HapResult_No_Error)
-        {
-            return result;
-        }
-        section_start = ((uint8_t *)section_start) + section_header_length;
-        switch (section_type) {
-            case kHapSectionChunkSecondStageCompressorTable:
-                *compressors = section_start;
-                section_chunk_count = section_length;
-                break;
-            case kHapSectionChunkSizeTable:
-                *chunk_sizes = section_start;
-                section_chunk_count = section_length / 4;
-                break;
-            case kHapSectionChunkOffsetTable:
-                *chunk_offsets = section_start;
-                section_chunk_count = section_length / 4;
-                break;
-            default:
-                // Ignore unrecognized sections
-                break;
-        }
+    if (region_end > texture->decodedBytes)
+    {
+        return HapResult_Bad_Arguments;
+    }
+    if (region_end - region_start > outputBufferBytes)
+    {
+        return HapResult_Buffer_Too_Small;
+    }
+    if (region_end == region_start)
+    {
+        return HapResult_No_Error;
+    }
 
-        /*
-         If we calculated a chunk count and already have one, make sure they match
-         */
-        if (section_chunk_count != 0)
+    chunk_count = hap_texture_chunk_count(texture);
+    chunk_info = hap_decoder_context_chunk_info(context, chunk_count);
+
+    if (chunk_info == NULL)
+    {
+        return HapResult_Internal_Error;
+    }
+
+    hap_texture_chunk_info(texture, outputBuffer, chunk_info);
+
+    /*
+     Keep only the chunks which overlap the region, sending those wholly inside it directly to their place in the output
+     buffer, and clipping the others
+     */
+    for (i = 0; i < chunk_count; i++)
+    {
+        size_t chunk_end = chunk_start + chunk_info[i].uncompressed_chunk_size;
+        if (chunk_end > region_start && chunk_start < region_end)
         {
-            if ((*chunk_count) != 0 && section_chunk_count != (*chunk_count))
+            size_t clip_start = chunk_start > region_start ? chunk_start : region_start;
+            size_t clip_end = chunk_end < region_end ? chunk_end : region_end;
+
+            chunk_info[region_chunk_count] = chunk_info[i];
+
+            if (clip_start == chunk_start && clip_end == chunk_end)
             {
-                return HapResult_Bad_Frame;
+                chunk_info[region_chunk_count].uncompressed_chunk_data = ((char *)outputBuffer) + (chunk_start - region_start);
             }
-            *chunk_count = section_chunk_count;
+            else
+            {
+                chunk_info[region_chunk_count].clip_destination = ((char *)outputBuffer) + (clip_start - region_start);
+                chunk_info[region_chunk_count].clip_offset = clip_start - chunk_start;
+                chunk_info[region_chunk_count].clip_length = clip_end - clip_start;
+                if (chunk_info[region_chunk_count].compressor == kHapCompressorSnappy)
+                {
+                    scratch_length += chunk_info[region_chunk_count].uncompressed_chunk_size;
+                }
+            }
+            region_chunk_count++;
         }
-
-        section_start = ((uint8_t *)section_start) + section_length;
-        bytes_remaining -= section_header_length + section_length;
+        chunk_start = chunk_end;
     }
 
     /*
-     The Chunk Second-Stage Compressor Table and Chunk Size Table are required
+     Compressed chunks which are clipped are decompressed to scratch space first
      */
-    if (*compressors == NULL || *chunk_sizes == NULL)
+    if (scratch_length > 0)
     {
-        return HapResult_Bad_Frame;
+        scratch = hap_decoder_context_scratch(context, scratch_length);
+        if (scratch == NULL)
+        {
+            hap_decoder_context_release_chunk_info(context, chunk_info);
+            return HapResult_Internal_Error;
+        }
+        scratch_length = 0;
+        for (i = 0; i < region_chunk_count; i++)
+        {
+            if (chunk_info[i].clip_destination && chunk_info[i].compressor == kHapCompressorSnappy)
+            {
+                chunk_info[i].uncompressed_chunk_data = scratch + scratch_length;
+                scratch_length += chunk_info[i].uncompressed_chunk_size;
+            }
+        }
     }
+
+    result = hap_decode_chunks(context, chunk_info, region_chunk_count, callback, info);
+
+    hap_decoder_context_release_scratch(context, scratch);
+    hap_decoder_context_release_chunk_info(context, chunk_info);
+
     return result;
 }
 
-unsigned int hap_decode_single_texture(const void *texture_section, uint32_t texture_section_length,
-                                       unsigned int texture_section_type,
-                                       HapDecodeCallback callback, void *info,
-                                       void *outputBuffer, unsigned long outputBufferBytes,
-                                       unsigned long *outputBufferBytesUsed,
-                                       unsigned int *outputBufferTextureFormat)
+unsigned int HapDecodeChunks(HapDecoderContext *context,
+                             const HapFrameInfo *frameInfo,
+                             unsigned int index,
+                             HapDecodeChunkFunction function, void *p,
+                             HapDecodeCallback callback, void *info)
 {
-    int result = HapResult_No_Error;
-    unsigned int textureFormat;
-    unsigned int compressor;
-    size_t bytesUsed = 0;
+    const HapTextureInfo *texture;
+    size_t block_bytes;
+    HapChunkFunctionInfo function_info;
+    HapChunkDecodeInfo *chunk_info;
+    unsigned int chunk_count;
+    unsigned int result;
+    unsigned int i;
 
     /*
-     One top-level section type describes texture-format and second-stage compression
-     Hap compressor/format constants can be unpacked by reading the top and bottom four bits.
+     Check arguments
      */
-    compressor = hap_top_4_bits(texture_section_type);
-    textureFormat = hap_bottom_4_bits(texture_section_type);
+    if (frameInfo == NULL
+        || index >= frameInfo->textureCount
+        || function == NULL
+        || callback == NULL
+        )
+    {
+        return HapResult_Bad_Arguments;
+    }
 
-    /*
-     Pass the texture format out
-     */
-    *outputBufferTextureFormat = hap_texture_format_constant_for_format_identifier(textureFormat);
-    if (*outputBufferTextureFormat == 0)
+    texture = &frameInfo->textures[index];
+    block_bytes = hap_texture_format_block_bytes(texture->textureFormat);
+
+    chunk_count = hap_texture_chunk_count(texture);
+    chunk_info = hap_decoder_context_chunk_info(context, chunk_count);
+
+    if (chunk_info == NULL)
     {
-        return HapResult_Bad_Frame;
+        return HapResult_Internal_Error;
     }
 
-    if (compressor == kHapCompressorComplex)
+    hap_texture_chunk_info(texture, NULL, chunk_info);
+
+    function_info.function = function;
+    function_info.p = p;
+
+    for (i = 0; i < chunk_count; i++)
     {
-        /*
-         The top-level section should contain a Decode Instructions Container followed by frame data
-         */
-        int chunk_count = 0;
-        const void *compressors = NULL;
-        const void *chunk_sizes = NULL;
-        const void *chunk_offsets = NULL;
-        const char *frame_data = NULL;
+        if (chunk_info[i].uncompressed_chunk_offset % block_bytes != 0)
+        {
+            break;
+        }
+    }
 
-        result = hap_decode_header_complex_instructions(texture_section, texture_section_length, &chunk_count, &compressors, &chunk_sizes, &chunk_offsets, &frame_data);
+    if (i == chunk_count)
+    {
+        function_info.scratch_count = chunk_count;
+        function_info.scratch = hap_decoder_context_chunk_scratch(context, chunk_count);
+        if (function_info.scratch == NULL)
+        {
+            hap_decoder_context_release_chunk_info(context, chunk_info);
+            return HapResult_Internal_Error;
+        }
 
-        if (result != HapResult_No_Error)
+        for (i = 0; i < chunk_count; i++)
         {
-            return result;
+            chunk_info[i].function_info = &function_info;
         }
 
-        if (chunk_count > 0)
+        result = hap_decode_chunks(context, chunk_info, chunk_count, callback, info);
+
+        hap_decoder_context_release_chunk_scratch(context, function_info.scratch, chunk_count);
+    }
+    else
+    {
+        /*
+         Chunks which split blocks can't be passed on as they are, so decode the whole texture, and then pass it on in
+         parts which end at the last block boundary in each chunk
+         */
+        char *texture_data = hap_decoder_context_scratch(context, texture->decodedBytes);
+        if (texture_data == NULL)
         {
-            /*
-             Step through the chunks, storing information for their decompression
-             */
-            HapChunkDecodeInfo *chunk_info = (HapChunkDecodeInfo *)malloc(sizeof(HapChunkDecodeInfo) * chunk_count);
+            hap_decoder_context_release_chunk_info(context, chunk_info);
+            return HapResult_Internal_Error;
+        }
 
-            size_t running_compressed_chunk_size = 0;
-            size_t running_uncompressed_chunk_size = 0;
-            int i;
+        hap_texture_chunk_info(texture, texture_data, chunk_info);
+        result = hap_decode_chunks(context, chunk_info, chunk_count, callback, info);
 
-            if (chunk_info == NULL)
+        if (result == HapResult_No_Error)
+        {
+            size_t part_start = 0;
+            for (i = 0; i < chunk_count; i++)
             {
-                return HapResult_Internal_Error;
-            }
+                size_t chunk_end = chunk_info[i].uncompressed_chunk_offset + chunk_info[i].uncompressed_chunk_size;
+                size_t part_end = i == chunk_count - 1 ? chunk_end : chunk_end - (chunk_end % block_bytes);
 
-            for (i = 0; i < chunk_count; i++) {
+                chunk_info[i].compressor = kHapCompressorNone;
+                chunk_info[i].compressed_chunk_data = texture_data + part_start;
+                chunk_info[i].compressed_chunk_size = part_end - part_start;
+                chunk_info[i].uncompressed_chunk_offset = part_start;
+                chunk_info[i].function_info = &function_info;
+                part_start = part_end;
+            }
 
-                chunk_info[i].compressor = *(((uint8_t *)compressors) + i);
+            result = hap_decode_chunks(context, chunk_info, chunk_count, callback, info);
+        }
 
-                chunk_info[i].compressed_chunk_size = hap_read_4_byte_uint(((uint8_t *)chunk_sizes) + (i * 4));
+        hap_decoder_context_release_scratch(context, texture_data);
+    }
 
-                if (chunk_offsets)
-                {
-                    chunk_info[i].compressed_chunk_data = frame_data + hap_read_4_byte_uint(((uint8_t *)chunk_offsets) + (i * 4));
-                }
-                else
-                {
-                    chunk_info[i].compressed_chunk_data = frame_data + running_compressed_chunk_size;
-                }
+    hap_decoder_context_release_chunk_info(context, chunk_info);
 
-                running_compressed_chunk_size += chunk_info[i].compressed_chunk_size;
+    return result;
+}
 
-                if (chunk_info[i].compressor == kHapCompressorSnappy)
-                {
-                    snappy_status snappy_result = snappy_uncompressed_length(chunk_info[i].compressed_chunk_data,
-                        chunk_info[i].compressed_chunk_size,
-                        &(chunk_info[i].uncompressed_chunk_size));
+/*
+ Details shared by every chunk of a texture being decoded by HapDecodeWithPitch()
+ */
+typedef struct HapPitchInfo {
+    char *output;
+    size_t row_length;
+    size_t pitch;
+    int non_temporal;
+} HapPitchInfo;
 
-                    if (snappy_result != SNAPPY_OK)
-                    {
-                        switch (snappy_result)
-                        {
-                        case SNAPPY_INVALID_INPUT:
-                            result = HapResult_Bad_Frame;
-                            break;
-                        default:
-                            result = HapResult_Internal_Error;
-                            break;
-                        }
-                        break;
-                    }
-                }
-                else
-                {
-                    chunk_info[i].uncompressed_chunk_size = chunk_info[i].compressed_chunk_size;
-                }
+/*
+ Copies length bytes to destination with non-temporal stores where they are available, so that the copy doesn't evict
+ the cache. Stores are fenced before returning, so that other threads see them once the work is done.
+ */
+static void hap_copy_non_temporal(char *destination, const char *source, size_t length)
+{
+#if defined(HAP_SSE2)
+    size_t head = (16 - ((uintptr_t)destination & 15)) & 15;
+    if (head > length)
+    {
+        head = length;
+    }
+    memcpy(destination, source, head);
+    destination += head;
+    source += head;
+    length -= head;
+    while (length >= 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)source);
+        __m128i b = _mm_loadu_si128((const __m128i *)(source + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(source + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(source + 48));
+        _mm_stream_si128((__m128i *)destination, a);
+        _mm_stream_si128((__m128i *)(destination + 16), b);
+        _mm_stream_si128((__m128i *)(destination + 32), c);
+        _mm_stream_si128((__m128i *)(destination + 48), d);
+        destination += 64;
+        source += 64;
+        length -= 64;
+    }
+    while (length >= 16)
+    {
+        _mm_stream_si128((__m128i *)destination, _mm_loadu_si128((const __m128i *)source));
+        destination += 16;
+        source += 16;
+        length -= 16;
+    }
+    memcpy(destination, source, length);
+    _mm_sfence();
+#else
+    memcpy(destination, source, length);
+#endif
+}
 
-                chunk_info[i].uncompressed_chunk_data = (char *)(((uint8_t *)outputBuffer) + running_uncompressed_chunk_size);
-                running_uncompressed_chunk_size += chunk_info[i].uncompressed_chunk_size;
-            }
+/*
+ A HapDecodeChunkFunction which places each part of the texture in its block rows in the output buffer
+ */
+static void hap_decode_chunk_to_pitch(void *p, const void *data, unsigned long offset, unsigned long length)
+{
+    const HapPitchInfo *pitch_info = (const HapPitchInfo *)p;
+    const char *source = (const char *)data;
+    size_t row = offset / pitch_info->row_length;
+    size_t column = offset % pitch_info->row_length;
 
-            if (result == HapResult_No_Error && running_uncompressed_chunk_size > outputBufferBytes)
-            {
-                result = HapResult_Buffer_Too_Small;
-            }
+    while (length > 0)
+    {
+        size_t part = pitch_info->row_length - column;
+        char *destination = pitch_info->output + (row * pitch_info->pitch) + column;
+        if (part > length)
+        {
+            part = length;
+        }
+        if (pitch_info->non_temporal)
+        {
+            hap_copy_non_temporal(destination, source, part);
+        }
+        else
+        {
+            memcpy(destination, source, part);
+        }
+        source += part;
+        length -= part;
+        row++;
+        column = 0;
+    }
+}
 
-            if (result == HapResult_No_Error)
-            {
-                /*
-                 Perform decompression
-                 */
-                bytesUsed = running_uncompressed_chunk_size;
+/*
+ Decodes each chunk which lies within one block row straight to its place in the output buffer, and passes the others,
+ which span block rows, through scratch space to hap_decode_chunk_to_pitch()
+ */
+static unsigned int hap_decode_texture_to_pitch(HapDecoderContext *context, const HapTextureInfo *texture,
+                                                HapPitchInfo *pitch_info,
+                                                HapDecodeCallback callback, void *info)
+{
+    HapChunkFunctionInfo function_info;
+    HapChunkDecodeInfo *chunk_info;
+    unsigned int chunk_count = hap_texture_chunk_count(texture);
+    unsigned int spanning_count = 0;
+    unsigned int result;
+    unsigned int i;
 
-                if (chunk_count == 1)
-                {
-                    /*
-                     We don't invoke the callback for one chunk, just decode it directly
-                     */
-                    hap_decode_chunk(chunk_info, 0);
-                }
-                else
-                {
-                    callback((HapDecodeWorkFunction)hap_decode_chunk, chunk_info, chunk_count, info);
-                }
+    chunk_info = hap_decoder_context_chunk_info(context, chunk_count);
+    if (chunk_info == NULL)
+    {
+        return HapResult_Internal_Error;
+    }
 
-                /*
-                 Check to see if we encountered any errors and report one of them
-                 */
-                for (i = 0; i < chunk_count; i++)
-                {
-                    if (chunk_info[i].result != HapResult_No_Error)
-                    {
-                        result = chunk_info[i].result;
-                        break;
-                    }
-                }
-            }
+    hap_texture_chunk_info(texture, NULL, chunk_info);
 
-            free(chunk_info);
+    function_info.function = hap_decode_chunk_to_pitch;
+    function_info.p = pitch_info;
+    function_info.scratch = NULL;
+    function_info.scratch_count = 0;
 
-            if (result != HapResult_No_Error)
-            {
-                return result;
-            }
-        }
-    }
-    else if (compressor == kHapCompressorSnappy)
+    for (i = 0; i < chunk_count; i++)
     {
-        /*
-         Only one section is present containing a single block of snappy-compressed texture data
-         */
-        snappy_status snappy_result = snappy_uncompressed_length((const char *)texture_section, texture_section_length, &bytesUsed);
-        if (snappy_result != SNAPPY_OK)
-        {
-            return HapResult_Internal_Error;
-        }
-        if (bytesUsed > outputBufferBytes)
+        size_t offset = chunk_info[i].uncompressed_chunk_offset;
+        size_t row = offset / pitch_info->row_length;
+        if (chunk_info[i].uncompressed_chunk_size == 0
+            || (offset + chunk_info[i].uncompressed_chunk_size - 1) / pitch_info->row_length == row)
         {
-            return HapResult_Buffer_Too_Small;
+            chunk_info[i].uncompressed_chunk_data = pitch_info->output + (row * pitch_info->pitch) + (offset % pitch_info->row_length);
         }
-        snappy_result = snappy_uncompress((const char *)texture_section, texture_section_length, (char *)outputBuffer, &bytesUsed);
-        if (snappy_result != SNAPPY_OK)
+        else
         {
-            return HapResult_Internal_Error;
+            chunk_info[i].function_info = &function_info;
+            spanning_count++;
         }
     }
-    else if (compressor == kHapCompressorNone)
+
+    if (spanning_count > 0)
     {
-        /*
-         Only one section is present containing a single block of uncompressed texture data
-         */
-        bytesUsed = texture_section_length;
-        if (texture_section_length > outputBufferBytes)
+        function_info.scratch_count = spanning_count;
+        function_info.scratch = hap_decoder_context_chunk_scratch(context, spanning_count);
+        if (function_info.scratch == NULL)
         {
-            return HapResult_Buffer_Too_Small;
+            hap_decoder_context_release_chunk_info(context, chunk_info);
+            return HapResult_Internal_Error;
         }
-        memcpy(outputBuffer, texture_section, texture_section_length);
     }
-    else
+
+    result = hap_decode_chunks(context, chunk_info, chunk_count, callback, info);
+
+    if (function_info.scratch)
     {
-        return HapResult_Bad_Frame;
+        hap_decoder_context_release_chunk_scratch(context, function_info.scratch, spanning_count);
     }
+    hap_decoder_context_release_chunk_info(context, chunk_info);
+
+    return result;
+}
+
+unsigned int HapDecodeWithPitch(HapDecoderContext *context,
+                                const HapFrameInfo *frameInfo,
+                                unsigned int index,
+                                unsigned int width,
+                                unsigned int options,
+                                HapDecodeCallback callback, void *info,
+                                void *outputBuffer, unsigned long outputBytesPerBlockRow, unsigned long outputBufferBytes)
+{
+    const HapTextureInfo *texture;
+    HapPitchInfo pitch_info;
+    size_t row_count;
+
     /*
-     Fill out the remaining return value
+     Check arguments
      */
-    if (outputBufferBytesUsed != NULL)
+    if (frameInfo == NULL
+        || index >= frameInfo->textureCount
+        || width == 0
+        || callback == NULL
+        || outputBuffer == NULL
+        )
     {
-        *outputBufferBytesUsed = bytesUsed;
+        return HapResult_Bad_Arguments;
     }
-    
-    return HapResult_No_Error;
-}
 
-int hap_get_section_at_index(const void *input_buffer, uint32_t input_buffer_bytes,
-                             unsigned int index,
-                             const void **section, uint32_t *section_length, unsigned int *section_type)
-{
-    int result;
-    uint32_t section_header_length;
+    texture = &frameInfo->textures[index];
 
-    result = hap_read_section_header(input_buffer, input_buffer_bytes, &section_header_length, section_length, section_type);
+    pitch_info.output = (char *)outputBuffer;
+    pitch_info.row_length = (size_t)((width + 3) / 4) * hap_texture_format_block_bytes(texture->textureFormat);
+    pitch_info.pitch = outputBytesPerBlockRow;
+    pitch_info.non_temporal = (options & HapDecodeOption_NonTemporalStores) != 0;
 
-    if (result != HapResult_No_Error)
+    // The texture must be a whole number of block rows of the given width
+    if (pitch_info.row_length > pitch_info.pitch
+        || texture->decodedBytes % pitch_info.row_length != 0)
     {
-        return result;
+        return HapResult_Bad_Arguments;
     }
 
-    if (*section_type == kHapSectionMultipleImages)
+    row_count = texture->decodedBytes / pitch_info.row_length;
+    if (row_count == 0)
     {
-        /*
-         Step through until we find the section at index
-         */
-        size_t offset = 0;
-        size_t top_section_length = *section_length;
-        input_buffer = ((uint8_t *)input_buffer) + section_header_length;
-        section_header_length = 0;
-        *section_length = 0;
-        for (int i = 0; i <= index; i++) {
-            offset += section_header_length + *section_length;
-            if (offset >= top_section_length)
-            {
-                return HapResult_Bad_Arguments;
-            }
-            result = hap_read_section_header(((uint8_t *)input_buffer) + offset,
-                                             top_section_length - offset,
-                                             &section_header_length,
-                                             section_length,
-                                             section_type);
-            if (result != HapResult_No_Error)
-            {
-                return result;
-            }
-        }
-        offset += section_header_length;
-        *section = ((uint8_t *)input_buffer) + offset;
         return HapResult_No_Error;
     }
-    else if (index == 0)
+    if (((row_count - 1) * pitch_info.pitch) + pitch_info.row_length > outputBufferBytes)
     {
-        /*
-         A single-texture frame with the texture as the top section.
-         */
-        *section = ((uint8_t *)input_buffer) + section_header_length;
-        return HapResult_No_Error;
+        return HapResult_Buffer_Too_Small;
     }
-    else
+
+    if (pitch_info.pitch == pitch_info.row_length && !pitch_info.non_temporal)
     {
-        *section = NULL;
-        *section_length = 0;
-        *section_type = 0;
-        return HapResult_Bad_Arguments;
+        // Rows are packed so the texture can be decoded in place
+        return hap_decode_texture(texture, context, callback, info, outputBuffer, outputBufferBytes, NULL);
+    }
+
+    if (!pitch_info.non_temporal)
+    {
+        return hap_decode_texture_to_pitch(context, texture, &pitch_info, callback, info);
     }
+
+    // snappy writes with ordinary stores, so every chunk goes through scratch space to be copied with non-temporal ones
+    return HapDecodeChunks(context, frameInfo, index, hap_decode_chunk_to_pitch, &pitch_info, callback, info);
 }
 
-unsigned int HapDecode(const void *inputBuffer, unsigned long inputBufferBytes,
-                       unsigned int index,
-                       HapDecodeCallback callback, void *info,
-                       void *outputBuffer, unsigned long outputBufferBytes,
-                       unsigned long *outputBufferBytesUsed,
-                       unsigned int *outputBufferTextureFormat)
+unsigned int HapDecodeChunksWithTexture(HapDecoderContext *context,
+                                        const HapFrameInfo *frameInfo,
+                                        unsigned int index,
+                                        unsigned int otherIndex, const void **otherTexture,
+                                        HapDecodeChunkFunction function, void *p,
+                                        HapDecodeCallback callback, void *info)
 {
-    int result = HapResult_No_Error;
-    const void *section;
-    uint32_t section_length;
-    unsigned int section_type;
+    const HapTextureInfo *other;
+    char *other_data = NULL;
+    unsigned int result = HapResult_No_Error;
 
     /*
      Check arguments
      */
-    if (inputBuffer == NULL
-        || index > 1
+    if (frameInfo == NULL
+        || index >= frameInfo->textureCount
+        || otherIndex >= frameInfo->textureCount
+        || otherIndex == index
+        || otherTexture == NULL
+        || function == NULL
         || callback == NULL
-        || outputBuffer == NULL
-        || outputBufferTextureFormat == NULL
         )
     {
         return HapResult_Bad_Arguments;
     }
 
-    /*
-     Locate the section at the given index, which will either be the top-level section in a single texture image, or one of the
-     sections inside a multi-image top-level section.
-     */
-    result = hap_get_section_at_index(inputBuffer, inputBufferBytes, index, &section, &section_length, &section_type);
+    other = &frameInfo->textures[otherIndex];
+
+    if (other->compressor == HapCompressorNone)
+    {
+        // An uncompressed texture can be read from the frame itself
+        *otherTexture = other->data;
+    }
+    else
+    {
+        other_data = hap_decoder_context_texture(context, other->decodedBytes);
+        if (other_data == NULL)
+        {
+            return HapResult_Internal_Error;
+        }
+        result = hap_decode_texture(other, context, callback, info, other_data, other->decodedBytes, NULL);
+        *otherTexture = other_data;
+    }
 
     if (result == HapResult_No_Error)
     {
-        /*
-         Decode the located texture
-         */
-        result = hap_decode_single_texture(section,
-                                           section_length,
-                                           section_type,
-                                           callback, info,
-                                           outputBuffer,
-                                           outputBufferBytes,
-                                           outputBufferBytesUsed,
-                                           outputBufferTextureFormat);
+        result = HapDecodeChunks(context, frameInfo, index, function, p, callback, info);
+    }
+
+    if (other_data != NULL)
+    {
+        hap_decoder_context_release_scratch(context, other_data);
     }
 
     return result;
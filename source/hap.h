@@ -49,7 +49,8 @@ enum HapTextureFormat {
 
 enum HapCompressor {
     HapCompressorNone,
-    HapCompressorSnappy
+    HapCompressorSnappy,
+    HapCompressorComplex // Reported by HapGetFrameInfo() for chunked textures, not accepted for encoding
 };
 
 enum HapResult {
@@ -60,6 +61,31 @@ enum HapResult {
     HapResult_Internal_Error
 };
 
+enum HapEncodeOption {
+    HapEncodeOption_None = 0,
+    HapEncodeOption_ChunkOffsetTable = 1U << 0,
+    HapEncodeOption_SkipIncompressible = 1U << 1,
+    HapEncodeOption_ReuseUnchangedChunks = 1U << 2
+};
+
+/*
+ Options for HapDecodeWithPitch()
+ */
+enum HapDecodeOption {
+    HapDecodeOption_None = 0,
+    HapDecodeOption_NonTemporalStores = 1U << 0
+};
+
+/*
+ How a chunk was stored, as reported by HapEncodeWithReport()
+ */
+enum HapChunkDecision {
+    HapChunkDecision_Compressed = 1, // Compressed with snappy
+    HapChunkDecision_Uncompressed,   // Stored uncompressed, as requested or because snappy saved no space
+    HapChunkDecision_Skipped,        // Stored uncompressed without being compressed, having been judged incompressible
+    HapChunkDecision_Reused          // Unchanged since the previous frame, and stored as it was then without being compressed
+};
+
 /*
  See HapDecode for descriptions of these function types.
  */
@@ -90,7 +116,9 @@ unsigned long HapMaxEncodedLength(unsigned int count,
  inputBufferBytes is an array of texture data lengths in bytes
  textureFormats is an array of HapTextureFormats
  compressors is an array of HapCompressors
- chunkCounts is an array of chunk counts to permit multithreaded decoding (1 or more)
+ chunkCounts is an array of chunk counts to permit multithreaded decoding (1 or more). Each texture is split into
+  exactly that many chunks, of whole blocks differing in size by at most one block, unless it has fewer blocks than that
+  or more than the 3355431 chunks a frame can describe
  outputBuffer is the destination buffer to receive the encoded frame
  outputBufferBytes is the destination buffer's length in bytes
  outputBufferBytesUsed will be set to the actual encoded length of the frame on return
@@ -103,6 +131,152 @@ unsigned int HapEncode(unsigned int count,
                        void *outputBuffer, unsigned long outputBufferBytes,
                        unsigned long *outputBufferBytesUsed);
 
+/*
+ Encodes one or multiple textures into one Hap frame as HapEncode() does, compressing chunks concurrently.
+
+ If any texture is split into more than one chunk, callback will be called for you to invoke a platform-appropriate
+ mechanism to assign work to threads, in the same way as it is for HapDecode(), and the same callback may be used for
+ both. This callback must not return until all the work has been completed. callback may be NULL, in which case
+ chunks are compressed on the calling thread.
+ info is an argument for your own use to pass context to the callback.
+ options is zero or more HapEncodeOptions combined with bitwise OR:
+  HapEncodeOption_ChunkOffsetTable writes a Chunk Offset Table for chunked textures, which lets each chunk be moved into
+  the frame by the thread which compressed it as soon as it is done, rather than packing the chunks in order once all
+  have been compressed. Chunks may be stored in any order. The table leaves room for at most 1864133 chunks.
+  HapEncodeOption_SkipIncompressible samples each chunk to be compressed with snappy for the repeated sequences snappy
+  relies on, and stores chunks which have too few uncompressed without compressing them. This saves most of the time
+  spent compressing textures which rarely compress, such as BC7 and BC6H, at the cost of a little space for chunks which
+  would have compressed slightly.
+ The remaining arguments are as for HapEncode().
+ */
+unsigned int HapEncodeWithCallback(unsigned int count,
+                                   const void **inputBuffers, unsigned long *inputBuffersBytes,
+                                   unsigned int *textureFormats,
+                                   unsigned int *compressors,
+                                   unsigned int *chunkCounts,
+                                   unsigned int options,
+                                   HapDecodeCallback callback, void *info,
+                                   void *outputBuffer, unsigned long outputBufferBytes,
+                                   unsigned long *outputBufferBytesUsed);
+
+/*
+ Encodes one or multiple textures into one Hap frame as HapEncodeWithCallback() does, reporting how each chunk was
+ stored.
+ chunkDecisions is an array of count arrays, one for each texture, each with at least as many entries as the chunk count
+ requested for the texture. On return each holds a HapChunkDecision for every chunk of the texture as stored in the
+ frame, in order. A texture may be stored as fewer chunks than requested, and is stored as one chunk if it is stored
+ uncompressed; use HapGetFrameTextureChunkCount() to find how many entries were written.
+ The remaining arguments are as for HapEncodeWithCallback().
+ */
+unsigned int HapEncodeWithReport(unsigned int count,
+                                 const void **inputBuffers, unsigned long *inputBuffersBytes,
+                                 unsigned int *textureFormats,
+                                 unsigned int *compressors,
+                                 unsigned int *chunkCounts,
+                                 unsigned int options,
+                                 HapDecodeCallback callback, void *info,
+                                 void *outputBuffer, unsigned long outputBufferBytes,
+                                 unsigned long *outputBufferBytesUsed,
+                                 unsigned int **chunkDecisions);
+
+/*
+ Produces part of a texture for HapEncodeWithFunction(). index is the index of the texture in the frame. data is to
+ receive length bytes of the texture starting offset bytes from its beginning.
+ */
+typedef void (*HapEncodeChunkFunction)(void *p, unsigned int index, void *data, unsigned long offset, unsigned long length);
+
+/*
+ Encodes one or multiple textures into one Hap frame as HapEncodeWithCallback() does, but rather than being passed in
+ buffers, the textures are produced by function one chunk at a time, so that they are never whole in memory.
+
+ Each chunk is produced on the thread which compresses it, immediately before it is compressed. Chunks to be compressed
+ are produced in scratch space which is reused by other chunks, so that they are still in cache when they are compressed.
+ Chunks of textures which are not compressed are produced directly in outputBuffer.
+ function is called once for each part of each texture, in no particular order.
+ p is an argument for your own use to pass context to function.
+ inputBuffersBytes is an array of texture data lengths in bytes.
+ The remaining arguments are as for HapEncodeWithCallback().
+ */
+unsigned int HapEncodeWithFunction(unsigned int count,
+                                   HapEncodeChunkFunction function, void *p,
+                                   unsigned long *inputBuffersBytes,
+                                   unsigned int *textureFormats,
+                                   unsigned int *compressors,
+                                   unsigned int *chunkCounts,
+                                   unsigned int options,
+                                   HapDecodeCallback callback, void *info,
+                                   void *outputBuffer, unsigned long outputBufferBytes,
+                                   unsigned long *outputBufferBytesUsed);
+
+/*
+ An encoder context holds storage which is reused between calls to HapEncodeWithContext() and HapEncodeChunks(), so that
+ once it has grown large enough for the frames being encoded, encoding makes no allocations of its own. Snappy may still
+ allocate its working memory inside snappy_compress(), which its C interface gives no way to provide.
+ A context may be used for any number of frames, but by only one thread at a time.
+ */
+typedef struct HapEncoderContext HapEncoderContext;
+
+/*
+ Returns a new encoder context, or NULL on error.
+ */
+HapEncoderContext *HapCreateEncoderContext(void);
+
+/*
+ Frees an encoder context.
+ */
+void HapDestroyEncoderContext(HapEncoderContext *context);
+
+/*
+ Encodes one or multiple textures into one Hap frame as HapEncodeWithReport() does, using storage from context.
+ context may be NULL, in which case storage is allocated and freed for this call.
+ chunkDecisions may be NULL.
+ options may also include HapEncodeOption_ReuseUnchangedChunks, which has no effect without a context. The context then
+ keeps a hash of each chunk of each texture it compresses with snappy, and the compressed chunk. A chunk whose hash
+ matches that of the same chunk in the previous frame encoded with the context, in the same texture format with the same
+ size and chunk count, is stored as it was then without being compressed again. This saves most of the time spent
+ compressing frames of largely static content. Chunks are compared only by their 64-bit hash.
+ The remaining arguments are as for HapEncodeWithReport().
+ */
+unsigned int HapEncodeWithContext(HapEncoderContext *context,
+                                  unsigned int count,
+                                  const void **inputBuffers, unsigned long *inputBuffersBytes,
+                                  unsigned int *textureFormats,
+                                  unsigned int *compressors,
+                                  unsigned int *chunkCounts,
+                                  unsigned int options,
+                                  HapDecodeCallback callback, void *info,
+                                  void *outputBuffer, unsigned long outputBufferBytes,
+                                  unsigned long *outputBufferBytesUsed,
+                                  unsigned int **chunkDecisions);
+
+/*
+ Encodes one or multiple textures produced by function into one Hap frame as HapEncodeWithFunction() does, using storage
+ from context, and reporting how each chunk was stored as HapEncodeWithReport() does.
+ context and chunkDecisions may be NULL.
+ options may include HapEncodeOption_ReuseUnchangedChunks as for HapEncodeWithContext(). Chunks are compared once
+ function has produced them, so only their compression with snappy is saved.
+ The remaining arguments are as for HapEncodeWithFunction().
+ */
+unsigned int HapEncodeChunks(HapEncoderContext *context,
+                             unsigned int count,
+                             HapEncodeChunkFunction function, void *p,
+                             unsigned long *inputBuffersBytes,
+                             unsigned int *textureFormats,
+                             unsigned int *compressors,
+                             unsigned int *chunkCounts,
+                             unsigned int options,
+                             HapDecodeCallback callback, void *info,
+                             void *outputBuffer, unsigned long outputBufferBytes,
+                             unsigned long *outputBufferBytesUsed,
+                             unsigned int **chunkDecisions);
+
+/*
+ Reports for the last frame encoded with context how many chunks were stored by HapEncodeOption_ReuseUnchangedChunks as
+ they were in the previous frame, in reusedChunks, out of how many chunks of textures compressed with snappy the frame
+ had, in totalChunks. The reuse ratio is reusedChunks / totalChunks.
+ */
+void HapGetEncoderContextReuse(const HapEncoderContext *context, unsigned int *reusedChunks, unsigned int *totalChunks);
+
 /*
  Decodes a texture from inputBuffer which is a Hap frame.
 
@@ -136,6 +310,402 @@ unsigned int HapDecode(const void *inputBuffer, unsigned long inputBufferBytes,
                        unsigned long *outputBufferBytesUsed,
                        unsigned int *outputBufferTextureFormat);
 
+/*
+ A decoder context holds storage which is reused between calls to HapDecodeWithContext(), so that once it has grown
+ large enough for the frames being decoded, decoding makes no allocations.
+ A context may be used for any number of frames, but by only one thread at a time.
+ */
+typedef struct HapDecoderContext HapDecoderContext;
+
+/*
+ Returns a new decoder context, or NULL on error.
+ */
+HapDecoderContext *HapCreateDecoderContext(void);
+
+/*
+ Frees a decoder context.
+ */
+void HapDestroyDecoderContext(HapDecoderContext *context);
+
+/*
+ Sets the least number of decoded bytes in each item of work handed to threads when decoding with context, so that small
+ frames don't spend more time waking threads than decoding. Adjacent chunks are grouped into work items of at least
+ minimumWorkBytes, and a texture smaller than that is decoded on the calling thread without calling the callback. The
+ default of 0 makes each chunk a work item. HapDecodeBatch(), HapDecodeAsync() and stream decoders don't group chunks.
+ */
+void HapSetDecoderContextMinimumWorkBytes(HapDecoderContext *context, unsigned long minimumWorkBytes);
+
+/*
+ Reports how the chunks of the last texture or textures decoded with context were grouped, with the number of chunks in
+ chunkCount and the number of work items in workItemCount. A single work item was decoded on the calling thread.
+ */
+void HapGetDecoderContextWorkItems(const HapDecoderContext *context, unsigned int *chunkCount, unsigned int *workItemCount);
+
+/*
+ Decodes a texture as HapDecode() does, using storage from context.
+ context may be NULL, in which case storage is allocated and freed for this call.
+ */
+unsigned int HapDecodeWithContext(HapDecoderContext *context,
+                                  const void *inputBuffer, unsigned long inputBufferBytes,
+                                  unsigned int index,
+                                  HapDecodeCallback callback, void *info,
+                                  void *outputBuffer, unsigned long outputBufferBytes,
+                                  unsigned long *outputBufferBytesUsed,
+                                  unsigned int *outputBufferTextureFormat);
+
+/*
+ Describes one texture in a frame. Pointers are into the frame the description was made from.
+ */
+typedef struct HapTextureInfo {
+    unsigned int textureFormat;     // a HapTextureFormat
+    unsigned int compressor;        // a HapCompressor, which is HapCompressorComplex if the texture is chunked
+    unsigned int chunkCount;        // 1 for a texture which is not chunked
+    const void *chunkCompressors;   // chunkCount one-byte values from the Chunk Second-Stage Compressor Table, or NULL
+    const void *chunkSizes;         // chunkCount four-byte little-endian values from the Chunk Size Table, or NULL
+    const void *chunkOffsets;       // chunkCount four-byte little-endian values from the Chunk Offset Table, or NULL
+    const void *data;               // the texture data, or for a chunked texture the frame data containing the chunks
+    unsigned long dataBytes;        // the length of data in bytes
+    unsigned long decodedBytes;     // the exact length of the decoded texture in bytes
+} HapTextureInfo;
+
+/*
+ Describes all the textures in a frame.
+ */
+typedef struct HapFrameInfo {
+    unsigned int textureCount;
+    HapTextureInfo textures[2];
+} HapFrameInfo;
+
+/*
+ Reads the headers of a frame once, filling outputFrameInfo with a description of every texture in it.
+ The frame is checked so that any texture it describes can be decoded with HapDecodeWithFrameInfo(), which then need not
+ read the headers again. The description refers to inputBuffer, which must remain valid while it is used.
+ */
+unsigned int HapGetFrameInfo(const void *inputBuffer, unsigned long inputBufferBytes, HapFrameInfo *outputFrameInfo);
+
+/*
+ Decodes the texture at index in a frame described by HapGetFrameInfo().
+ outputBufferBytes must be at least the texture's decodedBytes.
+ The remaining arguments are as for HapDecodeWithContext().
+ */
+unsigned int HapDecodeWithFrameInfo(HapDecoderContext *context,
+                                    const HapFrameInfo *frameInfo,
+                                    unsigned int index,
+                                    HapDecodeCallback callback, void *info,
+                                    void *outputBuffer, unsigned long outputBufferBytes,
+                                    unsigned long *outputBufferBytesUsed);
+
+/*
+ Decodes every texture in a frame described by HapGetFrameInfo(), such as the colour and alpha textures of a Hap Q Alpha
+ frame. The chunks of all the textures are decoded together, with at most one call to callback.
+ outputBuffers and outputBuffersBytes are arrays with a destination buffer and its length in bytes for each texture,
+ which must be at least that texture's decodedBytes.
+ The remaining arguments are as for HapDecodeWithContext().
+ */
+unsigned int HapDecodeAll(HapDecoderContext *context,
+                          const HapFrameInfo *frameInfo,
+                          HapDecodeCallback callback, void *info,
+                          void **outputBuffers, unsigned long *outputBuffersBytes);
+
+/*
+ Decodes the texture at index in a frame described by HapGetFrameInfo() to a buffer which already holds an earlier frame
+ decoded to it by this function, only decoding the chunks which have changed.
+
+ context remembers a hash of each chunk last decoded to each of the last few output buffers used with it. A chunk whose
+ compressed bytes have the same hash and length as those of the chunk decoded to the same place in outputBuffer before is
+ skipped, so playback of largely static content decodes little of each frame. Chunks are compared only by their 64-bit
+ hash, not byte for byte, so in the unlikely event of a collision a changed chunk is skipped, leaving the earlier frame's
+ blocks in outputBuffer and the chunk reported as unchanged. Only the most recent frame decoded to a buffer is
+ remembered, and the first frame decoded to a buffer is decoded whole. outputBuffer must not be changed by anything else
+ between calls.
+ context must not be NULL.
+ dirtyChunks has an entry for each of the texture's chunkCount chunks, which is set to 1 if the chunk was decoded or 0
+ if it was skipped. Use HapGetTextureChunkExtents() to find which bytes of the texture each chunk covers, so that only
+ the parts which changed need be uploaded.
+ The remaining arguments are as for HapDecodeWithFrameInfo().
+ */
+unsigned int HapDecodeChangedChunks(HapDecoderContext *context,
+                                    const HapFrameInfo *frameInfo,
+                                    unsigned int index,
+                                    HapDecodeCallback callback, void *info,
+                                    void *outputBuffer, unsigned long outputBufferBytes,
+                                    unsigned char *dirtyChunks);
+
+/*
+ A texture to decode with HapDecodeBatch(), and its result
+ */
+typedef struct HapDecodeBatchItem {
+    const HapFrameInfo *frameInfo;   // a frame described by HapGetFrameInfo()
+    unsigned int index;              // the index of the texture in the frame
+    void *outputBuffer;
+    unsigned long outputBufferBytes; // at least the texture's decodedBytes
+    unsigned int result;             // set to a HapResult for this texture
+} HapDecodeBatchItem;
+
+/*
+ Decodes textures from any number of frames, such as one from each stream of a video wall, with at most one call to
+ callback for them all.
+
+ The chunks of every texture are gathered into one list, which is handed out largest first so that threads finishing
+ last have little left to do. This keeps every thread busy when each frame has only one or two chunks, and costs one
+ dispatch rather than one for every frame.
+ items is an array of count textures to decode. Each item's result is set, and an item which can't be decoded doesn't
+ stop the others. Returns the first result of an item which wasn't HapResult_No_Error, or HapResult_No_Error.
+ The remaining arguments are as for HapDecodeWithContext().
+ */
+unsigned int HapDecodeBatch(HapDecoderContext *context,
+                            HapDecodeBatchItem *items, unsigned int count,
+                            HapDecodeCallback callback, void *info);
+
+/*
+ A decode request holds a texture being decoded asynchronously by HapDecodeAsync(), and its storage, which is reused when
+ the request is used again for another texture once it is done.
+ */
+typedef struct HapDecodeRequest HapDecodeRequest;
+
+/*
+ Called when an asynchronous decode is done, with the p given to HapDecodeAsync() and a HapResult for the whole texture.
+ */
+typedef void (*HapDecodeCompletion)(void *p, unsigned int result);
+
+/*
+ Returns a new decode request, or NULL on error.
+ */
+HapDecodeRequest *HapCreateDecodeRequest(void);
+
+/*
+ Frees a decode request, which must not have a decode in progress.
+ */
+void HapDestroyDecodeRequest(HapDecodeRequest *request);
+
+/*
+ Starts decoding the texture at index in a frame described by HapGetFrameInfo(), and returns without waiting for it to be
+ decoded, so that one thread can keep several frames or streams in flight.
+
+ callback is called once for every texture, including one which is not chunked, in the same way as it is for
+ HapDecode(), except that it may return before the work has been completed, having handed it to other threads. A
+ callback which waits for its work, such as HapThreadPoolCallback(), makes this return only once the texture has been
+ decoded; use HapThreadPoolAsyncCallback() to decode on a thread pool without waiting. The thread which decodes the last
+ chunk marks request done and then calls completion, if it is not NULL, with p. Once a request is done it may be used
+ again or destroyed, including by completion, and its results read. A request may only have one decode in progress. The
+ frame described by frameInfo and outputBuffer must remain valid until the request is done.
+ If this returns an error, nothing was started and completion is not called.
+ The remaining arguments are as for HapDecodeWithFrameInfo().
+ */
+unsigned int HapDecodeAsync(HapDecodeRequest *request,
+                            const HapFrameInfo *frameInfo,
+                            unsigned int index,
+                            HapDecodeCallback callback, void *info,
+                            void *outputBuffer, unsigned long outputBufferBytes,
+                            HapDecodeCompletion completion, void *p);
+
+/*
+ Returns non-zero if request has no decode in progress, for polling instead of, or as well as, using a completion.
+ */
+int HapDecodeRequestDone(const HapDecodeRequest *request);
+
+/*
+ Returns the HapResult of the last decode of request, which must be done, or HapResult_Bad_Arguments if it is not.
+ chunkResults may be NULL, or have an entry for each of the texture's chunkCount chunks to receive the HapResult of each.
+ */
+unsigned int HapGetDecodeRequestResult(const HapDecodeRequest *request, unsigned int *chunkResults);
+
+/*
+ A stream decoder decodes a texture while its frame is still arriving, such as from network storage, decoding each chunk
+ as soon as all of it has arrived rather than waiting for the whole frame. Its storage is reused for each texture.
+ */
+typedef struct HapStreamDecoder HapStreamDecoder;
+
+/*
+ Returns a new stream decoder, or NULL on error.
+ */
+HapStreamDecoder *HapCreateStreamDecoder(void);
+
+/*
+ Frees a stream decoder, which must not have a decode in progress.
+ */
+void HapDestroyStreamDecoder(HapStreamDecoder *decoder);
+
+/*
+ Starts decoding the texture at index in a frame which is being received into inputBuffer, in order from its start.
+ inputBufferBytes is the length of the whole frame, as given by its container, though none of it need have arrived yet.
+ Report its arrival with HapStreamBytesReceived(), and end it with HapEndStreamDecode(), which every decode must be.
+ outputBufferBytes must be at least the texture's decoded length, which is only known once the whole frame has arrived,
+ so is usually worked out from the dimensions of the image.
+ Once the decode has been ended and every chunk handed to callback has been decoded, the thread which decoded the last
+ one, or the one ending it if none is still being decoded, marks decoder done and then calls completion, if it is not
+ NULL, with p and the result of the whole decode. Once decoder is done it may be used again or destroyed, including by
+ completion. A decoder may only have one decode in progress. inputBuffer and outputBuffer must remain valid until
+ decoder is done.
+ If this returns an error, nothing was started and completion is not called.
+ callback and info are as for HapDecodeAsync().
+ */
+unsigned int HapBeginStreamDecode(HapStreamDecoder *decoder,
+                                  const void *inputBuffer, unsigned long inputBufferBytes,
+                                  unsigned int index,
+                                  HapDecodeCallback callback, void *info,
+                                  void *outputBuffer, unsigned long outputBufferBytes,
+                                  HapDecodeCompletion completion, void *p);
+
+/*
+ Tells decoder that the first receivedBytes bytes of its frame have arrived, which may not be fewer than at the last call.
+ Once the frame's headers and the texture's decode instructions have arrived, every chunk which has now arrived whole is
+ handed to callback, even if there is only one, as it is by HapDecodeAsync(). callback may return before decoding them,
+ having handed them to other threads, so the receiving thread isn't held up; with a callback which waits for its work,
+ such as HapThreadPoolCallback(), they are decoded before this returns. A chunk can only be decoded once the start of
+ every chunk before it in the texture has arrived, which tells where in outputBuffer it goes.
+ Returns the first error encountered in the frame, after which nothing more is decoded. An error decoding a chunk is only
+ returned once no chunk is still being decoded, so may instead only be passed to completion.
+ */
+unsigned int HapStreamBytesReceived(HapStreamDecoder *decoder, unsigned long receivedBytes);
+
+/*
+ Ends decoding with decoder, without waiting for any chunks still being decoded by other threads.
+ Returns HapResult_Bad_Arguments if the whole frame has not arrived, in which case the decode is abandoned once the chunks
+ already handed to callback have been decoded, or otherwise any error known so far, with outputBufferBytesUsed and
+ outputBufferTextureFormat set as they are by HapDecode() if there is none. If every chunk has already been decoded,
+ completion is called before this returns, and this returns the result of the whole decode.
+ */
+unsigned int HapEndStreamDecode(HapStreamDecoder *decoder,
+                                unsigned long *outputBufferBytesUsed,
+                                unsigned int *outputBufferTextureFormat);
+
+/*
+ Returns non-zero if decoder has no decode in progress, for polling instead of, or as well as, using a completion.
+ */
+int HapStreamDecodeDone(const HapStreamDecoder *decoder);
+
+/*
+ Returns the HapResult of the last decode with decoder, which must be done, or HapResult_Bad_Arguments if it is not.
+ */
+unsigned int HapGetStreamDecodeResult(const HapStreamDecoder *decoder);
+
+/*
+ Fills chunkOffsets and chunkLengths, which have an entry for each of texture's chunkCount chunks, with the position and
+ length in bytes of each chunk in the decoded texture.
+ */
+unsigned int HapGetTextureChunkExtents(const HapTextureInfo *texture, unsigned long *chunkOffsets, unsigned long *chunkLengths);
+
+/*
+ Part of a decoded texture. data points into the frame for a part which is stored uncompressed, or is NULL for a part
+ which must be decompressed.
+ */
+typedef struct HapTextureSpan {
+    const void *data;
+    unsigned long offset; // the position of the part in the decoded texture in bytes
+    unsigned long length; // the length of the part in bytes
+} HapTextureSpan;
+
+/*
+ Describes the texture at index in a frame described by HapGetFrameInfo() as spans, so that the parts stored uncompressed
+ can be used from the frame without being copied, such as by uploading them straight from a memory-mapped file.
+
+ An uncompressed texture is one span. For a chunked texture, neighbouring chunks which are both compressed, or both
+ uncompressed and next to each other in the frame, share a span. Spans are in the order they appear in the texture, and
+ together cover it. spans must have room for the texture's chunkCount spans, and spanCount is set to the number written.
+ Decode the compressed spans with HapDecodeCompressedChunks().
+ The spans point into the frame, which must remain valid while they are used.
+ */
+unsigned int HapGetTextureSpans(const HapFrameInfo *frameInfo, unsigned int index,
+                                HapTextureSpan *spans, unsigned int *spanCount);
+
+/*
+ Decodes only the chunks of the texture at index in a frame described by HapGetFrameInfo() which are compressed, to the
+ places they would take in the whole texture in outputBuffer. The parts of outputBuffer for uncompressed chunks are left
+ untouched.
+ The remaining arguments are as for HapDecodeWithFrameInfo().
+ */
+unsigned int HapDecodeCompressedChunks(HapDecoderContext *context,
+                                       const HapFrameInfo *frameInfo,
+                                       unsigned int index,
+                                       HapDecodeCallback callback, void *info,
+                                       void *outputBuffer, unsigned long outputBufferBytes);
+
+/*
+ Decodes part of the texture at index in a frame described by HapGetFrameInfo(), only decompressing the chunks needed.
+
+ A block row is a row of 4x4 blocks, covering four rows of pixels. width is the width of the texture in pixels, which
+ is not stored in the frame. blockRowCount block rows starting at firstBlockRow are decoded, and written to outputBuffer
+ as they would appear in the whole texture. outputBufferBytes must be at least the length of those rows.
+ The remaining arguments are as for HapDecodeWithContext().
+ */
+unsigned int HapDecodeRows(HapDecoderContext *context,
+                           const HapFrameInfo *frameInfo,
+                           unsigned int index,
+                           unsigned int width,
+                           unsigned int firstBlockRow, unsigned int blockRowCount,
+                           HapDecodeCallback callback, void *info,
+                           void *outputBuffer, unsigned long outputBufferBytes);
+
+/*
+ Decodes the texture at index in a frame described by HapGetFrameInfo() with its block rows a given distance apart, so
+ that it can be decoded straight into a staging buffer with its own row pitch and alignment.
+
+ A block row is a row of 4x4 blocks, covering four rows of pixels. width is the width of the texture in pixels, which
+ is not stored in the frame, and the texture must be a whole number of block rows of that width. outputBytesPerBlockRow
+ is the distance in bytes between the start of each block row in outputBuffer, and must be at least the length of a
+ block row. The bytes between the end of one block row and the start of the next are left untouched. outputBufferBytes
+ must be at least outputBytesPerBlockRow times one less than the number of block rows, plus the length of a block row.
+ Where block rows are packed, with outputBytesPerBlockRow the length of a block row, the texture is decompressed in
+ place, unless options include HapDecodeOption_NonTemporalStores. Otherwise a chunk which lies within one block row is
+ decompressed straight to its place in outputBuffer, while one which spans block rows is decompressed to scratch space in
+ context and copied to its block rows by the same thread, as HapDecodeChunks() does, so that copy remains for those
+ chunks. Uncompressed chunks are copied straight from the frame.
+ options is zero or more HapDecodeOptions combined with bitwise OR:
+  HapDecodeOption_NonTemporalStores writes the output with stores which bypass the processor's caches where the
+  processor has them. This suits textures larger than the last-level cache which are not read again by the processor,
+  such as those decoded to memory which is then uploaded to a GPU, and is slower for smaller textures. Every compressed
+  chunk is then decompressed to scratch space and copied.
+ The remaining arguments are as for HapDecodeWithFrameInfo().
+ */
+unsigned int HapDecodeWithPitch(HapDecoderContext *context,
+                                const HapFrameInfo *frameInfo,
+                                unsigned int index,
+                                unsigned int width,
+                                unsigned int options,
+                                HapDecodeCallback callback, void *info,
+                                void *outputBuffer, unsigned long outputBytesPerBlockRow, unsigned long outputBufferBytes);
+
+/*
+ Receives part of a decoded texture from HapDecodeChunks(). data holds length bytes of the texture starting offset bytes
+ from its beginning, and is only valid until the function returns.
+ */
+typedef void (*HapDecodeChunkFunction)(void *p, const void *data, unsigned long offset, unsigned long length);
+
+/*
+ Decodes the texture at index in a frame described by HapGetFrameInfo() without writing the whole texture to memory,
+ passing each chunk to function as soon as it has been decompressed, on the thread which decompressed it.
+
+ Every part of the texture is passed to function once, in parts which begin on block boundaries, in no particular order.
+ Compressed chunks are decompressed to scratch space in context which is reused by other chunks, so that function reads
+ them from cache. This works best when chunks are small enough to fit in the processor's cache. Uncompressed chunks are
+ passed to function from the frame itself.
+ p is an argument for your own use to pass context to function.
+ The remaining arguments are as for HapDecodeWithContext().
+ */
+unsigned int HapDecodeChunks(HapDecoderContext *context,
+                             const HapFrameInfo *frameInfo,
+                             unsigned int index,
+                             HapDecodeChunkFunction function, void *p,
+                             HapDecodeCallback callback, void *info);
+
+/*
+ Decodes the texture at index in a frame described by HapGetFrameInfo() as HapDecodeChunks() does, for frames whose
+ textures are combined to make one image, such as the colour and alpha textures of a Hap Q Alpha frame.
+
+ The texture at otherIndex is decoded whole first, to storage in context, and otherTexture is set to point to it before
+ function is first called, so that function can combine each part it is passed with the same blocks of the other
+ texture. An uncompressed other texture is not copied, and otherTexture points into the frame. otherTexture remains
+ valid until this function returns.
+ The remaining arguments are as for HapDecodeChunks().
+ */
+unsigned int HapDecodeChunksWithTexture(HapDecoderContext *context,
+                                        const HapFrameInfo *frameInfo,
+                                        unsigned int index,
+                                        unsigned int otherIndex, const void **otherTexture,
+                                        HapDecodeChunkFunction function, void *p,
+                                        HapDecodeCallback callback, void *info);
+
 /*
  If this returns HapResult_No_Error then outputTextureCount is set to the count of textures in the frame.
  */
@@ -0,0 +1,3505 @@
+/*
+ hap_pixels.c
+ 
+ Copyright (c) 2011-2013, Tom Butterworth and Vidvox LLC. All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "hap_pixels.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ SSE2 kernels are used wherever the compiler targets SSE2. AVX2 kernels are chosen at run time where the compiler lets
+ single functions target it.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAP_PIXELS_SSE2 1
+#include <emmintrin.h>
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define HAP_PIXELS_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+typedef struct HapPixelsJob HapPixelsJob;
+
+/*
+ Decodes one 4x4 block, or for a pair function two consecutive blocks of a block row, to dst where rows of pixels are
+ bytes_per_row apart
+ */
+typedef void (*HapPixelsBlockFunction)(const HapPixelsJob *job, const unsigned char *block, unsigned char *dst, size_t bytes_per_row);
+
+/*
+ Decodes one YCoCg block as a HapPixelsBlockFunction does, with merged_alpha the RGTC1 block giving the pixels' alpha, for
+ a texture decoded with its alpha texture, or NULL
+ */
+typedef void (*HapPixelsYCoCgBlockFunction)(const HapPixelsJob *job, const unsigned char *block, const unsigned char *merged_alpha,
+                                            unsigned char *dst, size_t bytes_per_row);
+
+struct HapPixelsJob {
+    unsigned int texture_format;
+    unsigned int bgra;
+    unsigned int bytes_per_pixel;
+    unsigned int width;
+    unsigned int height;
+    unsigned int blocks_per_row;
+    unsigned int block_rows;
+    unsigned int block_bytes;
+    HapPixelsBlockFunction decode_block; // NULL for a YCoCg texture
+    HapPixelsBlockFunction decode_pair; // May be NULL
+    HapPixelsYCoCgBlockFunction decode_ycocg_block; // Used instead of decode_block for a YCoCg texture
+    const void *alpha_texture; // An RGTC1 texture merged with a YCoCg texture, or NULL
+    unsigned char *output;
+    size_t output_bytes_per_row;
+};
+
+// Finds the colour and alpha parts of a block, either of which may be absent
+static void hap_pixels_block_layout(unsigned int texture_format, const unsigned char *block,
+                                    const unsigned char **colour_block, const unsigned char **alpha_block)
+{
+    switch (texture_format) {
+        case HapTextureFormat_RGB_DXT1:
+            *colour_block = block;
+            *alpha_block = NULL;
+            break;
+        case HapTextureFormat_RGBA_DXT5:
+            *colour_block = block + 8;
+            *alpha_block = block;
+            break;
+        default: // HapTextureFormat_A_RGTC1
+            *colour_block = NULL;
+            *alpha_block = block;
+            break;
+    }
+}
+
+// Expands a 5:6:5 colour to a pixel
+static void hap_pixels_expand_565(unsigned int colour, unsigned int bgra, unsigned char *pixel)
+{
+    unsigned int r = (colour >> 11) & 0x1F;
+    unsigned int g = (colour >> 5) & 0x3F;
+    unsigned int b = colour & 0x1F;
+    pixel[bgra ? 2 : 0] = (unsigned char)((r << 3) | (r >> 2));
+    pixel[1] = (unsigned char)((g << 2) | (g >> 4));
+    pixel[bgra ? 0 : 2] = (unsigned char)((b << 3) | (b >> 2));
+    pixel[3] = 255;
+}
+
+/*
+ Fills palette with the four opaque pixels a colour block's indices refer to. DXT1 blocks whose first colour is not
+ greater than their second have three colours and black, but the colour part of a DXT5 block always has four colours.
+ */
+static void hap_pixels_colour_palette(const unsigned char *colour_block, int three_colours_allowed, unsigned int bgra, unsigned char palette[16])
+{
+    unsigned int c0 = colour_block[0] | (colour_block[1] << 8);
+    unsigned int c1 = colour_block[2] | (colour_block[3] << 8);
+    int i;
+
+    hap_pixels_expand_565(c0, bgra, palette);
+    hap_pixels_expand_565(c1, bgra, palette + 4);
+    for (i = 0; i < 3; i++)
+    {
+        if (c0 > c1 || !three_colours_allowed)
+        {
+            palette[8 + i] = (unsigned char)((2 * palette[i] + palette[4 + i]) / 3);
+            palette[12 + i] = (unsigned char)((palette[i] + 2 * palette[4 + i]) / 3);
+        }
+        else
+        {
+            palette[8 + i] = (unsigned char)((palette[i] + palette[4 + i]) / 2);
+            palette[12 + i] = 0;
+        }
+    }
+    palette[11] = 255;
+    palette[15] = 255;
+}
+
+// Fills palette with the eight values a DXT5 alpha or RGTC1 block's indices refer to
+static void hap_pixels_alpha_palette(const unsigned char *alpha_block, unsigned char palette[8])
+{
+    unsigned int a0 = alpha_block[0];
+    unsigned int a1 = alpha_block[1];
+    unsigned int i;
+
+    palette[0] = (unsigned char)a0;
+    palette[1] = (unsigned char)a1;
+    if (a0 > a1)
+    {
+        for (i = 1; i < 7; i++)
+        {
+            palette[i + 1] = (unsigned char)(((7 - i) * a0 + i * a1) / 7);
+        }
+    }
+    else
+    {
+        for (i = 1; i < 5; i++)
+        {
+            palette[i + 1] = (unsigned char)(((5 - i) * a0 + i * a1) / 5);
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+// Returns the sixteen three-bit indices of a DXT5 alpha or RGTC1 block, with the first pixel's in the lowest bits
+static uint64_t hap_pixels_alpha_indices(const unsigned char *alpha_block)
+{
+    uint64_t indices = 0;
+    int i;
+    for (i = 7; i >= 2; i--)
+    {
+        indices = (indices << 8) | alpha_block[i];
+    }
+    return indices;
+}
+
+static void hap_pixels_alpha_values(const unsigned char *alpha_block, unsigned char values[16])
+{
+    unsigned char palette[8];
+    uint64_t indices = hap_pixels_alpha_indices(alpha_block);
+    int i;
+
+    hap_pixels_alpha_palette(alpha_block, palette);
+    for (i = 0; i < 16; i++)
+    {
+        values[i] = palette[(indices >> (3 * i)) & 7];
+    }
+}
+
+static void hap_pixels_decode_block_scalar(const HapPixelsJob *job, const unsigned char *block, unsigned char *dst, size_t bytes_per_row)
+{
+    const unsigned char *colour_block;
+    const unsigned char *alpha_block;
+    unsigned char palette[16];
+    unsigned char alpha[16];
+    int x, y;
+
+    hap_pixels_block_layout(job->texture_format, block, &colour_block, &alpha_block);
+    if (colour_block)
+    {
+        hap_pixels_colour_palette(colour_block, job->texture_format == HapTextureFormat_RGB_DXT1, job->bgra, palette);
+    }
+    else
+    {
+        memset(palette, 255, sizeof(palette));
+    }
+    if (alpha_block)
+    {
+        hap_pixels_alpha_values(alpha_block, alpha);
+    }
+    for (y = 0; y < 4; y++)
+    {
+        unsigned char *pixel = dst + y * bytes_per_row;
+        for (x = 0; x < 4; x++, pixel += 4)
+        {
+            unsigned int index = colour_block ? (colour_block[4 + y] >> (2 * x)) & 3 : 0;
+            memcpy(pixel, palette + index * 4, 4);
+            if (alpha_block)
+            {
+                pixel[3] = alpha[y * 4 + x];
+            }
+        }
+    }
+}
+
+
+/*
+ A YCoCg texture stores Co in the red of its colour blocks, Cg in the green, the scale they were multiplied by in the blue,
+ and Y in the alpha. Red, green and blue are Y plus amounts which depend only on Co, Cg and the scale, so each colour in a
+ block's palette gives the same amounts to every pixel which uses it.
+ */
+
+// Divides and rounds to the nearest integer, for a positive denominator
+static int hap_pixels_round_divide(int numerator, int denominator)
+{
+    int doubled = 2 * numerator + denominator;
+    int quotient = doubled / (2 * denominator);
+    // Division truncates towards zero, but rounding needs the floor
+    if (doubled < 0 && quotient * 2 * denominator != doubled)
+    {
+        quotient--;
+    }
+    return quotient;
+}
+
+/*
+ Fills offsets with the amounts to add to Y for the red, green and blue of each colour in the palette of a YCoCg block's
+ colour part, in the order of the output pixels, and 0 for their alpha
+ */
+static void hap_pixels_ycocg_offsets(const unsigned char *colour_block, unsigned int bgra, int16_t offsets[16])
+{
+    unsigned char palette[16];
+    int i;
+
+    hap_pixels_colour_palette(colour_block, 0, 0, palette);
+    for (i = 0; i < 4; i++)
+    {
+        /*
+         Co and Cg are stored offset by 128, and the scale as 8 times one less than itself. Multiplying Co and Cg by 8 too
+         leaves one division.
+         */
+        int divisor = palette[i * 4 + 2] + 8;
+        int co = (palette[i * 4] - 128) * 8;
+        int cg = (palette[i * 4 + 1] - 128) * 8;
+        offsets[i * 4 + (bgra ? 2 : 0)] = (int16_t)hap_pixels_round_divide(co - cg, divisor);
+        offsets[i * 4 + 1] = (int16_t)hap_pixels_round_divide(cg, divisor);
+        offsets[i * 4 + (bgra ? 0 : 2)] = (int16_t)hap_pixels_round_divide(-co - cg, divisor);
+        offsets[i * 4 + 3] = 0;
+    }
+}
+
+static void hap_pixels_decode_ycocg_block_scalar(const HapPixelsJob *job, const unsigned char *block, const unsigned char *merged_alpha,
+                                                 unsigned char *dst, size_t bytes_per_row)
+{
+    int16_t offsets[16];
+    unsigned char luma[16];
+    unsigned char alpha[16];
+    int x, y, c;
+
+    hap_pixels_ycocg_offsets(block + 8, job->bgra, offsets);
+    hap_pixels_alpha_values(block, luma);
+    if (merged_alpha)
+    {
+        hap_pixels_alpha_values(merged_alpha, alpha);
+    }
+    else
+    {
+        memset(alpha, 255, sizeof(alpha));
+    }
+    for (y = 0; y < 4; y++)
+    {
+        unsigned char *pixel = dst + y * bytes_per_row;
+        for (x = 0; x < 4; x++, pixel += 4)
+        {
+            unsigned int index = (block[12 + y] >> (2 * x)) & 3;
+            for (c = 0; c < 3; c++)
+            {
+                int value = luma[y * 4 + x] + offsets[index * 4 + c];
+                pixel[c] = (unsigned char)(value < 0 ? 0 : value > 255 ? 255 : value);
+            }
+            pixel[3] = alpha[y * 4 + x];
+        }
+    }
+}
+
+#if defined(HAP_PIXELS_SSE2)
+
+static void hap_pixels_decode_block_sse2(const HapPixelsJob *job, const unsigned char *block, unsigned char *dst, size_t bytes_per_row)
+{
+    const unsigned char *colour_block;
+    const unsigned char *alpha_block;
+    unsigned char palette[16];
+    unsigned char alpha[16];
+    __m128i colours, c0, c1, c2, c3;
+    int y;
+
+    hap_pixels_block_layout(job->texture_format, block, &colour_block, &alpha_block);
+    if (colour_block)
+    {
+        hap_pixels_colour_palette(colour_block, job->texture_format == HapTextureFormat_RGB_DXT1, job->bgra, palette);
+    }
+    else
+    {
+        memset(palette, 255, sizeof(palette));
+    }
+    if (alpha_block)
+    {
+        hap_pixels_alpha_values(alpha_block, alpha);
+    }
+    colours = _mm_loadu_si128((const __m128i *)palette);
+    c0 = _mm_shuffle_epi32(colours, 0x00);
+    c1 = _mm_shuffle_epi32(colours, 0x55);
+    c2 = _mm_shuffle_epi32(colours, 0xAA);
+    c3 = _mm_shuffle_epi32(colours, 0xFF);
+
+    for (y = 0; y < 4; y++)
+    {
+        __m128i pixels = c0;
+        if (colour_block)
+        {
+            /*
+             Multiplying moves each pixel's two-bit index to bits 6 and 7 of its lane, and each index then selects
+             one of the colours
+             */
+            __m128i indices = _mm_mullo_epi16(_mm_set1_epi32(colour_block[4 + y]), _mm_set_epi32(1, 4, 16, 64));
+            indices = _mm_and_si128(_mm_srli_epi32(indices, 6), _mm_set1_epi32(3));
+            pixels = _mm_and_si128(_mm_cmpeq_epi32(indices, _mm_setzero_si128()), c0);
+            pixels = _mm_or_si128(pixels, _mm_and_si128(_mm_cmpeq_epi32(indices, _mm_set1_epi32(1)), c1));
+            pixels = _mm_or_si128(pixels, _mm_and_si128(_mm_cmpeq_epi32(indices, _mm_set1_epi32(2)), c2));
+            pixels = _mm_or_si128(pixels, _mm_and_si128(_mm_cmpeq_epi32(indices, _mm_set1_epi32(3)), c3));
+        }
+        if (alpha_block)
+        {
+            // Move the row's four alpha values to the top byte of each lane
+            int32_t row_alpha;
+            __m128i values;
+            memcpy(&row_alpha, alpha + y * 4, 4);
+            values = _mm_unpacklo_epi8(_mm_setzero_si128(), _mm_cvtsi32_si128(row_alpha));
+            values = _mm_unpacklo_epi16(_mm_setzero_si128(), values);
+            pixels = _mm_or_si128(_mm_and_si128(pixels, _mm_set1_epi32(0x00FFFFFF)), values);
+        }
+        _mm_storeu_si128((__m128i *)(dst + y * bytes_per_row), pixels);
+    }
+}
+
+/*
+ Each register holds two pixels as sixteen-bit values, so that Y plus the colour's amounts can be saturated to bytes when
+ the two halves of a row are packed together
+ */
+static void hap_pixels_decode_ycocg_block_sse2(const HapPixelsJob *job, const unsigned char *block, const unsigned char *merged_alpha,
+                                               unsigned char *dst, size_t bytes_per_row)
+{
+    int16_t offsets[16];
+    unsigned char luma[16];
+    unsigned char alpha[16];
+    __m128i o0, o1, o2, o3;
+    int y;
+
+    hap_pixels_ycocg_offsets(block + 8, job->bgra, offsets);
+    hap_pixels_alpha_values(block, luma);
+    if (merged_alpha)
+    {
+        hap_pixels_alpha_values(merged_alpha, alpha);
+    }
+    else
+    {
+        memset(alpha, 255, sizeof(alpha));
+    }
+    o0 = _mm_loadl_epi64((const __m128i *)offsets);
+    o1 = _mm_loadl_epi64((const __m128i *)(offsets + 4));
+    o2 = _mm_loadl_epi64((const __m128i *)(offsets + 8));
+    o3 = _mm_loadl_epi64((const __m128i *)(offsets + 12));
+    o0 = _mm_unpacklo_epi64(o0, o0);
+    o1 = _mm_unpacklo_epi64(o1, o1);
+    o2 = _mm_unpacklo_epi64(o2, o2);
+    o3 = _mm_unpacklo_epi64(o3, o3);
+
+    for (y = 0; y < 4; y++)
+    {
+        __m128i halves[2];
+        __m128i values, pixels;
+        int32_t row_luma, row_alpha;
+        int half;
+
+        // Y for each channel of each pixel
+        memcpy(&row_luma, luma + y * 4, 4);
+        values = _mm_unpacklo_epi8(_mm_cvtsi32_si128(row_luma), _mm_setzero_si128());
+        values = _mm_unpacklo_epi16(values, values);
+        halves[0] = _mm_unpacklo_epi32(values, values);
+        halves[1] = _mm_unpackhi_epi32(values, values);
+
+        for (half = 0; half < 2; half++)
+        {
+            /*
+             Multiplying moves each pixel's two-bit index to bits 6 and 7 of the lanes for its channels, and each index
+             then selects the amounts for one of the colours
+             */
+            __m128i indices = _mm_mullo_epi16(_mm_set1_epi16(block[12 + y]),
+                                              half ? _mm_set_epi16(1, 1, 1, 1, 4, 4, 4, 4) : _mm_set_epi16(16, 16, 16, 16, 64, 64, 64, 64));
+            __m128i amounts;
+            indices = _mm_and_si128(_mm_srli_epi16(indices, 6), _mm_set1_epi16(3));
+            amounts = _mm_and_si128(_mm_cmpeq_epi16(indices, _mm_setzero_si128()), o0);
+            amounts = _mm_or_si128(amounts, _mm_and_si128(_mm_cmpeq_epi16(indices, _mm_set1_epi16(1)), o1));
+            amounts = _mm_or_si128(amounts, _mm_and_si128(_mm_cmpeq_epi16(indices, _mm_set1_epi16(2)), o2));
+            amounts = _mm_or_si128(amounts, _mm_and_si128(_mm_cmpeq_epi16(indices, _mm_set1_epi16(3)), o3));
+            halves[half] = _mm_add_epi16(halves[half], amounts);
+        }
+        pixels = _mm_packus_epi16(halves[0], halves[1]);
+
+        // Move the row's four alpha values to the top byte of each lane
+        memcpy(&row_alpha, alpha + y * 4, 4);
+        values = _mm_unpacklo_epi8(_mm_setzero_si128(), _mm_cvtsi32_si128(row_alpha));
+        values = _mm_unpacklo_epi16(_mm_setzero_si128(), values);
+        pixels = _mm_or_si128(_mm_and_si128(pixels, _mm_set1_epi32(0x00FFFFFF)), values);
+        _mm_storeu_si128((__m128i *)(dst + y * bytes_per_row), pixels);
+    }
+}
+
+#endif
+
+#if defined(HAP_PIXELS_AVX2)
+
+/*
+ Each row of a pair of blocks is eight pixels, which fill one register with the first block's pixels in the lower half
+ */
+__attribute__((target("avx2")))
+static void hap_pixels_decode_pair_avx2(const HapPixelsJob *job, const unsigned char *block, unsigned char *dst, size_t bytes_per_row)
+{
+    const unsigned char *colour_blocks[2];
+    const unsigned char *alpha_blocks[2];
+    unsigned char palettes[32];
+    unsigned char alpha_palettes[2][8];
+    uint64_t alpha_indices[2] = { 0, 0 };
+    __m256i colours, alpha0 = _mm256_setzero_si256(), alpha1 = _mm256_setzero_si256();
+    int i, y;
+
+    for (i = 0; i < 2; i++)
+    {
+        hap_pixels_block_layout(job->texture_format, block + i * job->block_bytes, &colour_blocks[i], &alpha_blocks[i]);
+        if (colour_blocks[i])
+        {
+            hap_pixels_colour_palette(colour_blocks[i], job->texture_format == HapTextureFormat_RGB_DXT1, job->bgra, palettes + i * 16);
+        }
+        else
+        {
+            memset(palettes + i * 16, 255, 16);
+        }
+        if (alpha_blocks[i])
+        {
+            hap_pixels_alpha_palette(alpha_blocks[i], alpha_palettes[i]);
+            alpha_indices[i] = hap_pixels_alpha_indices(alpha_blocks[i]);
+        }
+    }
+    colours = _mm256_loadu_si256((const __m256i *)palettes);
+    if (alpha_blocks[0])
+    {
+        alpha0 = _mm256_slli_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)alpha_palettes[0])), 24);
+        alpha1 = _mm256_slli_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)alpha_palettes[1])), 24);
+    }
+
+    for (y = 0; y < 4; y++)
+    {
+        __m256i pixels = colours;
+        if (colour_blocks[0])
+        {
+            // The second block's colours follow the first's
+            __m256i indices = _mm256_setr_epi32(colour_blocks[0][4 + y], colour_blocks[0][4 + y], colour_blocks[0][4 + y], colour_blocks[0][4 + y],
+                                                colour_blocks[1][4 + y], colour_blocks[1][4 + y], colour_blocks[1][4 + y], colour_blocks[1][4 + y]);
+            indices = _mm256_and_si256(_mm256_srlv_epi32(indices, _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6)), _mm256_set1_epi32(3));
+            indices = _mm256_add_epi32(indices, _mm256_setr_epi32(0, 0, 0, 0, 4, 4, 4, 4));
+            pixels = _mm256_permutevar8x32_epi32(colours, indices);
+        }
+        if (alpha_blocks[0])
+        {
+            int first = (int)((alpha_indices[0] >> (12 * y)) & 0xFFF);
+            int second = (int)((alpha_indices[1] >> (12 * y)) & 0xFFF);
+            __m256i indices = _mm256_setr_epi32(first, first, first, first, second, second, second, second);
+            __m256i values;
+            indices = _mm256_and_si256(_mm256_srlv_epi32(indices, _mm256_setr_epi32(0, 3, 6, 9, 0, 3, 6, 9)), _mm256_set1_epi32(7));
+            values = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(alpha0, indices),
+                                        _mm256_permutevar8x32_epi32(alpha1, indices),
+                                        0xF0);
+            pixels = _mm256_or_si256(_mm256_and_si256(pixels, _mm256_set1_epi32(0x00FFFFFF)), values);
+        }
+        _mm256_storeu_si256((__m256i *)(dst + y * bytes_per_row), pixels);
+    }
+}
+
+#endif
+
+/*
+ BPTC
+
+ BC7 and BC6H blocks are a stream of bits, read from the lowest bit of the first byte. Both divide a block into subsets
+ of pixels using the same table of partitions, and interpolate between the ends of a line for each subset using the same
+ weights.
+ */
+typedef struct HapPixelsBits {
+    uint64_t low;
+    uint64_t high;
+    unsigned int position;
+} HapPixelsBits;
+
+static void hap_pixels_bits_init(HapPixelsBits *bits, const unsigned char *block)
+{
+    int i;
+    bits->low = 0;
+    bits->high = 0;
+    bits->position = 0;
+    for (i = 7; i >= 0; i--)
+    {
+        bits->low = (bits->low << 8) | block[i];
+        bits->high = (bits->high << 8) | block[8 + i];
+    }
+}
+
+// Reads count bits, where count is at most 32
+static unsigned int hap_pixels_read_bits(HapPixelsBits *bits, unsigned int count)
+{
+    unsigned int position = bits->position;
+    uint64_t value;
+    if (position >= 64)
+    {
+        value = bits->high >> (position - 64);
+    }
+    else if (position == 0)
+    {
+        value = bits->low;
+    }
+    else
+    {
+        value = (bits->low >> position) | (bits->high << (64 - position));
+    }
+    bits->position += count;
+    return (unsigned int)(value & (((uint64_t)1 << count) - 1));
+}
+
+// Each two-subset partition is a mask of the pixels in the second subset
+static const uint16_t hap_pixels_bptc_partitions2[64] = {
+    0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80,
+    0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+    0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE,
+    0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+    0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A,
+    0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+    0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C,
+    0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22
+};
+
+// Three-subset partitions have two bits for each pixel giving its subset
+static const uint32_t hap_pixels_bptc_partitions3[64] = {
+    0xAA685050, 0x6A5A5040, 0x5A5A4200, 0x5450A0A8, 0xA5A50000, 0xA0A05050,
+    0x5555A0A0, 0x5A5A5050, 0xAA550000, 0xAA555500, 0xAAAA5500, 0x90909090,
+    0x94949494, 0xA4A4A4A4, 0xA9A59450, 0x2A0A4250, 0xA5945040, 0x0A425054,
+    0xA5A5A500, 0x55A0A0A0, 0xA8A85454, 0x6A6A4040, 0xA4A45000, 0x1A1A0500,
+    0x0050A4A4, 0xAAA59090, 0x14696914, 0x69691400, 0xA08585A0, 0xAA821414,
+    0x50A4A450, 0x6A5A0200, 0xA9A58000, 0x5090A0A8, 0xA8A09050, 0x24242424,
+    0x00AA5500, 0x24924924, 0x24499224, 0x50A50A50, 0x500AA550, 0xAAAA4444,
+    0x66660000, 0xA5A0A5A0, 0x50A050A0, 0x69286928, 0x44AAAA44, 0x66666600,
+    0xAA444444, 0x54A854A8, 0x95809580, 0x96969600, 0xA85454A8, 0x80959580,
+    0xAA141414, 0x96960000, 0xAAAA1414, 0xA05050A0, 0xA0A5A5A0, 0x96000000,
+    0x40804080, 0xA9A8A9A8, 0xAAAAAA44, 0x2A4A5254
+};
+
+/*
+ The first pixel of each subset is its anchor, whose index is stored with one bit fewer. The anchor of the first subset
+ is always the first pixel.
+ */
+static const unsigned char hap_pixels_bptc_anchors2[64] = {
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+    15,  2,  8,  2,  2,  8,  8, 15,  2,  8,  2,  2,  8,  8,  2,  2,
+    15, 15,  6,  8,  2,  8, 15, 15,  2,  8,  2,  2,  2, 15, 15,  6,
+     6,  2,  6,  8, 15, 15,  2,  2, 15, 15, 15, 15, 15,  2,  2, 15
+};
+
+static const unsigned char hap_pixels_bptc_anchors3[2][64] = {
+    {
+         3,  3, 15, 15,  8,  3, 15, 15,  8,  8,  6,  6,  6,  5,  3,  3,
+         3,  3,  8, 15,  3,  3,  6, 10,  5,  8,  8,  6,  8,  5, 15, 15,
+         8, 15,  3,  5,  6, 10,  8, 15, 15,  3, 15,  5, 15, 15, 15, 15,
+         3, 15,  5,  5,  5,  8,  5, 10,  5, 10,  8, 13, 15, 12,  3,  3
+    },
+    {
+        15,  8,  8,  3, 15, 15,  3,  8, 15, 15, 15, 15, 15, 15, 15,  8,
+        15,  8, 15,  3, 15,  8, 15,  8,  3, 15,  6, 10, 15, 15, 10,  8,
+        15,  3, 15, 10, 10,  8,  9, 10,  6, 15,  8, 15,  3,  6,  6,  8,
+        15,  3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  3, 15, 15,  8
+    }
+};
+
+// Weights out of 64 of the second end of a line, for indices of two, three and four bits
+static const unsigned char hap_pixels_bptc_weights2[4] = { 0, 21, 43, 64 };
+static const unsigned char hap_pixels_bptc_weights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+static const unsigned char hap_pixels_bptc_weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+static const unsigned char *hap_pixels_bptc_weights(unsigned int index_bits)
+{
+    return index_bits == 2 ? hap_pixels_bptc_weights2 : index_bits == 3 ? hap_pixels_bptc_weights3 : hap_pixels_bptc_weights4;
+}
+
+static unsigned int hap_pixels_bptc_subset(unsigned int subsets, unsigned int partition, unsigned int pixel)
+{
+    if (subsets == 2)
+    {
+        return (hap_pixels_bptc_partitions2[partition] >> pixel) & 1;
+    }
+    if (subsets == 3)
+    {
+        return (hap_pixels_bptc_partitions3[partition] >> (pixel * 2)) & 3;
+    }
+    return 0;
+}
+
+static int hap_pixels_bptc_is_anchor(unsigned int subsets, unsigned int partition, unsigned int pixel)
+{
+    if (pixel == 0)
+    {
+        return 1;
+    }
+    if (subsets == 2)
+    {
+        return pixel == hap_pixels_bptc_anchors2[partition];
+    }
+    if (subsets == 3)
+    {
+        return pixel == hap_pixels_bptc_anchors3[0][partition] || pixel == hap_pixels_bptc_anchors3[1][partition];
+    }
+    return 0;
+}
+
+/*
+ BC7 has eight modes, given by the position of the lowest set bit of a block. A block of any other mode is reserved and
+ decodes to transparent black.
+ */
+typedef struct HapPixelsBC7Mode {
+    unsigned char subsets;
+    unsigned char partition_bits;
+    unsigned char rotation_bits;
+    unsigned char index_selection_bits;
+    unsigned char colour_bits;
+    unsigned char alpha_bits; // 0 for opaque modes
+    unsigned char endpoint_pbits; // A low bit shared by the channels of each end
+    unsigned char shared_pbits; // A low bit shared by both ends of each subset
+    unsigned char index_bits;
+    unsigned char secondary_index_bits; // Separate indices for alpha, or 0
+} HapPixelsBC7Mode;
+
+static const HapPixelsBC7Mode hap_pixels_bc7_modes[8] = {
+    { 3, 4, 0, 0, 4, 0, 1, 0, 3, 0 },
+    { 2, 6, 0, 0, 6, 0, 0, 1, 3, 0 },
+    { 3, 6, 0, 0, 5, 0, 0, 0, 2, 0 },
+    { 2, 6, 0, 0, 7, 0, 1, 0, 2, 0 },
+    { 1, 0, 2, 1, 5, 6, 0, 0, 2, 3 },
+    { 1, 0, 2, 0, 7, 8, 0, 0, 2, 2 },
+    { 1, 0, 0, 0, 7, 7, 1, 0, 4, 0 },
+    { 2, 6, 0, 0, 5, 5, 1, 0, 2, 0 }
+};
+
+/*
+ A BC7 block unpacked to the ends of each subset's line in the order of the output pixels, the subset of each pixel and
+ the weights of its colour and alpha. alpha_channel is the channel which uses the alpha weights, which a block's rotation
+ may exchange with one of the colour channels.
+ */
+typedef struct HapPixelsBC7Block {
+    unsigned char ends[3][2][4];
+    unsigned char subsets[16];
+    unsigned char weights[16];
+    unsigned char alpha_weights[16];
+    unsigned int alpha_channel;
+} HapPixelsBC7Block;
+
+// Returns 0 for a reserved block
+static int hap_pixels_bc7_unpack(const unsigned char *block, unsigned int bgra, HapPixelsBC7Block *unpacked)
+{
+    const HapPixelsBC7Mode *mode;
+    HapPixelsBits bits;
+    unsigned int mode_index, partition, rotation, index_selection;
+    unsigned int pbits[6] = { 0, 0, 0, 0, 0, 0 };
+    unsigned int channels, s, e, c, i;
+    unsigned char indices[16], secondary_indices[16];
+    const unsigned char *colour_indices, *alpha_indices;
+    const unsigned char *colour_weights, *alpha_weights;
+
+    for (mode_index = 0; mode_index < 8 && (block[0] & (1 << mode_index)) == 0; mode_index++)
+    {
+    }
+    if (mode_index == 8)
+    {
+        return 0;
+    }
+    mode = &hap_pixels_bc7_modes[mode_index];
+    channels = mode->alpha_bits ? 4 : 3;
+
+    hap_pixels_bits_init(&bits, block);
+    hap_pixels_read_bits(&bits, mode_index + 1);
+    partition = hap_pixels_read_bits(&bits, mode->partition_bits);
+    rotation = hap_pixels_read_bits(&bits, mode->rotation_bits);
+    index_selection = hap_pixels_read_bits(&bits, mode->index_selection_bits);
+
+    // Each channel of every end is stored in turn
+    for (c = 0; c < channels; c++)
+    {
+        for (s = 0; s < mode->subsets; s++)
+        {
+            for (e = 0; e < 2; e++)
+            {
+                unpacked->ends[s][e][c] = (unsigned char)hap_pixels_read_bits(&bits, c < 3 ? mode->colour_bits : mode->alpha_bits);
+            }
+        }
+    }
+    for (i = 0; i < mode->subsets * 2u * mode->endpoint_pbits; i++)
+    {
+        pbits[i] = hap_pixels_read_bits(&bits, 1);
+    }
+    for (i = 0; i < mode->subsets * 2u * mode->shared_pbits; i += 2)
+    {
+        pbits[i] = pbits[i + 1] = hap_pixels_read_bits(&bits, 1);
+    }
+
+    // Ends are expanded to eight bits by repeating their high bits
+    for (s = 0; s < mode->subsets; s++)
+    {
+        for (e = 0; e < 2; e++)
+        {
+            for (c = 0; c < channels; c++)
+            {
+                unsigned int value = unpacked->ends[s][e][c];
+                unsigned int length = c < 3 ? mode->colour_bits : mode->alpha_bits;
+                if (mode->endpoint_pbits || mode->shared_pbits)
+                {
+                    value = (value << 1) | pbits[s * 2 + e];
+                    length++;
+                }
+                unpacked->ends[s][e][c] = (unsigned char)((value << (8 - length)) | (value >> (2 * length - 8)));
+            }
+            if (channels == 3)
+            {
+                unpacked->ends[s][e][3] = 255;
+            }
+        }
+    }
+
+    for (i = 0; i < 16; i++)
+    {
+        unpacked->subsets[i] = (unsigned char)hap_pixels_bptc_subset(mode->subsets, partition, i);
+        indices[i] = (unsigned char)hap_pixels_read_bits(&bits, mode->index_bits - hap_pixels_bptc_is_anchor(mode->subsets, partition, i));
+    }
+    for (i = 0; i < 16 && mode->secondary_index_bits; i++)
+    {
+        secondary_indices[i] = (unsigned char)hap_pixels_read_bits(&bits, mode->secondary_index_bits - (i == 0));
+    }
+
+    // Where a block has two sets of indices, its index selection bit chooses which set colour uses
+    colour_indices = indices;
+    alpha_indices = mode->secondary_index_bits ? secondary_indices : indices;
+    if (index_selection)
+    {
+        colour_indices = secondary_indices;
+        alpha_indices = indices;
+    }
+    colour_weights = hap_pixels_bptc_weights(colour_indices == indices ? mode->index_bits : mode->secondary_index_bits);
+    alpha_weights = hap_pixels_bptc_weights(alpha_indices == indices ? mode->index_bits : mode->secondary_index_bits);
+    for (i = 0; i < 16; i++)
+    {
+        unpacked->weights[i] = colour_weights[colour_indices[i]];
+        unpacked->alpha_weights[i] = alpha_weights[alpha_indices[i]];
+    }
+
+    // A rotation exchanges alpha with red, green or blue after interpolation, which is the same as exchanging the ends
+    unpacked->alpha_channel = 3;
+    if (rotation)
+    {
+        unpacked->alpha_channel = rotation - 1;
+    }
+    if (bgra && unpacked->alpha_channel != 3)
+    {
+        unpacked->alpha_channel = 2 - unpacked->alpha_channel;
+    }
+    for (s = 0; s < mode->subsets; s++)
+    {
+        for (e = 0; e < 2; e++)
+        {
+            unsigned char *end = unpacked->ends[s][e];
+            unsigned char swap;
+            if (rotation)
+            {
+                swap = end[3];
+                end[3] = end[rotation - 1];
+                end[rotation - 1] = swap;
+            }
+            if (bgra)
+            {
+                swap = end[0];
+                end[0] = end[2];
+                end[2] = swap;
+            }
+        }
+    }
+    return 1;
+}
+
+static void hap_pixels_decode_bc7_block_scalar(const HapPixelsJob *job, const unsigned char *block, unsigned char *dst, size_t bytes_per_row)
+{
+    HapPixelsBC7Block unpacked;
+    unsigned int i, c;
+
+    if (!hap_pixels_bc7_unpack(block, job->bgra, &unpacked))
+    {
+        for (i = 0; i < 4; i++)
+        {
+            memset(dst + i * bytes_per_row, 0, 16);
+        }
+        return;
+    }
+    for (i = 0; i < 16; i++)
+    {
+        const unsigned char *end0 = unpacked.ends[unpacked.subsets[i]][0];
+        const unsigned char *end1 = unpacked.ends[unpacked.subsets[i]][1];
+        unsigned char *pixel = dst + (i / 4) * bytes_per_row + (i % 4) * 4;
+        for (c = 0; c < 4; c++)
+        {
+            unsigned int weight = c == unpacked.alpha_channel ? unpacked.alpha_weights[i] : unpacked.weights[i];
+            pixel[c] = (unsigned char)(((64 - weight) * end0[c] + weight * end1[c] + 32) >> 6);
+        }
+    }
+}
+
+#if defined(HAP_PIXELS_SSE2)
+
+/*
+ Interpolates a row of pixels at a time in 16-bit lanes. Each pixel's weights are spread across its channels, taking the
+ alpha weight in the lane of the alpha channel.
+ */
+static void hap_pixels_decode_bc7_block_sse2(const HapPixelsJob *job, const unsigned char *block, unsigned char *dst, size_t bytes_per_row)
+{
+    HapPixelsBC7Block unpacked;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(32);
+    const __m128i sixty_four = _mm_set1_epi16(64);
+    __m128i alpha_lanes;
+    int32_t ends[3][2];
+    unsigned int y, s;
+
+    if (!hap_pixels_bc7_unpack(block, job->bgra, &unpacked))
+    {
+        for (y = 0; y < 4; y++)
+        {
+            _mm_storeu_si128((__m128i *)(dst + y * bytes_per_row), zero);
+        }
+        return;
+    }
+    alpha_lanes = _mm_slli_epi32(_mm_set1_epi32(0xFF), unpacked.alpha_channel * 8);
+    for (s = 0; s < 3; s++)
+    {
+        memcpy(&ends[s][0], unpacked.ends[s][0], 4);
+        memcpy(&ends[s][1], unpacked.ends[s][1], 4);
+    }
+
+    for (y = 0; y < 4; y++)
+    {
+        const unsigned char *subsets = unpacked.subsets + y * 4;
+        __m128i end0 = _mm_set_epi32(ends[subsets[3]][0], ends[subsets[2]][0], ends[subsets[1]][0], ends[subsets[0]][0]);
+        __m128i end1 = _mm_set_epi32(ends[subsets[3]][1], ends[subsets[2]][1], ends[subsets[1]][1], ends[subsets[0]][1]);
+        int32_t row_weights, row_alpha_weights;
+        __m128i weights, alpha_weights, low, high;
+
+        memcpy(&row_weights, unpacked.weights + y * 4, 4);
+        memcpy(&row_alpha_weights, unpacked.alpha_weights + y * 4, 4);
+        weights = _mm_cvtsi32_si128(row_weights);
+        weights = _mm_unpacklo_epi8(weights, weights);
+        weights = _mm_unpacklo_epi16(weights, weights);
+        alpha_weights = _mm_cvtsi32_si128(row_alpha_weights);
+        alpha_weights = _mm_unpacklo_epi8(alpha_weights, alpha_weights);
+        alpha_weights = _mm_unpacklo_epi16(alpha_weights, alpha_weights);
+        weights = _mm_or_si128(_mm_andnot_si128(alpha_lanes, weights), _mm_and_si128(alpha_lanes, alpha_weights));
+
+        low = _mm_unpacklo_epi8(weights, zero);
+        high = _mm_unpackhi_epi8(weights, zero);
+        low = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(end0, zero), _mm_sub_epi16(sixty_four, low)),
+                                          _mm_mullo_epi16(_mm_unpacklo_epi8(end1, zero), low)),
+                            round);
+        high = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(end0, zero), _mm_sub_epi16(sixty_four, high)),
+                                           _mm_mullo_epi16(_mm_unpackhi_epi8(end1, zero), high)),
+                             round);
+        _mm_storeu_si128((__m128i *)(dst + y * bytes_per_row), _mm_packus_epi16(_mm_srli_epi16(low, 6), _mm_srli_epi16(high, 6)));
+    }
+}
+
+#endif
+
+/*
+ BC6H has fourteen modes. Their fields are the ends of the lines of up to two regions, w and x for the first and y and z
+ for the second, each with a red, green and blue channel, and the partition d of two-region modes. Each mode stores
+ them as a different sequence of runs of bits.
+ */
+#define kHapBC6HFieldW 0
+#define kHapBC6HFieldX 3
+#define kHapBC6HFieldY 6
+#define kHapBC6HFieldZ 9
+#define kHapBC6HFieldD 12
+
+#define RW kHapBC6HFieldW
+#define GW (kHapBC6HFieldW + 1)
+#define BW (kHapBC6HFieldW + 2)
+#define RX kHapBC6HFieldX
+#define GX (kHapBC6HFieldX + 1)
+#define BX (kHapBC6HFieldX + 2)
+#define RY kHapBC6HFieldY
+#define GY (kHapBC6HFieldY + 1)
+#define BY (kHapBC6HFieldY + 2)
+#define RZ kHapBC6HFieldZ
+#define GZ (kHapBC6HFieldZ + 1)
+#define BZ (kHapBC6HFieldZ + 2)
+#define D kHapBC6HFieldD
+
+typedef struct HapPixelsBC6HMode {
+    unsigned char mode; // The value of the mode bits
+    unsigned char mode_bits;
+    unsigned char regions;
+    unsigned char transformed; // Whether x, y and z are stored as differences from w
+    unsigned char endpoint_bits;
+    unsigned char delta_bits[3];
+    unsigned char run_count;
+    /*
+     Each run is a field, its last bit and its first bit. The bits of a run are stored from its first bit towards its
+     last, so runs whose first bit is higher are stored reversed.
+     */
+    unsigned char runs[24][3];
+} HapPixelsBC6HMode;
+
+static const HapPixelsBC6HMode hap_pixels_bc6h_modes[14] = {
+    { 0x00, 2, 2, 1, 10, { 5, 5, 5 }, 20, {
+        { GY, 4, 4 }, { BY, 4, 4 }, { BZ, 4, 4 }, { RW, 9, 0 }, { GW, 9, 0 }, { BW, 9, 0 }, { RX, 4, 0 }, { GZ, 4, 4 },
+        { GY, 3, 0 }, { GX, 4, 0 }, { BZ, 0, 0 }, { GZ, 3, 0 }, { BX, 4, 0 }, { BZ, 1, 1 }, { BY, 3, 0 }, { RY, 4, 0 },
+        { BZ, 2, 2 }, { RZ, 4, 0 }, { BZ, 3, 3 }, { D, 4, 0 } } },
+    { 0x01, 2, 2, 1, 7, { 6, 6, 6 }, 24, {
+        { GY, 5, 5 }, { GZ, 4, 4 }, { GZ, 5, 5 }, { RW, 6, 0 }, { BZ, 0, 0 }, { BZ, 1, 1 }, { BY, 4, 4 }, { GW, 6, 0 },
+        { BY, 5, 5 }, { BZ, 2, 2 }, { GY, 4, 4 }, { BW, 6, 0 }, { BZ, 3, 3 }, { BZ, 5, 5 }, { BZ, 4, 4 }, { RX, 5, 0 },
+        { GY, 3, 0 }, { GX, 5, 0 }, { GZ, 3, 0 }, { BX, 5, 0 }, { BY, 3, 0 }, { RY, 5, 0 }, { RZ, 5, 0 }, { D, 4, 0 } } },
+    { 0x02, 5, 2, 1, 11, { 5, 4, 4 }, 19, {
+        { RW, 9, 0 }, { GW, 9, 0 }, { BW, 9, 0 }, { RX, 4, 0 }, { RW, 10, 10 }, { GY, 3, 0 }, { GX, 3, 0 }, { GW, 10, 10 },
+        { BZ, 0, 0 }, { GZ, 3, 0 }, { BX, 3, 0 }, { BW, 10, 10 }, { BZ, 1, 1 }, { BY, 3, 0 }, { RY, 4, 0 }, { BZ, 2, 2 },
+        { RZ, 4, 0 }, { BZ, 3, 3 }, { D, 4, 0 } } },
+    { 0x06, 5, 2, 1, 11, { 4, 5, 4 }, 21, {
+        { RW, 9, 0 }, { GW, 9, 0 }, { BW, 9, 0 }, { RX, 3, 0 }, { RW, 10, 10 }, { GZ, 4, 4 }, { GY, 3, 0 }, { GX, 4, 0 },
+        { GW, 10, 10 }, { GZ, 3, 0 }, { BX, 3, 0 }, { BW, 10, 10 }, { BZ, 1, 1 }, { BY, 3, 0 }, { RY, 3, 0 }, { BZ, 0, 0 },
+        { BZ, 2, 2 }, { RZ, 3, 0 }, { GY, 4, 4 }, { BZ, 3, 3 }, { D, 4, 0 } } },
+    { 0x0A, 5, 2, 1, 11, { 4, 4, 5 }, 21, {
+        { RW, 9, 0 }, { GW, 9, 0 }, { BW, 9, 0 }, { RX, 3, 0 }, { RW, 10, 10 }, { BY, 4, 4 }, { GY, 3, 0 }, { GX, 3, 0 },
+        { GW, 10, 10 }, { BZ, 0, 0 }, { GZ, 3, 0 }, { BX, 4, 0 }, { BW, 10, 10 }, { BY, 3, 0 }, { RY, 3, 0 }, { BZ, 1, 1 },
+        { BZ, 2, 2 }, { RZ, 3, 0 }, { BZ, 4, 4 }, { BZ, 3, 3 }, { D, 4, 0 } } },
+    { 0x0E, 5, 2, 1, 9, { 5, 5, 5 }, 20, {
+        { RW, 8, 0 }, { BY, 4, 4 }, { GW, 8, 0 }, { GY, 4, 4 }, { BW, 8, 0 }, { BZ, 4, 4 }, { RX, 4, 0 }, { GZ, 4, 4 },
+        { GY, 3, 0 }, { GX, 4, 0 }, { BZ, 0, 0 }, { GZ, 3, 0 }, { BX, 4, 0 }, { BZ, 1, 1 }, { BY, 3, 0 }, { RY, 4, 0 },
+        { BZ, 2, 2 }, { RZ, 4, 0 }, { BZ, 3, 3 }, { D, 4, 0 } } },
+    { 0x12, 5, 2, 1, 8, { 6, 5, 5 }, 20, {
+        { RW, 7, 0 }, { GZ, 4, 4 }, { BY, 4, 4 }, { GW, 7, 0 }, { BZ, 2, 2 }, { GY, 4, 4 }, { BW, 7, 0 }, { BZ, 3, 3 },
+        { BZ, 4, 4 }, { RX, 5, 0 }, { GY, 3, 0 }, { GX, 4, 0 }, { BZ, 0, 0 }, { GZ, 3, 0 }, { BX, 4, 0 }, { BZ, 1, 1 },
+        { BY, 3, 0 }, { RY, 5, 0 }, { RZ, 5, 0 }, { D, 4, 0 } } },
+    { 0x16, 5, 2, 1, 8, { 5, 6, 5 }, 22, {
+        { RW, 7, 0 }, { BZ, 0, 0 }, { BY, 4, 4 }, { GW, 7, 0 }, { GY, 5, 5 }, { GY, 4, 4 }, { BW, 7, 0 }, { GZ, 5, 5 },
+        { BZ, 4, 4 }, { RX, 4, 0 }, { GZ, 4, 4 }, { GY, 3, 0 }, { GX, 5, 0 }, { GZ, 3, 0 }, { BX, 4, 0 }, { BZ, 1, 1 },
+        { BY, 3, 0 }, { RY, 4, 0 }, { BZ, 2, 2 }, { RZ, 4, 0 }, { BZ, 3, 3 }, { D, 4, 0 } } },
+    { 0x1A, 5, 2, 1, 8, { 5, 5, 6 }, 22, {
+        { RW, 7, 0 }, { BZ, 1, 1 }, { BY, 4, 4 }, { GW, 7, 0 }, { BY, 5, 5 }, { GY, 4, 4 }, { BW, 7, 0 }, { BZ, 5, 5 },
+        { BZ, 4, 4 }, { RX, 4, 0 }, { GZ, 4, 4 }, { GY, 3, 0 }, { GX, 4, 0 }, { BZ, 0, 0 }, { GZ, 3, 0 }, { BX, 5, 0 },
+        { BY, 3, 0 }, { RY, 4, 0 }, { BZ, 2, 2 }, { RZ, 4, 0 }, { BZ, 3, 3 }, { D, 4, 0 } } },
+    { 0x1E, 5, 2, 0, 6, { 6, 6, 6 }, 24, {
+        { RW, 5, 0 }, { GZ, 4, 4 }, { BZ, 0, 0 }, { BZ, 1, 1 }, { BY, 4, 4 }, { GW, 5, 0 }, { GY, 5, 5 }, { BY, 5, 5 },
+        { BZ, 2, 2 }, { GY, 4, 4 }, { BW, 5, 0 }, { GZ, 5, 5 }, { BZ, 3, 3 }, { BZ, 5, 5 }, { BZ, 4, 4 }, { RX, 5, 0 },
+        { GY, 3, 0 }, { GX, 5, 0 }, { GZ, 3, 0 }, { BX, 5, 0 }, { BY, 3, 0 }, { RY, 5, 0 }, { RZ, 5, 0 }, { D, 4, 0 } } },
+    { 0x03, 5, 1, 0, 10, { 10, 10, 10 }, 6, {
+        { RW, 9, 0 }, { GW, 9, 0 }, { BW, 9, 0 }, { RX, 9, 0 }, { GX, 9, 0 }, { BX, 9, 0 } } },
+    { 0x07, 5, 1, 1, 11, { 9, 9, 9 }, 9, {
+        { RW, 9, 0 }, { GW, 9, 0 }, { BW, 9, 0 }, { RX, 8, 0 }, { RW, 10, 10 }, { GX, 8, 0 }, { GW, 10, 10 }, { BX, 8, 0 },
+        { BW, 10, 10 } } },
+    { 0x0B, 5, 1, 1, 12, { 8, 8, 8 }, 9, {
+        { RW, 9, 0 }, { GW, 9, 0 }, { BW, 9, 0 }, { RX, 7, 0 }, { RW, 10, 11 }, { GX, 7, 0 }, { GW, 10, 11 }, { BX, 7, 0 },
+        { BW, 10, 11 } } },
+    { 0x0F, 5, 1, 1, 16, { 4, 4, 4 }, 9, {
+        { RW, 9, 0 }, { GW, 9, 0 }, { BW, 9, 0 }, { RX, 3, 0 }, { RW, 10, 15 }, { GX, 3, 0 }, { GW, 10, 15 }, { BX, 3, 0 },
+        { BW, 10, 15 } } }
+};
+
+#undef RW
+#undef GW
+#undef BW
+#undef RX
+#undef GX
+#undef BX
+#undef RY
+#undef GY
+#undef BY
+#undef RZ
+#undef GZ
+#undef BZ
+#undef D
+
+// Returns the mode of a BC6H block, or NULL for a reserved block
+static const HapPixelsBC6HMode *hap_pixels_bc6h_mode(HapPixelsBits *bits)
+{
+    unsigned int value = hap_pixels_read_bits(bits, 2);
+    unsigned int i;
+    if (value < 2)
+    {
+        return &hap_pixels_bc6h_modes[value];
+    }
+    value |= hap_pixels_read_bits(bits, 3) << 2;
+    for (i = 2; i < 14; i++)
+    {
+        if (hap_pixels_bc6h_modes[i].mode == value)
+        {
+            return &hap_pixels_bc6h_modes[i];
+        }
+    }
+    return NULL;
+}
+
+static int hap_pixels_sign_extend(unsigned int value, unsigned int bits)
+{
+    return (int)(value ^ (1u << (bits - 1))) - (int)(1u << (bits - 1));
+}
+
+// Expands an end of a line from its stored bits to 16 bits, in the range of the texture's format
+static int hap_pixels_bc6h_unquantize(int value, unsigned int bits, int is_signed)
+{
+    int negative = value < 0;
+    int magnitude = negative ? -value : value;
+    int result;
+
+    if (!is_signed)
+    {
+        if (bits >= 15 || value == 0)
+        {
+            return value;
+        }
+        if (value == (1 << bits) - 1)
+        {
+            return 0xFFFF;
+        }
+        return ((value << 16) + 0x8000) >> bits;
+    }
+
+    if (bits >= 16 || magnitude == 0)
+    {
+        return value;
+    }
+    if (magnitude >= (1 << (bits - 1)) - 1)
+    {
+        result = 0x7FFF;
+    }
+    else
+    {
+        result = ((magnitude << 15) + 0x4000) >> (bits - 1);
+    }
+    return negative ? -result : result;
+}
+
+// Interpolates between two unquantized ends, rounding towards negative infinity as a shift would
+static int hap_pixels_bc6h_interpolate(int end0, int end1, unsigned int weight)
+{
+    int sum = (64 - (int)weight) * end0 + (int)weight * end1 + 32;
+    return sum >= 0 ? sum / 64 : -((63 - sum) / 64);
+}
+
+// Scales an interpolated value to the bits of a half float
+static uint16_t hap_pixels_bc6h_finish(int value, int is_signed)
+{
+    if (!is_signed)
+    {
+        return (uint16_t)((value * 31) >> 6);
+    }
+    if (value < 0)
+    {
+        return (uint16_t)(0x8000 | (((-value) * 31) >> 5));
+    }
+    return (uint16_t)((value * 31) >> 5);
+}
+
+/*
+ Decodes a BC6H block to pixels of three half floats. A reserved block decodes to zero.
+ */
+static void hap_pixels_decode_bc6h_block(const HapPixelsJob *job, const unsigned char *block, unsigned char *dst, size_t bytes_per_row)
+{
+    int is_signed = job->texture_format == HapTextureFormat_RGB_BPTC_SIGNED_FLOAT;
+    const HapPixelsBC6HMode *mode;
+    HapPixelsBits bits;
+    unsigned int fields[13] = { 0 };
+    int ends[2][2][3];
+    unsigned int partition, i, r, e, c, index_bits;
+    const unsigned char *weights;
+
+    hap_pixels_bits_init(&bits, block);
+    mode = hap_pixels_bc6h_mode(&bits);
+    if (mode == NULL)
+    {
+        for (i = 0; i < 4; i++)
+        {
+            memset(dst + i * bytes_per_row, 0, 24);
+        }
+        return;
+    }
+
+    for (i = 0; i < mode->run_count; i++)
+    {
+        const unsigned char *run = mode->runs[i];
+        int bit;
+        if (run[1] >= run[2])
+        {
+            fields[run[0]] |= hap_pixels_read_bits(&bits, run[1] - run[2] + 1) << run[2];
+        }
+        else
+        {
+            for (bit = run[2]; bit >= run[1]; bit--)
+            {
+                fields[run[0]] |= hap_pixels_read_bits(&bits, 1) << bit;
+            }
+        }
+    }
+    partition = fields[kHapBC6HFieldD];
+
+    for (c = 0; c < 3; c++)
+    {
+        unsigned int mask = (1u << mode->endpoint_bits) - 1;
+        unsigned int base = fields[kHapBC6HFieldW + c];
+        for (r = 0; r < mode->regions; r++)
+        {
+            for (e = 0; e < 2; e++)
+            {
+                unsigned int field = r * 6 + e * 3 + c;
+                unsigned int value = fields[field];
+                if (mode->transformed && field != kHapBC6HFieldW + c)
+                {
+                    value = (base + (unsigned int)hap_pixels_sign_extend(value, mode->delta_bits[c])) & mask;
+                }
+                ends[r][e][c] = is_signed ? hap_pixels_sign_extend(value, mode->endpoint_bits) : (int)value;
+                ends[r][e][c] = hap_pixels_bc6h_unquantize(ends[r][e][c], mode->endpoint_bits, is_signed);
+            }
+        }
+    }
+
+    index_bits = mode->regions == 2 ? 3 : 4;
+    weights = hap_pixels_bptc_weights(index_bits);
+    for (i = 0; i < 16; i++)
+    {
+        unsigned int region = hap_pixels_bptc_subset(mode->regions, partition, i);
+        unsigned int index = hap_pixels_read_bits(&bits, index_bits - hap_pixels_bptc_is_anchor(mode->regions, partition, i));
+        unsigned char *pixel = dst + (i / 4) * bytes_per_row + (i % 4) * 6;
+        for (c = 0; c < 3; c++)
+        {
+            uint16_t half = hap_pixels_bc6h_finish(hap_pixels_bc6h_interpolate(ends[region][0][c], ends[region][1][c], weights[index]), is_signed);
+            memcpy(pixel + c * 2, &half, 2);
+        }
+    }
+}
+
+// Returns the size of a pixel, or 0 for an unknown pixel format
+static unsigned int hap_pixels_bytes_per_pixel(unsigned int pixel_format)
+{
+    switch (pixel_format) {
+        case HapPixelFormat_RGBA8:
+        case HapPixelFormat_BGRA8:
+            return 4;
+        case HapPixelFormat_RGB16F:
+            return 6;
+        default:
+            return 0;
+    }
+}
+
+// BC6H textures are converted to and from half floats, and every other format to and from eight-bit pixels
+static int hap_pixels_formats_match(unsigned int texture_format, unsigned int pixel_format)
+{
+    if (texture_format == HapTextureFormat_RGB_BPTC_UNSIGNED_FLOAT || texture_format == HapTextureFormat_RGB_BPTC_SIGNED_FLOAT)
+    {
+        return pixel_format == HapPixelFormat_RGB16F;
+    }
+    return pixel_format == HapPixelFormat_RGBA8 || pixel_format == HapPixelFormat_BGRA8;
+}
+
+// Returns 0 if the texture format can't be decoded to pixels
+static int hap_pixels_job_init(HapPixelsJob *job, unsigned int texture_format, unsigned int pixel_format,
+                               unsigned int width, unsigned int height)
+{
+    switch (texture_format) {
+        case HapTextureFormat_RGB_DXT1:
+        case HapTextureFormat_A_RGTC1:
+            job->block_bytes = 8;
+            break;
+        case HapTextureFormat_RGBA_DXT5:
+        case HapTextureFormat_YCoCg_DXT5:
+        case HapTextureFormat_RGBA_BPTC_UNORM:
+        case HapTextureFormat_RGB_BPTC_UNSIGNED_FLOAT:
+        case HapTextureFormat_RGB_BPTC_SIGNED_FLOAT:
+            job->block_bytes = 16;
+            break;
+        default:
+            return 0;
+    }
+    if (!hap_pixels_formats_match(texture_format, pixel_format))
+    {
+        return 0;
+    }
+    job->texture_format = texture_format;
+    job->bgra = pixel_format == HapPixelFormat_BGRA8;
+    job->bytes_per_pixel = hap_pixels_bytes_per_pixel(pixel_format);
+    job->width = width;
+    job->height = height;
+    job->blocks_per_row = (width + 3) / 4;
+    job->block_rows = (height + 3) / 4;
+    job->decode_block = NULL;
+    job->decode_pair = NULL;
+    job->decode_ycocg_block = NULL;
+    job->alpha_texture = NULL;
+    if (texture_format == HapTextureFormat_YCoCg_DXT5)
+    {
+        job->decode_ycocg_block = hap_pixels_decode_ycocg_block_scalar;
+#if defined(HAP_PIXELS_SSE2)
+        job->decode_ycocg_block = hap_pixels_decode_ycocg_block_sse2;
+#endif
+        return 1;
+    }
+    if (texture_format == HapTextureFormat_RGBA_BPTC_UNORM)
+    {
+        job->decode_block = hap_pixels_decode_bc7_block_scalar;
+#if defined(HAP_PIXELS_SSE2)
+        job->decode_block = hap_pixels_decode_bc7_block_sse2;
+#endif
+        return 1;
+    }
+    if (texture_format != HapTextureFormat_RGBA_DXT5 && texture_format != HapTextureFormat_RGB_DXT1 && texture_format != HapTextureFormat_A_RGTC1)
+    {
+        job->decode_block = hap_pixels_decode_bc6h_block;
+        return 1;
+    }
+    job->decode_block = hap_pixels_decode_block_scalar;
+#if defined(HAP_PIXELS_SSE2)
+    job->decode_block = hap_pixels_decode_block_sse2;
+#endif
+#if defined(HAP_PIXELS_AVX2)
+    if (__builtin_cpu_supports("avx2"))
+    {
+        job->decode_pair = hap_pixels_decode_pair_avx2;
+    }
+#endif
+    return 1;
+}
+
+// Decodes a block, which is block block_index of the texture, to dst
+static void hap_pixels_decode_one_block(const HapPixelsJob *job, const unsigned char *block, size_t block_index,
+                                        unsigned char *dst, size_t bytes_per_row)
+{
+    if (job->decode_ycocg_block)
+    {
+        const unsigned char *merged_alpha = job->alpha_texture ? (const unsigned char *)job->alpha_texture + block_index * 8 : NULL;
+        job->decode_ycocg_block(job, block, merged_alpha, dst, bytes_per_row);
+    }
+    else
+    {
+        job->decode_block(job, block, dst, bytes_per_row);
+    }
+}
+
+/*
+ Converts block_count blocks from blocks, which is block first_block of the texture, to pixels. The range may begin and
+ end part of the way through a block row.
+ */
+static void hap_pixels_convert_blocks(const HapPixelsJob *job, const unsigned char *blocks, size_t first_block, size_t block_count)
+{
+    size_t block_index = first_block;
+    size_t end = first_block + block_count;
+
+    while (block_index < end)
+    {
+        unsigned int x = (unsigned int)(block_index % job->blocks_per_row) * 4;
+        unsigned int y = (unsigned int)(block_index / job->blocks_per_row) * 4;
+        unsigned char *dst = job->output + y * job->output_bytes_per_row + (size_t)x * job->bytes_per_pixel;
+        const unsigned char *block = blocks + (block_index - first_block) * job->block_bytes;
+        int whole_rows = y + 4 <= job->height;
+
+        if (job->decode_pair && whole_rows && block_index + 1 < end && x + 8 <= job->width)
+        {
+            job->decode_pair(job, block, dst, job->output_bytes_per_row);
+            block_index += 2;
+        }
+        else if (whole_rows && x + 4 <= job->width)
+        {
+            hap_pixels_decode_one_block(job, block, block_index, dst, job->output_bytes_per_row);
+            block_index++;
+        }
+        else
+        {
+            /*
+             Blocks at the right and bottom edges of the image may be partly outside it, so are decoded to a tile and
+             only the part inside the image is copied
+             */
+            unsigned char tile[96];
+            unsigned int tile_bytes_per_row = job->bytes_per_pixel * 4;
+            unsigned int columns = job->width - x < 4 ? job->width - x : 4;
+            unsigned int rows = job->height - y < 4 ? job->height - y : 4;
+            unsigned int row;
+            hap_pixels_decode_one_block(job, block, block_index, tile, tile_bytes_per_row);
+            for (row = 0; row < rows; row++)
+            {
+                memcpy(dst + row * job->output_bytes_per_row, tile + row * tile_bytes_per_row, columns * job->bytes_per_pixel);
+            }
+            block_index++;
+        }
+    }
+}
+
+/*
+ Finds the blocks of a chunk at offset into a texture which cover the image, returning 0 if none do. Blocks beyond those
+ covering the image are ignored.
+ */
+static int hap_pixels_chunk_blocks(const HapPixelsJob *job, unsigned long offset, unsigned long length,
+                                   size_t *first_block, size_t *block_count)
+{
+    size_t image_blocks = (size_t)job->blocks_per_row * job->block_rows;
+
+    *first_block = offset / job->block_bytes;
+    *block_count = length / job->block_bytes;
+    if (*first_block >= image_blocks)
+    {
+        return 0;
+    }
+    if (*block_count > image_blocks - *first_block)
+    {
+        *block_count = image_blocks - *first_block;
+    }
+    return 1;
+}
+
+/*
+ A HapDecodeChunkFunction which converts part of a texture to pixels
+ */
+static void hap_pixels_convert_chunk(void *p, const void *data, unsigned long offset, unsigned long length)
+{
+    const HapPixelsJob *job = (const HapPixelsJob *)p;
+    size_t first_block, block_count;
+
+    if (hap_pixels_chunk_blocks(job, offset, length, &first_block, &block_count))
+    {
+        hap_pixels_convert_blocks(job, (const unsigned char *)data, first_block, block_count);
+    }
+}
+
+/*
+ Checks the arguments to decode the texture at index to pixels and prepares job to do so, returning HapResult_No_Error or
+ an error
+ */
+static unsigned int hap_pixels_prepare_job(HapPixelsJob *job,
+                                           const HapFrameInfo *frameInfo,
+                                           unsigned int index,
+                                           unsigned int width, unsigned int height,
+                                           unsigned int pixelFormat,
+                                           HapDecodeCallback callback,
+                                           void *outputBuffer, unsigned long outputBytesPerRow, unsigned long outputBufferBytes)
+{
+    const HapTextureInfo *texture;
+
+    /*
+     Check arguments
+     */
+    if (frameInfo == NULL
+        || index >= frameInfo->textureCount
+        || width == 0
+        || height == 0
+        || hap_pixels_bytes_per_pixel(pixelFormat) == 0
+        || callback == NULL
+        || outputBuffer == NULL
+        || outputBytesPerRow < (unsigned long)width * hap_pixels_bytes_per_pixel(pixelFormat)
+        )
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    texture = &frameInfo->textures[index];
+    if (!hap_pixels_job_init(job, texture->textureFormat, pixelFormat, width, height))
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    /*
+     The texture must have enough blocks for the dimensions
+     */
+    if ((size_t)job->blocks_per_row * job->block_rows * job->block_bytes > texture->decodedBytes)
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    if (outputBufferBytes < (unsigned long)width * job->bytes_per_pixel
+        || (outputBufferBytes - (unsigned long)width * job->bytes_per_pixel) / outputBytesPerRow < height - 1)
+    {
+        return HapResult_Buffer_Too_Small;
+    }
+
+    job->output = (unsigned char *)outputBuffer;
+    job->output_bytes_per_row = outputBytesPerRow;
+
+    return HapResult_No_Error;
+}
+
+unsigned int HapDecodeToPixels(HapDecoderContext *context,
+                               const HapFrameInfo *frameInfo,
+                               unsigned int index,
+                               unsigned int width, unsigned int height,
+                               unsigned int pixelFormat,
+                               HapDecodeCallback callback, void *info,
+                               void *outputBuffer, unsigned long outputBytesPerRow, unsigned long outputBufferBytes)
+{
+    HapPixelsJob job;
+    unsigned int result = hap_pixels_prepare_job(&job, frameInfo, index, width, height, pixelFormat, callback,
+                                                 outputBuffer, outputBytesPerRow, outputBufferBytes);
+    if (result != HapResult_No_Error)
+    {
+        return result;
+    }
+
+    return HapDecodeChunks(context, frameInfo, index, hap_pixels_convert_chunk, &job, callback, info);
+}
+
+unsigned int HapDecodeFrameToPixels(HapDecoderContext *context,
+                                    const HapFrameInfo *frameInfo,
+                                    unsigned int width, unsigned int height,
+                                    unsigned int pixelFormat,
+                                    HapDecodeCallback callback, void *info,
+                                    void *outputBuffer, unsigned long outputBytesPerRow, unsigned long outputBufferBytes)
+{
+    HapPixelsJob job;
+    unsigned int colour_index, alpha_index;
+    unsigned int result;
+
+    if (frameInfo != NULL && frameInfo->textureCount == 1)
+    {
+        return HapDecodeToPixels(context, frameInfo, 0, width, height, pixelFormat, callback, info,
+                                 outputBuffer, outputBytesPerRow, outputBufferBytes);
+    }
+
+    /*
+     The only permitted combination of two textures is YCoCg colour with RGTC1 alpha, in either order
+     */
+    if (frameInfo == NULL || frameInfo->textureCount != 2)
+    {
+        return HapResult_Bad_Arguments;
+    }
+    colour_index = frameInfo->textures[0].textureFormat == HapTextureFormat_YCoCg_DXT5 ? 0 : 1;
+    alpha_index = 1 - colour_index;
+    if (frameInfo->textures[colour_index].textureFormat != HapTextureFormat_YCoCg_DXT5
+        || frameInfo->textures[alpha_index].textureFormat != HapTextureFormat_A_RGTC1)
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    result = hap_pixels_prepare_job(&job, frameInfo, colour_index, width, height, pixelFormat, callback,
+                                    outputBuffer, outputBytesPerRow, outputBufferBytes);
+    if (result != HapResult_No_Error)
+    {
+        return result;
+    }
+
+    // The alpha texture must have a block for every block of colour
+    if ((size_t)job.blocks_per_row * job.block_rows * 8 > frameInfo->textures[alpha_index].decodedBytes)
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    return HapDecodeChunksWithTexture(context, frameInfo, colour_index,
+                                      alpha_index, &job.alpha_texture,
+                                      hap_pixels_convert_chunk, &job,
+                                      callback, info);
+}
+
+/*
+ Decoding to YUV
+ */
+
+/*
+ Each block is converted to sixteen sets of three values with four fractional bits, which are red, green and blue, or for
+ a YCoCg texture Y, Co and Cg, and then multiplied by a matrix with twelve fractional bits to give Y', Cb and Cr. As the
+ matrix is linear, chroma is found from the sum of the values of the pixels it covers.
+ */
+typedef struct HapPixelsYUVJob {
+    HapPixelsJob pixels; // Decodes blocks of textures other than YCoCg to RGBA
+    unsigned int ycocg;
+    unsigned int interleaved; // Cb and Cr share a plane
+    int matrix[3][3];
+    unsigned char *planes[3];
+    size_t bytes_per_row[3];
+} HapPixelsYUVJob;
+
+static void hap_pixels_yuv_matrix(HapPixelsYUVJob *job, unsigned int matrix)
+{
+    float kr = matrix == HapYUVMatrix_BT709 ? 0.2126f : 0.299f;
+    float kb = matrix == HapYUVMatrix_BT709 ? 0.0722f : 0.114f;
+    float kg = 1.0f - kr - kb;
+    float cb_scale = 224.0f / 255.0f / (2.0f * (1.0f - kb));
+    float cr_scale = 224.0f / 255.0f / (2.0f * (1.0f - kr));
+    float rows[3][3];
+    int i, j;
+
+    rows[0][0] = kr * 219.0f / 255.0f;
+    rows[0][1] = kg * 219.0f / 255.0f;
+    rows[0][2] = kb * 219.0f / 255.0f;
+    rows[1][0] = -kr * cb_scale;
+    rows[1][1] = -kg * cb_scale;
+    rows[1][2] = (1.0f - kb) * cb_scale;
+    rows[2][0] = (1.0f - kr) * cr_scale;
+    rows[2][1] = -kg * cr_scale;
+    rows[2][2] = -kb * cr_scale;
+    for (i = 0; i < 3; i++)
+    {
+        float r = rows[i][0];
+        float g = rows[i][1];
+        float b = rows[i][2];
+        if (job->ycocg)
+        {
+            // Red is Y + Co - Cg, green Y + Cg and blue Y - Co - Cg, so the matrix is folded into one taking Y, Co and Cg
+            rows[i][0] = r + g + b;
+            rows[i][1] = r - b;
+            rows[i][2] = g - r - b;
+        }
+        for (j = 0; j < 3; j++)
+        {
+            float scaled = rows[i][j] * 4096.0f;
+            job->matrix[i][j] = (int)(scaled < 0.0f ? scaled - 0.5f : scaled + 0.5f);
+        }
+    }
+}
+
+// Fills values with the Y, Co and Cg of each pixel of a YCoCg block, with four fractional bits
+static void hap_pixels_ycocg_values(const unsigned char *block, int values[16][3])
+{
+    unsigned char palette[16];
+    unsigned char luma[16];
+    int co[4], cg[4];
+    int i;
+
+    hap_pixels_colour_palette(block + 8, 0, 0, palette);
+    hap_pixels_alpha_values(block, luma);
+    for (i = 0; i < 4; i++)
+    {
+        // As for hap_pixels_ycocg_offsets()
+        int divisor = palette[i * 4 + 2] + 8;
+        co[i] = hap_pixels_round_divide((palette[i * 4] - 128) * 8 * 16, divisor);
+        cg[i] = hap_pixels_round_divide((palette[i * 4 + 1] - 128) * 8 * 16, divisor);
+    }
+    for (i = 0; i < 16; i++)
+    {
+        unsigned int index = (block[12 + i / 4] >> (2 * (i % 4))) & 3;
+        values[i][0] = luma[i] * 16;
+        values[i][1] = co[index];
+        values[i][2] = cg[index];
+    }
+}
+
+// Multiplies values with fraction_bits fractional bits by a row of the matrix, adding offset and clamping the result
+static unsigned char hap_pixels_yuv_component(const int row[3], const int values[3], int offset, unsigned int fraction_bits)
+{
+    unsigned int shift = 12 + fraction_bits;
+    int sum = row[0] * values[0] + row[1] * values[1] + row[2] * values[2] + (offset << shift) + (1 << (shift - 1));
+    if (sum < 0)
+    {
+        return 0;
+    }
+    sum >>= shift;
+    return (unsigned char)(sum > 255 ? 255 : sum);
+}
+
+// Writes the part of a block at x, y inside the image to the planes
+static void hap_pixels_write_yuv(const HapPixelsYUVJob *job, unsigned int x, unsigned int y, const int values[16][3])
+{
+    unsigned int columns = job->pixels.width - x < 4 ? job->pixels.width - x : 4;
+    unsigned int rows = job->pixels.height - y < 4 ? job->pixels.height - y : 4;
+    unsigned int row, column, i, j, c;
+
+    for (row = 0; row < rows; row++)
+    {
+        unsigned char *luma = job->planes[0] + (y + row) * job->bytes_per_row[0] + x;
+        for (column = 0; column < columns; column++)
+        {
+            luma[column] = hap_pixels_yuv_component(job->matrix[0], values[row * 4 + column], 16, 4);
+        }
+    }
+    for (row = 0; row < rows; row += 2)
+    {
+        size_t cy = (y + row) / 2;
+        for (column = 0; column < columns; column += 2)
+        {
+            size_t cx = (x + column) / 2;
+            int sum[3] = { 0, 0, 0 };
+            unsigned int count = 0;
+            unsigned char cb, cr;
+            for (i = row; i < row + 2 && i < rows; i++)
+            {
+                for (j = column; j < column + 2 && j < columns; j++)
+                {
+                    for (c = 0; c < 3; c++)
+                    {
+                        sum[c] += values[i * 4 + j][c];
+                    }
+                    count++;
+                }
+            }
+            // At the right and bottom edges fewer than four pixels may be inside the image, and count is 1 or 2
+            if (count != 4)
+            {
+                for (c = 0; c < 3; c++)
+                {
+                    sum[c] *= (int)(4 / count);
+                }
+            }
+            cb = hap_pixels_yuv_component(job->matrix[1], sum, 128, 6);
+            cr = hap_pixels_yuv_component(job->matrix[2], sum, 128, 6);
+            if (job->interleaved)
+            {
+                job->planes[1][cy * job->bytes_per_row[1] + cx * 2] = cb;
+                job->planes[1][cy * job->bytes_per_row[1] + cx * 2 + 1] = cr;
+            }
+            else
+            {
+                job->planes[1][cy * job->bytes_per_row[1] + cx] = cb;
+                job->planes[2][cy * job->bytes_per_row[2] + cx] = cr;
+            }
+        }
+    }
+}
+
+/*
+ A HapDecodeChunkFunction which converts part of a texture to YUV
+ */
+static void hap_pixels_convert_chunk_to_yuv(void *p, const void *data, unsigned long offset, unsigned long length)
+{
+    const HapPixelsYUVJob *job = (const HapPixelsYUVJob *)p;
+    const HapPixelsJob *pixels = &job->pixels;
+    size_t first_block, block_count, i;
+
+    if (!hap_pixels_chunk_blocks(pixels, offset, length, &first_block, &block_count))
+    {
+        return;
+    }
+    for (i = 0; i < block_count; i++)
+    {
+        size_t block_index = first_block + i;
+        const unsigned char *block = (const unsigned char *)data + i * pixels->block_bytes;
+        int values[16][3];
+        unsigned int j, c;
+
+        if (job->ycocg)
+        {
+            hap_pixels_ycocg_values(block, values);
+        }
+        else
+        {
+            unsigned char tile[64];
+            pixels->decode_block(pixels, block, tile, 16);
+            for (j = 0; j < 16; j++)
+            {
+                for (c = 0; c < 3; c++)
+                {
+                    values[j][c] = tile[j * 4 + c] * 16;
+                }
+            }
+        }
+        hap_pixels_write_yuv(job,
+                             (unsigned int)(block_index % pixels->blocks_per_row) * 4,
+                             (unsigned int)(block_index / pixels->blocks_per_row) * 4,
+                             (const int (*)[3])values);
+    }
+}
+
+unsigned int HapDecodeFrameToYUV(HapDecoderContext *context,
+                                 const HapFrameInfo *frameInfo,
+                                 unsigned int width, unsigned int height,
+                                 unsigned int yuvFormat,
+                                 unsigned int matrix,
+                                 HapDecodeCallback callback, void *info,
+                                 void **outputPlanes, unsigned long *outputBytesPerRow, unsigned long *outputPlaneBytes)
+{
+    HapPixelsYUVJob job;
+    unsigned int index;
+    unsigned int texture_format;
+    unsigned int plane_count;
+    unsigned int plane;
+
+    /*
+     Check arguments
+     */
+    if (frameInfo == NULL
+        || frameInfo->textureCount == 0
+        || frameInfo->textureCount > 2
+        || width == 0
+        || height == 0
+        || (yuvFormat != HapYUVFormat_NV12 && yuvFormat != HapYUVFormat_I420)
+        || (matrix != HapYUVMatrix_BT601 && matrix != HapYUVMatrix_BT709)
+        || callback == NULL
+        || outputPlanes == NULL
+        || outputBytesPerRow == NULL
+        || outputPlaneBytes == NULL
+        )
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    /*
+     A Hap Q Alpha frame is decoded from its YCoCg texture alone
+     */
+    index = 0;
+    if (frameInfo->textureCount == 2)
+    {
+        index = frameInfo->textures[0].textureFormat == HapTextureFormat_YCoCg_DXT5 ? 0 : 1;
+        if (frameInfo->textures[index].textureFormat != HapTextureFormat_YCoCg_DXT5
+            || frameInfo->textures[1 - index].textureFormat != HapTextureFormat_A_RGTC1)
+        {
+            return HapResult_Bad_Arguments;
+        }
+    }
+    texture_format = frameInfo->textures[index].textureFormat;
+    if (texture_format != HapTextureFormat_RGB_DXT1
+        && texture_format != HapTextureFormat_RGBA_DXT5
+        && texture_format != HapTextureFormat_YCoCg_DXT5
+        && texture_format != HapTextureFormat_RGBA_BPTC_UNORM)
+    {
+        return HapResult_Bad_Arguments;
+    }
+    hap_pixels_job_init(&job.pixels, texture_format, HapPixelFormat_RGBA8, width, height);
+
+    /*
+     The texture must have enough blocks for the dimensions
+     */
+    if ((size_t)job.pixels.blocks_per_row * job.pixels.block_rows * job.pixels.block_bytes > frameInfo->textures[index].decodedBytes)
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    job.interleaved = yuvFormat == HapYUVFormat_NV12;
+    plane_count = job.interleaved ? 2 : 3;
+    for (plane = 0; plane < plane_count; plane++)
+    {
+        unsigned long rows = plane == 0 ? height : (height + 1) / 2;
+        unsigned long row_bytes = plane == 0 ? width : (width + 1) / 2 * (job.interleaved ? 2 : 1);
+        if (outputPlanes[plane] == NULL || outputBytesPerRow[plane] < row_bytes)
+        {
+            return HapResult_Bad_Arguments;
+        }
+        if (outputPlaneBytes[plane] < row_bytes
+            || (outputPlaneBytes[plane] - row_bytes) / outputBytesPerRow[plane] < rows - 1)
+        {
+            return HapResult_Buffer_Too_Small;
+        }
+        job.planes[plane] = (unsigned char *)outputPlanes[plane];
+        job.bytes_per_row[plane] = outputBytesPerRow[plane];
+    }
+
+    job.ycocg = texture_format == HapTextureFormat_YCoCg_DXT5;
+    hap_pixels_yuv_matrix(&job, matrix);
+
+    return HapDecodeChunks(context, frameInfo, index, hap_pixels_convert_chunk_to_yuv, &job, callback, info);
+}
+
+/*
+ Encoding
+ */
+
+typedef struct HapPixelsEncodeJob {
+    const unsigned char *input;
+    size_t input_bytes_per_row;
+    unsigned int width;
+    unsigned int height;
+    unsigned int bgra;
+    unsigned int bytes_per_pixel;
+    unsigned int blocks_per_row;
+    unsigned int quality;
+    unsigned int texture_formats[2];
+} HapPixelsEncodeJob;
+
+// Returns the length of a block in a texture format which can be encoded from pixels, or 0 for any other format
+static unsigned int hap_pixels_encoded_block_bytes(unsigned int texture_format)
+{
+    switch (texture_format) {
+        case HapTextureFormat_RGB_DXT1:
+        case HapTextureFormat_A_RGTC1:
+            return 8;
+        case HapTextureFormat_RGBA_DXT5:
+        case HapTextureFormat_YCoCg_DXT5:
+        case HapTextureFormat_RGBA_BPTC_UNORM:
+        case HapTextureFormat_RGB_BPTC_UNSIGNED_FLOAT:
+        case HapTextureFormat_RGB_BPTC_SIGNED_FLOAT:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+/*
+ Reads the sixteen pixels of a block, in RGBA order for eight-bit pixels, to pixels, which has room for sixteen pixels of
+ half floats. Blocks at the right and bottom edges of the image repeat its last column and row where they extend beyond
+ it.
+ */
+static void hap_pixels_load_block(const HapPixelsEncodeJob *job, unsigned int x, unsigned int y, unsigned char pixels[96])
+{
+    unsigned int bytes_per_pixel = job->bytes_per_pixel;
+    int i, j;
+
+    if (x + 4 <= job->width && y + 4 <= job->height)
+    {
+        for (i = 0; i < 4; i++)
+        {
+            memcpy(pixels + i * 4 * bytes_per_pixel, job->input + (y + i) * job->input_bytes_per_row + (size_t)x * bytes_per_pixel, 4 * bytes_per_pixel);
+        }
+    }
+    else
+    {
+        for (i = 0; i < 4; i++)
+        {
+            unsigned int row = y + i < job->height ? y + i : job->height - 1;
+            for (j = 0; j < 4; j++)
+            {
+                unsigned int column = x + j < job->width ? x + j : job->width - 1;
+                memcpy(pixels + (i * 4 + j) * bytes_per_pixel, job->input + row * job->input_bytes_per_row + (size_t)column * bytes_per_pixel, bytes_per_pixel);
+            }
+        }
+    }
+
+    if (job->bgra)
+    {
+        for (i = 0; i < 64; i += 4)
+        {
+            unsigned char b = pixels[i];
+            pixels[i] = pixels[i + 2];
+            pixels[i + 2] = b;
+        }
+    }
+}
+
+/*
+ Converts a block of pixels to scaled YCoCg, as Co, Cg, scale and Y, for a YCoCg texture.
+
+ Co is half of red minus blue, and Cg a quarter of twice green minus red and blue, so that red is Y + Co - Cg, green is
+ Y + Cg and blue is Y - Co - Cg. Co and Cg are multiplied by the largest scale of 1, 2 or 4 which keeps every pixel's in
+ range, so that blocks of similar colours keep more of their precision.
+ Below, co is twice Co and cg four times Cg, and the scale is applied as a shift.
+ */
+static int hap_pixels_ycocg_shift(int largest)
+{
+    return largest < 128 ? 2 : largest < 256 ? 1 : 0;
+}
+
+// Blue holds 8 times one less than the scale, which is exact for all three scales in five bits
+static const unsigned char hap_pixels_ycocg_scale_values[3] = { 0, 8, 24 };
+
+#if defined(HAP_PIXELS_SSE2)
+
+static void hap_pixels_ycocg_from_rgb_sse2(unsigned char pixels[64])
+{
+    __m128i co[4], cg[4], luma[4];
+    __m128i largest = _mm_setzero_si128();
+    __m128i scale, shift;
+    int row, shift_bits;
+
+    for (row = 0; row < 4; row++)
+    {
+        __m128i values = _mm_loadu_si128((const __m128i *)(pixels + row * 16));
+        __m128i mask = _mm_set1_epi32(0xFF);
+        __m128i r = _mm_and_si128(values, mask);
+        __m128i g2 = _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(values, 8), mask), 1);
+        __m128i b = _mm_and_si128(_mm_srli_epi32(values, 16), mask);
+        __m128i magnitudes;
+        co[row] = _mm_sub_epi32(r, b);
+        cg[row] = _mm_sub_epi32(_mm_sub_epi32(g2, r), b);
+        luma[row] = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(r, g2), _mm_add_epi32(b, _mm_set1_epi32(2))), 2);
+        // Twice co and cg compare on the same scale, and fit in sixteen bits
+        magnitudes = _mm_packs_epi32(_mm_slli_epi32(co[row], 1), cg[row]);
+        magnitudes = _mm_max_epi16(magnitudes, _mm_sub_epi16(_mm_setzero_si128(), magnitudes));
+        largest = _mm_max_epi16(largest, magnitudes);
+    }
+    largest = _mm_max_epi16(largest, _mm_shuffle_epi32(largest, _MM_SHUFFLE(1, 0, 3, 2)));
+    largest = _mm_max_epi16(largest, _mm_shuffle_epi32(largest, _MM_SHUFFLE(2, 3, 0, 1)));
+    largest = _mm_max_epi16(largest, _mm_shufflelo_epi16(largest, _MM_SHUFFLE(2, 3, 0, 1)));
+    shift_bits = hap_pixels_ycocg_shift(_mm_cvtsi128_si32(largest) & 0xFFFF);
+    shift = _mm_cvtsi32_si128(shift_bits);
+    scale = _mm_set1_epi32(hap_pixels_ycocg_scale_values[shift_bits]);
+
+    for (row = 0; row < 4; row++)
+    {
+        // Both values are at least 0 once offset, and packing saturates any 256 to 255
+        __m128i co_value = _mm_srli_epi32(_mm_add_epi32(_mm_sll_epi32(co[row], shift), _mm_set1_epi32(257)), 1);
+        __m128i cg_value = _mm_srli_epi32(_mm_add_epi32(_mm_sll_epi32(cg[row], shift), _mm_set1_epi32(514)), 2);
+        __m128i cocg = _mm_packs_epi32(co_value, cg_value);
+        __m128i sy = _mm_packs_epi32(scale, luma[row]);
+        __m128i first, second;
+        cocg = _mm_unpacklo_epi16(cocg, _mm_unpackhi_epi64(cocg, cocg));
+        sy = _mm_unpacklo_epi16(sy, _mm_unpackhi_epi64(sy, sy));
+        first = _mm_unpacklo_epi32(cocg, sy);
+        second = _mm_unpackhi_epi32(cocg, sy);
+        _mm_storeu_si128((__m128i *)(pixels + row * 16), _mm_packus_epi16(first, second));
+    }
+}
+
+#else
+
+static void hap_pixels_ycocg_from_rgb_scalar(unsigned char pixels[64])
+{
+    int co[16], cg[16];
+    int largest = 0;
+    int i, shift;
+
+    for (i = 0; i < 16; i++)
+    {
+        int r = pixels[i * 4];
+        int g2 = pixels[i * 4 + 1] * 2;
+        int b = pixels[i * 4 + 2];
+        int co_magnitude, cg_magnitude;
+        co[i] = r - b;
+        cg[i] = g2 - r - b;
+        pixels[i * 4 + 3] = (unsigned char)((r + g2 + b + 2) >> 2);
+        co_magnitude = (co[i] < 0 ? -co[i] : co[i]) * 2;
+        cg_magnitude = cg[i] < 0 ? -cg[i] : cg[i];
+        largest = co_magnitude > largest ? co_magnitude : largest;
+        largest = cg_magnitude > largest ? cg_magnitude : largest;
+    }
+    shift = hap_pixels_ycocg_shift(largest);
+
+    for (i = 0; i < 16; i++)
+    {
+        int co_value = (co[i] * (1 << shift) + 257) >> 1;
+        int cg_value = (cg[i] * (1 << shift) + 514) >> 2;
+        pixels[i * 4] = (unsigned char)(co_value > 255 ? 255 : co_value);
+        pixels[i * 4 + 1] = (unsigned char)(cg_value > 255 ? 255 : cg_value);
+        pixels[i * 4 + 2] = hap_pixels_ycocg_scale_values[shift];
+    }
+}
+
+#endif
+
+static unsigned int hap_pixels_pack_565(int r, int g, int b)
+{
+    r = r < 0 ? 0 : r > 255 ? 255 : r;
+    g = g < 0 ? 0 : g > 255 ? 255 : g;
+    b = b < 0 ? 0 : b > 255 ? 255 : b;
+    return (unsigned int)((((r * 31 + 127) / 255) << 11) | (((g * 63 + 127) / 255) << 5) | ((b * 31 + 127) / 255));
+}
+
+// Spreads the low sixteen bits of value to the even bits of the result
+static uint32_t hap_pixels_spread_bits(uint32_t value)
+{
+    value = (value | (value << 8)) & 0x00FF00FF;
+    value = (value | (value << 4)) & 0x0F0F0F0F;
+    value = (value | (value << 2)) & 0x33333333;
+    value = (value | (value << 1)) & 0x55555555;
+    return value;
+}
+
+/*
+ Chooses indices for the four-colour palette of c0 and c1 by projecting each pixel onto the line between the colours.
+ Bit n of each mask is set for pixel n if it is at least one sixth, one half or five sixths of the way from c0 to c1.
+ */
+static uint32_t hap_pixels_indices_from_masks(uint32_t sixth, uint32_t half, uint32_t five_sixths)
+{
+    /*
+     Steps along the line are 0, 1, 2 and 3, which are indices 0, 2, 3 and 1, so the low bit of an index is set from half
+     way, and the high bit for the middle two steps
+     */
+    return hap_pixels_spread_bits(half) | (hap_pixels_spread_bits(sixth & ~five_sixths) << 1);
+}
+
+#if defined(HAP_PIXELS_SSE2)
+
+static uint32_t hap_pixels_project_indices_sse2(const unsigned char pixels[64], const unsigned char palette[16])
+{
+    int axis_r = palette[4] - palette[0];
+    int axis_g = palette[5] - palette[1];
+    int axis_b = palette[6] - palette[2];
+    int total = axis_r * axis_r + axis_g * axis_g + axis_b * axis_b;
+    __m128i base = _mm_set_epi16(0, palette[2], palette[1], palette[0], 0, palette[2], palette[1], palette[0]);
+    __m128i axis = _mm_set_epi16(0, (short)axis_b, (short)axis_g, (short)axis_r, 0, (short)axis_b, (short)axis_g, (short)axis_r);
+    __m128i sixth_threshold = _mm_set1_epi32(total - 1);
+    __m128i half_threshold = _mm_set1_epi32(total * 3 - 1);
+    __m128i five_sixths_threshold = _mm_set1_epi32(total * 5 - 1);
+    uint32_t sixth = 0, half = 0, five_sixths = 0;
+    int row;
+
+    for (row = 0; row < 4; row++)
+    {
+        __m128i values = _mm_loadu_si128((const __m128i *)(pixels + row * 16));
+        // Each multiply-add gives the red and green, and the blue, parts of the projection of two pixels
+        __m128i low = _mm_madd_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(values, _mm_setzero_si128()), base), axis);
+        __m128i high = _mm_madd_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(values, _mm_setzero_si128()), base), axis);
+        __m128i t = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high), _MM_SHUFFLE(2, 0, 2, 0))),
+                                  _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high), _MM_SHUFFLE(3, 1, 3, 1))));
+        t = _mm_add_epi32(_mm_slli_epi32(t, 2), _mm_slli_epi32(t, 1));
+        sixth |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(t, sixth_threshold))) << (row * 4);
+        half |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(t, half_threshold))) << (row * 4);
+        five_sixths |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(t, five_sixths_threshold))) << (row * 4);
+    }
+    return hap_pixels_indices_from_masks(sixth, half, five_sixths);
+}
+
+#else
+
+static uint32_t hap_pixels_project_indices_scalar(const unsigned char pixels[64], const unsigned char palette[16])
+{
+    int axis[3];
+    int total;
+    uint32_t sixth = 0, half = 0, five_sixths = 0;
+    int i;
+
+    for (i = 0; i < 3; i++)
+    {
+        axis[i] = palette[4 + i] - palette[i];
+    }
+    total = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+
+    for (i = 0; i < 16; i++)
+    {
+        const unsigned char *pixel = pixels + i * 4;
+        int t = ((pixel[0] - palette[0]) * axis[0] + (pixel[1] - palette[1]) * axis[1] + (pixel[2] - palette[2]) * axis[2]) * 6;
+        sixth |= (uint32_t)(t >= total) << i;
+        half |= (uint32_t)(t >= total * 3) << i;
+        five_sixths |= (uint32_t)(t >= total * 5) << i;
+    }
+    return hap_pixels_indices_from_masks(sixth, half, five_sixths);
+}
+
+#endif
+
+static void hap_pixels_write_colour_block(unsigned int c0, unsigned int c1, uint32_t indices, unsigned char *colour_block)
+{
+    colour_block[0] = (unsigned char)(c0 & 0xFF);
+    colour_block[1] = (unsigned char)(c0 >> 8);
+    colour_block[2] = (unsigned char)(c1 & 0xFF);
+    colour_block[3] = (unsigned char)(c1 >> 8);
+    colour_block[4] = (unsigned char)(indices & 0xFF);
+    colour_block[5] = (unsigned char)((indices >> 8) & 0xFF);
+    colour_block[6] = (unsigned char)((indices >> 16) & 0xFF);
+    colour_block[7] = (unsigned char)(indices >> 24);
+}
+
+/*
+ Returns the four-colour palette of two 5:6:5 colours, which must be different and in order, and the palette indices
+ nearest each pixel, with the squared error in error
+ */
+static uint32_t hap_pixels_nearest_indices(const unsigned char pixels[64], unsigned int c0, unsigned int c1, unsigned long *error)
+{
+    unsigned char block[4];
+    unsigned char palette[16];
+    uint32_t indices = 0;
+    unsigned long total = 0;
+    int i, k;
+
+    block[0] = (unsigned char)(c0 & 0xFF);
+    block[1] = (unsigned char)(c0 >> 8);
+    block[2] = (unsigned char)(c1 & 0xFF);
+    block[3] = (unsigned char)(c1 >> 8);
+    hap_pixels_colour_palette(block, 0, 0, palette);
+
+    for (i = 0; i < 16; i++)
+    {
+        unsigned long best = ~0UL;
+        uint32_t best_index = 0;
+        for (k = 0; k < 4; k++)
+        {
+            int dr = pixels[i * 4] - palette[k * 4];
+            int dg = pixels[i * 4 + 1] - palette[k * 4 + 1];
+            int db = pixels[i * 4 + 2] - palette[k * 4 + 2];
+            unsigned long distance = (unsigned long)(dr * dr + dg * dg + db * db);
+            if (distance < best)
+            {
+                best = distance;
+                best_index = (uint32_t)k;
+            }
+        }
+        indices |= best_index << (i * 2);
+        total += best;
+    }
+    *error = total;
+    return indices;
+}
+
+/*
+ Orders two colours for a four-colour block, or returns 0 if they are the same, which needs a block of one colour
+ */
+static int hap_pixels_order_colours(unsigned int *c0, unsigned int *c1)
+{
+    if (*c0 < *c1)
+    {
+        unsigned int swap = *c0;
+        *c0 = *c1;
+        *c1 = swap;
+    }
+    return *c0 != *c1;
+}
+
+/*
+ The fast colour encoder takes the corners of the box bounding the pixels' colours, inset slightly to reduce the error
+ of the colours at their extremes, on whichever diagonal follows the colours, and projects each pixel onto the line
+ between them.
+ */
+static void hap_pixels_encode_colour_fast(const unsigned char pixels[64], unsigned char *colour_block)
+{
+    int min[3] = { 255, 255, 255 };
+    int max[3] = { 0, 0, 0 };
+    int centre[3];
+    int covariance_rg = 0, covariance_bg = 0;
+    unsigned int c0, c1;
+    unsigned char palette[16];
+    uint32_t indices;
+    int i, c;
+
+#if defined(HAP_PIXELS_SSE2)
+    {
+        __m128i low = _mm_loadu_si128((const __m128i *)pixels);
+        __m128i high = low;
+        unsigned char extremes[32];
+        for (i = 1; i < 4; i++)
+        {
+            __m128i row = _mm_loadu_si128((const __m128i *)(pixels + i * 16));
+            low = _mm_min_epu8(low, row);
+            high = _mm_max_epu8(high, row);
+        }
+        low = _mm_min_epu8(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(1, 0, 3, 2)));
+        low = _mm_min_epu8(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(2, 3, 0, 1)));
+        high = _mm_max_epu8(high, _mm_shuffle_epi32(high, _MM_SHUFFLE(1, 0, 3, 2)));
+        high = _mm_max_epu8(high, _mm_shuffle_epi32(high, _MM_SHUFFLE(2, 3, 0, 1)));
+        _mm_storeu_si128((__m128i *)extremes, low);
+        _mm_storeu_si128((__m128i *)(extremes + 16), high);
+        for (c = 0; c < 3; c++)
+        {
+            min[c] = extremes[c];
+            max[c] = extremes[16 + c];
+        }
+    }
+#else
+    for (i = 0; i < 16; i++)
+    {
+        for (c = 0; c < 3; c++)
+        {
+            int value = pixels[i * 4 + c];
+            min[c] = value < min[c] ? value : min[c];
+            max[c] = value > max[c] ? value : max[c];
+        }
+    }
+#endif
+
+    for (c = 0; c < 3; c++)
+    {
+        int inset = (max[c] - min[c]) >> 4;
+        min[c] += inset;
+        max[c] -= inset;
+        centre[c] = (min[c] + max[c]) / 2;
+    }
+
+    for (i = 0; i < 16; i++)
+    {
+        int g = pixels[i * 4 + 1] - centre[1];
+        covariance_rg += (pixels[i * 4] - centre[0]) * g;
+        covariance_bg += (pixels[i * 4 + 2] - centre[2]) * g;
+    }
+
+    if (covariance_rg < 0)
+    {
+        int swap = min[0];
+        min[0] = max[0];
+        max[0] = swap;
+    }
+    if (covariance_bg < 0)
+    {
+        int swap = min[2];
+        min[2] = max[2];
+        max[2] = swap;
+    }
+
+    c0 = hap_pixels_pack_565(max[0], max[1], max[2]);
+    c1 = hap_pixels_pack_565(min[0], min[1], min[2]);
+
+    if (!hap_pixels_order_colours(&c0, &c1))
+    {
+        hap_pixels_write_colour_block(c0, c1, 0, colour_block);
+        return;
+    }
+
+    hap_pixels_expand_565(c0, 0, palette);
+    hap_pixels_expand_565(c1, 0, palette + 4);
+#if defined(HAP_PIXELS_SSE2)
+    indices = hap_pixels_project_indices_sse2(pixels, palette);
+#else
+    indices = hap_pixels_project_indices_scalar(pixels, palette);
+#endif
+    hap_pixels_write_colour_block(c0, c1, indices, colour_block);
+}
+
+/*
+ The high quality colour encoder fits a line through the pixels' colours along their principal axis, and then refines
+ the colours at its ends by least squares until they stop improving. The result is compared with the fast encoder's.
+ */
+static void hap_pixels_encode_colour_high(const unsigned char pixels[64], unsigned char *colour_block)
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    float low = 0.0f, high = 0.0f;
+    unsigned int c0, c1;
+    unsigned long error, best_error;
+    uint32_t indices;
+    int i, c, iteration;
+
+    // Start from the fast encoder's result
+    hap_pixels_encode_colour_fast(pixels, colour_block);
+    c0 = colour_block[0] | (colour_block[1] << 8);
+    c1 = colour_block[2] | (colour_block[3] << 8);
+    if (c0 == c1)
+    {
+        // Only a block of one colour gives equal colours, and that can't be improved on
+        return;
+    }
+    // Nearest indices are never worse than projected ones
+    indices = hap_pixels_nearest_indices(pixels, c0, c1, &best_error);
+    hap_pixels_write_colour_block(c0, c1, indices, colour_block);
+
+    for (i = 0; i < 16; i++)
+    {
+        for (c = 0; c < 3; c++)
+        {
+            mean[c] += pixels[i * 4 + c];
+        }
+    }
+    for (c = 0; c < 3; c++)
+    {
+        mean[c] /= 16.0f;
+    }
+    for (i = 0; i < 16; i++)
+    {
+        float r = pixels[i * 4] - mean[0];
+        float g = pixels[i * 4 + 1] - mean[1];
+        float b = pixels[i * 4 + 2] - mean[2];
+        covariance[0] += r * r;
+        covariance[1] += r * g;
+        covariance[2] += r * b;
+        covariance[3] += g * g;
+        covariance[4] += g * b;
+        covariance[5] += b * b;
+    }
+
+    // Power iteration finds the principal axis
+    for (iteration = 0; iteration < 8; iteration++)
+    {
+        float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+        float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+        float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+        float largest = x * x > y * y ? (x * x > z * z ? x : z) : (y * y > z * z ? y : z);
+        if (largest == 0.0f)
+        {
+            break;
+        }
+        axis[0] = x / largest;
+        axis[1] = y / largest;
+        axis[2] = z / largest;
+    }
+
+    for (i = 0; i < 16; i++)
+    {
+        float t = (pixels[i * 4] - mean[0]) * axis[0] + (pixels[i * 4 + 1] - mean[1]) * axis[1] + (pixels[i * 4 + 2] - mean[2]) * axis[2];
+        low = t < low ? t : low;
+        high = t > high ? t : high;
+    }
+    {
+        float length = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+        if (length > 0.0f)
+        {
+            low /= length;
+            high /= length;
+        }
+    }
+
+    c0 = hap_pixels_pack_565((int)(mean[0] + axis[0] * high + 0.5f), (int)(mean[1] + axis[1] * high + 0.5f), (int)(mean[2] + axis[2] * high + 0.5f));
+    c1 = hap_pixels_pack_565((int)(mean[0] + axis[0] * low + 0.5f), (int)(mean[1] + axis[1] * low + 0.5f), (int)(mean[2] + axis[2] * low + 0.5f));
+
+    for (iteration = 0; iteration < 8 && hap_pixels_order_colours(&c0, &c1); iteration++)
+    {
+        /*
+         The palette is c0, c1, (2 c0 + c1) / 3 and (c0 + 2 c1) / 3, so each pixel is a weighted sum of the two colours.
+         Solve for the two colours which best give the pixels with the current indices.
+         */
+        static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+        float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+        float ax[3] = { 0.0f, 0.0f, 0.0f };
+        float bx[3] = { 0.0f, 0.0f, 0.0f };
+        float determinant;
+        int ends[2][3];
+
+        indices = hap_pixels_nearest_indices(pixels, c0, c1, &error);
+        if (error < best_error)
+        {
+            best_error = error;
+            hap_pixels_write_colour_block(c0, c1, indices, colour_block);
+        }
+        else if (iteration > 0)
+        {
+            break;
+        }
+
+        for (i = 0; i < 16; i++)
+        {
+            float a = weights[(indices >> (i * 2)) & 3];
+            float b = 1.0f - a;
+            aa += a * a;
+            bb += b * b;
+            ab += a * b;
+            for (c = 0; c < 3; c++)
+            {
+                ax[c] += a * pixels[i * 4 + c];
+                bx[c] += b * pixels[i * 4 + c];
+            }
+        }
+        determinant = aa * bb - ab * ab;
+        if (determinant == 0.0f)
+        {
+            break;
+        }
+        for (c = 0; c < 3; c++)
+        {
+            ends[0][c] = (int)((ax[c] * bb - bx[c] * ab) / determinant + 0.5f);
+            ends[1][c] = (int)((bx[c] * aa - ax[c] * ab) / determinant + 0.5f);
+        }
+        c0 = hap_pixels_pack_565(ends[0][0], ends[0][1], ends[0][2]);
+        c1 = hap_pixels_pack_565(ends[1][0], ends[1][1], ends[1][2]);
+    }
+}
+
+static void hap_pixels_write_alpha_block(unsigned int a0, unsigned int a1, uint64_t indices, unsigned char *alpha_block)
+{
+    int i;
+    alpha_block[0] = (unsigned char)a0;
+    alpha_block[1] = (unsigned char)a1;
+    for (i = 0; i < 6; i++)
+    {
+        alpha_block[2 + i] = (unsigned char)((indices >> (i * 8)) & 0xFF);
+    }
+}
+
+/*
+ Returns the indices nearest each value for the palette of a0 and a1, with the squared error in error
+ */
+static uint64_t hap_pixels_nearest_alpha_indices(const unsigned char values[16], unsigned int a0, unsigned int a1, unsigned long *error)
+{
+    unsigned char block[2];
+    unsigned char palette[8];
+    uint64_t indices = 0;
+    unsigned long total = 0;
+    int i, k;
+
+    block[0] = (unsigned char)a0;
+    block[1] = (unsigned char)a1;
+    hap_pixels_alpha_palette(block, palette);
+
+    for (i = 0; i < 16; i++)
+    {
+        unsigned long best = ~0UL;
+        uint64_t best_index = 0;
+        for (k = 0; k < 8; k++)
+        {
+            int difference = values[i] - palette[k];
+            unsigned long distance = (unsigned long)(difference * difference);
+            if (distance < best)
+            {
+                best = distance;
+                best_index = (uint64_t)k;
+            }
+        }
+        indices |= best_index << (i * 3);
+        total += best;
+    }
+    *error = total;
+    return indices;
+}
+
+/*
+ Encodes sixteen values as a DXT5 alpha or RGTC1 block. Both qualities use eight values between the least and greatest.
+ The high quality encoder picks nearest values exactly, and also tries six values between the least and greatest
+ excluding 0 and 255, which the palette then includes.
+ */
+static void hap_pixels_encode_alpha(const unsigned char values[16], unsigned int quality, unsigned char *alpha_block)
+{
+    unsigned int min = 255, max = 0;
+    unsigned int inner_min = 255, inner_max = 0;
+    uint64_t indices = 0;
+    int i;
+
+    for (i = 0; i < 16; i++)
+    {
+        unsigned int value = values[i];
+        min = value < min ? value : min;
+        max = value > max ? value : max;
+        if (value != 0 && value != 255)
+        {
+            inner_min = value < inner_min ? value : inner_min;
+            inner_max = value > inner_max ? value : inner_max;
+        }
+    }
+
+    if (min == max)
+    {
+        hap_pixels_write_alpha_block(min, max, 0, alpha_block);
+        return;
+    }
+
+    if (quality == HapPixelsQuality_Fast)
+    {
+        /*
+         Palette entries from a0 to a1 are indices 0, 2, 3, 4, 5, 6, 7 and 1
+         */
+        float scale = 7.0f / (float)(max - min);
+        for (i = 0; i < 16; i++)
+        {
+            uint64_t step = (uint64_t)((float)(max - values[i]) * scale + 0.5f);
+            uint64_t index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+            indices |= index << (i * 3);
+        }
+        hap_pixels_write_alpha_block(max, min, indices, alpha_block);
+    }
+    else
+    {
+        unsigned long error, six_error;
+        indices = hap_pixels_nearest_alpha_indices(values, max, min, &error);
+        hap_pixels_write_alpha_block(max, min, indices, alpha_block);
+        if (inner_min <= inner_max && (min == 0 || max == 255))
+        {
+            uint64_t six_indices = hap_pixels_nearest_alpha_indices(values, inner_min, inner_max, &six_error);
+            if (six_error < error)
+            {
+                hap_pixels_write_alpha_block(inner_min, inner_max, six_indices, alpha_block);
+            }
+        }
+    }
+}
+
+/*
+ BPTC encoding
+
+ Blocks are encoded with one subset, as a line through the pixels of the whole block: BC7 blocks in mode 6 with seven
+ bits and a low bit for each end, and BC6H blocks in the one-region modes. The high quality encoders refine the ends of
+ the line by least squares and, for BC6H, try every one-region mode.
+ */
+static void hap_pixels_write_bits(HapPixelsBits *bits, unsigned int value, unsigned int count)
+{
+    uint64_t masked = value & (((uint64_t)1 << count) - 1);
+    unsigned int position = bits->position;
+    if (position >= 64)
+    {
+        bits->high |= masked << (position - 64);
+    }
+    else
+    {
+        bits->low |= masked << position;
+        if (position + count > 64)
+        {
+            bits->high |= masked >> (64 - position);
+        }
+    }
+    bits->position += count;
+}
+
+static void hap_pixels_bits_store(const HapPixelsBits *bits, unsigned char *block)
+{
+    int i;
+    for (i = 0; i < 8; i++)
+    {
+        block[i] = (unsigned char)(bits->low >> (i * 8));
+        block[8 + i] = (unsigned char)(bits->high >> (i * 8));
+    }
+}
+
+/*
+ Fits a line through sixteen values of up to four channels, as the corners of their bounding box on the diagonal which
+ follows the values for the fast encoders, or along their principal axis. The ends are ordered so that the first pixel,
+ whose index is stored without its high bit, is nearer the first.
+ */
+static void hap_pixels_bptc_fit(const float values[16][4], unsigned int channels, unsigned int quality, float ends[2][4])
+{
+    float dot = 0.0f, span = 0.0f;
+    unsigned int i, c, d;
+
+    if (quality == HapPixelsQuality_Fast)
+    {
+        float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        unsigned int reference = 0;
+        for (c = 0; c < channels; c++)
+        {
+            ends[0][c] = ends[1][c] = values[0][c];
+            for (i = 0; i < 16; i++)
+            {
+                ends[0][c] = values[i][c] < ends[0][c] ? values[i][c] : ends[0][c];
+                ends[1][c] = values[i][c] > ends[1][c] ? values[i][c] : ends[1][c];
+                mean[c] += values[i][c];
+            }
+            mean[c] /= 16.0f;
+            if (ends[1][c] - ends[0][c] > ends[1][reference] - ends[0][reference])
+            {
+                reference = c;
+            }
+        }
+        // Channels which fall as the widest channel rises run the other way along the diagonal
+        for (c = 0; c < channels; c++)
+        {
+            float covariance = 0.0f;
+            for (i = 0; i < 16 && c != reference; i++)
+            {
+                covariance += (values[i][c] - mean[c]) * (values[i][reference] - mean[reference]);
+            }
+            if (covariance < 0.0f)
+            {
+                float swap = ends[0][c];
+                ends[0][c] = ends[1][c];
+                ends[1][c] = swap;
+            }
+        }
+    }
+    else
+    {
+        float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        float covariance[4][4] = { { 0.0f } };
+        float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        float low = 0.0f, high = 0.0f, length = 0.0f;
+        int iteration;
+
+        for (i = 0; i < 16; i++)
+        {
+            for (c = 0; c < channels; c++)
+            {
+                mean[c] += values[i][c] / 16.0f;
+            }
+        }
+        for (i = 0; i < 16; i++)
+        {
+            for (c = 0; c < channels; c++)
+            {
+                for (d = 0; d < channels; d++)
+                {
+                    covariance[c][d] += (values[i][c] - mean[c]) * (values[i][d] - mean[d]);
+                }
+            }
+        }
+        // Power iteration finds the principal axis
+        for (iteration = 0; iteration < 8; iteration++)
+        {
+            float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            float largest = 0.0f;
+            for (c = 0; c < channels; c++)
+            {
+                for (d = 0; d < channels; d++)
+                {
+                    next[c] += covariance[c][d] * axis[d];
+                }
+                largest = next[c] * next[c] > largest * largest ? next[c] : largest;
+            }
+            if (largest == 0.0f)
+            {
+                break;
+            }
+            for (c = 0; c < channels; c++)
+            {
+                axis[c] = next[c] / largest;
+            }
+        }
+        for (i = 0; i < 16; i++)
+        {
+            float t = 0.0f;
+            for (c = 0; c < channels; c++)
+            {
+                t += (values[i][c] - mean[c]) * axis[c];
+            }
+            low = t < low ? t : low;
+            high = t > high ? t : high;
+        }
+        for (c = 0; c < channels; c++)
+        {
+            length += axis[c] * axis[c];
+        }
+        for (c = 0; c < channels; c++)
+        {
+            ends[0][c] = mean[c] + (length > 0.0f ? axis[c] * low / length : 0.0f);
+            ends[1][c] = mean[c] + (length > 0.0f ? axis[c] * high / length : 0.0f);
+        }
+    }
+
+    for (c = 0; c < channels; c++)
+    {
+        float direction = ends[1][c] - ends[0][c];
+        dot += (values[0][c] - ends[0][c]) * direction;
+        span += direction * direction;
+    }
+    if (dot * 2.0f > span)
+    {
+        for (c = 0; c < channels; c++)
+        {
+            float swap = ends[0][c];
+            ends[0][c] = ends[1][c];
+            ends[1][c] = swap;
+        }
+    }
+}
+
+/*
+ Solves for the ends of the line which best give the values with the current weights of the second end, returning 0 if
+ the weights don't determine them
+ */
+static int hap_pixels_bptc_refine(const float values[16][4], unsigned int channels, const unsigned char weights[16], float ends[2][4])
+{
+    float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+    float ax[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float bx[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float determinant;
+    unsigned int i, c;
+
+    for (i = 0; i < 16; i++)
+    {
+        float b = weights[i] / 64.0f;
+        float a = 1.0f - b;
+        aa += a * a;
+        bb += b * b;
+        ab += a * b;
+        for (c = 0; c < channels; c++)
+        {
+            ax[c] += a * values[i][c];
+            bx[c] += b * values[i][c];
+        }
+    }
+    determinant = aa * bb - ab * ab;
+    if (determinant == 0.0f)
+    {
+        return 0;
+    }
+    for (c = 0; c < channels; c++)
+    {
+        ends[0][c] = (ax[c] * bb - bx[c] * ab) / determinant;
+        ends[1][c] = (bx[c] * aa - ax[c] * ab) / determinant;
+    }
+    return 1;
+}
+
+/*
+ Chooses the index of each value from a palette of four or sixteen, by projecting onto the line between the palette's
+ ends for the fast encoders, or as the nearest entry. Returns the squared error.
+ */
+static uint64_t hap_pixels_bptc_indices(const int values[16][4], const int palette[16][4], unsigned int levels, unsigned int channels,
+                                        unsigned int quality, unsigned char indices[16])
+{
+    const int *last = palette[levels - 1];
+    float length = 0.0f, scale = 0.0f;
+    uint64_t error = 0;
+    unsigned int i, c, k;
+
+    for (c = 0; c < channels; c++)
+    {
+        float direction = (float)(last[c] - palette[0][c]);
+        length += direction * direction;
+    }
+    if (length > 0.0f)
+    {
+        scale = (float)(levels - 1) / length;
+    }
+    for (i = 0; i < 16; i++)
+    {
+        uint64_t best = 0;
+        if (quality == HapPixelsQuality_Fast)
+        {
+            float dot = 0.0f;
+            unsigned int index = 0;
+            for (c = 0; c < channels; c++)
+            {
+                dot += (float)(values[i][c] - palette[0][c]) * (float)(last[c] - palette[0][c]);
+            }
+            if (dot > 0.0f)
+            {
+                index = (unsigned int)(dot * scale + 0.5f);
+                index = index > levels - 1 ? levels - 1 : index;
+            }
+            indices[i] = (unsigned char)index;
+            for (c = 0; c < channels; c++)
+            {
+                int64_t difference = values[i][c] - palette[index][c];
+                best += (uint64_t)(difference * difference);
+            }
+        }
+        else
+        {
+            for (k = 0; k < levels; k++)
+            {
+                uint64_t distance = 0;
+                for (c = 0; c < channels; c++)
+                {
+                    int64_t difference = values[i][c] - palette[k][c];
+                    distance += (uint64_t)(difference * difference);
+                }
+                if (k == 0 || distance < best)
+                {
+                    best = distance;
+                    indices[i] = (unsigned char)k;
+                }
+            }
+        }
+        error += best;
+    }
+    return error;
+}
+
+#if defined(HAP_PIXELS_SSE2)
+
+/*
+ The fast encoders' projection for BC7, whose values fit in 16-bit lanes. Dot products are formed for two pixels at a
+ time with madd, and scaled to indices in floats exactly as hap_pixels_bptc_indices() scales them.
+ */
+static uint64_t hap_pixels_bc7_project_sse2(const int values[16][4], const int palette[16][4], unsigned int levels, unsigned int channels,
+                                            unsigned char indices[16])
+{
+    const int *last = palette[levels - 1];
+    int direction[4] = { 0, 0, 0, 0 };
+    float length = 0.0f, scale = 0.0f;
+    __m128i origin, directions, channel_mask, largest, errors = _mm_setzero_si128();
+    __m128 scales;
+    int32_t chosen[4], sums[4];
+    unsigned int i, c;
+
+    for (c = 0; c < channels; c++)
+    {
+        direction[c] = last[c] - palette[0][c];
+        length += (float)direction[c] * (float)direction[c];
+    }
+    if (length > 0.0f)
+    {
+        scale = (float)(levels - 1) / length;
+    }
+    origin = _mm_set_epi16((short)palette[0][3], (short)palette[0][2], (short)palette[0][1], (short)palette[0][0],
+                           (short)palette[0][3], (short)palette[0][2], (short)palette[0][1], (short)palette[0][0]);
+    directions = _mm_set_epi16((short)direction[3], (short)direction[2], (short)direction[1], (short)direction[0],
+                               (short)direction[3], (short)direction[2], (short)direction[1], (short)direction[0]);
+    channel_mask = _mm_set_epi16(channels > 3 ? -1 : 0, channels > 2 ? -1 : 0, channels > 1 ? -1 : 0, -1,
+                                 channels > 3 ? -1 : 0, channels > 2 ? -1 : 0, channels > 1 ? -1 : 0, -1);
+    largest = _mm_set1_epi32((int)levels - 1);
+    scales = _mm_set1_ps(scale);
+
+    for (i = 0; i < 16; i += 4)
+    {
+        __m128i first = _mm_packs_epi32(_mm_loadu_si128((const __m128i *)values[i]), _mm_loadu_si128((const __m128i *)values[i + 1]));
+        __m128i second = _mm_packs_epi32(_mm_loadu_si128((const __m128i *)values[i + 2]), _mm_loadu_si128((const __m128i *)values[i + 3]));
+        __m128 first_dots = _mm_castsi128_ps(_mm_madd_epi16(_mm_sub_epi16(first, origin), directions));
+        __m128 second_dots = _mm_castsi128_ps(_mm_madd_epi16(_mm_sub_epi16(second, origin), directions));
+        // Each madd gives two partial sums per pixel, which are added to give four dot products
+        __m128i dots = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(first_dots, second_dots, _MM_SHUFFLE(2, 0, 2, 0))),
+                                     _mm_castps_si128(_mm_shuffle_ps(first_dots, second_dots, _MM_SHUFFLE(3, 1, 3, 1))));
+        __m128i index = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(dots), scales), _mm_set1_ps(0.5f)));
+        __m128i over = _mm_cmpgt_epi32(index, largest);
+        index = _mm_and_si128(index, _mm_cmpgt_epi32(dots, _mm_setzero_si128()));
+        index = _mm_or_si128(_mm_andnot_si128(over, index), _mm_and_si128(over, largest));
+        _mm_storeu_si128((__m128i *)chosen, index);
+
+        for (c = 0; c < 4; c += 2)
+        {
+            __m128i pixels = c == 0 ? first : second;
+            __m128i chosen_palette = _mm_packs_epi32(_mm_loadu_si128((const __m128i *)palette[chosen[c]]),
+                                                     _mm_loadu_si128((const __m128i *)palette[chosen[c + 1]]));
+            __m128i difference = _mm_and_si128(_mm_sub_epi16(pixels, chosen_palette), channel_mask);
+            errors = _mm_add_epi32(errors, _mm_madd_epi16(difference, difference));
+            indices[i + c] = (unsigned char)chosen[c];
+            indices[i + c + 1] = (unsigned char)chosen[c + 1];
+        }
+    }
+    _mm_storeu_si128((__m128i *)sums, errors);
+    return (uint64_t)sums[0] + (uint64_t)sums[1] + (uint64_t)sums[2] + (uint64_t)sums[3];
+}
+
+#endif
+
+// Chooses the indices of a BC7 block's eight-bit values
+static uint64_t hap_pixels_bc7_indices(const int values[16][4], const int palette[16][4], unsigned int levels, unsigned int channels,
+                                       unsigned int quality, unsigned char indices[16])
+{
+#if defined(HAP_PIXELS_SSE2)
+    if (quality == HapPixelsQuality_Fast)
+    {
+        return hap_pixels_bc7_project_sse2(values, palette, levels, channels, indices);
+    }
+#endif
+    return hap_pixels_bptc_indices(values, palette, levels, channels, quality, indices);
+}
+
+/*
+ Encodes a BC7 block in mode 6 from the ends of a line, returning the squared error and the weight of each pixel's index
+ */
+static uint64_t hap_pixels_bc7_encode_ends(const int values[16][4], const float ends[2][4], unsigned int quality,
+                                           unsigned char *block, unsigned char weights[16])
+{
+    int quantized[2][4];
+    unsigned int pbits[2];
+    int palette[16][4];
+    unsigned char indices[16];
+    HapPixelsBits bits = { 0, 0, 0 };
+    uint64_t error;
+    unsigned int i, e, c, p;
+
+    // Each end has seven bits per channel and a low bit shared by its channels
+    for (e = 0; e < 2; e++)
+    {
+        float best = 0.0f;
+        for (p = 0; p < 2; p++)
+        {
+            int candidate[4];
+            float difference = 0.0f;
+            for (c = 0; c < 4; c++)
+            {
+                float target = ends[e][c] < 0.0f ? 0.0f : ends[e][c] > 255.0f ? 255.0f : ends[e][c];
+                float offset;
+                candidate[c] = (int)((target - (float)p) / 2.0f + 0.5f);
+                candidate[c] = candidate[c] > 127 ? 127 : candidate[c];
+                offset = (float)(candidate[c] * 2 + (int)p) - target;
+                difference += offset * offset;
+            }
+            if (p == 0 || difference < best)
+            {
+                best = difference;
+                pbits[e] = p;
+                memcpy(quantized[e], candidate, sizeof(candidate));
+            }
+        }
+    }
+    for (i = 0; i < 16; i++)
+    {
+        for (c = 0; c < 4; c++)
+        {
+            int end0 = quantized[0][c] * 2 + (int)pbits[0];
+            int end1 = quantized[1][c] * 2 + (int)pbits[1];
+            palette[i][c] = ((64 - hap_pixels_bptc_weights4[i]) * end0 + hap_pixels_bptc_weights4[i] * end1 + 32) >> 6;
+        }
+    }
+    error = hap_pixels_bc7_indices(values, (const int (*)[4])palette, 16, 4, quality, indices);
+
+    // The first pixel's index must be in the lower half of the palette, which exchanging the ends achieves
+    if (indices[0] >= 8)
+    {
+        for (c = 0; c < 4; c++)
+        {
+            int swap = quantized[0][c];
+            quantized[0][c] = quantized[1][c];
+            quantized[1][c] = swap;
+        }
+        p = pbits[0];
+        pbits[0] = pbits[1];
+        pbits[1] = p;
+        for (i = 0; i < 16; i++)
+        {
+            indices[i] = (unsigned char)(15 - indices[i]);
+        }
+    }
+
+    hap_pixels_write_bits(&bits, 1 << 6, 7);
+    for (c = 0; c < 4; c++)
+    {
+        hap_pixels_write_bits(&bits, (unsigned int)quantized[0][c], 7);
+        hap_pixels_write_bits(&bits, (unsigned int)quantized[1][c], 7);
+    }
+    hap_pixels_write_bits(&bits, pbits[0], 1);
+    hap_pixels_write_bits(&bits, pbits[1], 1);
+    for (i = 0; i < 16; i++)
+    {
+        hap_pixels_write_bits(&bits, indices[i], i == 0 ? 3 : 4);
+        weights[i] = hap_pixels_bptc_weights4[indices[i]];
+    }
+    hap_pixels_bits_store(&bits, block);
+    return error;
+}
+
+/*
+ Encodes a BC7 block in mode 5 from the ends of a line through the colours, with alpha given its own indices between its
+ least and greatest values, returning the squared error and the weight of each pixel's colour index
+ */
+static uint64_t hap_pixels_bc7_encode_ends_mode5(const int values[16][4], const float ends[2][4], unsigned int quality,
+                                                 unsigned char *block, unsigned char weights[16])
+{
+    int colours[2][3];
+    int alphas[2] = { 255, 0 };
+    int palette[16][4] = { { 0 } };
+    int alpha_values[16][4] = { { 0 } };
+    unsigned char indices[16], alpha_indices[16];
+    HapPixelsBits bits = { 0, 0, 0 };
+    uint64_t error;
+    unsigned int i, e, c;
+
+    for (e = 0; e < 2; e++)
+    {
+        for (c = 0; c < 3; c++)
+        {
+            float target = ends[e][c] < 0.0f ? 0.0f : ends[e][c] > 255.0f ? 255.0f : ends[e][c];
+            colours[e][c] = (int)(target * 127.0f / 255.0f + 0.5f);
+        }
+    }
+    for (i = 0; i < 16; i++)
+    {
+        alpha_values[i][0] = values[i][3];
+        alphas[0] = values[i][3] < alphas[0] ? values[i][3] : alphas[0];
+        alphas[1] = values[i][3] > alphas[1] ? values[i][3] : alphas[1];
+    }
+    for (i = 0; i < 4; i++)
+    {
+        for (c = 0; c < 3; c++)
+        {
+            int end0 = (colours[0][c] << 1) | (colours[0][c] >> 6);
+            int end1 = (colours[1][c] << 1) | (colours[1][c] >> 6);
+            palette[i][c] = ((64 - hap_pixels_bptc_weights2[i]) * end0 + hap_pixels_bptc_weights2[i] * end1 + 32) >> 6;
+        }
+    }
+    error = hap_pixels_bc7_indices(values, (const int (*)[4])palette, 4, 3, quality, indices);
+    for (i = 0; i < 4; i++)
+    {
+        palette[i][0] = ((64 - hap_pixels_bptc_weights2[i]) * alphas[0] + hap_pixels_bptc_weights2[i] * alphas[1] + 32) >> 6;
+    }
+    error += hap_pixels_bc7_indices((const int (*)[4])alpha_values, (const int (*)[4])palette, 4, 1, quality, alpha_indices);
+
+    // The first pixel's indices must be in the lower half of their palettes
+    if (indices[0] >= 2)
+    {
+        for (c = 0; c < 3; c++)
+        {
+            int swap = colours[0][c];
+            colours[0][c] = colours[1][c];
+            colours[1][c] = swap;
+        }
+        for (i = 0; i < 16; i++)
+        {
+            indices[i] = (unsigned char)(3 - indices[i]);
+        }
+    }
+    if (alpha_indices[0] >= 2)
+    {
+        int swap = alphas[0];
+        alphas[0] = alphas[1];
+        alphas[1] = swap;
+        for (i = 0; i < 16; i++)
+        {
+            alpha_indices[i] = (unsigned char)(3 - alpha_indices[i]);
+        }
+    }
+
+    hap_pixels_write_bits(&bits, 1 << 5, 6);
+    hap_pixels_write_bits(&bits, 0, 2); // No rotation
+    for (c = 0; c < 3; c++)
+    {
+        hap_pixels_write_bits(&bits, (unsigned int)colours[0][c], 7);
+        hap_pixels_write_bits(&bits, (unsigned int)colours[1][c], 7);
+    }
+    hap_pixels_write_bits(&bits, (unsigned int)alphas[0], 8);
+    hap_pixels_write_bits(&bits, (unsigned int)alphas[1], 8);
+    for (i = 0; i < 16; i++)
+    {
+        hap_pixels_write_bits(&bits, indices[i], i == 0 ? 1 : 2);
+        weights[i] = hap_pixels_bptc_weights2[indices[i]];
+    }
+    for (i = 0; i < 16; i++)
+    {
+        hap_pixels_write_bits(&bits, alpha_indices[i], i == 0 ? 1 : 2);
+    }
+    hap_pixels_bits_store(&bits, block);
+    return error;
+}
+
+typedef uint64_t (*HapPixelsBC7EndsFunction)(const int values[16][4], const float ends[2][4], unsigned int quality,
+                                             unsigned char *block, unsigned char weights[16]);
+
+/*
+ Encodes a block in one mode from a line fitted through the first channels of its values, refining the line for the
+ high quality encoder while that improves the block. Returns the squared error.
+ */
+static uint64_t hap_pixels_bc7_encode_mode(HapPixelsBC7EndsFunction function, const int integers[16][4], const float values[16][4],
+                                           unsigned int channels, unsigned int quality, unsigned char *block)
+{
+    float ends[2][4];
+    unsigned char weights[16];
+    unsigned char candidate[16];
+    uint64_t error, best_error;
+    int iteration;
+
+    hap_pixels_bptc_fit(values, channels, quality, ends);
+    best_error = function(integers, (const float (*)[4])ends, quality, block, weights);
+
+    for (iteration = 0; quality != HapPixelsQuality_Fast && best_error > 0 && iteration < 4; iteration++)
+    {
+        if (!hap_pixels_bptc_refine(values, channels, weights, ends))
+        {
+            break;
+        }
+        error = function(integers, (const float (*)[4])ends, quality, candidate, weights);
+        if (error >= best_error)
+        {
+            break;
+        }
+        best_error = error;
+        memcpy(block, candidate, 16);
+    }
+    return best_error;
+}
+
+/*
+ Blocks are encoded in mode 6, as a line through their colour and alpha. Where alpha varies the block is also encoded in
+ mode 5, which gives alpha its own indices, and the better of the two is kept.
+ */
+static void hap_pixels_encode_bc7(const unsigned char pixels[64], unsigned int quality, unsigned char *block)
+{
+    float values[16][4];
+    int integers[16][4];
+    unsigned char candidate[16];
+    uint64_t error;
+    int alpha_varies = 0;
+    unsigned int i, c;
+
+    for (i = 0; i < 16; i++)
+    {
+        for (c = 0; c < 4; c++)
+        {
+            integers[i][c] = pixels[i * 4 + c];
+            values[i][c] = pixels[i * 4 + c];
+        }
+        alpha_varies = alpha_varies || pixels[i * 4 + 3] != pixels[3];
+    }
+    error = hap_pixels_bc7_encode_mode(hap_pixels_bc7_encode_ends, (const int (*)[4])integers, (const float (*)[4])values, 4, quality, block);
+    if (alpha_varies
+        && hap_pixels_bc7_encode_mode(hap_pixels_bc7_encode_ends_mode5, (const int (*)[4])integers, (const float (*)[4])values, 3, quality, candidate) < error)
+    {
+        memcpy(block, candidate, 16);
+    }
+}
+
+/*
+ BC6H blocks are encoded from the values their ends are interpolated as, which are the bits of the pixels' half floats
+ scaled by 64 / 31, or 32 / 31 with a sign, so that finishing them gives the half floats back. Infinities are encoded as
+ the largest finite value, and NaN and, for an unsigned texture, negative values as zero.
+ */
+static int hap_pixels_bc6h_from_half(uint16_t half, int is_signed)
+{
+    int magnitude = half & 0x7FFF;
+    if (magnitude > 0x7C00)
+    {
+        return 0;
+    }
+    if (magnitude == 0x7C00)
+    {
+        magnitude = 0x7BFF;
+    }
+    if (!is_signed)
+    {
+        return (half & 0x8000) ? 0 : (magnitude * 64 + 30) / 31;
+    }
+    magnitude = (magnitude * 32 + 30) / 31;
+    return (half & 0x8000) ? -magnitude : magnitude;
+}
+
+/*
+ Reduces an end to the bits it is stored with, rounding down, or up if upward is set, so that the interpolated values
+ between the ends of a line cover the values it was fitted through
+ */
+static int hap_pixels_bc6h_quantize(float end, unsigned int bits, int is_signed, int upward)
+{
+    int value = (int)(end < 0.0f ? end - 0.5f : end + 0.5f);
+    int lowest = is_signed ? -((1 << (bits - 1)) - 1) : 0;
+    int highest = is_signed ? (1 << (bits - 1)) - 1 : (1 << bits) - 1;
+    int quantized;
+
+    if (!is_signed)
+    {
+        value = value < 0 ? 0 : value > 0xFFFF ? 0xFFFF : value;
+        quantized = bits >= 16 ? value : (value << bits) >> 16;
+    }
+    else
+    {
+        int magnitude = value < 0 ? -value : value;
+        magnitude = magnitude > 0x7FFF ? 0x7FFF : magnitude;
+        value = value < 0 ? -magnitude : magnitude;
+        quantized = bits >= 16 ? magnitude : (magnitude << (bits - 1)) >> 15;
+        quantized = value < 0 ? -quantized : quantized;
+    }
+    quantized = quantized < lowest ? lowest : quantized > highest ? highest : quantized;
+
+    if (upward && quantized < highest && hap_pixels_bc6h_unquantize(quantized, bits, is_signed) < value)
+    {
+        quantized++;
+    }
+    else if (!upward && quantized > lowest && hap_pixels_bc6h_unquantize(quantized, bits, is_signed) > value)
+    {
+        quantized--;
+    }
+    return quantized;
+}
+
+/*
+ Encodes a BC6H block in a one-region mode from the ends of a line, returning the squared error and the weight of each
+ pixel's index. Where a mode stores the second end as a difference from the first, differences out of range are clamped.
+ */
+static uint64_t hap_pixels_bc6h_encode_ends(const int values[16][4], const HapPixelsBC6HMode *mode, int is_signed,
+                                            const float ends[2][4], unsigned int quality,
+                                            unsigned char *block, unsigned char weights[16])
+{
+    int quantized[2][3];
+    int palette[16][4];
+    unsigned char indices[16];
+    unsigned int fields[13] = { 0 };
+    unsigned int endpoint_mask = (1u << mode->endpoint_bits) - 1;
+    HapPixelsBits bits = { 0, 0, 0 };
+    uint64_t error;
+    unsigned int i, c;
+    int reversible = 1;
+
+    for (c = 0; c < 3; c++)
+    {
+        quantized[0][c] = hap_pixels_bc6h_quantize(ends[0][c], mode->endpoint_bits, is_signed, ends[0][c] > ends[1][c]);
+        quantized[1][c] = hap_pixels_bc6h_quantize(ends[1][c], mode->endpoint_bits, is_signed, ends[1][c] >= ends[0][c]);
+        if (mode->transformed)
+        {
+            int limit = 1 << (mode->delta_bits[c] - 1);
+            int delta = quantized[1][c] - quantized[0][c];
+            delta = delta < -limit ? -limit : delta > limit - 1 ? limit - 1 : delta;
+            quantized[1][c] = quantized[0][c] + delta;
+            // The ends can only be exchanged if the negated difference is in range too
+            reversible = reversible && delta != -limit;
+        }
+    }
+    for (i = 0; i < 16; i++)
+    {
+        for (c = 0; c < 3; c++)
+        {
+            palette[i][c] = hap_pixels_bc6h_interpolate(hap_pixels_bc6h_unquantize(quantized[0][c], mode->endpoint_bits, is_signed),
+                                                        hap_pixels_bc6h_unquantize(quantized[1][c], mode->endpoint_bits, is_signed),
+                                                        hap_pixels_bptc_weights4[i]);
+        }
+    }
+    error = hap_pixels_bptc_indices(values, (const int (*)[4])palette, 16, 3, quality, indices);
+
+    // The first pixel's index must be in the lower half of the palette
+    if (indices[0] >= 8 && reversible)
+    {
+        for (c = 0; c < 3; c++)
+        {
+            int swap = quantized[0][c];
+            quantized[0][c] = quantized[1][c];
+            quantized[1][c] = swap;
+        }
+        for (i = 0; i < 16; i++)
+        {
+            indices[i] = (unsigned char)(15 - indices[i]);
+        }
+    }
+    else if (indices[0] >= 8)
+    {
+        error = 0;
+        indices[0] = 7;
+        for (i = 0; i < 16; i++)
+        {
+            for (c = 0; c < 3; c++)
+            {
+                int64_t difference = values[i][c] - palette[indices[i]][c];
+                error += (uint64_t)(difference * difference);
+            }
+        }
+    }
+
+    for (c = 0; c < 3; c++)
+    {
+        fields[kHapBC6HFieldW + c] = (unsigned int)quantized[0][c] & endpoint_mask;
+        if (mode->transformed)
+        {
+            fields[kHapBC6HFieldX + c] = (unsigned int)(quantized[1][c] - quantized[0][c]) & ((1u << mode->delta_bits[c]) - 1);
+        }
+        else
+        {
+            fields[kHapBC6HFieldX + c] = (unsigned int)quantized[1][c] & endpoint_mask;
+        }
+    }
+    hap_pixels_write_bits(&bits, mode->mode, mode->mode_bits);
+    for (i = 0; i < mode->run_count; i++)
+    {
+        const unsigned char *run = mode->runs[i];
+        int bit;
+        if (run[1] >= run[2])
+        {
+            hap_pixels_write_bits(&bits, fields[run[0]] >> run[2], run[1] - run[2] + 1);
+        }
+        else
+        {
+            for (bit = run[2]; bit >= run[1]; bit--)
+            {
+                hap_pixels_write_bits(&bits, fields[run[0]] >> bit, 1);
+            }
+        }
+    }
+    for (i = 0; i < 16; i++)
+    {
+        hap_pixels_write_bits(&bits, indices[i], i == 0 ? 3 : 4);
+        weights[i] = hap_pixels_bptc_weights4[indices[i]];
+    }
+    hap_pixels_bits_store(&bits, block);
+    return error;
+}
+
+// Returns whether a mode which stores the second end as a difference from the first can store the ends of a line
+static int hap_pixels_bc6h_mode_fits(const HapPixelsBC6HMode *mode, int is_signed, const float ends[2][4])
+{
+    unsigned int c;
+    for (c = 0; c < 3 && mode->transformed; c++)
+    {
+        int limit = 1 << (mode->delta_bits[c] - 1);
+        int delta = hap_pixels_bc6h_quantize(ends[1][c], mode->endpoint_bits, is_signed, ends[1][c] >= ends[0][c])
+                    - hap_pixels_bc6h_quantize(ends[0][c], mode->endpoint_bits, is_signed, ends[0][c] > ends[1][c]);
+        if (delta < -limit || delta >= limit)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ Encodes a block of pixels of three half floats. The fast encoder uses the most precise one-region mode which can store
+ the ends of the line, falling back on mode 11, which stores both ends with ten bits. The high quality encoder tries
+ every one-region mode.
+ */
+static void hap_pixels_encode_bc6h(const unsigned char pixels[96], int is_signed, unsigned int quality, unsigned char *block)
+{
+    float values[16][4];
+    int integers[16][4];
+    float fitted[2][4];
+    unsigned char weights[16];
+    unsigned char candidate[16];
+    uint64_t best_error = 0;
+    unsigned int i, c, m, first_mode = 10;
+
+    for (i = 0; i < 16; i++)
+    {
+        for (c = 0; c < 3; c++)
+        {
+            uint16_t half;
+            memcpy(&half, pixels + i * 6 + c * 2, 2);
+            integers[i][c] = hap_pixels_bc6h_from_half(half, is_signed);
+            values[i][c] = (float)integers[i][c];
+        }
+        integers[i][3] = 0;
+        values[i][3] = 0.0f;
+    }
+    hap_pixels_bptc_fit((const float (*)[4])values, 3, quality, fitted);
+
+    if (quality == HapPixelsQuality_Fast)
+    {
+        for (first_mode = 13; first_mode > 10 && !hap_pixels_bc6h_mode_fits(&hap_pixels_bc6h_modes[first_mode], is_signed, (const float (*)[4])fitted); first_mode--)
+        {
+        }
+    }
+
+    for (m = first_mode; m < (quality == HapPixelsQuality_Fast ? first_mode + 1 : 14u); m++)
+    {
+        float ends[2][4];
+        uint64_t previous_error = 0;
+        int iteration;
+
+        memcpy(ends, fitted, sizeof(ends));
+        for (iteration = 0; iteration < 5; iteration++)
+        {
+            uint64_t error = hap_pixels_bc6h_encode_ends((const int (*)[4])integers, &hap_pixels_bc6h_modes[m], is_signed, (const float (*)[4])ends,
+                                                         quality, candidate, weights);
+            if ((m == first_mode && iteration == 0) || error < best_error)
+            {
+                best_error = error;
+                memcpy(block, candidate, 16);
+            }
+            if (quality == HapPixelsQuality_Fast
+                || error == 0
+                || (iteration > 0 && error >= previous_error)
+                || !hap_pixels_bptc_refine((const float (*)[4])values, 3, weights, ends))
+            {
+                break;
+            }
+            previous_error = error;
+        }
+    }
+}
+
+static void hap_pixels_encode_block(const HapPixelsEncodeJob *job, unsigned int texture_format, unsigned char pixels[96], unsigned char *block)
+{
+    unsigned char alpha[16];
+    unsigned char *colour_block = NULL;
+    int i;
+
+    switch (texture_format) {
+        case HapTextureFormat_RGBA_BPTC_UNORM:
+            hap_pixels_encode_bc7(pixels, job->quality, block);
+            break;
+        case HapTextureFormat_RGB_BPTC_UNSIGNED_FLOAT:
+        case HapTextureFormat_RGB_BPTC_SIGNED_FLOAT:
+            hap_pixels_encode_bc6h(pixels, texture_format == HapTextureFormat_RGB_BPTC_SIGNED_FLOAT, job->quality, block);
+            break;
+        case HapTextureFormat_RGB_DXT1:
+            colour_block = block;
+            break;
+        case HapTextureFormat_YCoCg_DXT5:
+            // Once converted the block is encoded as DXT5, with Y as its alpha
+#if defined(HAP_PIXELS_SSE2)
+            hap_pixels_ycocg_from_rgb_sse2(pixels);
+#else
+            hap_pixels_ycocg_from_rgb_scalar(pixels);
+#endif
+            // fall through
+        case HapTextureFormat_RGBA_DXT5:
+            colour_block = block + 8;
+            // fall through
+        default: // HapTextureFormat_A_RGTC1
+            for (i = 0; i < 16; i++)
+            {
+                alpha[i] = pixels[i * 4 + 3];
+            }
+            hap_pixels_encode_alpha(alpha, job->quality, block);
+            break;
+    }
+
+    if (colour_block && job->quality == HapPixelsQuality_Fast)
+    {
+        hap_pixels_encode_colour_fast(pixels, colour_block);
+    }
+    else if (colour_block)
+    {
+        hap_pixels_encode_colour_high(pixels, colour_block);
+    }
+}
+
+/*
+ A HapEncodeChunkFunction which encodes the blocks of part of a texture from pixels
+ */
+static void hap_pixels_encode_chunk(void *p, unsigned int index, void *data, unsigned long offset, unsigned long length)
+{
+    const HapPixelsEncodeJob *job = (const HapPixelsEncodeJob *)p;
+    unsigned int texture_format = job->texture_formats[index];
+    size_t block_bytes = hap_pixels_encoded_block_bytes(texture_format);
+    size_t first_block = offset / block_bytes;
+    size_t block_count = length / block_bytes;
+    unsigned char pixels[96];
+    size_t i;
+
+    for (i = 0; i < block_count; i++)
+    {
+        size_t block_index = first_block + i;
+        hap_pixels_load_block(job,
+                              (unsigned int)(block_index % job->blocks_per_row) * 4,
+                              (unsigned int)(block_index / job->blocks_per_row) * 4,
+                              pixels);
+        hap_pixels_encode_block(job, texture_format, pixels, ((unsigned char *)data) + i * block_bytes);
+    }
+}
+
+// Fills lengths with the length of each texture, or returns 0 if any format can't be encoded from pixels
+static int hap_pixels_texture_lengths(unsigned int width, unsigned int height, unsigned int count, const unsigned int *textureFormats,
+                                      unsigned long *lengths)
+{
+    unsigned int i;
+    for (i = 0; i < count; i++)
+    {
+        unsigned int block_bytes = hap_pixels_encoded_block_bytes(textureFormats[i]);
+        if (block_bytes == 0)
+        {
+            return 0;
+        }
+        lengths[i] = (unsigned long)((width + 3) / 4) * ((height + 3) / 4) * block_bytes;
+    }
+    return 1;
+}
+
+unsigned long HapMaxEncodedLengthForPixels(unsigned int width, unsigned int height,
+                                           unsigned int count,
+                                           unsigned int *textureFormats,
+                                           unsigned int *chunkCounts)
+{
+    unsigned long lengths[2];
+
+    if (width == 0 || height == 0
+        || count == 0 || count > 2
+        || textureFormats == NULL
+        || !hap_pixels_texture_lengths(width, height, count, textureFormats, lengths))
+    {
+        return 0;
+    }
+
+    return HapMaxEncodedLength(count, lengths, textureFormats, chunkCounts);
+}
+
+unsigned int HapEncodePixelsWithContext(HapEncoderContext *context,
+                                        const void *inputBuffer, unsigned long inputBytesPerRow,
+                                        unsigned int width, unsigned int height,
+                                        unsigned int pixelFormat,
+                                        unsigned int count,
+                                        unsigned int *textureFormats,
+                                        unsigned int *compressors,
+                                        unsigned int *chunkCounts,
+                                        unsigned int quality,
+                                        unsigned int options,
+                                        HapDecodeCallback callback, void *info,
+                                        void *outputBuffer, unsigned long outputBufferBytes,
+                                        unsigned long *outputBufferBytesUsed)
+{
+    HapPixelsEncodeJob job;
+    unsigned long lengths[2];
+    unsigned int i;
+
+    /*
+     Check arguments
+     */
+    if (inputBuffer == NULL
+        || width == 0
+        || height == 0
+        || hap_pixels_bytes_per_pixel(pixelFormat) == 0
+        || inputBytesPerRow < (unsigned long)width * hap_pixels_bytes_per_pixel(pixelFormat)
+        || count == 0 || count > 2
+        || textureFormats == NULL
+        || (quality != HapPixelsQuality_Fast && quality != HapPixelsQuality_High)
+        || !hap_pixels_texture_lengths(width, height, count, textureFormats, lengths)
+        )
+    {
+        return HapResult_Bad_Arguments;
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (!hap_pixels_formats_match(textureFormats[i], pixelFormat))
+        {
+            return HapResult_Bad_Arguments;
+        }
+    }
+
+    job.input = (const unsigned char *)inputBuffer;
+    job.input_bytes_per_row = inputBytesPerRow;
+    job.width = width;
+    job.height = height;
+    job.bgra = pixelFormat == HapPixelFormat_BGRA8;
+    job.bytes_per_pixel = hap_pixels_bytes_per_pixel(pixelFormat);
+    job.blocks_per_row = (width + 3) / 4;
+    job.quality = quality;
+    for (i = 0; i < count; i++)
+    {
+        job.texture_formats[i] = textureFormats[i];
+    }
+
+    return HapEncodeChunks(context,
+                           count,
+                           hap_pixels_encode_chunk, &job,
+                           lengths,
+                           textureFormats,
+                           compressors,
+                           chunkCounts,
+                           options,
+                           callback, info,
+                           outputBuffer, outputBufferBytes,
+                           outputBufferBytesUsed,
+                           NULL);
+}
+
+unsigned int HapEncodePixels(const void *inputBuffer, unsigned long inputBytesPerRow,
+                             unsigned int width, unsigned int height,
+                             unsigned int pixelFormat,
+                             unsigned int count,
+                             unsigned int *textureFormats,
+                             unsigned int *compressors,
+                             unsigned int *chunkCounts,
+                             unsigned int quality,
+                             unsigned int options,
+                             HapDecodeCallback callback, void *info,
+                             void *outputBuffer, unsigned long outputBufferBytes,
+                             unsigned long *outputBufferBytesUsed)
+{
+    return HapEncodePixelsWithContext(NULL,
+                                      inputBuffer, inputBytesPerRow,
+                                      width, height,
+                                      pixelFormat,
+                                      count,
+                                      textureFormats,
+                                      compressors,
+                                      chunkCounts,
+                                      quality,
+                                      options,
+                                      callback, info,
+                                      outputBuffer, outputBufferBytes,
+                                      outputBufferBytesUsed);
+}
@@ -0,0 +1,213 @@
+/*
+ hap_pixels.h
+ 
+ Copyright (c) 2011-2013, Tom Butterworth and Vidvox LLC. All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef hap_pixels_h
+#define hap_pixels_h
+
+#include "hap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ Optional decoding of textures to pixels, and encoding of pixels to textures, on the CPU, for use where no GPU is
+ available.
+ */
+
+/*
+ HapPixelFormat_RGBA8 and HapPixelFormat_BGRA8 have four bytes per pixel, in the order given by their name.
+ HapPixelFormat_RGB16F has three half floats per pixel, in the host's byte order, and is the only format for BC6H
+ textures, which can't be converted to or from the other formats.
+ */
+enum HapPixelFormat {
+    HapPixelFormat_RGBA8 = 1,
+    HapPixelFormat_BGRA8,
+    HapPixelFormat_RGB16F
+};
+
+/*
+ Decodes the texture at index in a frame described by HapGetFrameInfo() to pixels.
+
+ Textures in HapTextureFormat_RGB_DXT1, HapTextureFormat_RGBA_DXT5, HapTextureFormat_YCoCg_DXT5,
+ HapTextureFormat_A_RGTC1, HapTextureFormat_RGBA_BPTC_UNORM and the two BC6H formats can be decoded. DXT1 and YCoCg
+ pixels are opaque, and RGTC1 pixels are white with the texture's value as their alpha. YCoCg textures are converted
+ back to RGB as Hap Q's shader does. BC6H textures are decoded to HapPixelFormat_RGB16F.
+ width and height are the dimensions of the image in pixels, which are not stored in the frame.
+ pixelFormat is a HapPixelFormat.
+ Each chunk is converted to pixels by the thread which decompressed it, as soon as it has been decompressed, so the
+ texture is never written to memory as a whole. Work is assigned to threads using callback in the same way as it is for
+ HapDecode().
+ outputBytesPerRow is the distance in bytes between the start of each row of pixels in outputBuffer, and must be at least
+ width times the size of a pixel.
+ The remaining arguments are as for HapDecodeWithContext().
+ */
+unsigned int HapDecodeToPixels(HapDecoderContext *context,
+                               const HapFrameInfo *frameInfo,
+                               unsigned int index,
+                               unsigned int width, unsigned int height,
+                               unsigned int pixelFormat,
+                               HapDecodeCallback callback, void *info,
+                               void *outputBuffer, unsigned long outputBytesPerRow, unsigned long outputBufferBytes);
+
+/*
+ Decodes a whole frame described by HapGetFrameInfo() to pixels, combining its textures where it has two.
+
+ A frame of one texture is decoded as HapDecodeToPixels() decodes it. The colour of a Hap Q Alpha frame is merged with its
+ alpha as each chunk of colour is converted to pixels, so every pixel is written once. The alpha texture is decoded first,
+ using HapDecodeChunksWithTexture().
+ The arguments are as for HapDecodeToPixels().
+ */
+unsigned int HapDecodeFrameToPixels(HapDecoderContext *context,
+                                    const HapFrameInfo *frameInfo,
+                                    unsigned int width, unsigned int height,
+                                    unsigned int pixelFormat,
+                                    HapDecodeCallback callback, void *info,
+                                    void *outputBuffer, unsigned long outputBytesPerRow, unsigned long outputBufferBytes);
+
+/*
+ Layouts of YUV 4:2:0 images for HapDecodeFrameToYUV(). Chroma planes are half the width and half the height of the luma
+ plane, rounded up.
+ */
+enum HapYUVFormat {
+    HapYUVFormat_NV12 = 1, // A plane of Y and a plane of interleaved Cb and Cr
+    HapYUVFormat_I420      // Planes of Y, Cb and Cr
+};
+
+/*
+ Colour matrices for HapDecodeFrameToYUV(), both producing limited range (16-235 luma, 16-240 chroma) Y'CbCr
+ */
+enum HapYUVMatrix {
+    HapYUVMatrix_BT601 = 1,
+    HapYUVMatrix_BT709
+};
+
+/*
+ Decodes a frame described by HapGetFrameInfo() to a YUV 4:2:0 image, for handing to video encoders which take NV12 or
+ I420.
+
+ Frames of HapTextureFormat_RGB_DXT1, HapTextureFormat_RGBA_DXT5, HapTextureFormat_YCoCg_DXT5 and
+ HapTextureFormat_RGBA_BPTC_UNORM textures can be decoded, as can Hap Q Alpha frames, whose alpha is ignored, as is the
+ alpha of other textures. YCoCg blocks are converted directly from Y, Co and Cg to Y'CbCr by a single matrix, without
+ passing through RGB. Each chroma sample is the average of the two by two pixels it covers.
+ width and height are the dimensions of the image in pixels, which are not stored in the frame.
+ yuvFormat is a HapYUVFormat, and matrix a HapYUVMatrix.
+ outputPlanes, outputBytesPerRow and outputPlaneBytes are arrays giving the start, the distance in bytes between the
+ start of each row, and the size in bytes of each plane, and have two entries for HapYUVFormat_NV12 or three for
+ HapYUVFormat_I420.
+ Each chunk is converted by the thread which decompressed it, as soon as it has been decompressed, so neither the texture
+ nor an RGB image is written to memory as a whole. Work is assigned to threads using callback in the same way as it is
+ for HapDecode().
+ The remaining arguments are as for HapDecodeWithContext().
+ */
+unsigned int HapDecodeFrameToYUV(HapDecoderContext *context,
+                                 const HapFrameInfo *frameInfo,
+                                 unsigned int width, unsigned int height,
+                                 unsigned int yuvFormat,
+                                 unsigned int matrix,
+                                 HapDecodeCallback callback, void *info,
+                                 void **outputPlanes, unsigned long *outputBytesPerRow, unsigned long *outputPlaneBytes);
+
+/*
+ Qualities of texture compression for HapEncodePixels()
+ */
+enum HapPixelsQuality {
+    HapPixelsQuality_Fast = 0, // Suitable for encoding in real time
+    HapPixelsQuality_High
+};
+
+/*
+ Returns the maximum size of an output buffer for a frame encoded from pixels by HapEncodePixels(), or returns 0 on error.
+ width and height are the dimensions of the image in pixels.
+ The remaining arguments are as for HapMaxEncodedLength().
+ */
+unsigned long HapMaxEncodedLengthForPixels(unsigned int width, unsigned int height,
+                                           unsigned int count,
+                                           unsigned int *textureFormats,
+                                           unsigned int *chunkCounts);
+
+/*
+ Encodes an image as a Hap frame, compressing it to one or multiple textures and then compressing those as HapEncode()
+ does.
+
+ Textures in HapTextureFormat_RGB_DXT1, HapTextureFormat_RGBA_DXT5, HapTextureFormat_YCoCg_DXT5,
+ HapTextureFormat_A_RGTC1, HapTextureFormat_RGBA_BPTC_UNORM and the two BC6H formats can be encoded. YCoCg textures are
+ encoded from the image's colour converted to scaled YCoCg, with the scale chosen for each block, and RGTC1 textures from
+ the image's alpha, so a Hap Q Alpha frame is encoded from HapTextureFormat_YCoCg_DXT5 and HapTextureFormat_A_RGTC1.
+ BPTC blocks are encoded in the modes which don't divide them into subsets, which suits live encoding. BC6H textures are
+ encoded from HapPixelFormat_RGB16F, where infinities are encoded as the largest finite value, and NaN, and negative
+ values for HapTextureFormat_RGB_BPTC_UNSIGNED_FLOAT, as zero.
+ inputBuffer holds the image, in the HapPixelFormat pixelFormat, with rows inputBytesPerRow apart.
+ width and height are the dimensions of the image in pixels.
+ quality is a HapPixelsQuality.
+ Each chunk of each texture is compressed from the image by the thread which then compresses the chunk further, using
+ HapEncodeWithFunction(), and work is assigned to threads using callback in the same way as it is for HapDecode().
+ callback may be NULL, in which case the image is encoded on the calling thread.
+ Use HapMaxEncodedLengthForPixels() to discover the minimal value for outputBufferBytes.
+ The remaining arguments are as for HapEncodeWithCallback().
+ */
+unsigned int HapEncodePixels(const void *inputBuffer, unsigned long inputBytesPerRow,
+                             unsigned int width, unsigned int height,
+                             unsigned int pixelFormat,
+                             unsigned int count,
+                             unsigned int *textureFormats,
+                             unsigned int *compressors,
+                             unsigned int *chunkCounts,
+                             unsigned int quality,
+                             unsigned int options,
+                             HapDecodeCallback callback, void *info,
+                             void *outputBuffer, unsigned long outputBufferBytes,
+                             unsigned long *outputBufferBytesUsed);
+
+/*
+ Encodes an image as a Hap frame as HapEncodePixels() does, using storage from context, so that once the context has
+ grown large enough for the frames being encoded, encoding makes no allocations of its own.
+ context may be NULL, in which case storage is allocated and freed for this call.
+ options may include HapEncodeOption_ReuseUnchangedChunks, as for HapEncodeChunks(). Unchanged chunks are still
+ compressed to textures, but not with snappy.
+ The remaining arguments are as for HapEncodePixels().
+ */
+unsigned int HapEncodePixelsWithContext(HapEncoderContext *context,
+                                        const void *inputBuffer, unsigned long inputBytesPerRow,
+                                        unsigned int width, unsigned int height,
+                                        unsigned int pixelFormat,
+                                        unsigned int count,
+                                        unsigned int *textureFormats,
+                                        unsigned int *compressors,
+                                        unsigned int *chunkCounts,
+                                        unsigned int quality,
+                                        unsigned int options,
+                                        HapDecodeCallback callback, void *info,
+                                        void *outputBuffer, unsigned long outputBufferBytes,
+                                        unsigned long *outputBufferBytesUsed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
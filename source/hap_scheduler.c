@@ -0,0 +1,514 @@
+/*
+ hap_scheduler.c
+ 
+ Copyright (c) 2011-2013, Tom Butterworth and Vidvox LLC. All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// For clock_gettime() and CLOCK_MONOTONIC
+#define _POSIX_C_SOURCE 200809L
+
+#include "hap_scheduler.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#define kHapSchedulerMaxThreads 64
+// The weight given to each new measurement in the estimate of decoding time
+#define kHapSchedulerEstimateWeight 0.125
+
+enum HapScheduledFrameState {
+    HapScheduledFrameState_Queued = 0,  // Not yet started
+    HapScheduledFrameState_Starting,    // Being handed to HapDecodeAsync(), which hasn't yet dispatched its work
+    HapScheduledFrameState_Started      // Its work items are being taken by workers
+};
+
+typedef struct HapScheduledFrame HapScheduledFrame;
+
+struct HapScheduledFrame {
+    HapScheduledFrame *next;
+    HapScheduler *scheduler;
+    HapFrameInfo frame_info;
+    unsigned int index;
+    void *output;
+    unsigned long output_bytes;
+    unsigned long long deadline;
+    int priority;
+    unsigned int options;
+    HapScheduleCompletion completion;
+    void *p;
+    HapDecodeRequest *request;
+    unsigned int state;
+    int hopeless;
+    // Set when the work is dispatched
+    HapDecodeWorkFunction function;
+    void *work;
+    unsigned int work_count;
+    unsigned int next_work;
+    unsigned long bytes_per_item;
+};
+
+struct HapScheduler {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t threads[kHapSchedulerMaxThreads];
+    unsigned int thread_count;
+    int stop;
+    // Ordered by deadline, then by priority, highest first, then by when they were scheduled
+    HapScheduledFrame *queue;
+    HapScheduledFrame *free_frames;
+    /*
+     Recent time spent on work and bytes of texture decoded by it, each decaying as more is measured, so their ratio is the
+     nanoseconds a thread takes to decode a byte, or 0 until it has been measured
+     */
+    double work_time;
+    double work_bytes;
+    HapSchedulerStatistics statistics;
+};
+
+unsigned long long HapSchedulerTime(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return ((unsigned long long)time.tv_sec * 1000000000ULL) + (unsigned long long)time.tv_nsec;
+}
+
+// Returns the bytes of a frame's texture which are still to be handed to workers
+static unsigned long hap_scheduler_frame_bytes(const HapScheduledFrame *frame)
+{
+    if (frame->state == HapScheduledFrameState_Started)
+    {
+        return (frame->work_count - frame->next_work) * frame->bytes_per_item;
+    }
+    return frame->frame_info.textures[frame->index].decodedBytes;
+}
+
+static int hap_scheduler_frame_has_work(const HapScheduledFrame *frame)
+{
+    return frame->state == HapScheduledFrameState_Queued
+        || (frame->state == HapScheduledFrameState_Started && frame->next_work < frame->work_count);
+}
+
+static void hap_scheduler_unlink(HapScheduler *scheduler, HapScheduledFrame *frame)
+{
+    HapScheduledFrame **link = &scheduler->queue;
+    while (*link != frame)
+    {
+        link = &(*link)->next;
+    }
+    *link = frame->next;
+}
+
+static void hap_scheduler_recycle(HapScheduler *scheduler, HapScheduledFrame *frame)
+{
+    frame->next = scheduler->free_frames;
+    scheduler->free_frames = frame;
+}
+
+/*
+ Called with the mutex held. Estimates when each frame will be finished given the work ahead of it, and marks those which
+ would miss their deadline as hopeless, so their work is only done once no other frame has any. A frame which would miss
+ its deadline even with nothing ahead of it is moved to dropped if it may be. Frames are only dropped then, because an
+ estimate of work far ahead is too uncertain to drop a frame on. Returns the frame to work on next, or NULL if none has work.
+ */
+static HapScheduledFrame *hap_scheduler_choose(HapScheduler *scheduler, HapScheduledFrame **dropped)
+{
+    HapScheduledFrame **link = &scheduler->queue;
+    HapScheduledFrame *chosen = NULL;
+    HapScheduledFrame *hopeless = NULL;
+    unsigned long long now = HapSchedulerTime();
+    double time_per_byte = scheduler->work_bytes > 0.0 ? scheduler->work_time / scheduler->work_bytes : 0.0;
+    double ahead = 0.0;
+
+    while (*link != NULL)
+    {
+        HapScheduledFrame *frame = *link;
+        double bytes = (double)hap_scheduler_frame_bytes(frame);
+        double finish = (double)now + (((ahead + bytes) * time_per_byte) / scheduler->thread_count);
+
+        if (finish > (double)frame->deadline)
+        {
+            if (frame->state == HapScheduledFrameState_Queued
+                && (frame->options & HapScheduleOption_DropIfLate)
+                && (double)now + ((bytes * time_per_byte) / scheduler->thread_count) > (double)frame->deadline)
+            {
+                *link = frame->next;
+                frame->next = *dropped;
+                *dropped = frame;
+                scheduler->statistics.dropped++;
+                continue;
+            }
+            frame->hopeless = 1;
+        }
+        else
+        {
+            frame->hopeless = 0;
+            ahead += bytes;
+        }
+
+        if (hap_scheduler_frame_has_work(frame))
+        {
+            if (!frame->hopeless && chosen == NULL)
+            {
+                chosen = frame;
+            }
+            else if (frame->hopeless && hopeless == NULL)
+            {
+                hopeless = frame;
+            }
+        }
+        link = &frame->next;
+    }
+    return chosen ? chosen : hopeless;
+}
+
+// Called by HapDecodeAsync() with a frame's work
+static void hap_scheduler_dispatch(HapDecodeWorkFunction function, void *p, unsigned int count, void *info)
+{
+    HapScheduledFrame *frame = (HapScheduledFrame *)info;
+    HapScheduler *scheduler = frame->scheduler;
+
+    pthread_mutex_lock(&scheduler->mutex);
+    frame->function = function;
+    frame->work = p;
+    frame->work_count = count;
+    frame->next_work = 0;
+    frame->bytes_per_item = frame->frame_info.textures[frame->index].decodedBytes / count;
+    frame->state = HapScheduledFrameState_Started;
+    pthread_cond_broadcast(&scheduler->cond);
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+// Called by HapDecodeAsync() once a frame is decoded, or directly if it couldn't be started
+static void hap_scheduler_complete(void *p, unsigned int result)
+{
+    HapScheduledFrame *frame = (HapScheduledFrame *)p;
+    HapScheduler *scheduler = frame->scheduler;
+    HapScheduleCompletion completion = frame->completion;
+    void *completion_p = frame->p;
+    unsigned int outcome;
+
+    pthread_mutex_lock(&scheduler->mutex);
+    hap_scheduler_unlink(scheduler, frame);
+    if (HapSchedulerTime() > frame->deadline)
+    {
+        outcome = HapScheduleOutcome_Late;
+        scheduler->statistics.late++;
+    }
+    else
+    {
+        outcome = HapScheduleOutcome_OnTime;
+        scheduler->statistics.onTime++;
+    }
+    hap_scheduler_recycle(scheduler, frame);
+    pthread_cond_broadcast(&scheduler->cond);
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    completion(completion_p, result, outcome);
+}
+
+// Called without the mutex held, for frames which have been unlinked from the queue
+static void hap_scheduler_drop(HapScheduler *scheduler, HapScheduledFrame *dropped)
+{
+    HapScheduledFrame *frame;
+
+    for (frame = dropped; frame != NULL; frame = frame->next)
+    {
+        frame->completion(frame->p, HapResult_No_Error, HapScheduleOutcome_Dropped);
+    }
+
+    pthread_mutex_lock(&scheduler->mutex);
+    while (dropped != NULL)
+    {
+        frame = dropped;
+        dropped = frame->next;
+        hap_scheduler_recycle(scheduler, frame);
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+static void *hap_scheduler_thread(void *arg)
+{
+    HapScheduler *scheduler = (HapScheduler *)arg;
+
+    pthread_mutex_lock(&scheduler->mutex);
+    while (!scheduler->stop || scheduler->queue != NULL)
+    {
+        HapScheduledFrame *dropped = NULL;
+        HapScheduledFrame *frame = hap_scheduler_choose(scheduler, &dropped);
+
+        if (dropped != NULL)
+        {
+            pthread_mutex_unlock(&scheduler->mutex);
+            hap_scheduler_drop(scheduler, dropped);
+            pthread_mutex_lock(&scheduler->mutex);
+        }
+        else if (frame == NULL)
+        {
+            pthread_cond_wait(&scheduler->cond, &scheduler->mutex);
+        }
+        else if (frame->state == HapScheduledFrameState_Queued)
+        {
+            unsigned int result;
+
+            frame->state = HapScheduledFrameState_Starting;
+            pthread_mutex_unlock(&scheduler->mutex);
+            result = HapDecodeAsync(frame->request, &frame->frame_info, frame->index,
+                                    hap_scheduler_dispatch, frame,
+                                    frame->output, frame->output_bytes,
+                                    hap_scheduler_complete, frame);
+            if (result != HapResult_No_Error)
+            {
+                hap_scheduler_complete(frame, result);
+            }
+            pthread_mutex_lock(&scheduler->mutex);
+        }
+        else
+        {
+            /*
+             The frame may be completed and recycled by the work item, so nothing of it is used once the work is done
+             */
+            HapDecodeWorkFunction function = frame->function;
+            void *work = frame->work;
+            unsigned int item = frame->next_work++;
+            unsigned long bytes = frame->bytes_per_item;
+            unsigned long long start;
+            double sample;
+
+            pthread_mutex_unlock(&scheduler->mutex);
+            start = HapSchedulerTime();
+            function(work, item);
+            sample = (double)(HapSchedulerTime() - start);
+            pthread_mutex_lock(&scheduler->mutex);
+
+            /*
+             Totals rather than an average of each item's time per byte, so an item whose thread was preempted doesn't
+             outweigh the rest
+             */
+            scheduler->work_time += (sample - scheduler->work_time) * kHapSchedulerEstimateWeight;
+            scheduler->work_bytes += ((double)bytes - scheduler->work_bytes) * kHapSchedulerEstimateWeight;
+        }
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+    return NULL;
+}
+
+HapScheduler *HapCreateScheduler(unsigned int threadCount)
+{
+    HapScheduler *scheduler;
+    unsigned int i;
+
+    if (threadCount == 0)
+    {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = processors > 0 ? (unsigned int)processors : 1;
+    }
+    if (threadCount > kHapSchedulerMaxThreads)
+    {
+        threadCount = kHapSchedulerMaxThreads;
+    }
+
+    scheduler = (HapScheduler *)calloc(1, sizeof(HapScheduler));
+    if (scheduler == NULL)
+    {
+        return NULL;
+    }
+
+    if (pthread_mutex_init(&scheduler->mutex, NULL) != 0)
+    {
+        free(scheduler);
+        return NULL;
+    }
+    if (pthread_cond_init(&scheduler->cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&scheduler->mutex);
+        free(scheduler);
+        return NULL;
+    }
+
+    // Hold the mutex so no thread sees thread_count while it is still being counted
+    pthread_mutex_lock(&scheduler->mutex);
+    for (i = 0; i < threadCount; i++)
+    {
+        if (pthread_create(&scheduler->threads[i], NULL, hap_scheduler_thread, scheduler) != 0)
+        {
+            break;
+        }
+        scheduler->thread_count++;
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    if (scheduler->thread_count == 0)
+    {
+        HapDestroyScheduler(scheduler);
+        return NULL;
+    }
+    return scheduler;
+}
+
+void HapDestroyScheduler(HapScheduler *scheduler)
+{
+    HapScheduledFrame **link;
+    HapScheduledFrame *dropped = NULL;
+    HapScheduledFrame *frame;
+    unsigned int i;
+
+    if (scheduler == NULL)
+    {
+        return;
+    }
+
+    // Take the frames which haven't been started, leaving those which have for the workers to finish
+    pthread_mutex_lock(&scheduler->mutex);
+    scheduler->stop = 1;
+    link = &scheduler->queue;
+    while (*link != NULL)
+    {
+        frame = *link;
+        if (frame->state == HapScheduledFrameState_Queued)
+        {
+            *link = frame->next;
+            frame->next = dropped;
+            dropped = frame;
+            scheduler->statistics.dropped++;
+        }
+        else
+        {
+            link = &frame->next;
+        }
+    }
+    pthread_cond_broadcast(&scheduler->cond);
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    hap_scheduler_drop(scheduler, dropped);
+
+    for (i = 0; i < scheduler->thread_count; i++)
+    {
+        pthread_join(scheduler->threads[i], NULL);
+    }
+
+    while (scheduler->free_frames != NULL)
+    {
+        frame = scheduler->free_frames;
+        scheduler->free_frames = frame->next;
+        HapDestroyDecodeRequest(frame->request);
+        free(frame);
+    }
+
+    pthread_cond_destroy(&scheduler->cond);
+    pthread_mutex_destroy(&scheduler->mutex);
+    free(scheduler);
+}
+
+unsigned int HapScheduleDecode(HapScheduler *scheduler,
+                               const HapFrameInfo *frameInfo,
+                               unsigned int index,
+                               void *outputBuffer, unsigned long outputBufferBytes,
+                               unsigned long long deadline,
+                               int priority,
+                               unsigned int options,
+                               HapScheduleCompletion completion, void *p)
+{
+    HapScheduledFrame *frame;
+    HapScheduledFrame **link;
+
+    /*
+     Check arguments
+     */
+    if (scheduler == NULL
+        || frameInfo == NULL
+        || index >= frameInfo->textureCount
+        || outputBuffer == NULL
+        || completion == NULL
+        )
+    {
+        return HapResult_Bad_Arguments;
+    }
+
+    if (frameInfo->textures[index].decodedBytes > outputBufferBytes)
+    {
+        return HapResult_Buffer_Too_Small;
+    }
+
+    pthread_mutex_lock(&scheduler->mutex);
+    frame = scheduler->free_frames;
+    if (frame != NULL)
+    {
+        scheduler->free_frames = frame->next;
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    if (frame == NULL)
+    {
+        frame = (HapScheduledFrame *)malloc(sizeof(HapScheduledFrame));
+        if (frame == NULL)
+        {
+            return HapResult_Internal_Error;
+        }
+        frame->request = HapCreateDecodeRequest();
+        if (frame->request == NULL)
+        {
+            free(frame);
+            return HapResult_Internal_Error;
+        }
+    }
+
+    frame->scheduler = scheduler;
+    frame->frame_info = *frameInfo;
+    frame->index = index;
+    frame->output = outputBuffer;
+    frame->output_bytes = outputBufferBytes;
+    frame->deadline = deadline;
+    frame->priority = priority;
+    frame->options = options;
+    frame->completion = completion;
+    frame->p = p;
+    frame->state = HapScheduledFrameState_Queued;
+    frame->hopeless = 0;
+
+    pthread_mutex_lock(&scheduler->mutex);
+    link = &scheduler->queue;
+    while (*link != NULL
+           && ((*link)->deadline < deadline || ((*link)->deadline == deadline && (*link)->priority >= priority)))
+    {
+        link = &(*link)->next;
+    }
+    frame->next = *link;
+    *link = frame;
+    pthread_cond_signal(&scheduler->cond);
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    return HapResult_No_Error;
+}
+
+void HapGetSchedulerStatistics(HapScheduler *scheduler, HapSchedulerStatistics *statistics)
+{
+    if (scheduler == NULL || statistics == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&scheduler->mutex);
+    *statistics = scheduler->statistics;
+    pthread_mutex_unlock(&scheduler->mutex);
+}
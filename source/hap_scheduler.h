@@ -0,0 +1,126 @@
+/*
+ hap_scheduler.h
+ 
+ Copyright (c) 2011-2013, Tom Butterworth and Vidvox LLC. All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef hap_scheduler_h
+#define hap_scheduler_h
+
+#include "hap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ An optional scheduler for decoding frames from many streams at once, each with a time by which it must be presented.
+ Building it requires POSIX threads and clock_gettime() with CLOCK_MONOTONIC (POSIX.1-2008).
+
+ The scheduler has its own worker threads, which take chunks of the frames scheduled with it in order of their deadlines,
+ earliest first, across every stream, using HapDecodeAsync(). It keeps an estimate of how long decoding takes, and a frame
+ which can no longer be decoded by its deadline, given the work ahead of it, is decoded after the frames which can still
+ make theirs. A frame scheduled with HapScheduleOption_DropIfLate is dropped once it hasn't been started and there is no
+ longer time to decode it at all. Under load, frames are dropped or late rather than every stream falling behind together.
+ */
+typedef struct HapScheduler HapScheduler;
+
+/*
+ Options for HapScheduleDecode()
+ */
+enum HapScheduleOption {
+    HapScheduleOption_None = 0,
+    HapScheduleOption_DropIfLate = 1U << 0
+};
+
+/*
+ What became of a scheduled frame
+ */
+enum HapScheduleOutcome {
+    HapScheduleOutcome_OnTime = 1, // Decoded by its deadline
+    HapScheduleOutcome_Late,       // Decoded after its deadline
+    HapScheduleOutcome_Dropped     // Not decoded, and its output buffer is untouched
+};
+
+/*
+ Called on a worker thread when a scheduled frame is done, with the p given to HapScheduleDecode(), a HapResult, and a
+ HapScheduleOutcome.
+ */
+typedef void (*HapScheduleCompletion)(void *p, unsigned int result, unsigned int outcome);
+
+/*
+ Counts of the frames a scheduler has finished with
+ */
+typedef struct HapSchedulerStatistics {
+    unsigned long long onTime;
+    unsigned long long late;
+    unsigned long long dropped;
+} HapSchedulerStatistics;
+
+/*
+ Returns the current time in nanoseconds, from a clock which only moves forward, which deadlines are measured against.
+ */
+unsigned long long HapSchedulerTime(void);
+
+/*
+ Returns a new scheduler with threadCount worker threads, or NULL on error.
+ If threadCount is 0 the scheduler has one worker for each online processor.
+ */
+HapScheduler *HapCreateScheduler(unsigned int threadCount);
+
+/*
+ Drops the frames which haven't been started, finishes those which have, then stops the scheduler's threads and frees it.
+ No frames may be scheduled while this is called.
+ */
+void HapDestroyScheduler(HapScheduler *scheduler);
+
+/*
+ Schedules the texture at index in a frame described by HapGetFrameInfo() to be decoded to outputBuffer by deadline,
+ which is a time from HapSchedulerTime(), and returns without waiting. completion is called once the frame is done,
+ which it is straight away if it is dropped, and may not be NULL.
+ Frames with the same deadline are decoded in order of priority, highest first.
+ options is zero or more HapScheduleOptions combined with bitwise OR.
+ The frame described by frameInfo and outputBuffer must remain valid until completion is called.
+ If this returns an error, the frame was not scheduled and completion is not called.
+ The remaining arguments are as for HapDecodeWithFrameInfo().
+ */
+unsigned int HapScheduleDecode(HapScheduler *scheduler,
+                               const HapFrameInfo *frameInfo,
+                               unsigned int index,
+                               void *outputBuffer, unsigned long outputBufferBytes,
+                               unsigned long long deadline,
+                               int priority,
+                               unsigned int options,
+                               HapScheduleCompletion completion, void *p);
+
+/*
+ Fills statistics with counts of the frames scheduler has finished with since it was created.
+ */
+void HapGetSchedulerStatistics(HapScheduler *scheduler, HapSchedulerStatistics *statistics);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,532 @@
+/*
+ hap_threadpool.c
+ 
+ Copyright (c) 2011-2013, Tom Butterworth and Vidvox LLC. All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "hap_threadpool.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define kHapThreadPoolMaxThreads 64
+// The number of callbacks which can be in progress at once, beyond which work is done on the calling thread
+#define kHapThreadPoolMaxJobs 64
+// How many times an idle thread looks for work before sleeping
+#define kHapThreadPoolSpinCount 2000
+#define kHapThreadPoolCacheLineSize 64
+
+/*
+ Each thread working on a job has its own range of work indices, packed into one value as (begin << 32) | end so it can
+ be updated atomically. The owning thread takes indices from the beginning of its range, and a thread which has run out
+ of work steals the second half of another thread's range.
+ */
+typedef struct HapThreadPoolRange {
+    _Alignas(kHapThreadPoolCacheLineSize) atomic_uint_fast64_t value;
+} HapThreadPoolRange;
+
+typedef struct HapThreadPoolJob {
+    HapDecodeWorkFunction function;
+    void *p;
+    atomic_uint remaining;
+    // The job's allocation if it was submitted by HapThreadPoolAsyncCallback(), otherwise NULL
+    void *allocation;
+    // Only used by jobs whose submitter waits for them
+    int done;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    // One range for each worker, and a final one for the thread which made the callback
+    HapThreadPoolRange ranges[kHapThreadPoolMaxThreads + 1];
+} HapThreadPoolJob;
+
+/*
+ Jobs are published to workers through slots. A worker increments a slot's users before reading its job, and the thread
+ which withdraws the job waits for users to reach zero after doing so, so the job is never used after it ends. A job is
+ withdrawn by the thread which published it, or for an asynchronous job, by the worker which completed its last item.
+ */
+typedef struct HapThreadPoolSlot {
+    _Alignas(kHapThreadPoolCacheLineSize) _Atomic(HapThreadPoolJob *) job;
+    atomic_uint users;
+} HapThreadPoolSlot;
+
+typedef struct HapThreadPoolWorker {
+    HapThreadPool *pool;
+    unsigned int index;
+    pthread_t thread;
+} HapThreadPoolWorker;
+
+struct HapThreadPool {
+    // The allocation the pool was placed in, rounded up to a cache line
+    void *allocation;
+    unsigned int thread_count;
+    HapThreadPoolWorker workers[kHapThreadPoolMaxThreads];
+    HapThreadPoolSlot slots[kHapThreadPoolMaxJobs];
+    // Incremented whenever a job is published, so a worker going to sleep can tell if it missed one
+    atomic_uint epoch;
+    atomic_uint sleeping;
+    atomic_int stop;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+// Marks a slot which is being withdrawn and may not be reused yet
+static HapThreadPoolJob hap_thread_pool_reserved_job;
+
+#define hap_thread_pool_range(begin, end) ((((uint_fast64_t)(begin)) << 32) | (end))
+#define hap_thread_pool_range_begin(range) ((unsigned int)((range) >> 32))
+#define hap_thread_pool_range_end(range) ((unsigned int)((range) & 0xFFFFFFFFU))
+
+static void hap_thread_pool_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Takes the next index from a thread's own range, returning 0 if it is empty
+static int hap_thread_pool_pop(HapThreadPoolJob *job, unsigned int participant, unsigned int *index)
+{
+    uint_fast64_t range = atomic_load(&job->ranges[participant].value);
+    while (hap_thread_pool_range_begin(range) < hap_thread_pool_range_end(range))
+    {
+        unsigned int begin = hap_thread_pool_range_begin(range);
+        if (atomic_compare_exchange_weak(&job->ranges[participant].value, &range, hap_thread_pool_range(begin + 1, hap_thread_pool_range_end(range))))
+        {
+            *index = begin;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Moves half the remaining work of another thread into this thread's empty range, returning 0 if there was none
+static int hap_thread_pool_steal(HapThreadPoolJob *job, unsigned int participant, unsigned int participant_count)
+{
+    unsigned int i;
+    for (i = 1; i < participant_count; i++)
+    {
+        unsigned int victim = (participant + i) % participant_count;
+        uint_fast64_t range = atomic_load(&job->ranges[victim].value);
+        while (hap_thread_pool_range_begin(range) < hap_thread_pool_range_end(range))
+        {
+            unsigned int begin = hap_thread_pool_range_begin(range);
+            unsigned int end = hap_thread_pool_range_end(range);
+            unsigned int split = end - ((end - begin + 1) / 2);
+            if (atomic_compare_exchange_weak(&job->ranges[victim].value, &range, hap_thread_pool_range(begin, split)))
+            {
+                // Nobody else changes an empty range, so this needn't be a compare-exchange
+                atomic_store(&job->ranges[participant].value, hap_thread_pool_range(split, end));
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ Performs work from a job until none is left to be claimed, returning 0 if there was none. finished is set to 1 if this
+ thread completed the job's last item.
+ */
+static int hap_thread_pool_work(HapThreadPoolJob *job, unsigned int participant, unsigned int participant_count, int *finished)
+{
+    int worked = 0;
+    unsigned int index;
+    for (;;)
+    {
+        if (!hap_thread_pool_pop(job, participant, &index))
+        {
+            if (hap_thread_pool_steal(job, participant, participant_count))
+            {
+                continue;
+            }
+            break;
+        }
+        job->function(job->p, index);
+        worked = 1;
+        if (atomic_fetch_sub(&job->remaining, 1) == 1)
+        {
+            *finished = 1;
+            if (job->allocation == NULL)
+            {
+                pthread_mutex_lock(&job->mutex);
+                job->done = 1;
+                pthread_cond_signal(&job->cond);
+                pthread_mutex_unlock(&job->mutex);
+            }
+        }
+    }
+    return worked;
+}
+
+// Withdraws a slot's job, which the caller must not be counted as a user of, and waits until no worker can still be using it
+static void hap_thread_pool_withdraw(HapThreadPoolSlot *slot)
+{
+    atomic_store(&slot->job, &hap_thread_pool_reserved_job);
+    while (atomic_load(&slot->users) != 0)
+    {
+        hap_thread_pool_pause();
+    }
+    atomic_store(&slot->job, NULL);
+}
+
+// Performs work from any published job, returning 0 if there was none
+static int hap_thread_pool_find_work(HapThreadPool *pool, unsigned int worker)
+{
+    int worked = 0;
+    unsigned int i;
+    for (i = 0; i < kHapThreadPoolMaxJobs; i++)
+    {
+        // Start at a different slot on each thread so they spread over concurrent jobs
+        HapThreadPoolSlot *slot = &pool->slots[(worker + i) % kHapThreadPoolMaxJobs];
+        HapThreadPoolJob *job;
+        if (atomic_load_explicit(&slot->job, memory_order_relaxed) == NULL)
+        {
+            continue;
+        }
+        atomic_fetch_add(&slot->users, 1);
+        job = atomic_load(&slot->job);
+        if (job != NULL && job != &hap_thread_pool_reserved_job)
+        {
+            int finished = 0;
+            worked |= hap_thread_pool_work(job, worker, pool->thread_count + 1, &finished);
+            if (finished && job->allocation != NULL)
+            {
+                // Nobody waits for an asynchronous job, so the thread which completes it withdraws and frees it
+                atomic_fetch_sub(&slot->users, 1);
+                hap_thread_pool_withdraw(slot);
+                free(job->allocation);
+                continue;
+            }
+        }
+        atomic_fetch_sub(&slot->users, 1);
+    }
+    return worked;
+}
+
+static void *hap_thread_pool_thread(void *arg)
+{
+    HapThreadPoolWorker *worker = (HapThreadPoolWorker *)arg;
+    HapThreadPool *pool = worker->pool;
+    unsigned int spins = 0;
+
+    while (!atomic_load(&pool->stop))
+    {
+        unsigned int epoch;
+
+        if (hap_thread_pool_find_work(pool, worker->index))
+        {
+            spins = 0;
+            continue;
+        }
+        if (++spins < kHapThreadPoolSpinCount)
+        {
+            hap_thread_pool_pause();
+            continue;
+        }
+
+        /*
+         Sleep until a job is published. The epoch is read before looking for work one last time so that a job published
+         after that is not missed.
+         */
+        epoch = atomic_load(&pool->epoch);
+        if (hap_thread_pool_find_work(pool, worker->index))
+        {
+            spins = 0;
+            continue;
+        }
+        pthread_mutex_lock(&pool->mutex);
+        atomic_fetch_add(&pool->sleeping, 1);
+        while (atomic_load(&pool->epoch) == epoch && !atomic_load(&pool->stop))
+        {
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+        }
+        atomic_fetch_sub(&pool->sleeping, 1);
+        pthread_mutex_unlock(&pool->mutex);
+        spins = 0;
+    }
+    return NULL;
+}
+
+HapThreadPool *HapCreateThreadPool(unsigned int threadCount)
+{
+    HapThreadPool *pool;
+    void *allocation;
+    unsigned int i;
+
+    if (threadCount == 0)
+    {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = processors > 0 ? (unsigned int)processors : 1;
+    }
+    if (threadCount > kHapThreadPoolMaxThreads)
+    {
+        threadCount = kHapThreadPoolMaxThreads;
+    }
+
+    allocation = malloc(sizeof(HapThreadPool) + kHapThreadPoolCacheLineSize - 1);
+    if (allocation == NULL)
+    {
+        return NULL;
+    }
+    pool = (HapThreadPool *)(((uintptr_t)allocation + kHapThreadPoolCacheLineSize - 1) & ~(uintptr_t)(kHapThreadPoolCacheLineSize - 1));
+    pool->allocation = allocation;
+
+    pool->thread_count = 0;
+    for (i = 0; i < kHapThreadPoolMaxJobs; i++)
+    {
+        atomic_init(&pool->slots[i].job, NULL);
+        atomic_init(&pool->slots[i].users, 0);
+    }
+    atomic_init(&pool->epoch, 0);
+    atomic_init(&pool->sleeping, 0);
+    atomic_init(&pool->stop, 0);
+    if (pthread_mutex_init(&pool->mutex, NULL) != 0)
+    {
+        free(pool->allocation);
+        return NULL;
+    }
+    if (pthread_cond_init(&pool->cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&pool->mutex);
+        free(pool->allocation);
+        return NULL;
+    }
+
+    for (i = 0; i < threadCount; i++)
+    {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (pthread_create(&pool->workers[i].thread, NULL, hap_thread_pool_thread, &pool->workers[i]) != 0)
+        {
+            break;
+        }
+        pool->thread_count++;
+    }
+
+    if (pool->thread_count == 0)
+    {
+        HapDestroyThreadPool(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void HapDestroyThreadPool(HapThreadPool *pool)
+{
+    unsigned int i;
+
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    atomic_store(&pool->stop, 1);
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (i = 0; i < pool->thread_count; i++)
+    {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->allocation);
+}
+
+// Returns a free slot, reserved for the caller to publish a job in, or NULL if every slot is in use
+static HapThreadPoolSlot *hap_thread_pool_reserve_slot(HapThreadPool *pool)
+{
+    unsigned int i;
+    for (i = 0; i < kHapThreadPoolMaxJobs; i++)
+    {
+        HapThreadPoolJob *expected = NULL;
+        if (atomic_load_explicit(&pool->slots[i].job, memory_order_relaxed) == NULL
+            && atomic_compare_exchange_strong(&pool->slots[i].job, &expected, &hap_thread_pool_reserved_job))
+        {
+            return &pool->slots[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ Divides count work items evenly between the first participant_count ranges of a job, leaving any others empty, and
+ publishes it in a reserved slot, waking up to wake sleeping workers
+ */
+static void hap_thread_pool_publish(HapThreadPool *pool, HapThreadPoolSlot *slot, HapThreadPoolJob *job,
+                                    unsigned int count, unsigned int participant_count, unsigned int wake)
+{
+    unsigned int sleeping;
+    unsigned int i;
+
+    for (i = 0; i < pool->thread_count + 1; i++)
+    {
+        unsigned int begin = count;
+        unsigned int end = count;
+        if (i < participant_count)
+        {
+            begin = (unsigned int)(((uint64_t)count * i) / participant_count);
+            end = (unsigned int)(((uint64_t)count * (i + 1)) / participant_count);
+        }
+        atomic_init(&job->ranges[i].value, hap_thread_pool_range(begin, end));
+    }
+
+    atomic_store(&slot->job, job);
+    atomic_fetch_add(&pool->epoch, 1);
+
+    // Only wake as many sleeping workers as there is work for
+    sleeping = atomic_load(&pool->sleeping);
+    if (sleeping > 0)
+    {
+        if (wake > sleeping)
+        {
+            wake = sleeping;
+        }
+        pthread_mutex_lock(&pool->mutex);
+        if (wake >= pool->thread_count)
+        {
+            pthread_cond_broadcast(&pool->cond);
+        }
+        else
+        {
+            for (i = 0; i < wake; i++)
+            {
+                pthread_cond_signal(&pool->cond);
+            }
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+void HapThreadPoolCallback(HapDecodeWorkFunction function, void *p, unsigned int count, void *info)
+{
+    HapThreadPool *pool = (HapThreadPool *)info;
+    HapThreadPoolSlot *slot = NULL;
+    HapThreadPoolJob job;
+    unsigned int participant_count;
+    unsigned int spins;
+    int finished = 0;
+    unsigned int i;
+
+    if (pool != NULL && count > 1)
+    {
+        slot = hap_thread_pool_reserve_slot(pool);
+    }
+
+    if (slot == NULL)
+    {
+        /*
+         There is no pool, too little work to share or too many jobs in progress, so do the work on this thread
+         */
+        for (i = 0; i < count; i++)
+        {
+            function(p, i);
+        }
+        return;
+    }
+
+    job.function = function;
+    job.p = p;
+    job.allocation = NULL;
+    job.done = 0;
+    atomic_init(&job.remaining, count);
+    pthread_mutex_init(&job.mutex, NULL);
+    pthread_cond_init(&job.cond, NULL);
+
+    // Divide the work evenly between the workers and this thread, which takes the final range
+    participant_count = pool->thread_count + 1;
+    hap_thread_pool_publish(pool, slot, &job, count, participant_count, count - 1);
+
+    hap_thread_pool_work(&job, participant_count - 1, participant_count, &finished);
+
+    // Wait for work other threads are still performing, briefly spinning before sleeping
+    for (spins = 0; atomic_load(&job.remaining) != 0 && spins < kHapThreadPoolSpinCount; spins++)
+    {
+        hap_thread_pool_pause();
+    }
+    pthread_mutex_lock(&job.mutex);
+    while (!job.done)
+    {
+        pthread_cond_wait(&job.cond, &job.mutex);
+    }
+    pthread_mutex_unlock(&job.mutex);
+
+    hap_thread_pool_withdraw(slot);
+
+    pthread_cond_destroy(&job.cond);
+    pthread_mutex_destroy(&job.mutex);
+}
+
+void HapThreadPoolAsyncCallback(HapDecodeWorkFunction function, void *p, unsigned int count, void *info)
+{
+    HapThreadPool *pool = (HapThreadPool *)info;
+    HapThreadPoolSlot *slot = NULL;
+    HapThreadPoolJob *job = NULL;
+    void *allocation = NULL;
+    unsigned int i;
+
+    if (pool != NULL && count > 0)
+    {
+        allocation = malloc(sizeof(HapThreadPoolJob) + kHapThreadPoolCacheLineSize - 1);
+        if (allocation != NULL)
+        {
+            slot = hap_thread_pool_reserve_slot(pool);
+            if (slot == NULL)
+            {
+                free(allocation);
+            }
+        }
+    }
+
+    if (slot == NULL)
+    {
+        /*
+         There is no pool, no memory or too many jobs in progress, so do the work on this thread
+         */
+        for (i = 0; i < count; i++)
+        {
+            function(p, i);
+        }
+        return;
+    }
+
+    job = (HapThreadPoolJob *)(((uintptr_t)allocation + kHapThreadPoolCacheLineSize - 1) & ~(uintptr_t)(kHapThreadPoolCacheLineSize - 1));
+    job->function = function;
+    job->p = p;
+    job->allocation = allocation;
+    job->done = 0;
+    atomic_init(&job->remaining, count);
+
+    // Divide the work evenly between the workers only, and return without waiting for it
+    hap_thread_pool_publish(pool, slot, job, count, pool->thread_count, count);
+}
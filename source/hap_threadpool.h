@@ -0,0 +1,81 @@
+/*
+ hap_threadpool.h
+ 
+ Copyright (c) 2011-2013, Tom Butterworth and Vidvox LLC. All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef hap_threadpool_h
+#define hap_threadpool_h
+
+#include "hap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ An optional pool of persistent worker threads which can be used as the callback for HapDecode() and the other functions
+ taking a HapDecodeCallback. Building it requires POSIX threads and C11 atomics (<stdatomic.h> and _Alignas), so it must
+ be compiled as C11 or later, and can't be built with compilers lacking them, such as older versions of MSVC.
+
+ One pool may be shared by any number of threads decoding or encoding at once. Work passed to the callback is divided
+ between the workers and the calling thread, which also does work until all of it has been completed. Idle workers take
+ work from busy ones, and wait briefly for more work before sleeping.
+ */
+typedef struct HapThreadPool HapThreadPool;
+
+/*
+ Returns a new pool with threadCount worker threads, or NULL on error.
+ If threadCount is 0 the pool has one worker for each online processor.
+ */
+HapThreadPool *HapCreateThreadPool(unsigned int threadCount);
+
+/*
+ Stops the pool's threads and frees it. No thread may be using the pool when this is called, and all work passed to
+ HapThreadPoolAsyncCallback() must have been completed.
+ */
+void HapDestroyThreadPool(HapThreadPool *pool);
+
+/*
+ A HapDecodeCallback which performs work on the pool passed as info.
+
+ HapDecode(inputBuffer, inputBufferBytes, 0, HapThreadPoolCallback, pool, ...);
+ */
+void HapThreadPoolCallback(HapDecodeWorkFunction function, void *p, unsigned int count, void *info);
+
+/*
+ A HapDecodeCallback which hands work to the workers of the pool passed as info and returns without waiting for it to be
+ completed, for use with HapDecodeAsync(). HapThreadPoolCallback() waits for its work, so HapDecodeAsync() using it only
+ returns once the texture has been decoded. If too many jobs are in progress or memory can't be allocated, the work is
+ done on the calling thread before this returns.
+
+ HapDecodeAsync(request, &frameInfo, 0, HapThreadPoolAsyncCallback, pool, ..., completion, p);
+ */
+void HapThreadPoolAsyncCallback(HapDecodeWorkFunction function, void *p, unsigned int count, void *info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,821 @@
+/*
+ hap_pixels_test.c
+ 
+ Copyright (c) 2011-2013, Tom Butterworth and Vidvox LLC. All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ Checks the CPU texture codecs in hap_pixels.c: decodes reference BC7 and BC6H blocks in every mode, built here from the
+ bit layouts in the BPTC specification, round-trips an image through each texture format, decodes a whole Hap Q Alpha
+ frame of an image whose size isn't a whole number of blocks, and checks frames decoded to YUV against their RGBA.
+
+ Build it with the library and snappy's C bindings, for example, from this directory:
+
+ cc -std=c99 -I../source -o hap_pixels_test hap_pixels_test.c ../source/hap.c ../source/hap_pixels.c -lsnappy -lm
+
+ It prints each failure and exits non-zero if there were any.
+ */
+
+#include "hap.h"
+#include "hap_pixels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static int failures = 0;
+
+static void check(int condition, const char *what, int detail)
+{
+    if (!condition)
+    {
+        printf("FAIL: %s (%#x)\n", what, detail);
+        failures++;
+    }
+}
+
+static void serial_callback(HapDecodeWorkFunction function, void *p, unsigned int count, void *info)
+{
+    unsigned int i;
+    (void)info;
+    for (i = 0; i < count; i++)
+    {
+        function(p, i);
+    }
+}
+
+/*
+ Blocks are assembled a field at a time, least significant bit first
+ */
+typedef struct Bits {
+    unsigned char block[16];
+    unsigned int position;
+} Bits;
+
+static void bits_init(Bits *bits)
+{
+    memset(bits->block, 0, sizeof(bits->block));
+    bits->position = 0;
+}
+
+static void bits_write(Bits *bits, unsigned int value, unsigned int count)
+{
+    unsigned int i;
+    for (i = 0; i < count; i++, bits->position++)
+    {
+        if ((value >> i) & 1U)
+        {
+            bits->block[bits->position / 8] |= (unsigned char)(1U << (bits->position % 8));
+        }
+    }
+}
+
+static void bits_set(Bits *bits, unsigned int first, unsigned int last)
+{
+    unsigned int i;
+    for (i = first; i <= last; i++)
+    {
+        bits->block[i / 8] |= (unsigned char)(1U << (i % 8));
+    }
+}
+
+/*
+ Decodes a single 4x4 block, stored uncompressed in a frame of textureFormat, to pixels
+ */
+static unsigned int decode_block(const unsigned char *block, unsigned int textureFormat, unsigned int sectionType,
+                                 unsigned int pixelFormat, void *pixels, unsigned long bytesPerRow)
+{
+    unsigned char frame[20];
+    HapFrameInfo info;
+    unsigned int result;
+
+    frame[0] = 16;
+    frame[1] = 0;
+    frame[2] = 0;
+    frame[3] = (unsigned char)sectionType;
+    memcpy(frame + 4, block, 16);
+
+    result = HapGetFrameInfo(frame, sizeof(frame), &info);
+    if (result == HapResult_No_Error && info.textures[0].textureFormat != textureFormat)
+    {
+        result = HapResult_Bad_Frame;
+    }
+    if (result == HapResult_No_Error)
+    {
+        result = HapDecodeToPixels(NULL, &info, 0, 4, 4, pixelFormat, serial_callback, NULL, pixels, bytesPerRow, bytesPerRow * 4);
+    }
+    return result;
+}
+
+/*
+ BC7 modes, as in the table of the BPTC specification
+ */
+typedef struct BC7Mode {
+    unsigned int subsets;
+    unsigned int partition_bits;
+    unsigned int rotation_bits;
+    unsigned int index_selection_bits;
+    unsigned int colour_bits;
+    unsigned int alpha_bits;
+    unsigned int endpoint_pbits;
+    unsigned int shared_pbits;
+} BC7Mode;
+
+static const BC7Mode bc7_modes[8] = {
+    { 3, 4, 0, 0, 4, 0, 1, 0 },
+    { 2, 6, 0, 0, 6, 0, 0, 1 },
+    { 3, 6, 0, 0, 5, 0, 0, 0 },
+    { 2, 6, 0, 0, 7, 0, 1, 0 },
+    { 1, 0, 2, 1, 5, 6, 0, 0 },
+    { 1, 0, 2, 0, 7, 8, 0, 0 },
+    { 1, 0, 0, 0, 7, 7, 1, 0 },
+    { 2, 6, 0, 0, 5, 5, 1, 0 }
+};
+
+static unsigned int bc7_expand(unsigned int value, unsigned int bits)
+{
+    value <<= 8 - bits;
+    return value | (value >> bits);
+}
+
+/*
+ Every BC7 mode, with every endpoint set to the same colour and every index zero, decodes to that colour
+ */
+static void test_bc7_modes(void)
+{
+    unsigned int m;
+    for (m = 0; m < 8; m++)
+    {
+        const BC7Mode *mode = &bc7_modes[m];
+        unsigned int has_pbit = mode->endpoint_pbits || mode->shared_pbits;
+        unsigned int colour[3] = { 0x5A, 0x21, 0x6B };
+        unsigned int alpha = 0x35;
+        unsigned int pbit = 1;
+        unsigned int expected[4];
+        unsigned char pixels[64];
+        Bits bits;
+        unsigned int c, e, i;
+
+        bits_init(&bits);
+        bits_write(&bits, 1U << m, m + 1);
+        bits_write(&bits, 0, mode->partition_bits + mode->rotation_bits + mode->index_selection_bits);
+        for (c = 0; c < 3; c++)
+        {
+            for (e = 0; e < mode->subsets * 2; e++)
+            {
+                bits_write(&bits, colour[c] & ((1U << mode->colour_bits) - 1), mode->colour_bits);
+            }
+        }
+        for (e = 0; e < (mode->alpha_bits ? mode->subsets * 2 : 0); e++)
+        {
+            bits_write(&bits, alpha & ((1U << mode->alpha_bits) - 1), mode->alpha_bits);
+        }
+        for (e = 0; e < mode->subsets * (mode->endpoint_pbits ? 2 : mode->shared_pbits); e++)
+        {
+            bits_write(&bits, pbit, 1);
+        }
+
+        for (c = 0; c < 3; c++)
+        {
+            unsigned int value = colour[c] & ((1U << mode->colour_bits) - 1);
+            if (has_pbit)
+            {
+                value = (value << 1) | pbit;
+            }
+            expected[c] = bc7_expand(value, mode->colour_bits + has_pbit);
+        }
+        if (mode->alpha_bits)
+        {
+            unsigned int value = alpha & ((1U << mode->alpha_bits) - 1);
+            if (has_pbit)
+            {
+                value = (value << 1) | pbit;
+            }
+            expected[3] = mode->alpha_bits + has_pbit == 8 ? value : bc7_expand(value, mode->alpha_bits + has_pbit);
+        }
+        else
+        {
+            expected[3] = 255;
+        }
+
+        check(decode_block(bits.block, HapTextureFormat_RGBA_BPTC_UNORM, 0xAC, HapPixelFormat_RGBA8, pixels, 16) == HapResult_No_Error,
+              "BC7 decode", (int)m);
+        for (i = 0; i < 16; i++)
+        {
+            check(pixels[i * 4] == expected[0] && pixels[i * 4 + 1] == expected[1]
+                  && pixels[i * 4 + 2] == expected[2] && pixels[i * 4 + 3] == expected[3],
+                  "BC7 solid block", (int)m);
+        }
+    }
+}
+
+/*
+ A BC7 mode 6 block from black to white, with each pixel using the index of its position, checks the interpolation weights
+ */
+static void test_bc7_interpolation(void)
+{
+    static const unsigned int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+    unsigned char pixels[64];
+    Bits bits;
+    unsigned int i;
+
+    bits_init(&bits);
+    bits_write(&bits, 1U << 6, 7);
+    for (i = 0; i < 4; i++)
+    {
+        bits_write(&bits, 0, 7);
+        bits_write(&bits, 0x7F, 7);
+    }
+    bits_write(&bits, 0, 1);
+    bits_write(&bits, 1, 1);
+    // The first index has an implicit leading zero
+    bits_write(&bits, 0, 3);
+    for (i = 1; i < 16; i++)
+    {
+        bits_write(&bits, i, 4);
+    }
+
+    check(decode_block(bits.block, HapTextureFormat_RGBA_BPTC_UNORM, 0xAC, HapPixelFormat_RGBA8, pixels, 16) == HapResult_No_Error,
+          "BC7 decode", 6);
+    for (i = 0; i < 16; i++)
+    {
+        unsigned int expected = (weights[i] * 255 + 32) >> 6;
+        check(pixels[i * 4] == expected && pixels[i * 4 + 3] == expected, "BC7 interpolation", 6);
+    }
+}
+
+/*
+ BC6H modes, from the block layouts in the BPTC specification
+ */
+typedef struct BC6HMode {
+    unsigned int mode_bits;
+    unsigned int mode;
+    unsigned int endpoint_bits;
+    unsigned int regions;
+    unsigned int transformed;       // whether endpoints after the first are deltas from it
+    // The bit ranges holding the first endpoint, or every endpoint if they are not deltas
+    unsigned int w_ranges[4][2];
+    // The bit holding the most significant bit of each endpoint's red, green and blue, or 0 for deltas
+    unsigned int top_bits[4][3];
+} BC6HMode;
+
+static const BC6HMode bc6h_modes[14] = {
+    { 2, 0x00, 10, 2, 1, { { 5, 34 } },                                 { { 14, 24, 34 } } },
+    { 2, 0x01,  7, 2, 1, { { 5, 11 }, { 15, 21 }, { 25, 31 } },         { { 11, 21, 31 } } },
+    { 5, 0x02, 11, 2, 1, { { 5, 34 }, { 40, 40 }, { 49, 49 }, { 59, 59 } }, { { 40, 49, 59 } } },
+    { 5, 0x06, 11, 2, 1, { { 5, 34 }, { 39, 39 }, { 50, 50 }, { 59, 59 } }, { { 39, 50, 59 } } },
+    { 5, 0x0A, 11, 2, 1, { { 5, 34 }, { 39, 39 }, { 49, 49 }, { 60, 60 } }, { { 39, 49, 60 } } },
+    { 5, 0x0E,  9, 2, 1, { { 5, 13 }, { 15, 23 }, { 25, 33 } },         { { 13, 23, 33 } } },
+    { 5, 0x12,  8, 2, 1, { { 5, 12 }, { 15, 22 }, { 25, 32 } },         { { 12, 22, 32 } } },
+    { 5, 0x16,  8, 2, 1, { { 5, 12 }, { 15, 22 }, { 25, 32 } },         { { 12, 22, 32 } } },
+    { 5, 0x1A,  8, 2, 1, { { 5, 12 }, { 15, 22 }, { 25, 32 } },         { { 12, 22, 32 } } },
+    { 5, 0x1E,  6, 2, 0, { { 5, 76 } },
+      { { 10, 20, 30 }, { 40, 50, 60 }, { 70, 21, 22 }, { 76, 31, 33 } } },
+    { 5, 0x03, 10, 1, 0, { { 5, 64 } },                                 { { 14, 24, 34 }, { 44, 54, 64 } } },
+    { 5, 0x07, 11, 1, 1, { { 5, 34 }, { 44, 44 }, { 54, 54 }, { 64, 64 } }, { { 44, 54, 64 } } },
+    { 5, 0x0B, 12, 1, 1, { { 5, 34 }, { 43, 44 }, { 53, 54 }, { 63, 64 } }, { { 43, 53, 63 } } },
+    { 5, 0x0F, 16, 1, 1, { { 5, 34 }, { 39, 44 }, { 49, 54 }, { 59, 64 } }, { { 39, 49, 59 } } }
+};
+
+static unsigned int bc6h_unquantize(unsigned int value, unsigned int bits)
+{
+    if (bits >= 15 || value == 0)
+    {
+        return value;
+    }
+    if (value == (1U << bits) - 1)
+    {
+        return 0xFFFF;
+    }
+    return ((value << 16) + 0x8000) >> bits;
+}
+
+static unsigned int half_at(const unsigned char *pixels, unsigned int index)
+{
+    unsigned short half;
+    memcpy(&half, pixels + index * 2, 2);
+    return half;
+}
+
+/*
+ Every BC6H mode decodes a block whose first endpoint is largest, with other endpoints equal to it and every index zero,
+ and one whose endpoints have only their most significant bit set
+ */
+static void test_bc6h_modes(void)
+{
+    unsigned int m;
+    for (m = 0; m < 14; m++)
+    {
+        const BC6HMode *mode = &bc6h_modes[m];
+        unsigned char pixels[96];
+        unsigned int expected;
+        Bits bits;
+        unsigned int i, r;
+
+        bits_init(&bits);
+        bits_write(&bits, mode->mode, mode->mode_bits);
+        for (r = 0; r < 4 && mode->w_ranges[r][1] != 0; r++)
+        {
+            bits_set(&bits, mode->w_ranges[r][0], mode->w_ranges[r][1]);
+        }
+        check(decode_block(bits.block, HapTextureFormat_RGB_BPTC_UNSIGNED_FLOAT, 0xA2, HapPixelFormat_RGB16F, pixels, 24) == HapResult_No_Error,
+              "BC6H decode", (int)m);
+        expected = (bc6h_unquantize((1U << mode->endpoint_bits) - 1, mode->endpoint_bits) * 31) >> 6;
+        for (i = 0; i < 48; i++)
+        {
+            check(half_at(pixels, i) == expected, "BC6H largest block", (int)m);
+        }
+
+        bits_init(&bits);
+        bits_write(&bits, mode->mode, mode->mode_bits);
+        for (r = 0; r < 4; r++)
+        {
+            unsigned int c;
+            for (c = 0; c < 3; c++)
+            {
+                if (mode->top_bits[r][c])
+                {
+                    bits_set(&bits, mode->top_bits[r][c], mode->top_bits[r][c]);
+                }
+            }
+        }
+        check(decode_block(bits.block, HapTextureFormat_RGB_BPTC_UNSIGNED_FLOAT, 0xA2, HapPixelFormat_RGB16F, pixels, 24) == HapResult_No_Error,
+              "BC6H decode", (int)m);
+        expected = (bc6h_unquantize(1U << (mode->endpoint_bits - 1), mode->endpoint_bits) * 31) >> 6;
+        for (i = 0; i < 48; i++)
+        {
+            check(half_at(pixels, i) == expected, "BC6H top bit block", (int)m);
+        }
+    }
+}
+
+/*
+ A BC6H mode 11 block from zero to the largest value, with each pixel using the index of its position
+ */
+static void test_bc6h_interpolation(void)
+{
+    static const unsigned int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+    unsigned char pixels[96];
+    Bits bits;
+    unsigned int i;
+
+    bits_init(&bits);
+    bits_write(&bits, 0x03, 5);
+    bits_write(&bits, 0, 30);
+    bits_write(&bits, 0x3FF, 10);
+    bits_write(&bits, 0x3FF, 10);
+    bits_write(&bits, 0x3FF, 10);
+    bits_write(&bits, 0, 3);
+    for (i = 1; i < 16; i++)
+    {
+        bits_write(&bits, i, 4);
+    }
+
+    check(decode_block(bits.block, HapTextureFormat_RGB_BPTC_UNSIGNED_FLOAT, 0xA2, HapPixelFormat_RGB16F, pixels, 24) == HapResult_No_Error,
+          "BC6H decode", 11);
+    for (i = 0; i < 16; i++)
+    {
+        unsigned int expected = ((((weights[i] * 0xFFFF) + 32) >> 6) * 31) >> 6;
+        check(half_at(pixels, i * 3) == expected && half_at(pixels, i * 3 + 2) == expected, "BC6H interpolation", 11);
+    }
+}
+
+static unsigned int float_to_half(float value)
+{
+    int exponent;
+    float mantissa;
+    unsigned int bits;
+
+    if (value < ldexpf(1.0f, -14))
+    {
+        return (unsigned int)(value * ldexpf(1.0f, 24) + 0.5f);
+    }
+    mantissa = frexpf(value, &exponent);
+    bits = (unsigned int)((mantissa * 2.0f - 1.0f) * 1024.0f + 0.5f);
+    return ((unsigned int)(exponent + 14) << 10) + bits;
+}
+
+static float half_to_float(unsigned int half)
+{
+    unsigned int exponent = (half >> 10) & 31;
+    unsigned int mantissa = half & 1023;
+    float value = exponent == 0 ? ldexpf((float)mantissa, -24) : ldexpf((float)(mantissa | 1024), (int)exponent - 25);
+    return (half & 0x8000) ? -value : value;
+}
+
+/*
+ Encodes a smooth image in textureFormat and decodes it again, checking the error is within what the format allows
+ */
+static void test_round_trip(unsigned int textureFormat, unsigned int quality, double minimumSNR)
+{
+    const unsigned int width = 64;
+    const unsigned int height = 48;
+    int is_float = textureFormat == HapTextureFormat_RGB_BPTC_UNSIGNED_FLOAT || textureFormat == HapTextureFormat_RGB_BPTC_SIGNED_FLOAT;
+    unsigned int pixel_format = is_float ? HapPixelFormat_RGB16F : HapPixelFormat_RGBA8;
+    unsigned int channels = is_float ? 3 : 4;
+    unsigned long bytes_per_row = width * channels * (is_float ? 2 : 1);
+    unsigned char *image = (unsigned char *)malloc(bytes_per_row * height);
+    unsigned char *decoded = (unsigned char *)malloc(bytes_per_row * height);
+    unsigned int compressor = HapCompressorSnappy;
+    unsigned int chunk_count = 3;
+    unsigned long frame_bytes = HapMaxEncodedLengthForPixels(width, height, 1, &textureFormat, &chunk_count);
+    void *frame = malloc(frame_bytes);
+    unsigned long frame_bytes_used;
+    HapFrameInfo info;
+    double signal = 0.0;
+    double noise = 0.0;
+    unsigned int x, y, c;
+
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            for (c = 0; c < channels; c++)
+            {
+                float value = (float)(x * (c + 1) + y * (4 - c)) / (float)(width * 4 + height * 4);
+                if (is_float)
+                {
+                    unsigned short half = (unsigned short)float_to_half(value * 4.0f);
+                    memcpy(image + y * bytes_per_row + (x * channels + c) * 2, &half, 2);
+                }
+                else
+                {
+                    image[y * bytes_per_row + x * channels + c] = (unsigned char)(value * 255.0f);
+                }
+            }
+        }
+    }
+
+    check(HapEncodePixels(image, bytes_per_row, width, height, pixel_format, 1, &textureFormat, &compressor, &chunk_count,
+                          quality, 0, serial_callback, NULL, frame, frame_bytes, &frame_bytes_used) == HapResult_No_Error,
+          "encode", (int)textureFormat);
+    check(HapGetFrameInfo(frame, frame_bytes_used, &info) == HapResult_No_Error, "frame info", (int)textureFormat);
+    check(HapDecodeToPixels(NULL, &info, 0, width, height, pixel_format, serial_callback, NULL,
+                            decoded, bytes_per_row, bytes_per_row * height) == HapResult_No_Error,
+          "decode", (int)textureFormat);
+
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            for (c = 0; c < channels; c++)
+            {
+                double a, b;
+                // DXT1 and YCoCg are opaque, and RGTC1 keeps only alpha
+                if ((c == 3 && (textureFormat == HapTextureFormat_RGB_DXT1 || textureFormat == HapTextureFormat_YCoCg_DXT5))
+                    || (c != 3 && textureFormat == HapTextureFormat_A_RGTC1))
+                {
+                    continue;
+                }
+                if (is_float)
+                {
+                    unsigned short half;
+                    memcpy(&half, image + y * bytes_per_row + (x * channels + c) * 2, 2);
+                    a = half_to_float(half);
+                    memcpy(&half, decoded + y * bytes_per_row + (x * channels + c) * 2, 2);
+                    b = half_to_float(half);
+                }
+                else
+                {
+                    a = image[y * bytes_per_row + x * channels + c];
+                    b = decoded[y * bytes_per_row + x * channels + c];
+                }
+                signal += a * a;
+                noise += (a - b) * (a - b);
+            }
+        }
+    }
+    check(noise == 0.0 || 10.0 * log10(signal / noise) >= minimumSNR, "round trip", (int)textureFormat);
+
+    free(frame);
+    free(decoded);
+    free(image);
+}
+
+/*
+ Encodes a Hap Q Alpha frame of an image whose dimensions aren't multiples of the block size, and decodes it whole with
+ HapDecodeFrameToPixels(), into rows with padding which must be left untouched. Colour and alpha must match each texture
+ decoded alone, and be close to the image.
+ */
+static void test_hap_q_alpha(unsigned int quality, unsigned int alphaCompressor)
+{
+    const unsigned int width = 61;
+    const unsigned int height = 45;
+    const unsigned long bytes_per_row = width * 4;
+    const unsigned long padded_bytes_per_row = bytes_per_row + 12;
+    unsigned int texture_formats[2] = { HapTextureFormat_YCoCg_DXT5, HapTextureFormat_A_RGTC1 };
+    unsigned int compressors[2] = { HapCompressorSnappy, 0 };
+    unsigned int chunk_counts[2] = { 5, 3 };
+    unsigned char *image = (unsigned char *)malloc(bytes_per_row * height);
+    unsigned char *merged = (unsigned char *)malloc(padded_bytes_per_row * (height + 1));
+    unsigned char *colour = (unsigned char *)malloc(bytes_per_row * height);
+    unsigned char *alpha = (unsigned char *)malloc(bytes_per_row * height);
+    unsigned long frame_bytes = HapMaxEncodedLengthForPixels(width, height, 2, texture_formats, chunk_counts);
+    void *frame = malloc(frame_bytes);
+    unsigned long frame_bytes_used;
+    HapDecoderContext *context = HapCreateDecoderContext();
+    HapFrameInfo info;
+    double signal[2] = { 0.0, 0.0 };
+    double noise[2] = { 0.0, 0.0 };
+    int matches = 1;
+    int padding_intact = 1;
+    unsigned int x, y, c;
+
+    compressors[1] = alphaCompressor;
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            unsigned char *pixel = image + y * bytes_per_row + x * 4;
+            pixel[0] = (unsigned char)(x * 4);
+            pixel[1] = (unsigned char)(y * 5);
+            pixel[2] = (unsigned char)(255 - (x + y) * 2);
+            pixel[3] = (unsigned char)(64 + x + y * 2);
+        }
+    }
+
+    check(HapEncodePixels(image, bytes_per_row, width, height, HapPixelFormat_RGBA8, 2, texture_formats, compressors,
+                          chunk_counts, quality, 0, serial_callback, NULL, frame, frame_bytes, &frame_bytes_used) == HapResult_No_Error,
+          "hap q alpha encode", (int)alphaCompressor);
+    check(HapGetFrameInfo(frame, frame_bytes_used, &info) == HapResult_No_Error && info.textureCount == 2,
+          "hap q alpha frame info", (int)alphaCompressor);
+
+    memset(merged, 0xA5, padded_bytes_per_row * (height + 1));
+    check(HapDecodeFrameToPixels(context, &info, width, height, HapPixelFormat_RGBA8, serial_callback, NULL,
+                                 merged, padded_bytes_per_row, padded_bytes_per_row * height) == HapResult_No_Error,
+          "hap q alpha decode", (int)alphaCompressor);
+    check(HapDecodeToPixels(NULL, &info, 0, width, height, HapPixelFormat_RGBA8, serial_callback, NULL,
+                            colour, bytes_per_row, bytes_per_row * height) == HapResult_No_Error,
+          "hap q alpha colour decode", (int)alphaCompressor);
+    check(HapDecodeToPixels(NULL, &info, 1, width, height, HapPixelFormat_RGBA8, serial_callback, NULL,
+                            alpha, bytes_per_row, bytes_per_row * height) == HapResult_No_Error,
+          "hap q alpha alpha decode", (int)alphaCompressor);
+
+    for (y = 0; y <= height; y++)
+    {
+        for (x = y < height ? bytes_per_row : 0; x < padded_bytes_per_row; x++)
+        {
+            if (merged[y * padded_bytes_per_row + x] != 0xA5)
+            {
+                padding_intact = 0;
+            }
+        }
+    }
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            const unsigned char *a = image + y * bytes_per_row + x * 4;
+            const unsigned char *b = merged + y * padded_bytes_per_row + x * 4;
+            if (memcmp(b, colour + y * bytes_per_row + x * 4, 3) != 0 || b[3] != alpha[y * bytes_per_row + x * 4 + 3])
+            {
+                matches = 0;
+            }
+            for (c = 0; c < 4; c++)
+            {
+                signal[c / 3] += (double)a[c] * a[c];
+                noise[c / 3] += ((double)a[c] - b[c]) * ((double)a[c] - b[c]);
+            }
+        }
+    }
+    check(padding_intact, "hap q alpha padding", (int)alphaCompressor);
+    check(matches, "hap q alpha matches textures", (int)alphaCompressor);
+    check(noise[0] == 0.0 || 10.0 * log10(signal[0] / noise[0]) >= 30.0, "hap q alpha colour", (int)alphaCompressor);
+    check(noise[1] == 0.0 || 10.0 * log10(signal[1] / noise[1]) >= 40.0, "hap q alpha alpha", (int)alphaCompressor);
+
+    HapDestroyDecoderContext(context);
+    free(frame);
+    free(alpha);
+    free(colour);
+    free(merged);
+    free(image);
+}
+
+/*
+ Returns the value of a Y', Cb or Cr sample, for channel 0, 1 or 2, of red, green and blue from 0 to 255 in matrix
+ */
+static double yuv_reference(unsigned int matrix, unsigned int channel, double r, double g, double b)
+{
+    double kr = matrix == HapYUVMatrix_BT709 ? 0.2126 : 0.299;
+    double kb = matrix == HapYUVMatrix_BT709 ? 0.0722 : 0.114;
+    double y = kr * r + (1.0 - kr - kb) * g + kb * b;
+
+    switch (channel)
+    {
+        case 0:
+            return 16.0 + y * 219.0 / 255.0;
+        case 1:
+            return 128.0 + (b - y) * 224.0 / 255.0 / (2.0 * (1.0 - kb));
+        default:
+            return 128.0 + (r - y) * 224.0 / 255.0 / (2.0 * (1.0 - kr));
+    }
+}
+
+/*
+ Encodes an image whose dimensions are odd in textureFormat, or as Hap Q Alpha if alphaFormat isn't 0, decodes it with
+ HapDecodeFrameToYUV() in every layout and matrix, and checks the planes against the texture decoded to RGBA and
+ converted here. Chroma is the average of the pixels inside the image of the two by two it covers. Planes have padded
+ rows, which must be left untouched.
+ */
+static void test_yuv(unsigned int textureFormat, unsigned int alphaFormat)
+{
+    const unsigned int width = 61;
+    const unsigned int height = 45;
+    const unsigned int chroma_width = (width + 1) / 2;
+    const unsigned int chroma_height = (height + 1) / 2;
+    const unsigned long padding = 5;
+    const unsigned long bytes_per_row = width * 4;
+    unsigned int texture_formats[2];
+    unsigned int compressors[2] = { HapCompressorSnappy, HapCompressorSnappy };
+    unsigned int chunk_counts[2] = { 7, 2 };
+    unsigned int count = alphaFormat ? 2 : 1;
+    unsigned char *image = (unsigned char *)malloc(bytes_per_row * height);
+    unsigned char *rgba = (unsigned char *)malloc(bytes_per_row * height);
+    unsigned long frame_bytes;
+    void *frame;
+    unsigned long frame_bytes_used;
+    HapFrameInfo info;
+    unsigned int yuv_format, matrix;
+    unsigned int x, y;
+
+    texture_formats[0] = textureFormat;
+    texture_formats[1] = alphaFormat;
+    frame_bytes = HapMaxEncodedLengthForPixels(width, height, count, texture_formats, chunk_counts);
+    frame = malloc(frame_bytes);
+
+    // Colours stay clear of the limits, where converting through RGB would clamp
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            unsigned char *pixel = image + y * bytes_per_row + x * 4;
+            pixel[0] = (unsigned char)(40 + x * 3);
+            pixel[1] = (unsigned char)(200 - y * 3);
+            pixel[2] = (unsigned char)(60 + (x + y) * 2);
+            pixel[3] = (unsigned char)(255 - x);
+        }
+    }
+
+    check(HapEncodePixels(image, bytes_per_row, width, height, HapPixelFormat_RGBA8, count, texture_formats, compressors,
+                          chunk_counts, HapPixelsQuality_Fast, 0, serial_callback, NULL, frame, frame_bytes, &frame_bytes_used) == HapResult_No_Error,
+          "yuv encode", (int)textureFormat);
+    check(HapGetFrameInfo(frame, frame_bytes_used, &info) == HapResult_No_Error, "yuv frame info", (int)textureFormat);
+    check(HapDecodeToPixels(NULL, &info, 0, width, height, HapPixelFormat_RGBA8, serial_callback, NULL,
+                            rgba, bytes_per_row, bytes_per_row * height) == HapResult_No_Error,
+          "yuv rgba decode", (int)textureFormat);
+
+    for (yuv_format = HapYUVFormat_NV12; yuv_format <= HapYUVFormat_I420; yuv_format++)
+    {
+        for (matrix = HapYUVMatrix_BT601; matrix <= HapYUVMatrix_BT709; matrix++)
+        {
+            unsigned int interleaved = yuv_format == HapYUVFormat_NV12;
+            unsigned int plane_count = interleaved ? 2 : 3;
+            unsigned long plane_bytes_per_row[3];
+            unsigned long plane_bytes[3];
+            void *planes[3] = { NULL, NULL, NULL };
+            double worst = 0.0;
+            int padding_intact = 1;
+            unsigned int plane;
+
+            for (plane = 0; plane < plane_count; plane++)
+            {
+                unsigned long row_bytes = plane == 0 ? width : chroma_width * (interleaved ? 2 : 1);
+                plane_bytes_per_row[plane] = row_bytes + padding;
+                plane_bytes[plane] = plane_bytes_per_row[plane] * (plane == 0 ? height : chroma_height);
+                planes[plane] = malloc(plane_bytes[plane]);
+                memset(planes[plane], 0xA5, plane_bytes[plane]);
+            }
+
+            check(HapDecodeFrameToYUV(NULL, &info, width, height, yuv_format, matrix, serial_callback, NULL,
+                                      planes, plane_bytes_per_row, plane_bytes) == HapResult_No_Error,
+                  "yuv decode", (int)textureFormat);
+
+            for (y = 0; y < height; y++)
+            {
+                const unsigned char *luma = (const unsigned char *)planes[0] + y * plane_bytes_per_row[0];
+                for (x = 0; x < width; x++)
+                {
+                    const unsigned char *pixel = rgba + y * bytes_per_row + x * 4;
+                    double difference = fabs(luma[x] - yuv_reference(matrix, 0, pixel[0], pixel[1], pixel[2]));
+                    worst = difference > worst ? difference : worst;
+                }
+            }
+            for (y = 0; y < chroma_height; y++)
+            {
+                for (x = 0; x < chroma_width; x++)
+                {
+                    double sum[3] = { 0.0, 0.0, 0.0 };
+                    unsigned int pixel_count = 0;
+                    unsigned int i, j, c;
+                    for (i = y * 2; i < y * 2 + 2 && i < height; i++)
+                    {
+                        for (j = x * 2; j < x * 2 + 2 && j < width; j++)
+                        {
+                            for (c = 0; c < 3; c++)
+                            {
+                                sum[c] += rgba[i * bytes_per_row + j * 4 + c];
+                            }
+                            pixel_count++;
+                        }
+                    }
+                    for (c = 1; c < 3; c++)
+                    {
+                        unsigned int sample;
+                        double difference;
+                        if (interleaved)
+                        {
+                            sample = ((const unsigned char *)planes[1])[y * plane_bytes_per_row[1] + x * 2 + c - 1];
+                        }
+                        else
+                        {
+                            sample = ((const unsigned char *)planes[c])[y * plane_bytes_per_row[c] + x];
+                        }
+                        difference = fabs(sample - yuv_reference(matrix, c, sum[0] / pixel_count, sum[1] / pixel_count, sum[2] / pixel_count));
+                        worst = difference > worst ? difference : worst;
+                    }
+                }
+            }
+            for (plane = 0; plane < plane_count; plane++)
+            {
+                unsigned long rows = plane_bytes[plane] / plane_bytes_per_row[plane];
+                unsigned long row_bytes = plane_bytes_per_row[plane] - padding;
+                unsigned long row, column;
+                for (row = 0; row < rows; row++)
+                {
+                    for (column = row_bytes; column < plane_bytes_per_row[plane]; column++)
+                    {
+                        if (((const unsigned char *)planes[plane])[row * plane_bytes_per_row[plane] + column] != 0xA5)
+                        {
+                            padding_intact = 0;
+                        }
+                    }
+                }
+                free(planes[plane]);
+            }
+
+            // YCoCg is converted without rounding to RGB first, so may differ from the reference by a little more
+            check(worst <= (textureFormat == HapTextureFormat_YCoCg_DXT5 ? 1.25 : 0.75), "yuv samples", (int)(yuv_format * 16 + matrix));
+            check(padding_intact, "yuv padding", (int)(yuv_format * 16 + matrix));
+        }
+    }
+
+    free(frame);
+    free(rgba);
+    free(image);
+}
+
+int main(void)
+{
+    unsigned int quality;
+
+    test_bc7_modes();
+    test_bc7_interpolation();
+    test_bc6h_modes();
+    test_bc6h_interpolation();
+
+    test_yuv(HapTextureFormat_RGB_DXT1, 0);
+    test_yuv(HapTextureFormat_RGBA_DXT5, 0);
+    test_yuv(HapTextureFormat_RGBA_BPTC_UNORM, 0);
+    test_yuv(HapTextureFormat_YCoCg_DXT5, 0);
+    test_yuv(HapTextureFormat_YCoCg_DXT5, HapTextureFormat_A_RGTC1);
+
+    for (quality = HapPixelsQuality_Fast; quality <= HapPixelsQuality_High; quality++)
+    {
+        test_round_trip(HapTextureFormat_RGB_DXT1, quality, 30.0);
+        test_round_trip(HapTextureFormat_RGBA_DXT5, quality, 30.0);
+        test_round_trip(HapTextureFormat_YCoCg_DXT5, quality, 35.0);
+        test_round_trip(HapTextureFormat_A_RGTC1, quality, 40.0);
+        test_round_trip(HapTextureFormat_RGBA_BPTC_UNORM, quality, 35.0);
+        test_round_trip(HapTextureFormat_RGB_BPTC_UNSIGNED_FLOAT, quality, 35.0);
+        test_round_trip(HapTextureFormat_RGB_BPTC_SIGNED_FLOAT, quality, 35.0);
+        test_hap_q_alpha(quality, HapCompressorSnappy);
+        test_hap_q_alpha(quality, HapCompressorNone);
+    }
+
+    if (failures == 0)
+    {
+        printf("PASS\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
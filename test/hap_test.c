@@ -0,0 +1,130 @@
+/*
+ hap_test.c
+ 
+ Copyright (c) 2011-2013, Tom Butterworth and Vidvox LLC. All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ 
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ Checks encoding and decoding frames in hap.c.
+
+ Build it with snappy's C bindings, for example, from this directory:
+
+ cc -std=c99 -I../source -o hap_test hap_test.c ../source/hap.c -lsnappy
+
+ It prints each failure and exits non-zero if there were any.
+ */
+
+#include "hap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures = 0;
+
+static void check(int condition, const char *what, int detail)
+{
+    if (!condition)
+    {
+        printf("FAIL: %s (%#x)\n", what, detail);
+        failures++;
+    }
+}
+
+static void serial_callback(HapDecodeWorkFunction function, void *p, unsigned int count, void *info)
+{
+    unsigned int i;
+    (void)info;
+    for (i = 0; i < count; i++)
+    {
+        function(p, i);
+    }
+}
+
+/*
+ Encodes a compressible DXT5 texture of two million chunks of one block each, which needs decode instructions too long
+ for a 3-byte section length if every chunk is written, and checks it decodes to the same texture
+ */
+static void test_chunk_limit(unsigned int options, int expectedChunkCount)
+{
+    unsigned int chunk_count = 2000000;
+    unsigned long length = (unsigned long)chunk_count * 16U;
+    unsigned int format = HapTextureFormat_RGBA_DXT5;
+    unsigned int compressor = HapCompressorSnappy;
+    unsigned char *texture = (unsigned char *)malloc(length);
+    unsigned char *decoded = (unsigned char *)malloc(length);
+    unsigned long max_length = HapMaxEncodedLength(1, &length, &format, &chunk_count);
+    unsigned char *frame = (unsigned char *)malloc(max_length);
+    const void *input = texture;
+    unsigned long used = 0;
+    unsigned long decoded_used = 0;
+    unsigned int decoded_format = 0;
+    int stored_chunk_count = 0;
+    unsigned int result;
+    unsigned long i;
+
+    if (texture == NULL || decoded == NULL || frame == NULL)
+    {
+        check(0, "chunk limit allocation", 0);
+        free(texture);
+        free(decoded);
+        free(frame);
+        return;
+    }
+
+    for (i = 0; i < length; i++)
+    {
+        texture[i] = (unsigned char)((i >> 16) & 0xF0);
+    }
+
+    result = HapEncodeWithCallback(1, &input, &length, &format, &compressor, &chunk_count, options,
+                                   serial_callback, NULL, frame, max_length, &used);
+    check(result == HapResult_No_Error, "chunk limit encode", (int)result);
+
+    if (result == HapResult_No_Error)
+    {
+        result = HapGetFrameTextureChunkCount(frame, used, 0, &stored_chunk_count);
+        check(result == HapResult_No_Error && stored_chunk_count == expectedChunkCount, "chunk limit chunk count", stored_chunk_count);
+
+        result = HapDecode(frame, used, 0, serial_callback, NULL, decoded, length, &decoded_used, &decoded_format);
+        check(result == HapResult_No_Error, "chunk limit decode", (int)result);
+        check(result == HapResult_No_Error && decoded_used == length && memcmp(decoded, texture, length) == 0,
+              "chunk limit round trip", (int)options);
+    }
+
+    free(texture);
+    free(decoded);
+    free(frame);
+}
+
+int main(void)
+{
+    test_chunk_limit(0, 2000000);
+    test_chunk_limit(HapEncodeOption_ChunkOffsetTable, 1864133);
+
+    if (failures == 0)
+    {
+        printf("PASS\n");
+    }
+    return failures == 0 ? 0 : 1;
+}